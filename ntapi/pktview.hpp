@@ -0,0 +1,424 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a C++ packet view layer on top of the packet
+ * descriptors. Where the @ref PacketMacros decide the descriptor type at
+ * runtime on every field access, a PacketView is bound to one descriptor
+ * type at compile time. @ref nt::dispatch_descriptor decides the
+ * descriptor type once per segment and runs a loop specialized for it.
+ *
+ * @ref nt::bench_capture_file compares the two over the packets of an NT
+ * capture file.
+ *
+ * The header is not included by nt.h and must be included directly from
+ * C++ code.
+ */
+#ifndef __PKTVIEW_HPP__
+#define __PKTVIEW_HPP__
+
+#if !defined(__cplusplus)
+  #error pktview.hpp is a C++ header
+#endif
+
+#include "nt.h"
+
+#include <chrono>
+
+namespace nt {
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+namespace detail {
+
+/**
+ * Fields common to the NT standard and extended descriptors
+ */
+template <typename Descr>
+class Std0ViewBase {
+public:
+  Std0ViewBase(const uint8_t* hdr, uint8_t portOffset) : hdr_(hdr), portOffset_(portOffset) {}
+  const Descr* descr() const { return reinterpret_cast<const Descr*>(hdr_); }
+  const NtStd0Descr_t* std0() const { return reinterpret_cast<const NtStd0Descr_t*>(hdr_); }
+  const uint8_t* hdr() const { return hdr_; }
+  const void* l2() const { return hdr_ + descr_length(); }
+  uint32_t descr_length() const { return (uint32_t)sizeof(NtStd0Descr_t) + ((uint32_t)std0()->extensionLength << 3); }
+  uint32_t cap_length() const { return std0()->storedLength; }
+  uint32_t wire_length() const { return std0()->wireLength; }
+  uint64_t timestamp() const { return std0()->timestamp; }
+  uint32_t rx_port() const { return (uint32_t)std0()->rxPort + portOffset_; }
+  bool crc_error() const { return std0()->crcError != 0; }
+  bool sliced() const { return std0()->frameSliced != 0; }
+  bool is_ip() const { return std0()->IPFrame != 0; }
+  bool is_tcp() const { return std0()->TCPFrame != 0; }
+  bool is_udp() const { return std0()->UDPFrame != 0; }
+protected:
+  const uint8_t* hdr_;
+  uint8_t portOffset_;
+};
+
+/**
+ * Fields common to the extended descriptors 7, 8 and 9
+ */
+template <typename Descr>
+class ExtViewBase : public Std0ViewBase<Descr> {
+public:
+  ExtViewBase(const uint8_t* hdr, uint8_t portOffset) : Std0ViewBase<Descr>(hdr, portOffset) {}
+  uint32_t descr_length() const { return (uint32_t)sizeof(Descr); }
+  const void* l2() const { return this->hdr_ + sizeof(Descr); }
+  uint32_t hash() const { return this->descr()->rx.hash; }
+  uint32_t hash_type() const { return this->descr()->rx.hashType; }
+  bool hash_valid() const { return this->descr()->rx.hashValid != 0; }
+  uint32_t l2_frame_type() const { return this->descr()->rx.l2FrameType; }
+  uint32_t l3_frame_type() const { return this->descr()->rx.l3FrameType; }
+  uint32_t l4_frame_type() const { return this->descr()->rx.l4FrameType; }
+  uint32_t l3_offset() const { return this->descr()->rx.l3Offset; }
+  uint32_t l4_offset() const { return this->descr()->rx.l4Offset; }
+  uint32_t l5_offset() const { return this->descr()->rx.l5Offset; }
+  uint32_t l3_length() const { return this->descr()->rx.l3Size; }
+  uint32_t l4_length() const { return this->descr()->rx.l4Size; }
+  uint32_t l4_protocol() const { return this->descr()->rx.l4ProtocolNumber; }
+  uint32_t vlan_count() const { return this->descr()->rx.vlanCount; }
+  uint32_t mpls_count() const { return this->descr()->rx.mplsCount; }
+  bool l3_fragmented() const { return this->descr()->rx.l3Fragmented != 0; }
+  bool l3_first_fragment() const { return this->descr()->rx.l3FirstFragment != 0; }
+  bool ipv6_fragment_header() const { return this->descr()->rx.ipv6FragmentHeader != 0; }
+  bool decode_error() const { return this->descr()->rx.decodeError != 0; }
+};
+
+/**
+ * Fields common to the dynamic descriptors 1, 2 and 3
+ */
+template <typename Descr>
+class DynViewBase {
+public:
+  DynViewBase(const uint8_t* hdr, uint8_t portOffset) : hdr_(hdr), portOffset_(portOffset) {}
+  const Descr* descr() const { return reinterpret_cast<const Descr*>(hdr_); }
+  const uint8_t* hdr() const { return hdr_; }
+  // descrLength == 0 means descriptor length is 64
+  uint32_t descr_length() const { uint32_t len = descr()->descrLength; return len ? len : 64; }
+  const void* l2() const { return hdr_ + descr_length(); }
+  uint32_t cap_length() const { return (uint32_t)descr()->capLength; }
+  uint64_t timestamp() const { return descr()->timestamp; }
+  uint32_t rx_port() const { return (uint32_t)descr()->rxPort + portOffset_; }
+  bool ts_color() const { return descr()->tsColor != 0; }
+  uint32_t offset0() const { return (uint32_t)descr()->offset0; }
+  uint32_t offset1() const { return (uint32_t)descr()->offset1; }
+protected:
+  const uint8_t* hdr_;
+  uint8_t portOffset_;
+};
+
+} // namespace detail
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Typed view of one packet in a segment
+ *
+ * PacketView is specialized for NtStd0Descr_t, NtExt7Descr_t, NtExt8Descr_t,
+ * NtExt9Descr_t, NtDyn1Descr_t, NtDyn2Descr_t and NtDyn3Descr_t. The field
+ * accessors read the descriptor directly without any descriptor type check,
+ * so a view must only be used on packets carrying that descriptor type.
+ */
+template <typename Descr>
+class PacketView;
+
+template <>
+class PacketView<NtStd0Descr_t> : public detail::Std0ViewBase<NtStd0Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::Std0ViewBase<NtStd0Descr_t>(hdr, portOffset) {}
+};
+
+template <>
+class PacketView<NtExt7Descr_t> : public detail::ExtViewBase<NtExt7Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::ExtViewBase<NtExt7Descr_t>(hdr, portOffset) {}
+  uint32_t l4_port_type() const { return descr()->rx.l4PortType; }
+};
+
+template <>
+class PacketView<NtExt8Descr_t> : public detail::ExtViewBase<NtExt8Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::ExtViewBase<NtExt8Descr_t>(hdr, portOffset) {}
+  uint32_t l4_port_type() const { return descr()->rx.l4PortType; }
+  bool ipf_unmatched_flag() const { return descr()->rx.l3UnmatchedFragFlag != 0; }
+  bool ipf_last_fragment() const { return descr()->rx.l3LastFragment != 0; }
+};
+
+template <>
+class PacketView<NtExt9Descr_t> : public detail::ExtViewBase<NtExt9Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::ExtViewBase<NtExt9Descr_t>(hdr, portOffset) {}
+  uint32_t tunnel_type() const { return descr()->rx.tunnelType; }
+  uint32_t tunnel_hdr_length() const { return descr()->rx.tunnelHdrSize; }
+  uint32_t inner_l3_offset() const { return descr()->rx.innerL3Offset; }
+  uint32_t inner_l4_offset() const { return descr()->rx.innerL4Offset; }
+  uint32_t inner_l5_offset() const { return descr()->rx.innerL5Offset; }
+  uint32_t inner_l3_frame_type() const { return descr()->rx.innerL3FrameType; }
+  uint32_t inner_l4_frame_type() const { return descr()->rx.innerL4FrameType; }
+  uint32_t inner_l3_fragment_type() const { return descr()->rx.innerL3FragmentType; }
+  bool ipf_unmatched_flag() const { return descr()->rx.l3UnmatchedFragFlag != 0; }
+  bool ipf_last_fragment() const { return descr()->rx.l3LastFragment != 0; }
+  uint32_t deduplication_crc() const { return descr()->rx.dedupCrc; }
+};
+
+template <>
+class PacketView<NtDyn1Descr_t> : public detail::DynViewBase<NtDyn1Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::DynViewBase<NtDyn1Descr_t>(hdr, portOffset) {}
+  uint32_t offset2() const { return descr()->offset2; }
+  uint32_t ip_protocol() const { return (uint32_t)descr()->ipProtocol; }
+  uint32_t color() const { return descr()->color; }
+};
+
+template <>
+class PacketView<NtDyn2Descr_t> : public detail::DynViewBase<NtDyn2Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::DynViewBase<NtDyn2Descr_t>(hdr, portOffset) {}
+  uint32_t offset2() const { return (uint32_t)descr()->offset2; }
+  uint32_t ip_protocol() const { return (uint32_t)descr()->ipProtocol; }
+  uint64_t color() const { return descr()->color; }
+};
+
+template <>
+class PacketView<NtDyn3Descr_t> : public detail::DynViewBase<NtDyn3Descr_t> {
+public:
+  PacketView(const uint8_t* hdr, uint8_t portOffset) : detail::DynViewBase<NtDyn3Descr_t>(hdr, portOffset) {}
+  uint32_t wire_length() const { return (uint32_t)descr()->wireLength; }
+  uint64_t color() const { return ((uint64_t)descr()->color_hi << 14) | (uint64_t)descr()->color_lo; }
+};
+
+/**
+ * @brief Run a visitor on every packet in a segment with a known descriptor type
+ *
+ * No descriptor type check is made. Use this function when the descriptor
+ * type is known at build time, otherwise use @ref dispatch_descriptor.
+ *
+ * @param[in] segNetBuf  Segment NtNetBuf_t
+ * @param[in] visitor    Callable invoked as visitor(PacketView<Descr>)
+ *
+ * @return Returns the number of packets visited
+ */
+template <typename Descr, typename Visitor>
+inline uint64_t for_each_packet(const struct NtNetBuf_s* segNetBuf, Visitor&& visitor)
+{
+  const uint8_t* pkt = reinterpret_cast<const uint8_t*>(segNetBuf->hHdr);
+  const uint8_t* end = pkt + segNetBuf->length;
+  uint64_t count = 0;
+  while (pkt < end) {
+    PacketView<Descr> view(pkt, segNetBuf->portOffset);
+    visitor(view);
+    pkt += view.cap_length();
+    count++;
+  }
+  return count;
+}
+
+/**
+ * @brief Run a visitor on every packet in a segment
+ *
+ * The descriptor type is read from the first packet in the segment and
+ * the segment is then traversed by a loop specialized for that descriptor
+ * type. The visitor must accept a PacketView of every supported
+ * descriptor type, e.g. a generic lambda or a functor with overloads.
+ * All packets in a segment carry the same descriptor type.
+ *
+ * @param[in]  segNetBuf  Segment NtNetBuf_t
+ * @param[in]  visitor    Callable invoked as visitor(PacketView<Descr>)
+ * @param[out] count      Optional - the number of packets visited
+ *
+ * @retval  NT_SUCCESS                                Success
+ * @retval  NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR  The descriptor type is not supported
+ */
+template <typename Visitor>
+inline int dispatch_descriptor(const struct NtNetBuf_s* segNetBuf, Visitor&& visitor, uint64_t* count = NULL)
+{
+  uint64_t packets = 0;
+  if (segNetBuf->length != 0) {
+    const NtDynDescr_t* dyn = reinterpret_cast<const NtDynDescr_t*>(segNetBuf->hHdr);
+    const NtStd0Descr_t* std0 = reinterpret_cast<const NtStd0Descr_t*>(segNetBuf->hHdr);
+    if (dyn->ntDynDescr) {
+      switch (dyn->descrFormat) {
+      case 1: packets = for_each_packet<NtDyn1Descr_t>(segNetBuf, visitor); break;
+      case 2: packets = for_each_packet<NtDyn2Descr_t>(segNetBuf, visitor); break;
+      case 3: packets = for_each_packet<NtDyn3Descr_t>(segNetBuf, visitor); break;
+      default: return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+      }
+    } else if (std0->descriptorType == 0) {
+      return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+    } else {
+      switch (std0->extensionFormat) {
+      case 0: packets = for_each_packet<NtStd0Descr_t>(segNetBuf, visitor); break;
+      case 7: packets = for_each_packet<NtExt7Descr_t>(segNetBuf, visitor); break;
+      case 8: packets = for_each_packet<NtExt8Descr_t>(segNetBuf, visitor); break;
+      case 9: packets = for_each_packet<NtExt9Descr_t>(segNetBuf, visitor); break;
+      default: return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+      }
+    }
+  }
+  if (count != NULL) {
+    *count = packets;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Result of @ref bench_capture_file
+ */
+struct PacketViewBenchResult {
+  uint64_t segments;        //!< Segments read from the file
+  uint64_t packets;         //!< Packets visited by each path - the packets of the file times the repeat count
+  double macroNs;           //!< Nanoseconds per packet with @ref _nt_net_get_next_packet and the @ref PacketMacros
+  double viewNs;            //!< Nanoseconds per packet with @ref dispatch_descriptor and PacketView
+  uint64_t macroChecksum;   //!< Sum of the fields read by the macro path
+  uint64_t viewChecksum;    //!< Sum of the fields read by the view path - equals macroChecksum
+};
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+namespace detail {
+
+inline uint64_t bench_now_ns()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Read the fields of every packet in a segment with the PacketMacros
+ */
+inline uint64_t bench_macros(struct NtNetBuf_s* segNetBuf)
+{
+  struct NtNetBuf_s pkt;
+  struct NtNetBuf_s* h = &pkt;
+  uint64_t segLength = segNetBuf->length, sum = 0;
+  if (segLength == 0) {
+    return 0;
+  }
+  _nt_net_build_pkt_netbuf(segNetBuf, &pkt);
+  do {
+    sum += (uint64_t)NT_NET_GET_PKT_CAP_LENGTH(h) + (uint64_t)NT_NET_GET_PKT_DESCR_LENGTH(h) + (uintptr_t)NT_NET_GET_PKT_L2_PTR(h);
+  } while (_nt_net_get_next_packet(segNetBuf, segLength, &pkt) > 0);
+  return sum;
+}
+
+/**
+ * Read the same fields through a PacketView
+ */
+struct BenchVisitor {
+  uint64_t sum;
+  template <typename View>
+  void operator()(const View& view) { sum += (uint64_t)view.cap_length() + view.descr_length() + (uintptr_t)view.l2(); }
+};
+
+} // namespace detail
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Compare PacketView with the packet macros over an NT capture file
+ *
+ * Every segment of the file is read with @ref NT_NetFileGet and walked
+ * repeat times with @ref _nt_net_get_next_packet and the
+ * @ref PacketMacros, and repeat times with @ref dispatch_descriptor. Both
+ * paths read the capture length, the descriptor length and the layer 2
+ * pointer of every packet - the fields every descriptor type has. Only
+ * the walks are timed, not the file reads.
+ *
+ * @param[in]  fileName  NT capture file
+ * @param[in]  repeat    Number of walks per segment and path. 0 is taken as 1
+ * @param[out] result    Result
+ *
+ * @retval  NT_SUCCESS                                Success
+ * @retval  NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR  The file holds a descriptor type not supported by PacketView
+ * @retval  Otherwise                                 The error of @ref NT_NetFileOpen or @ref NT_NetFileGet
+ */
+inline int bench_capture_file(const char* fileName, uint32_t repeat, PacketViewBenchResult* result)
+{
+  NtNetStreamFile_t hFile;
+  NtNetBuf_t hNetBuf;
+  uint64_t macroNs = 0, viewNs = 0;
+  int status;
+
+  memset(result, 0, sizeof(*result));
+  if (repeat == 0) {
+    repeat = 1;
+  }
+  if ((status = NT_NetFileOpen(&hFile, "pktview", NT_NET_INTERFACE_SEGMENT, fileName)) != NT_SUCCESS) {
+    return status;
+  }
+  while ((status = NT_NetFileGet(hFile, &hNetBuf)) == NT_SUCCESS) {
+    detail::BenchVisitor visitor = { 0 };
+    uint64_t start, count = 0, sum = 0;
+    uint32_t r;
+    start = detail::bench_now_ns();
+    for (r = 0; r < repeat; r++) {
+      sum += detail::bench_macros(hNetBuf);
+    }
+    macroNs += detail::bench_now_ns() - start;
+    start = detail::bench_now_ns();
+    for (r = 0; r < repeat && status == NT_SUCCESS; r++) {
+      status = dispatch_descriptor(hNetBuf, visitor, &count);
+    }
+    viewNs += detail::bench_now_ns() - start;
+    (void)NT_NetFileRelease(hFile, hNetBuf);
+    if (status != NT_SUCCESS) {
+      break;
+    }
+    result->segments++;
+    result->packets += count * repeat;
+    result->macroChecksum += sum;
+    result->viewChecksum += visitor.sum;
+  }
+  (void)NT_NetFileClose(hFile);
+  if (status != NT_STATUS_END_OF_FILE) {
+    return status;
+  }
+  if (result->packets > 0) {
+    result->macroNs = (double)macroNs / (double)result->packets;
+    result->viewNs = (double)viewNs / (double)result->packets;
+  }
+  return NT_SUCCESS;
+}
+
+} // namespace nt
+
+#endif // __PKTVIEW_HPP__
@@ -1132,6 +1132,120 @@ static NT_INLINE uint64_t _nt_net_get_next_packet(struct NtNetBuf_s * segNetBuf,
   }
 }
 
+/**
+ * @brief Inline C function to fill an array of packet NtNetBuf_t
+ * structures from a segment in one pass.
+ *
+ * The segment is walked once and a packet NtNetBuf_t is built for up to
+ * "max" packets, starting at "segOffset". The offset is updated to the
+ * next packet that has not been returned, so the function can be called
+ * again until it returns 0 to traverse the whole segment in bursts.
+ *
+ * @param[in] segNetBuf     Segment NtNetBuf_s * structure
+ * @param[in,out] segOffset Offset of the next packet in the segment. Must be 0 on the first call for a segment
+ * @param[out] pktNetBufs   Array of packet NtNetBuf_s structures
+ * @param[in] max           Number of entries in the pktNetBufs array
+ *
+ * @retval Returns the number of packets stored in pktNetBufs. 0 means that there is no more data in the segment
+ */
+static NT_INLINE unsigned _nt_net_get_packet_burst(struct NtNetBuf_s * segNetBuf, uint64_t * segOffset, struct NtNetBuf_s * pktNetBufs, unsigned max)
+{
+  uint8_t* nextPacket = (uint8_t*)segNetBuf->hHdr + *segOffset;
+  uint8_t* endSegm = (uint8_t*)segNetBuf->hHdr + segNetBuf->length;
+  unsigned count = 0;
+  while (count < max && nextPacket < endSegm) {
+    struct NtNetBuf_s * pktNetBuf = &pktNetBufs[count++];
+    memcpy((void*)pktNetBuf, (void*)segNetBuf, sizeof(struct NtNetBuf_s));
+    pktNetBuf->hHdr=(NtNetBufHdr_t)nextPacket;
+    pktNetBuf->hPkt=(NtNetBufPkt_t)(nextPacket + NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+    nextPacket += NT_NET_GET_PKT_CAP_LENGTH(pktNetBuf);
+  }
+  *segOffset = (uint64_t)(nextPacket - (uint8_t*)segNetBuf->hHdr);
+  return count;
+}
+
+/**
+ * Burst state used by @ref _nt_net_rx_get_packet_burst. Must be zero
+ * initialized before the first call.
+ */
+struct NtNetRxBurst_s {
+  NtNetBuf_t hNetBuf;   //!< The segment currently being traversed - NULL if no segment is held
+  uint64_t offset;      //!< Offset of the next packet in the segment
+};
+
+/**
+ * @brief Inline C function to get a burst of packets from a segment based
+ * RX stream
+ *
+ * This function is a burst version of @ref NT_NetRxGetNextPacket. It walks
+ * the segment held in "burst" and fills up to "max" packet NtNetBuf_t
+ * structures. When the segment has been traversed it is released and
+ * the next segment is retrieved via @ref NT_NetRxGet, hence the packets
+ * returned are valid until the next call. Empty segments only containing a
+ * time stamp update are returned as a burst of 0 packets and can be
+ * inspected via burst->hNetBuf until the next call.
+ *
+ * @note The stream must be opened with @ref NT_NET_INTERFACE_SEGMENT
+ * @note This function has no mutex protection, therefore the same hStream cannot be used by multiple threads
+ *
+ * @param[in]     hStream     Network RX stream handle
+ * @param[in,out] burst       Burst state
+ * @param[out]    pktNetBufs  Array of packet NtNetBuf_s structures
+ * @param[in]     max         Number of entries in the pktNetBufs array
+ * @param[out]    count       Number of packets stored in pktNetBufs
+ * @param[in]     timeout     The timeout in milliseconds used when a new segment is needed. See @ref NT_NetRxGet
+ *
+ * @retval  NT_SUCCESS          Packets have been returned
+ * @retval  NT_STATUS_TIMEOUT   No data has been returned and a timeout has occured
+ * @retval  NT_STATUS_TRYAGAIN  The resource is temporarily unavailable because of reconfiguration - call again
+ * @retval  Error               Use @ref NT_ExplainError for an error description
+ */
+static NT_INLINE int _nt_net_rx_get_packet_burst(NtNetStreamRx_t hStream, struct NtNetRxBurst_s * burst, struct NtNetBuf_s * pktNetBufs, unsigned max, unsigned * count, int timeout)
+{
+  int status;
+  *count = 0;
+  if (burst->hNetBuf != NULL) {
+    *count = _nt_net_get_packet_burst(burst->hNetBuf, &burst->offset, pktNetBufs, max);
+    if (*count) {
+      return NT_SUCCESS;
+    }
+    status = NT_NetRxRelease(hStream, burst->hNetBuf);
+    burst->hNetBuf = NULL;
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+  }
+  status = NT_NetRxGet(hStream, &burst->hNetBuf, timeout);
+  if (status != NT_SUCCESS) {
+    burst->hNetBuf = NULL;
+    return status;
+  }
+  burst->offset = 0;
+  *count = _nt_net_get_packet_burst(burst->hNetBuf, &burst->offset, pktNetBufs, max);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Inline C function to release the segment held by a burst state
+ *
+ * Must be called before closing the stream if @ref _nt_net_rx_get_packet_burst has been used.
+ *
+ * @param[in]     hStream  Network RX stream handle
+ * @param[in,out] burst    Burst state
+ *
+ * @retval  NT_SUCCESS    Success
+ * @retval !=NT_SUCCESS   Error - use @ref NT_ExplainError for an error description
+ */
+static NT_INLINE int _nt_net_rx_release_packet_burst(NtNetStreamRx_t hStream, struct NtNetRxBurst_s * burst)
+{
+  int status = NT_SUCCESS;
+  if (burst->hNetBuf != NULL) {
+    status = NT_NetRxRelease(hStream, burst->hNetBuf);
+    burst->hNetBuf = NULL;
+  }
+  return status;
+}
+
 /**
  * @brief Inline C function to build a packet based NtNetBuf_t
  * from a segment based NtNetBuf_t
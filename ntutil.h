@@ -57,6 +57,33 @@ extern "C" {
 #endif
 
 #include "ntutil/hashref.h"
+#include "ntutil/hashref_pkt.h"
+#include "ntutil/atomic.h"
+#include "ntutil/compat.h"
+#include "ntutil/ring.h"
+#include "ntutil/fanout.h"
+#include "ntutil/aio.h"
+#include "ntutil/capfile.h"
+#include "ntutil/capindex.h"
+#include "ntutil/merge.h"
+#include "ntutil/emu.h"
+#include "ntutil/segindex.h"
+#include "ntutil/seggen.h"
+#include "ntutil/capbench.h"
+#include "ntutil/perf.h"
+#include "ntutil/descbench.h"
+#include "ntutil/segref.h"
+#include "ntutil/rxfd.h"
+#include "ntutil/rxpoll.h"
+#include "ntutil/fairpoll.h"
+#include "ntutil/capwrite.h"
+#include "ntutil/capstripe.h"
+#include "ntutil/capring.h"
+#include "ntutil/pcapconv.h"
+#include "ntutil/flowtab.h"
+#include "ntutil/flowage.h"
+#include "ntutil/ipdefrag.h"
+#include "ntutil/tcpreasm.h"
 
 #ifdef __cplusplus
 }
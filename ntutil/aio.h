@@ -0,0 +1,736 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains asynchronous file I/O used by the capture
+ * file utilities. Requests are served by io_uring on Linux when the
+ * kernel supports it, by a pool of threads doing pread/pwrite on other
+ * POSIX systems, and synchronously otherwise. Completions are returned
+ * in any order.
+ *
+ */
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#include "nt.h"
+#include "compat.h"
+
+#ifdef _MSC_VER
+#include <errno.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define _NT_AIO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+/**
+ * Convert an errno value into an NTAPI error code
+ */
+#define NT_AIO_ERRNO(_errno_) ((int)((uint32_t)(_errno_) | NT_SYSTEM_ERRORS))
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+// O_DIRECT is only defined by fcntl.h when _GNU_SOURCE is defined
+#if defined(__linux__)
+#if defined(O_DIRECT)
+#define _NT_AIO_O_DIRECT O_DIRECT
+#elif defined(__x86_64__) || defined(__i386__)
+#define _NT_AIO_O_DIRECT 040000
+#elif defined(__aarch64__)
+#define _NT_AIO_O_DIRECT 0200000
+#endif
+#endif
+
+#ifdef MAP_POPULATE
+#define _NT_AIO_MAP_POPULATE MAP_POPULATE
+#else
+#define _NT_AIO_MAP_POPULATE 0
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Alignment of buffers, offsets and lengths required by direct I/O
+ */
+#define NT_AIO_DIRECT_ALIGN 4096
+
+/**
+ * Asynchronous I/O backends
+ */
+enum NtAioBackend_e {
+  NT_AIO_BACKEND_AUTO = 0,  //!< Use the best backend available
+  NT_AIO_BACKEND_SYNC,      //!< Serve requests synchronously when submitted
+  NT_AIO_BACKEND_THREADS,   //!< Serve requests in a pool of threads
+  NT_AIO_BACKEND_IO_URING,  //!< Serve requests with io_uring
+};
+
+/**
+ * Asynchronous I/O operations
+ */
+enum NtAioOp_e {
+  NT_AIO_OP_READ = 0,       //!< Read from the file
+  NT_AIO_OP_WRITE,          //!< Write to the file
+};
+
+/**
+ * Asynchronous I/O request. The request must stay valid until it is returned
+ * by @ref _nt_aio_wait.
+ */
+typedef struct NtAioReq_s {
+  enum NtAioOp_e op;        //!< Operation
+  void *buf;                //!< Data buffer
+  uint32_t length;          //!< Number of bytes to transfer
+  uint64_t offset;          //!< File offset
+  int64_t result;           //!< Number of bytes transferred or -errno on failure
+  uintptr_t arg;            //!< User specific data
+  uint32_t fixed;           //!< Index plus one of the buffer registered with @ref _nt_aio_register holding the data, 0 if not registered
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint32_t done;            // io_uring: bytes transferred by the parts completed so far
+#endif
+} NtAioReq_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#ifdef _NT_AIO_IO_URING
+struct _NtAioUring_s {
+  int fd;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+};
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Asynchronous I/O context
+ */
+typedef struct NtAio_s {
+  enum NtAioBackend_e backend; //!< Backend in use
+  uint32_t depth;           //!< Maximum number of outstanding requests
+  uint32_t outstanding;     //!< Number of requests submitted and not yet returned
+  uint32_t registered;      //!< Number of buffers registered with io_uring
+#ifndef DOXYGEN_INTERNAL_ONLY
+  int fd;
+  NtAioReq_t **queue;       // Submitted requests - thread and sync backends
+  uint32_t qHead;
+  uint32_t qTail;
+  NtAioReq_t **done;        // Completed requests - thread and sync backends
+  uint32_t dHead;
+  uint32_t dTail;
+#ifndef _MSC_VER
+  pthread_mutex_t lock;
+  pthread_cond_t submitted;
+  pthread_cond_t completed;
+  pthread_t *threads;
+  uint32_t numThreads;
+  int stop;
+#endif
+#ifdef _NT_AIO_IO_URING
+  struct _NtAioUring_s uring;
+#endif
+#endif
+} NtAio_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE int64_t _nt_aio_do(int fd, NtAioReq_t* req)
+{
+#ifdef _MSC_VER
+  int64_t res;
+  if (_lseeki64(fd, (__int64)req->offset, SEEK_SET) < 0) {
+    return -errno;
+  }
+  res = req->op == NT_AIO_OP_READ ? _read(fd, req->buf, req->length) : _write(fd, req->buf, req->length);
+  return res < 0 ? -errno : res;
+#else
+  uint32_t done = 0;
+  // Complete the transfer unless end of file or an error is reached
+  while (done < req->length) {
+    ssize_t res = req->op == NT_AIO_OP_READ ?
+      pread(fd, (uint8_t*)req->buf + done, req->length - done, (off_t)(req->offset + done)) :
+      pwrite(fd, (const uint8_t*)req->buf + done, req->length - done, (off_t)(req->offset + done));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return done > 0 ? (int64_t)done : -errno;
+    }
+    if (res == 0) {
+      break;
+    }
+    done += (uint32_t)res;
+  }
+  return done;
+#endif
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_aio_thread(void* arg)
+{
+  NtAio_t* aio = (NtAio_t*)arg;
+  pthread_mutex_lock(&aio->lock);
+  for (;;) {
+    NtAioReq_t* req;
+    while (aio->qHead == aio->qTail && !aio->stop) {
+      pthread_cond_wait(&aio->submitted, &aio->lock);
+    }
+    if (aio->stop) {
+      break;
+    }
+    req = aio->queue[aio->qTail++ % aio->depth];
+    pthread_mutex_unlock(&aio->lock);
+    req->result = _nt_aio_do(aio->fd, req);
+    pthread_mutex_lock(&aio->lock);
+    aio->done[aio->dHead++ % aio->depth] = req;
+    pthread_cond_signal(&aio->completed);
+  }
+  pthread_mutex_unlock(&aio->lock);
+  return NULL;
+}
+#endif
+
+#ifdef _NT_AIO_IO_URING
+/*
+ * IORING_OP_READ and IORING_OP_WRITE came with Linux 5.6, together with
+ * the probe. Older kernels fail the probe and reject the opcodes.
+ */
+static NT_INLINE int _nt_aio_uring_probe(int fd)
+{
+  struct io_uring_probe* probe;
+  int supported;
+  probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+  if (probe == NULL) {
+    return 0;
+  }
+  supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+              probe->ops_len > IORING_OP_WRITE &&
+              (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0 &&
+              (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+  free(probe);
+  return supported;
+}
+
+static NT_INLINE int _nt_aio_uring_open(struct _NtAioUring_s* ring, uint32_t depth)
+{
+  struct io_uring_params p;
+  uint8_t* sq;
+  uint8_t* cq;
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  ring->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+  if (ring->fd < 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (!_nt_aio_uring_probe(ring->fd)) {
+    close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    return NT_ERROR_FEATURE_NOT_SUPPORTED;
+  }
+  ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqRingSize > ring->sqRingSize) {
+      ring->sqRingSize = ring->cqRingSize;
+    }
+  }
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | _NT_AIO_MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    goto error;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | _NT_AIO_MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+      ring->cqRing = NULL;
+      goto error;
+    }
+  }
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | _NT_AIO_MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if ((void*)ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto error;
+  }
+  sq = (uint8_t*)ring->sqRing;
+  cq = (uint8_t*)ring->cqRing;
+  ring->sqHead = (unsigned*)(sq + p.sq_off.head);
+  ring->sqTail = (unsigned*)(sq + p.sq_off.tail);
+  ring->sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+  ring->sqArray = (unsigned*)(sq + p.sq_off.array);
+  ring->cqHead = (unsigned*)(cq + p.cq_off.head);
+  ring->cqTail = (unsigned*)(cq + p.cq_off.tail);
+  ring->cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  return NT_SUCCESS;
+
+error:
+  {
+    int err = errno;
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+      munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) {
+      munmap(ring->cqRing, ring->cqRingSize);
+    }
+    close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    return NT_AIO_ERRNO(err);
+  }
+}
+
+static NT_INLINE void _nt_aio_uring_close(struct _NtAioUring_s* ring)
+{
+  munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing != ring->sqRing) {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+}
+
+/*
+ * Submit the part of the request not transferred yet
+ */
+static NT_INLINE int _nt_aio_uring_submit(struct _NtAioUring_s* ring, int fd, NtAioReq_t* req)
+{
+  unsigned tail = *ring->sqTail;
+  unsigned idx = tail & ring->sqMask;
+  struct io_uring_sqe* sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  if (req->fixed != 0) {
+    sqe->opcode = req->op == NT_AIO_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->buf_index = (uint16_t)(req->fixed - 1);
+  } else {
+    sqe->opcode = req->op == NT_AIO_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+  }
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)((uint8_t*)req->buf + req->done);
+  sqe->len = req->length - req->done;
+  sqe->off = req->offset + req->done;
+  sqe->user_data = (uint64_t)(uintptr_t)req;
+  ring->sqArray[idx] = idx;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+    if (errno != EINTR) {
+      return NT_AIO_ERRNO(errno);
+    }
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Get a completed request. A short transfer is resubmitted for the rest,
+ * like the thread backend retries it, so the request completes when all
+ * of it is transferred, at end of file or on an error.
+ */
+static NT_INLINE NtAioReq_t* _nt_aio_uring_reap(struct _NtAioUring_s* ring, int fd, int block)
+{
+  for (;;) {
+    unsigned head = *ring->cqHead;
+    if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+      NtAioReq_t* req = (NtAioReq_t*)(uintptr_t)cqe->user_data;
+      int32_t res = cqe->res;
+      __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+      if (res > 0) {
+        req->done += (uint32_t)res;
+      }
+      if ((res > 0 && req->done < req->length) || res == -EINTR || res == -EAGAIN) {
+        int status = _nt_aio_uring_submit(ring, fd, req);
+        if (status == NT_SUCCESS) {
+          continue;
+        }
+        res = -(int32_t)(status & ~NT_SYSTEM_ERRORS);
+      }
+      req->result = req->done > 0 || res >= 0 ? (int64_t)req->done : res;
+      return req;
+    }
+    if (!block) {
+      return NULL;
+    }
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      return NULL;
+    }
+  }
+}
+#endif // _NT_AIO_IO_URING
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Open an asynchronous I/O context
+ *
+ * With @ref NT_AIO_BACKEND_AUTO io_uring is tried first, then the thread
+ * pool and finally the synchronous backend.
+ *
+ * @param[out] aio         Asynchronous I/O context
+ * @param[in]  fd          File descriptor
+ * @param[in]  backend     Backend to use
+ * @param[in]  depth       Maximum number of outstanding requests
+ * @param[in]  numThreads  Number of threads used by the thread pool backend
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED     The backend is not supported
+ * @retval otherwise                          Error
+ */
+static NT_INLINE int _nt_aio_open(NtAio_t* aio, int fd, enum NtAioBackend_e backend, uint32_t depth, uint32_t numThreads)
+{
+  memset(aio, 0, sizeof(*aio));
+  if (depth == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  aio->fd = fd;
+  aio->depth = depth;
+
+#ifdef _NT_AIO_IO_URING
+  if (backend == NT_AIO_BACKEND_AUTO || backend == NT_AIO_BACKEND_IO_URING) {
+    int status = _nt_aio_uring_open(&aio->uring, depth);
+    if (status == NT_SUCCESS) {
+      aio->backend = NT_AIO_BACKEND_IO_URING;
+      return NT_SUCCESS;
+    }
+    if (backend == NT_AIO_BACKEND_IO_URING) {
+      return status;
+    }
+  }
+#else
+  if (backend == NT_AIO_BACKEND_IO_URING) {
+    return NT_ERROR_FEATURE_NOT_SUPPORTED;
+  }
+#endif
+
+  aio->queue = (NtAioReq_t**)calloc(depth, sizeof(NtAioReq_t*));
+  aio->done = (NtAioReq_t**)calloc(depth, sizeof(NtAioReq_t*));
+  if (aio->queue == NULL || aio->done == NULL) {
+    free(aio->queue);
+    free(aio->done);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+
+#ifndef _MSC_VER
+  if ((backend == NT_AIO_BACKEND_AUTO || backend == NT_AIO_BACKEND_THREADS) && numThreads > 0) {
+    uint32_t t;
+    aio->threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    if (aio->threads == NULL) {
+      free(aio->queue);
+      free(aio->done);
+      return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->submitted, NULL);
+    pthread_cond_init(&aio->completed, NULL);
+    aio->backend = NT_AIO_BACKEND_THREADS;
+    for (t = 0; t < numThreads; t++) {
+      if (pthread_create(&aio->threads[t], NULL, _nt_aio_thread, aio) != 0) {
+        break;
+      }
+      aio->numThreads++;
+    }
+    if (aio->numThreads > 0) {
+      return NT_SUCCESS;
+    }
+    pthread_cond_destroy(&aio->completed);
+    pthread_cond_destroy(&aio->submitted);
+    pthread_mutex_destroy(&aio->lock);
+    free(aio->threads);
+    aio->threads = NULL;
+    if (backend == NT_AIO_BACKEND_THREADS) {
+      free(aio->queue);
+      free(aio->done);
+      return NT_ERROR_RESOURCE_UNAVAILABLE;
+    }
+  }
+#else
+  (void)numThreads;
+  if (backend == NT_AIO_BACKEND_THREADS) {
+    free(aio->queue);
+    free(aio->done);
+    return NT_ERROR_FEATURE_NOT_SUPPORTED;
+  }
+#endif
+  aio->backend = NT_AIO_BACKEND_SYNC;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Register buffers
+ *
+ * With io_uring the buffers are pinned once instead of on every request.
+ * A request using a registered buffer sets @ref NtAioReq_s::fixed to the
+ * index of the buffer plus one. The other backends ignore the
+ * registration and the fixed field.
+ *
+ * @param[in] aio      Asynchronous I/O context
+ * @param[in] bufs     Buffers
+ * @param[in] numBufs  Number of buffers
+ * @param[in] size     Size of every buffer
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Buffers are already registered
+ * @retval otherwise                    Error - the buffers are not registered
+ */
+static NT_INLINE int _nt_aio_register(NtAio_t* aio, void* const* bufs, uint32_t numBufs, uint32_t size)
+{
+  if (aio->registered != 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+#ifdef _NT_AIO_IO_URING
+  if (aio->backend == NT_AIO_BACKEND_IO_URING) {
+    struct iovec* iov = (struct iovec*)calloc(numBufs, sizeof(struct iovec));
+    uint32_t i;
+    int res;
+    if (iov == NULL) {
+      return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+    for (i = 0; i < numBufs; i++) {
+      iov[i].iov_base = bufs[i];
+      iov[i].iov_len = size;
+    }
+    res = (int)syscall(__NR_io_uring_register, aio->uring.fd, IORING_REGISTER_BUFFERS, iov, numBufs);
+    free(iov);
+    if (res < 0) {
+      return NT_AIO_ERRNO(errno);
+    }
+    aio->registered = numBufs;
+  }
+#else
+  (void)aio;
+  (void)bufs;
+  (void)numBufs;
+  (void)size;
+#endif
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Submit a request
+ *
+ * @param[in] aio  Asynchronous I/O context
+ * @param[in] req  Request
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  The maximum number of outstanding requests is reached
+ * @retval otherwise           Error
+ */
+static NT_INLINE int _nt_aio_submit(NtAio_t* aio, NtAioReq_t* req)
+{
+  if (aio->outstanding == aio->depth) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  switch (aio->backend) {
+#ifdef _NT_AIO_IO_URING
+  case NT_AIO_BACKEND_IO_URING:
+    {
+      int status;
+      req->done = 0;
+      status = _nt_aio_uring_submit(&aio->uring, aio->fd, req);
+      if (status != NT_SUCCESS) {
+        return status;
+      }
+    }
+    break;
+#endif
+#ifndef _MSC_VER
+  case NT_AIO_BACKEND_THREADS:
+    pthread_mutex_lock(&aio->lock);
+    aio->queue[aio->qHead++ % aio->depth] = req;
+    pthread_cond_signal(&aio->submitted);
+    pthread_mutex_unlock(&aio->lock);
+    break;
+#endif
+  default:
+    req->result = _nt_aio_do(aio->fd, req);
+    aio->done[aio->dHead++ % aio->depth] = req;
+    break;
+  }
+  aio->outstanding++;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get a completed request
+ *
+ * @param[in]  aio    Asynchronous I/O context
+ * @param[out] req    Completed request
+ * @param[in]  block  Wait for a request to complete if none has completed
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  No request has completed
+ * @retval NT_STATUS_NO_DATA   No request is outstanding
+ * @retval otherwise           Waiting for a completion failed
+ */
+static NT_INLINE int _nt_aio_wait(NtAio_t* aio, NtAioReq_t** req, int block)
+{
+  if (aio->outstanding == 0) {
+    return NT_STATUS_NO_DATA;
+  }
+  switch (aio->backend) {
+#ifdef _NT_AIO_IO_URING
+  case NT_AIO_BACKEND_IO_URING:
+    *req = _nt_aio_uring_reap(&aio->uring, aio->fd, block);
+    if (*req == NULL && block) {
+      return NT_AIO_ERRNO(errno);
+    }
+    break;
+#endif
+#ifndef _MSC_VER
+  case NT_AIO_BACKEND_THREADS:
+    pthread_mutex_lock(&aio->lock);
+    while (block && aio->dHead == aio->dTail) {
+      pthread_cond_wait(&aio->completed, &aio->lock);
+    }
+    *req = aio->dHead != aio->dTail ? aio->done[aio->dTail++ % aio->depth] : NULL;
+    pthread_mutex_unlock(&aio->lock);
+    break;
+#endif
+  default:
+    *req = aio->done[aio->dTail++ % aio->depth];
+    break;
+  }
+  if (*req == NULL) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  aio->outstanding--;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Close an asynchronous I/O context
+ *
+ * Outstanding requests are completed before the context is closed,
+ * unless waiting for them fails. The file descriptor is not closed.
+ *
+ * @param[in] aio  Asynchronous I/O context
+ */
+static NT_INLINE void _nt_aio_close(NtAio_t* aio)
+{
+  NtAioReq_t* req;
+  // Interrupted waits are retried by the backends, so a failed wait will
+  // not succeed later - closing the ring cancels the requests left
+  while (aio->outstanding > 0 && _nt_aio_wait(aio, &req, 1) == NT_SUCCESS) {
+  }
+  switch (aio->backend) {
+#ifdef _NT_AIO_IO_URING
+  case NT_AIO_BACKEND_IO_URING:
+    _nt_aio_uring_close(&aio->uring);
+    break;
+#endif
+#ifndef _MSC_VER
+  case NT_AIO_BACKEND_THREADS:
+    {
+      uint32_t t;
+      pthread_mutex_lock(&aio->lock);
+      aio->stop = 1;
+      pthread_cond_broadcast(&aio->submitted);
+      pthread_mutex_unlock(&aio->lock);
+      for (t = 0; t < aio->numThreads; t++) {
+        pthread_join(aio->threads[t], NULL);
+      }
+      pthread_cond_destroy(&aio->completed);
+      pthread_cond_destroy(&aio->submitted);
+      pthread_mutex_destroy(&aio->lock);
+      free(aio->threads);
+    }
+    break;
+#endif
+  default:
+    break;
+  }
+  free(aio->queue);
+  free(aio->done);
+  memset(aio, 0, sizeof(*aio));
+}
+
+/**
+ * @brief Allocate a buffer aligned for direct I/O
+ *
+ * @param[in] size  Size of the buffer
+ *
+ * @retval Pointer to the buffer or NULL if out of memory
+ */
+static NT_INLINE void* _nt_aio_alloc(size_t size)
+{
+#ifdef _MSC_VER
+  return _aligned_malloc(size, NT_AIO_DIRECT_ALIGN);
+#else
+  void* mem;
+  if (posix_memalign(&mem, NT_AIO_DIRECT_ALIGN, size) != 0) {
+    return NULL;
+  }
+  return mem;
+#endif
+}
+
+/**
+ * @brief Free a buffer allocated with @ref _nt_aio_alloc
+ */
+static NT_INLINE void _nt_aio_free(void* mem)
+{
+#ifdef _MSC_VER
+  _aligned_free(mem);
+#else
+  free(mem);
+#endif
+}
+
+#endif // __AIO_H__
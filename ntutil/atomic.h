@@ -0,0 +1,175 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the atomic operations and CPU hints used by
+ * the lock-free utilities. GCC/Clang builtins are used on Linux and
+ * compiler intrinsics with x86/x64 memory ordering on Windows.
+ *
+ */
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#include "nt.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Size of a CPU cache line. Used to keep fields written by different
+ * threads apart.
+ */
+#define NT_CACHE_LINE_SIZE 64
+
+#ifdef _MSC_VER
+#define _NT_ATOMIC_BARRIER() _ReadWriteBarrier()
+#endif
+
+static NT_INLINE uint32_t _nt_atomic_load_acquire_u32(const volatile uint32_t* p)
+{
+#ifdef _MSC_VER
+  uint32_t v = *p;
+  _NT_ATOMIC_BARRIER();
+  return v;
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static NT_INLINE void _nt_atomic_store_release_u32(volatile uint32_t* p, uint32_t v)
+{
+#ifdef _MSC_VER
+  _NT_ATOMIC_BARRIER();
+  *p = v;
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static NT_INLINE uint64_t _nt_atomic_load_acquire_u64(const volatile uint64_t* p)
+{
+#ifdef _MSC_VER
+  uint64_t v = *p;
+  _NT_ATOMIC_BARRIER();
+  return v;
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static NT_INLINE void _nt_atomic_store_release_u64(volatile uint64_t* p, uint64_t v)
+{
+#ifdef _MSC_VER
+  _NT_ATOMIC_BARRIER();
+  *p = v;
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static NT_INLINE uint32_t _nt_atomic_fetch_add_u32(volatile uint32_t* p, uint32_t v)
+{
+#ifdef _MSC_VER
+  return (uint32_t)_InterlockedExchangeAdd((volatile long*)p, (long)v);
+#else
+  return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static NT_INLINE uint32_t _nt_atomic_fetch_sub_u32(volatile uint32_t* p, uint32_t v)
+{
+#ifdef _MSC_VER
+  return (uint32_t)_InterlockedExchangeAdd((volatile long*)p, -(long)v);
+#else
+  return __atomic_fetch_sub(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static NT_INLINE uint64_t _nt_atomic_fetch_add_u64(volatile uint64_t* p, uint64_t v)
+{
+#ifdef _MSC_VER
+  return (uint64_t)_InterlockedExchangeAdd64((volatile __int64*)p, (__int64)v);
+#else
+  return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static NT_INLINE uint32_t _nt_atomic_exchange_u32(volatile uint32_t* p, uint32_t v)
+{
+#ifdef _MSC_VER
+  return (uint32_t)_InterlockedExchange((volatile long*)p, (long)v);
+#else
+  return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * @brief Full memory barrier - orders earlier stores before later loads
+ */
+static NT_INLINE void _nt_atomic_fence(void)
+{
+#ifdef _MSC_VER
+  _mm_mfence();
+#else
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * @brief Hint the CPU that the caller is spinning
+ */
+static NT_INLINE void _nt_cpu_relax(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+#endif // __ATOMIC_H__
@@ -0,0 +1,893 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+/**
+ * @file
+ *
+ * This header file contains a compiler of BPF filter programs, as made by
+ * pcap_compile, to native x86-64 code. bpf_filter interprets the program
+ * one instruction at a time; the compiled program keeps A and X in
+ * registers, checks the packet bounds with a single compare per load and
+ * jumps directly between the instructions, so filtering large files
+ * offline is no longer bound by the interpreter.
+ *
+ * @ref _nt_bpfjit_compile validates the program and compiles it once.
+ * Where native code cannot be made - on other architectures, with MSVC
+ * or when executable memory cannot be mapped - the program is run by an
+ * interpreter with the same results instead. @ref _nt_bpfjit_is_native
+ * tells which one is used.
+ *
+ * @ref _nt_bpfjit_offline_filter replaces pcap_offline_filter for
+ * packets in pcap records, and @ref _nt_bpfjit_segment filters the
+ * packets of an NT segment and returns the matches as a bitmap. The
+ * packets of a segment are filtered as the records made of them by
+ * @ref _nt_pcapconv_run would be, so a filter selects the same packets
+ * whether it is run before or after the conversion.
+ *
+ * The header needs the libpcap headers, which need the BSD types of
+ * sys/types.h, so it is not included by ntutil.h - include it directly.
+ *
+ */
+#ifndef __BPFJIT_H__
+#define __BPFJIT_H__
+
+#include "nt.h"
+#include "compat.h"
+
+#include <pcap/pcap.h>
+#include <pcap/bpf.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__)) && !defined(_WIN32)
+#define _NT_BPFJIT_NATIVE 1
+#include <sys/mman.h>
+#endif
+
+/**
+ * BPF compiler configuration. Zero selects the default value.
+ */
+typedef struct NtBpfJitConfig_s {
+  int interpret;            //!< Run the program in the interpreter instead of compiling it, e.g. to compare the two
+  int stripFcs;             //!< @ref _nt_bpfjit_segment: leave the 4 byte Ethernet FCS out of the packets filtered
+} NtBpfJitConfig_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+typedef uint32_t (*_NtBpfJitFn_t)(const uint8_t* pkt, uint32_t wirelen, uint32_t buflen);
+#endif
+
+/**
+ * Compiled BPF program
+ */
+typedef struct NtBpfJit_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtBpfJitConfig_t config;
+  struct bpf_insn* insns;   // Validated copy of the program for the interpreter
+  uint32_t numInsns;        // 0 when the program is empty
+  _NtBpfJitFn_t fn;         // Native code - NULL when interpreted
+  uint8_t* code;
+  size_t codeSize;
+#endif
+} NtBpfJit_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Accept only the instructions bpf_filter executes, forward jumps that
+ * stay in the program, scratch memory indexes in range and no division
+ * by a constant zero. The program must end with a return.
+ */
+static NT_INLINE int _nt_bpfjit_validate(const struct bpf_insn* insns, uint32_t numInsns)
+{
+  uint32_t i;
+  for (i = 0; i < numInsns; i++) {
+    const struct bpf_insn* pc = &insns[i];
+    uint32_t left = numInsns - i - 1;
+    switch (pc->code) {
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+    case BPF_LD | BPF_W | BPF_LEN:
+    case BPF_LD | BPF_IMM:
+    case BPF_LDX | BPF_W | BPF_LEN:
+    case BPF_LDX | BPF_IMM:
+    case BPF_LDX | BPF_B | BPF_MSH:
+    case BPF_ALU | BPF_ADD | BPF_K:
+    case BPF_ALU | BPF_SUB | BPF_K:
+    case BPF_ALU | BPF_MUL | BPF_K:
+    case BPF_ALU | BPF_OR | BPF_K:
+    case BPF_ALU | BPF_AND | BPF_K:
+    case BPF_ALU | BPF_XOR | BPF_K:
+    case BPF_ALU | BPF_LSH | BPF_K:
+    case BPF_ALU | BPF_RSH | BPF_K:
+    case BPF_ALU | BPF_ADD | BPF_X:
+    case BPF_ALU | BPF_SUB | BPF_X:
+    case BPF_ALU | BPF_MUL | BPF_X:
+    case BPF_ALU | BPF_DIV | BPF_X:
+    case BPF_ALU | BPF_MOD | BPF_X:
+    case BPF_ALU | BPF_OR | BPF_X:
+    case BPF_ALU | BPF_AND | BPF_X:
+    case BPF_ALU | BPF_XOR | BPF_X:
+    case BPF_ALU | BPF_LSH | BPF_X:
+    case BPF_ALU | BPF_RSH | BPF_X:
+    case BPF_ALU | BPF_NEG:
+    case BPF_RET | BPF_K:
+    case BPF_RET | BPF_A:
+    case BPF_MISC | BPF_TAX:
+    case BPF_MISC | BPF_TXA:
+      break;
+    case BPF_LD | BPF_MEM:
+    case BPF_LDX | BPF_MEM:
+    case BPF_ST:
+    case BPF_STX:
+      if (pc->k >= BPF_MEMWORDS) {
+        return NT_ERROR_INVALID_PARAMETER;
+      }
+      break;
+    case BPF_ALU | BPF_DIV | BPF_K:
+    case BPF_ALU | BPF_MOD | BPF_K:
+      if (pc->k == 0) {
+        return NT_ERROR_INVALID_PARAMETER;
+      }
+      break;
+    case BPF_JMP | BPF_JA:
+      if (pc->k >= left) {
+        return NT_ERROR_INVALID_PARAMETER;
+      }
+      break;
+    case BPF_JMP | BPF_JGT | BPF_K:
+    case BPF_JMP | BPF_JGE | BPF_K:
+    case BPF_JMP | BPF_JEQ | BPF_K:
+    case BPF_JMP | BPF_JSET | BPF_K:
+    case BPF_JMP | BPF_JGT | BPF_X:
+    case BPF_JMP | BPF_JGE | BPF_X:
+    case BPF_JMP | BPF_JEQ | BPF_X:
+    case BPF_JMP | BPF_JSET | BPF_X:
+      if (pc->jt >= left || pc->jf >= left) {
+        return NT_ERROR_INVALID_PARAMETER;
+      }
+      break;
+    default:
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+  }
+  if (numInsns > 0 && BPF_CLASS(insns[numInsns - 1].code) != BPF_RET) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Interpreter of a validated program. Loads beyond the buffer return 0
+ * like bpf_filter. Shifts use the low 5 bits of the count like the
+ * native code, where the result of the C shift would be undefined.
+ */
+static NT_INLINE uint32_t _nt_bpfjit_interpret(const struct bpf_insn* pc, const uint8_t* p, uint32_t wirelen, uint32_t buflen)
+{
+  uint32_t A = 0, X = 0;
+  uint32_t mem[BPF_MEMWORDS];
+  uint64_t k;
+
+  memset(mem, 0, sizeof(mem));
+  for (;; pc++) {
+    switch (pc->code) {
+    case BPF_RET | BPF_K:
+      return pc->k;
+    case BPF_RET | BPF_A:
+      return A;
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+      k = BPF_MODE(pc->code) == BPF_IND ? (uint64_t)X + pc->k : pc->k;
+      if (k + 4 > buflen) {
+        return 0;
+      }
+      A = ((uint32_t)p[k] << 24) | ((uint32_t)p[k + 1] << 16) | ((uint32_t)p[k + 2] << 8) | p[k + 3];
+      break;
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_IND:
+      k = BPF_MODE(pc->code) == BPF_IND ? (uint64_t)X + pc->k : pc->k;
+      if (k + 2 > buflen) {
+        return 0;
+      }
+      A = ((uint32_t)p[k] << 8) | p[k + 1];
+      break;
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_IND:
+      k = BPF_MODE(pc->code) == BPF_IND ? (uint64_t)X + pc->k : pc->k;
+      if (k >= buflen) {
+        return 0;
+      }
+      A = p[k];
+      break;
+    case BPF_LD | BPF_W | BPF_LEN:
+      A = wirelen;
+      break;
+    case BPF_LDX | BPF_W | BPF_LEN:
+      X = wirelen;
+      break;
+    case BPF_LDX | BPF_B | BPF_MSH:
+      if (pc->k >= buflen) {
+        return 0;
+      }
+      X = (uint32_t)(p[pc->k] & 0xf) << 2;
+      break;
+    case BPF_LD | BPF_IMM:
+      A = pc->k;
+      break;
+    case BPF_LDX | BPF_IMM:
+      X = pc->k;
+      break;
+    case BPF_LD | BPF_MEM:
+      A = mem[pc->k];
+      break;
+    case BPF_LDX | BPF_MEM:
+      X = mem[pc->k];
+      break;
+    case BPF_ST:
+      mem[pc->k] = A;
+      break;
+    case BPF_STX:
+      mem[pc->k] = X;
+      break;
+    case BPF_JMP | BPF_JA:
+      pc += pc->k;
+      break;
+    case BPF_JMP | BPF_JGT | BPF_K:
+      pc += A > pc->k ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JGE | BPF_K:
+      pc += A >= pc->k ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K:
+      pc += A == pc->k ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JSET | BPF_K:
+      pc += (A & pc->k) != 0 ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JGT | BPF_X:
+      pc += A > X ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JGE | BPF_X:
+      pc += A >= X ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_X:
+      pc += A == X ? pc->jt : pc->jf;
+      break;
+    case BPF_JMP | BPF_JSET | BPF_X:
+      pc += (A & X) != 0 ? pc->jt : pc->jf;
+      break;
+    case BPF_ALU | BPF_ADD | BPF_X:
+      A += X;
+      break;
+    case BPF_ALU | BPF_SUB | BPF_X:
+      A -= X;
+      break;
+    case BPF_ALU | BPF_MUL | BPF_X:
+      A *= X;
+      break;
+    case BPF_ALU | BPF_DIV | BPF_X:
+      if (X == 0) {
+        return 0;
+      }
+      A /= X;
+      break;
+    case BPF_ALU | BPF_MOD | BPF_X:
+      if (X == 0) {
+        return 0;
+      }
+      A %= X;
+      break;
+    case BPF_ALU | BPF_AND | BPF_X:
+      A &= X;
+      break;
+    case BPF_ALU | BPF_OR | BPF_X:
+      A |= X;
+      break;
+    case BPF_ALU | BPF_XOR | BPF_X:
+      A ^= X;
+      break;
+    case BPF_ALU | BPF_LSH | BPF_X:
+      A <<= X & 31;
+      break;
+    case BPF_ALU | BPF_RSH | BPF_X:
+      A >>= X & 31;
+      break;
+    case BPF_ALU | BPF_ADD | BPF_K:
+      A += pc->k;
+      break;
+    case BPF_ALU | BPF_SUB | BPF_K:
+      A -= pc->k;
+      break;
+    case BPF_ALU | BPF_MUL | BPF_K:
+      A *= pc->k;
+      break;
+    case BPF_ALU | BPF_DIV | BPF_K:
+      A /= pc->k;
+      break;
+    case BPF_ALU | BPF_MOD | BPF_K:
+      A %= pc->k;
+      break;
+    case BPF_ALU | BPF_AND | BPF_K:
+      A &= pc->k;
+      break;
+    case BPF_ALU | BPF_OR | BPF_K:
+      A |= pc->k;
+      break;
+    case BPF_ALU | BPF_XOR | BPF_K:
+      A ^= pc->k;
+      break;
+    case BPF_ALU | BPF_LSH | BPF_K:
+      A <<= pc->k & 31;
+      break;
+    case BPF_ALU | BPF_RSH | BPF_K:
+      A >>= pc->k & 31;
+      break;
+    case BPF_ALU | BPF_NEG:
+      A = 0U - A;
+      break;
+    case BPF_MISC | BPF_TAX:
+      X = A;
+      break;
+    case BPF_MISC | BPF_TXA:
+      A = X;
+      break;
+    default:
+      return 0;
+    }
+  }
+}
+
+#ifdef _NT_BPFJIT_NATIVE
+/*
+ * x86-64 code generation. The generated function follows the System V
+ * calling convention: pkt in rdi, wirelen in esi and buflen in edx. A is
+ * kept in eax, X in ecx and buflen in r8. r9 and r10 hold the offset of a
+ * load, and M[] lives in the red zone below the stack pointer, as the
+ * function calls nothing.
+ *
+ * Every instruction is emitted with a fixed size, so a first pass with no
+ * buffer gives the address of every instruction and the second pass
+ * emits the code with the jumps resolved. Jumps always use 32 bit
+ * displacements.
+ */
+typedef struct _NtBpfJitEmit_s {
+  uint8_t* buf;   // NULL while sizing
+  uint32_t pos;
+  const uint32_t* addr;
+} _NtBpfJitEmit_t;
+
+#define _NT_BPFJIT_EMIT(_e_, _s_) _nt_bpfjit_emit(_e_, (const uint8_t*)(_s_), (uint32_t)sizeof(_s_) - 1)
+
+static NT_INLINE void _nt_bpfjit_emit(_NtBpfJitEmit_t* e, const uint8_t* bytes, uint32_t n)
+{
+  if (e->buf != NULL) {
+    memcpy(e->buf + e->pos, bytes, n);
+  }
+  e->pos += n;
+}
+
+static NT_INLINE void _nt_bpfjit_emit_u8(_NtBpfJitEmit_t* e, uint8_t b)
+{
+  _nt_bpfjit_emit(e, &b, 1);
+}
+
+static NT_INLINE void _nt_bpfjit_emit_u32(_NtBpfJitEmit_t* e, uint32_t k)
+{
+  uint8_t b[4];
+  b[0] = (uint8_t)k;
+  b[1] = (uint8_t)(k >> 8);
+  b[2] = (uint8_t)(k >> 16);
+  b[3] = (uint8_t)(k >> 24);
+  _nt_bpfjit_emit(e, b, 4);
+}
+
+/*
+ * jmp rel32 when cc is 0, otherwise the jcc rel32 with the second opcode
+ * byte cc
+ */
+static NT_INLINE void _nt_bpfjit_emit_jump(_NtBpfJitEmit_t* e, uint8_t cc, uint32_t target)
+{
+  if (cc == 0) {
+    _NT_BPFJIT_EMIT(e, "\xE9");
+  } else {
+    _nt_bpfjit_emit_u8(e, 0x0F);
+    _nt_bpfjit_emit_u8(e, cc);
+  }
+  _nt_bpfjit_emit_u32(e, target - (e->pos + 4));
+}
+
+/*
+ * r9 = offset of the load, and return 0 unless size bytes from it are
+ * inside the buffer. The sums are 64 bit and cannot overflow.
+ */
+static NT_INLINE void _nt_bpfjit_emit_bounds(_NtBpfJitEmit_t* e, const struct bpf_insn* pc, uint8_t size, uint32_t ret0)
+{
+  if (BPF_MODE(pc->code) == BPF_IND) {
+    _NT_BPFJIT_EMIT(e, "\x41\x89\xC9");     // mov r9d, ecx
+    _NT_BPFJIT_EMIT(e, "\x41\xBA");         // mov r10d, k
+    _nt_bpfjit_emit_u32(e, pc->k);
+    _NT_BPFJIT_EMIT(e, "\x4D\x01\xD1");     // add r9, r10
+  } else {
+    _NT_BPFJIT_EMIT(e, "\x41\xB9");         // mov r9d, k
+    _nt_bpfjit_emit_u32(e, pc->k);
+  }
+  _NT_BPFJIT_EMIT(e, "\x4D\x8D\x51");       // lea r10, [r9 + size]
+  _nt_bpfjit_emit_u8(e, size);
+  _NT_BPFJIT_EMIT(e, "\x4D\x39\xC2");       // cmp r10, r8
+  _nt_bpfjit_emit_jump(e, 0x87, ret0);      // ja ret0
+}
+
+/*
+ * Conditional jump of instruction i. A jump to the next instruction is
+ * left out, so the common compare with one branch falling through is a
+ * single jcc.
+ */
+static NT_INLINE void _nt_bpfjit_emit_branch(_NtBpfJitEmit_t* e, uint32_t i, const struct bpf_insn* pc, uint8_t cc)
+{
+  // The inverse condition differs in the low bit: je/jne, ja/jbe, jae/jb
+  if (pc->jt == 0 && pc->jf != 0) {
+    _nt_bpfjit_emit_jump(e, (uint8_t)(cc ^ 1), e->addr[i + 1 + pc->jf]);
+  } else if (pc->jt != 0) {
+    _nt_bpfjit_emit_jump(e, cc, e->addr[i + 1 + pc->jt]);
+    if (pc->jf != 0) {
+      _nt_bpfjit_emit_jump(e, 0, e->addr[i + 1 + pc->jf]);
+    }
+  }
+}
+
+/*
+ * Emit the function. e->addr[numInsns] is the address of the code
+ * returning 0 for loads out of bounds and division by zero.
+ */
+static NT_INLINE void _nt_bpfjit_emit_program(_NtBpfJitEmit_t* e, const struct bpf_insn* insns, uint32_t numInsns, uint32_t* addr)
+{
+  uint32_t i, loaded = 0;
+
+  // Zero the scratch memory words the program reads, like the interpreter
+  for (i = 0; i < numInsns; i++) {
+    if (insns[i].code == (BPF_LD | BPF_MEM) || insns[i].code == (BPF_LDX | BPF_MEM)) {
+      loaded |= 1U << insns[i].k;
+    }
+  }
+  _NT_BPFJIT_EMIT(e, "\x41\x89\xD0");       // mov r8d, edx
+  _NT_BPFJIT_EMIT(e, "\x31\xC0");           // xor eax, eax
+  _NT_BPFJIT_EMIT(e, "\x31\xC9");           // xor ecx, ecx
+  for (i = 0; i < BPF_MEMWORDS; i++) {
+    if (loaded & (1U << i)) {
+      _NT_BPFJIT_EMIT(e, "\x89\x44\x24");   // mov [rsp - 64 + 4 * i], eax
+      _nt_bpfjit_emit_u8(e, (uint8_t)(0xC0 + 4 * i));
+    }
+  }
+
+  for (i = 0; i < numInsns; i++) {
+    const struct bpf_insn* pc = &insns[i];
+    const uint32_t ret0 = e->addr[numInsns];
+    addr[i] = e->pos;
+    switch (pc->code) {
+    case BPF_RET | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\xB8");           // mov eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      _NT_BPFJIT_EMIT(e, "\xC3");           // ret
+      break;
+    case BPF_RET | BPF_A:
+      _NT_BPFJIT_EMIT(e, "\xC3");           // ret
+      break;
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+      _nt_bpfjit_emit_bounds(e, pc, 4, ret0);
+      _NT_BPFJIT_EMIT(e, "\x42\x8B\x04\x0F"); // mov eax, [rdi + r9]
+      _NT_BPFJIT_EMIT(e, "\x0F\xC8");       // bswap eax
+      break;
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_IND:
+      _nt_bpfjit_emit_bounds(e, pc, 2, ret0);
+      _NT_BPFJIT_EMIT(e, "\x42\x0F\xB7\x04\x0F"); // movzx eax, word [rdi + r9]
+      _NT_BPFJIT_EMIT(e, "\x66\xC1\xC0\x08"); // rol ax, 8
+      break;
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_IND:
+      _nt_bpfjit_emit_bounds(e, pc, 1, ret0);
+      _NT_BPFJIT_EMIT(e, "\x42\x0F\xB6\x04\x0F"); // movzx eax, byte [rdi + r9]
+      break;
+    case BPF_LDX | BPF_B | BPF_MSH:
+      _nt_bpfjit_emit_bounds(e, pc, 1, ret0);
+      _NT_BPFJIT_EMIT(e, "\x42\x0F\xB6\x0C\x0F"); // movzx ecx, byte [rdi + r9]
+      _NT_BPFJIT_EMIT(e, "\x83\xE1\x0F");   // and ecx, 0xf
+      _NT_BPFJIT_EMIT(e, "\xC1\xE1\x02");   // shl ecx, 2
+      break;
+    case BPF_LD | BPF_W | BPF_LEN:
+      _NT_BPFJIT_EMIT(e, "\x89\xF0");       // mov eax, esi
+      break;
+    case BPF_LDX | BPF_W | BPF_LEN:
+      _NT_BPFJIT_EMIT(e, "\x89\xF1");       // mov ecx, esi
+      break;
+    case BPF_LD | BPF_IMM:
+      _NT_BPFJIT_EMIT(e, "\xB8");           // mov eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_LDX | BPF_IMM:
+      _NT_BPFJIT_EMIT(e, "\xB9");           // mov ecx, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_LD | BPF_MEM:
+      _NT_BPFJIT_EMIT(e, "\x8B\x44\x24");   // mov eax, [rsp - 64 + 4 * k]
+      _nt_bpfjit_emit_u8(e, (uint8_t)(0xC0 + 4 * pc->k));
+      break;
+    case BPF_LDX | BPF_MEM:
+      _NT_BPFJIT_EMIT(e, "\x8B\x4C\x24");   // mov ecx, [rsp - 64 + 4 * k]
+      _nt_bpfjit_emit_u8(e, (uint8_t)(0xC0 + 4 * pc->k));
+      break;
+    case BPF_ST:
+      _NT_BPFJIT_EMIT(e, "\x89\x44\x24");   // mov [rsp - 64 + 4 * k], eax
+      _nt_bpfjit_emit_u8(e, (uint8_t)(0xC0 + 4 * pc->k));
+      break;
+    case BPF_STX:
+      _NT_BPFJIT_EMIT(e, "\x89\x4C\x24");   // mov [rsp - 64 + 4 * k], ecx
+      _nt_bpfjit_emit_u8(e, (uint8_t)(0xC0 + 4 * pc->k));
+      break;
+    case BPF_JMP | BPF_JA:
+      if (pc->k != 0) {
+        _nt_bpfjit_emit_jump(e, 0, e->addr[i + 1 + pc->k]);
+      }
+      break;
+    case BPF_JMP | BPF_JGT | BPF_K:
+    case BPF_JMP | BPF_JGE | BPF_K:
+    case BPF_JMP | BPF_JEQ | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x3D");           // cmp eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      _nt_bpfjit_emit_branch(e, i, pc, BPF_OP(pc->code) == BPF_JGT ? 0x87 : BPF_OP(pc->code) == BPF_JGE ? 0x83 : 0x84);
+      break;
+    case BPF_JMP | BPF_JSET | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\xA9");           // test eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      _nt_bpfjit_emit_branch(e, i, pc, 0x85);
+      break;
+    case BPF_JMP | BPF_JGT | BPF_X:
+    case BPF_JMP | BPF_JGE | BPF_X:
+    case BPF_JMP | BPF_JEQ | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x39\xC8");       // cmp eax, ecx
+      _nt_bpfjit_emit_branch(e, i, pc, BPF_OP(pc->code) == BPF_JGT ? 0x87 : BPF_OP(pc->code) == BPF_JGE ? 0x83 : 0x84);
+      break;
+    case BPF_JMP | BPF_JSET | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x85\xC8");       // test eax, ecx
+      _nt_bpfjit_emit_branch(e, i, pc, 0x85);
+      break;
+    case BPF_ALU | BPF_ADD | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x01\xC8");       // add eax, ecx
+      break;
+    case BPF_ALU | BPF_SUB | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x29\xC8");       // sub eax, ecx
+      break;
+    case BPF_ALU | BPF_MUL | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x0F\xAF\xC1");   // imul eax, ecx
+      break;
+    case BPF_ALU | BPF_DIV | BPF_X:
+    case BPF_ALU | BPF_MOD | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x85\xC9");       // test ecx, ecx
+      _nt_bpfjit_emit_jump(e, 0x84, ret0);  // je ret0
+      _NT_BPFJIT_EMIT(e, "\x31\xD2");       // xor edx, edx
+      _NT_BPFJIT_EMIT(e, "\xF7\xF1");       // div ecx
+      if (BPF_OP(pc->code) == BPF_MOD) {
+        _NT_BPFJIT_EMIT(e, "\x89\xD0");     // mov eax, edx
+      }
+      break;
+    case BPF_ALU | BPF_AND | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x21\xC8");       // and eax, ecx
+      break;
+    case BPF_ALU | BPF_OR | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x09\xC8");       // or eax, ecx
+      break;
+    case BPF_ALU | BPF_XOR | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\x31\xC8");       // xor eax, ecx
+      break;
+    case BPF_ALU | BPF_LSH | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\xD3\xE0");       // shl eax, cl
+      break;
+    case BPF_ALU | BPF_RSH | BPF_X:
+      _NT_BPFJIT_EMIT(e, "\xD3\xE8");       // shr eax, cl
+      break;
+    case BPF_ALU | BPF_ADD | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x05");           // add eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_SUB | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x2D");           // sub eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_MUL | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x69\xC0");       // imul eax, eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_DIV | BPF_K:
+    case BPF_ALU | BPF_MOD | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x41\xB9");       // mov r9d, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      _NT_BPFJIT_EMIT(e, "\x31\xD2");       // xor edx, edx
+      _NT_BPFJIT_EMIT(e, "\x41\xF7\xF1");   // div r9d
+      if (BPF_OP(pc->code) == BPF_MOD) {
+        _NT_BPFJIT_EMIT(e, "\x89\xD0");     // mov eax, edx
+      }
+      break;
+    case BPF_ALU | BPF_AND | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x25");           // and eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_OR | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x0D");           // or eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_XOR | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\x35");           // xor eax, k
+      _nt_bpfjit_emit_u32(e, pc->k);
+      break;
+    case BPF_ALU | BPF_LSH | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\xC1\xE0");       // shl eax, k
+      _nt_bpfjit_emit_u8(e, (uint8_t)(pc->k & 31));
+      break;
+    case BPF_ALU | BPF_RSH | BPF_K:
+      _NT_BPFJIT_EMIT(e, "\xC1\xE8");       // shr eax, k
+      _nt_bpfjit_emit_u8(e, (uint8_t)(pc->k & 31));
+      break;
+    case BPF_ALU | BPF_NEG:
+      _NT_BPFJIT_EMIT(e, "\xF7\xD8");       // neg eax
+      break;
+    case BPF_MISC | BPF_TAX:
+      _NT_BPFJIT_EMIT(e, "\x89\xC1");       // mov ecx, eax
+      break;
+    case BPF_MISC | BPF_TXA:
+      _NT_BPFJIT_EMIT(e, "\x89\xC8");       // mov eax, ecx
+      break;
+    default:
+      break;
+    }
+  }
+  addr[numInsns] = e->pos;
+  _NT_BPFJIT_EMIT(e, "\x31\xC0");           // ret0: xor eax, eax
+  _NT_BPFJIT_EMIT(e, "\xC3");               // ret
+}
+
+/*
+ * Size the code, map it writable, emit it and make it executable. Returns
+ * 0 if the program must be interpreted.
+ */
+static NT_INLINE int _nt_bpfjit_native(NtBpfJit_t* jit)
+{
+  _NtBpfJitEmit_t e;
+  uint32_t* addr;
+  uint32_t size;
+  void* code;
+
+  addr = (uint32_t*)calloc(jit->numInsns + 1, sizeof(uint32_t));
+  if (addr == NULL) {
+    return 0;
+  }
+  // Sizing pass - the jumps use the zero addresses but have their final size
+  memset(&e, 0, sizeof(e));
+  e.addr = addr;
+  _nt_bpfjit_emit_program(&e, jit->insns, jit->numInsns, addr);
+  size = e.pos;
+  // Emitting pass - every jump target is known now
+  code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | _NT_COMPAT_MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(addr);
+    return 0;
+  }
+  e.buf = (uint8_t*)code;
+  e.pos = 0;
+  _nt_bpfjit_emit_program(&e, jit->insns, jit->numInsns, addr);
+  free(addr);
+  if (e.pos != size || mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, size);
+    return 0;
+  }
+  jit->code = (uint8_t*)code;
+  jit->codeSize = size;
+  jit->fn = (_NtBpfJitFn_t)(uintptr_t)code;
+  return 1;
+}
+#endif
+#endif
+
+/**
+ * @brief Release a compiled BPF program
+ *
+ * @param[in] jit  Compiled program
+ */
+static NT_INLINE void _nt_bpfjit_free(NtBpfJit_t* jit)
+{
+#ifdef _NT_BPFJIT_NATIVE
+  if (jit->code != NULL) {
+    munmap(jit->code, jit->codeSize);
+  }
+#endif
+  free(jit->insns);
+  memset(jit, 0, sizeof(*jit));
+}
+
+/**
+ * @brief Compile a BPF program
+ *
+ * The program is validated and compiled to native code, or prepared for
+ * the interpreter where native code cannot be made. The program is
+ * copied, so it can be freed with pcap_freecode afterwards. An empty
+ * program matches no packets, like pcap_offline_filter.
+ *
+ * @param[out] jit     Compiled program
+ * @param[in]  prog    Program, e.g. from pcap_compile
+ * @param[in]  config  Optional configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         The program has an invalid instruction or jump
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_bpfjit_compile(NtBpfJit_t* jit, const struct bpf_program* prog, const NtBpfJitConfig_t* config)
+{
+  int status;
+
+  memset(jit, 0, sizeof(*jit));
+  if (config != NULL) {
+    jit->config = *config;
+  }
+  if (prog->bf_insns == NULL || prog->bf_len == 0) {
+    return NT_SUCCESS;
+  }
+  if ((status = _nt_bpfjit_validate(prog->bf_insns, prog->bf_len)) != NT_SUCCESS) {
+    return status;
+  }
+  jit->insns = (struct bpf_insn*)malloc(prog->bf_len * sizeof(struct bpf_insn));
+  if (jit->insns == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  memcpy(jit->insns, prog->bf_insns, prog->bf_len * sizeof(struct bpf_insn));
+  jit->numInsns = prog->bf_len;
+#ifdef _NT_BPFJIT_NATIVE
+  if (jit->config.interpret == 0) {
+    (void)_nt_bpfjit_native(jit);
+  }
+#endif
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Tell whether a compiled program runs as native code
+ *
+ * @param[in] jit  Compiled program
+ *
+ * @retval 1  The program runs as native code
+ * @retval 0  The program is interpreted, or is empty
+ */
+static NT_INLINE int _nt_bpfjit_is_native(const NtBpfJit_t* jit)
+{
+  return jit->fn != NULL;
+}
+
+/**
+ * @brief Run a compiled BPF program on a packet
+ *
+ * This is the equivalent of bpf_filter.
+ *
+ * @param[in] jit      Compiled program
+ * @param[in] pkt      First byte of the packet
+ * @param[in] wirelen  Length of the packet on the wire
+ * @param[in] buflen   Bytes of the packet present at pkt
+ *
+ * @retval The return value of the program - 0 when the packet does not match
+ */
+static NT_INLINE uint32_t _nt_bpfjit_filter(const NtBpfJit_t* jit, const uint8_t* pkt, uint32_t wirelen, uint32_t buflen)
+{
+  if (jit->fn != NULL) {
+    return jit->fn(pkt, wirelen, buflen);
+  }
+  if (jit->numInsns == 0) {
+    return 0;
+  }
+  return _nt_bpfjit_interpret(jit->insns, pkt, wirelen, buflen);
+}
+
+/**
+ * @brief Run a compiled BPF program on a packet of a pcap record
+ *
+ * This replaces pcap_offline_filter, with the program compiled by
+ * @ref _nt_bpfjit_compile instead of the bpf_program.
+ *
+ * @param[in] jit  Compiled program
+ * @param[in] h    Record header
+ * @param[in] pkt  Packet data
+ *
+ * @retval The return value of the program - 0 when the packet does not match
+ */
+static NT_INLINE int _nt_bpfjit_offline_filter(const NtBpfJit_t* jit, const struct pcap_pkthdr* h, const uint8_t* pkt)
+{
+  return (int)_nt_bpfjit_filter(jit, pkt, h->len, h->caplen);
+}
+
+/**
+ * @brief Run a compiled BPF program on the packets of a segment
+ *
+ * Up to maxPkts packets are filtered starting at offset, which is moved
+ * past them, so the function can be called again until it returns 0 to
+ * filter the whole segment, like @ref _nt_net_get_packet_burst. Bit i of
+ * the bitmap is set when packet i of the call matches.
+ *
+ * The program sees the packet as a pcap record of it: the wire length
+ * without the FCS when @ref NtBpfJitConfig_s::stripFcs is set, and as
+ * many bytes as are stored of the frame, excluding the padding after it.
+ *
+ * @param[in]     jit        Compiled program
+ * @param[in]     segNetBuf  Segment
+ * @param[in,out] offset     Offset of the next packet in the segment. Must be 0 on the first call for a segment
+ * @param[out]    bitmap     Match bitmap of (maxPkts + 63) / 64 words
+ * @param[in]     maxPkts    Most packets filtered
+ * @param[out]    matches    Optional - number of packets that matched
+ *
+ * @retval The number of packets filtered. 0 means that there are no more packets in the segment
+ */
+static NT_INLINE uint32_t _nt_bpfjit_segment(const NtBpfJit_t* jit, struct NtNetBuf_s* segNetBuf, uint64_t* offset, uint64_t* bitmap,
+                                             uint32_t maxPkts, uint32_t* matches)
+{
+  struct NtNetBuf_s burst[64];
+  uint32_t n = 0, hits = 0;
+  unsigned count, i;
+
+  memset(bitmap, 0, ((maxPkts + 63) / 64) * sizeof(uint64_t));
+  while (n < maxPkts && (count = _nt_net_get_packet_burst(segNetBuf, offset, burst, maxPkts - n < 64 ? maxPkts - n : 64)) > 0) {
+    for (i = 0; i < count; i++, n++) {
+      uint32_t descrLength = (uint32_t)NT_NET_GET_PKT_DESCR_LENGTH(&burst[i]);
+      uint32_t stored = (uint32_t)NT_NET_GET_PKT_CAP_LENGTH(&burst[i]);
+      uint32_t wire = (uint32_t)NT_NET_GET_PKT_WIRE_LENGTH(&burst[i]);
+      uint32_t data = stored > descrLength ? stored - descrLength : 0;
+      if (jit->config.stripFcs) {
+        wire = wire > 4 ? wire - 4 : 0;
+      }
+      if (_nt_bpfjit_filter(jit, (const uint8_t*)burst[i].hPkt, wire, data < wire ? data : wire) != 0) {
+        bitmap[n >> 6] |= 1ULL << (n & 63);
+        hits++;
+      }
+    }
+  }
+  if (matches != NULL) {
+    *matches = hits;
+  }
+  return n;
+}
+
+#endif // __BPFJIT_H__
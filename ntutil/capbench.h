@@ -0,0 +1,440 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the capture file benchmarks. They generate
+ * segments with the segment generator (see seggen.h), so they are kept
+ * out of the headers they measure.
+ *
+ * @ref _nt_capfile_bench compares the buffered, O_DIRECT and
+ * memory-mapped modes of the reader on a generated file.
+ *
+ * @ref _nt_capwrite_bench measures the writer throughput per CPU core,
+ * writing segments of an emulated host buffer.
+ *
+ */
+#ifndef __CAPBENCH_H__
+#define __CAPBENCH_H__
+
+#include "nt.h"
+#include "aio.h"
+#include "capfile.h"
+#include "capwrite.h"
+#include "compat.h"
+#include "seggen.h"
+
+/**
+ * Capture file reader benchmark configuration. Zero selects the default value.
+ */
+typedef struct NtCapFileBenchConfig_s {
+  uint64_t bytes;           //!< Segment bytes in the generated file. Default is 1 GB
+  uint32_t segmentSize;     //!< Maximum size of the generated segments. Default is 1 MB
+  const NtSegGenConfig_t *gen; //!< Packets in the file - NULL selects the segment generator defaults
+} NtCapFileBenchConfig_t;
+
+/**
+ * Capture file reader benchmark result - one per read mode
+ */
+typedef struct NtCapFileBenchResult_s {
+  const char *mode;         //!< "buffered", "direct" or "mapped"
+  uint64_t bytes;           //!< Segment bytes delivered
+  uint64_t pkts;            //!< Packets delivered
+  uint64_t checksum;        //!< Sum of the capture lengths and the first byte of every packet - equal for all modes
+  double seconds;           //!< Time to read the file and visit every packet
+  double gbps;              //!< Throughput in Gbit/s
+  double nsPerPkt;          //!< Nanoseconds per packet
+  NtCapFileReadAio_t aio;   //!< Read-ahead counters - tells whether O_DIRECT was used
+} NtCapFileBenchResult_t;
+
+/**
+ * @brief Compare the read modes of the capture file reader
+ *
+ * Writes a capture file of generated packets and reads it once in each
+ * mode - buffered reads, O_DIRECT reads and memory-mapped - visiting the
+ * capture length and the first byte of every packet. Unless the file is
+ * larger than the memory, the buffered and mapped modes read it from the
+ * page cache after it has been written, while O_DIRECT reads it from the
+ * disk. The file system must support O_DIRECT for the direct mode to use
+ * it - otherwise it reads buffered, as reported in
+ * @ref NtCapFileBenchResult_s::aio.
+ *
+ * @param[in]  name        File name - the file is created or truncated and left in place
+ * @param[in]  config      Reader configuration - NULL selects the defaults. The direct and mapped fields are set per mode
+ * @param[in]  bench       Benchmark configuration - NULL selects the defaults
+ * @param[out] results     Results
+ * @param[in]  maxResults  Number of entries in results
+ * @param[out] count       Number of results stored
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error returned by the reader or when writing the file
+ */
+static NT_INLINE int _nt_capfile_bench(const char* name, const NtCapFileConfig_t* config, const NtCapFileBenchConfig_t* bench,
+                                       NtCapFileBenchResult_t* results, uint32_t maxResults, uint32_t* count)
+{
+  static const struct {
+    const char* mode;
+    int direct;
+    int mapped;
+  } modes[] = { { "buffered", 0, 0 }, { "direct", 1, 0 }, { "mapped", 0, 1 } };
+  NtCapFileBenchConfig_t cfg;
+  NtSegGenConfig_t genConfig;
+  NtSegGen_t gen;
+  NtFileHeader0_t header;
+  struct NtNetBuf_s seg;
+  struct NtNetBuf_s burst[64];
+  uint64_t written = 0;
+  uint8_t* buf;
+  uint32_t m;
+  FILE* fp;
+  int status = NT_SUCCESS;
+
+  *count = 0;
+  if (bench != NULL) {
+    cfg = *bench;
+  } else {
+    memset(&cfg, 0, sizeof(cfg));
+  }
+  if (cfg.bytes == 0) {
+    cfg.bytes = 1024ULL * 1024 * 1024;
+  }
+  if (cfg.segmentSize == 0) {
+    cfg.segmentSize = 1024 * 1024;
+  }
+  if (cfg.gen != NULL) {
+    genConfig = *cfg.gen;
+  } else {
+    memset(&genConfig, 0, sizeof(genConfig));
+  }
+  if ((status = _nt_seggen_init(&gen, &genConfig)) != NT_SUCCESS) {
+    return status;
+  }
+  buf = (uint8_t*)_nt_aio_alloc(cfg.segmentSize);
+  if (buf == NULL) {
+    _nt_seggen_free(&gen);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+
+  // Write the file
+  if ((fp = fopen(name, "wb")) == NULL) {
+    status = NT_AIO_ERRNO(errno);
+    goto out;
+  }
+  memset(&header, 0, sizeof(header));
+  header.structid = NT_STID_FILE_HEADER0;
+  header.cookie = NT_FILE_HEADER0_COOKIE;
+  header.tsType = NT_TIMESTAMP_TYPE_NATIVE_UNIX;
+  memcpy(header.colorMap, gen.colorMap, sizeof(header.colorMap));
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    status = NT_AIO_ERRNO(errno);
+  }
+  while (status == NT_SUCCESS && written < cfg.bytes) {
+    int genStatus = _nt_seggen_segment(&gen, buf, cfg.segmentSize, &seg);
+    size_t length = (size_t)NT_NET_GET_SEGMENT_LENGTH(&seg);
+    if (length == 0) {
+      status = written > 0 ? NT_SUCCESS : NT_ERROR_INVALID_PARAMETER;
+      break;
+    }
+    if (fwrite(buf, length, 1, fp) != 1) {
+      status = NT_AIO_ERRNO(errno);
+    }
+    written += length;
+    if (genStatus != NT_SUCCESS) {
+      break;
+    }
+  }
+  if (fclose(fp) != 0 && status == NT_SUCCESS) {
+    status = NT_AIO_ERRNO(errno);
+  }
+  if (status != NT_SUCCESS) {
+    goto out;
+  }
+
+  // Read it in every mode
+  for (m = 0; m < sizeof(modes) / sizeof(modes[0]) && *count < maxResults; m++) {
+    NtCapFileBenchResult_t* res = &results[*count];
+    NtCapFileConfig_t readConfig;
+    NtCapFileRead_t read;
+    NtCapFile_t file;
+    NtNetBuf_t hNetBuf;
+    uint64_t start;
+    if (config != NULL) {
+      readConfig = *config;
+    } else {
+      memset(&readConfig, 0, sizeof(readConfig));
+    }
+    readConfig.direct = modes[m].direct;
+    readConfig.mapped = modes[m].mapped;
+    memset(res, 0, sizeof(*res));
+    res->mode = modes[m].mode;
+    start = _nt_compat_now_ns();
+    if ((status = _nt_capfile_open(&file, name, &readConfig)) != NT_SUCCESS) {
+      break;
+    }
+    while ((status = _nt_capfile_get(&file, &hNetBuf)) == NT_SUCCESS) {
+      uint64_t offset = 0;
+      unsigned num, i;
+      while ((num = _nt_net_get_packet_burst(hNetBuf, &offset, burst, 64)) > 0) {
+        for (i = 0; i < num; i++) {
+          res->checksum += NT_NET_GET_PKT_CAP_LENGTH(&burst[i]) + *(const uint8_t*)NT_NET_GET_PKT_L2_PTR(&burst[i]);
+        }
+        res->pkts += num;
+      }
+      res->bytes += NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+      if ((status = _nt_capfile_release(&file, hNetBuf)) != NT_SUCCESS) {
+        break;
+      }
+    }
+    res->seconds = (double)(_nt_compat_now_ns() - start) / 1e9;
+    read.cmd = NT_CAPFILE_READ_AIO_CMD;
+    (void)_nt_capfile_read(&file, &read);
+    res->aio = read.u.aio;
+    _nt_capfile_close(&file);
+    if (status != NT_STATUS_END_OF_FILE) {
+      break;
+    }
+    status = NT_SUCCESS;
+    if (res->seconds > 0) {
+      res->gbps = (double)res->bytes * 8 / res->seconds / 1e9;
+    }
+    if (res->pkts > 0) {
+      res->nsPerPkt = res->seconds * 1e9 / (double)res->pkts;
+    }
+    (*count)++;
+  }
+
+out:
+  _nt_aio_free(buf);
+  _nt_seggen_free(&gen);
+  return status;
+}
+
+/**
+ * Capture file writer benchmark configuration. Zero selects the default value.
+ */
+typedef struct NtCapWriteBenchConfig_s {
+  uint64_t bytes;           //!< Segment bytes to write. Default is 4 GB
+  uint32_t segmentSize;     //!< Maximum segment size. Default is 1 MB
+  uint32_t hostBufferSize;  //!< Size of the emulated host buffer. Default is 64 MB
+  uint32_t misalign;        //!< Offset of the host buffer memory from the file offsets modulo @ref NT_AIO_DIRECT_ALIGN. 0 lets the direct path write the segments without copying them
+  const NtSegGenConfig_t *gen; //!< Packets in the host buffer - NULL selects the segment generator defaults
+} NtCapWriteBenchConfig_t;
+
+/**
+ * Capture file writer benchmark result
+ */
+typedef struct NtCapWriteBenchResult_s {
+  uint64_t bytes;           //!< Segment bytes written
+  double seconds;           //!< Elapsed time including closing the file
+  double cpuSeconds;        //!< CPU time of the process - includes the io_uring and thread pool workers
+  double gbps;              //!< Throughput in Gbit/s
+  double gbpsPerCore;       //!< Throughput in Gbit/s per CPU second
+  NtCapWriteStat_t stat;    //!< Writer counters
+} NtCapWriteBenchResult_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtCapWriteBench_s {
+  struct NtNetBuf_s *netBufs;
+  uint8_t *held;
+};
+
+static NT_INLINE int _nt_capwrite_bench_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  struct _NtCapWriteBench_s* bench = (struct _NtCapWriteBench_s*)ctx;
+  bench->held[hNetBuf - bench->netBufs] = 0;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE double _nt_capwrite_cpu_seconds(void)
+{
+#ifdef _MSC_VER
+  FILETIME create, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+  return ((double)(((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+          (double)(((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 1e7;
+#elif defined(CLOCK_PROCESS_CPUTIME_ID)
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+  // Strict ISO C modes hide clock_gettime - clock() is the processor time
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Measure the capture file writer throughput
+ *
+ * Fills an emulated host buffer with consecutive segments of generated
+ * packets and writes them to a file over and over, as a recorder does
+ * with the segments of an RX stream. A segment is written again when the
+ * writer has released it. Run it with @ref NtCapWriteConfig_s::copy set
+ * to measure a recorder copying the segments.
+ *
+ * @param[in]  name    File name - the file is created or truncated and left in place
+ * @param[in]  config  Writer configuration - NULL selects the defaults
+ * @param[in]  bench   Benchmark configuration - NULL selects the defaults
+ * @param[out] result  Result
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error returned by the writer
+ */
+static NT_INLINE int _nt_capwrite_bench(const char* name, const NtCapWriteConfig_t* config, const NtCapWriteBenchConfig_t* bench,
+                                        NtCapWriteBenchResult_t* result)
+{
+  NtCapWriteBenchConfig_t cfg;
+  NtSegGenConfig_t genConfig;
+  NtSegGen_t gen;
+  NtFileHeader0_t header;
+  NtCapWrite_t w;
+  struct _NtCapWriteBench_s ctx;
+  uint8_t* mem;
+  uint8_t* base;
+  uint32_t numSegs = 0, i, off = 0;
+  uint64_t start;
+  double cpu;
+  int status, closeStatus;
+
+  memset(result, 0, sizeof(*result));
+  memset(&ctx, 0, sizeof(ctx));
+  if (bench != NULL) {
+    cfg = *bench;
+  } else {
+    memset(&cfg, 0, sizeof(cfg));
+  }
+  if (cfg.bytes == 0) {
+    cfg.bytes = 4ULL * 1024 * 1024 * 1024;
+  }
+  if (cfg.segmentSize == 0) {
+    cfg.segmentSize = 1024 * 1024;
+  }
+  if (cfg.hostBufferSize == 0) {
+    cfg.hostBufferSize = 64 * 1024 * 1024;
+  }
+  if (cfg.hostBufferSize < cfg.segmentSize || (cfg.misalign % 8) != 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (cfg.gen != NULL) {
+    genConfig = *cfg.gen;
+  } else {
+    memset(&genConfig, 0, sizeof(genConfig));
+  }
+  if ((status = _nt_seggen_init(&gen, &genConfig)) != NT_SUCCESS) {
+    return status;
+  }
+  mem = (uint8_t*)_nt_aio_alloc((size_t)cfg.hostBufferSize + NT_AIO_DIRECT_ALIGN);
+  ctx.netBufs = (struct NtNetBuf_s*)calloc(cfg.hostBufferSize / cfg.segmentSize, sizeof(struct NtNetBuf_s));
+  ctx.held = (uint8_t*)calloc(cfg.hostBufferSize / cfg.segmentSize, 1);
+  if (mem == NULL || ctx.netBufs == NULL || ctx.held == NULL) {
+    status = NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    goto out;
+  }
+  // The segments follow each other as in a host buffer, aligned like the file after the header
+  base = mem + (sizeof(NtFileHeader0_t) + cfg.misalign) % NT_AIO_DIRECT_ALIGN;
+  while (numSegs < cfg.hostBufferSize / cfg.segmentSize) {
+    status = _nt_seggen_segment(&gen, base + off, cfg.segmentSize, &ctx.netBufs[numSegs]);
+    if (status != NT_SUCCESS || NT_NET_GET_SEGMENT_LENGTH(&ctx.netBufs[numSegs]) == 0) {
+      break;
+    }
+    off += (uint32_t)NT_NET_GET_SEGMENT_LENGTH(&ctx.netBufs[numSegs]);
+    numSegs++;
+  }
+  if (numSegs == 0) {
+    status = NT_ERROR_INVALID_PARAMETER;
+    goto out;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.structid = NT_STID_FILE_HEADER0;
+  header.cookie = NT_FILE_HEADER0_COOKIE;
+  header.tsType = NT_TIMESTAMP_TYPE_NATIVE_UNIX;
+  memcpy(header.colorMap, gen.colorMap, sizeof(header.colorMap));
+
+  start = _nt_compat_now_ns();
+  cpu = _nt_capwrite_cpu_seconds();
+  status = _nt_capwrite_open_release(&w, name, &header, sizeof(header), _nt_capwrite_bench_release, &ctx, config);
+  if (status != NT_SUCCESS) {
+    goto out;
+  }
+  for (i = 0; status == NT_SUCCESS && result->bytes < cfg.bytes; i = i + 1 == numSegs ? 0 : i + 1) {
+    while (ctx.held[i] && (status = _nt_capwrite_poll(&w, 1)) == NT_SUCCESS) {
+    }
+    if (status != NT_SUCCESS) {
+      break;
+    }
+    ctx.held[i] = 1;
+    if ((status = _nt_capwrite_put(&w, &ctx.netBufs[i])) != NT_SUCCESS) {
+      break;
+    }
+    result->bytes += NT_NET_GET_SEGMENT_LENGTH(&ctx.netBufs[i]);
+  }
+  closeStatus = _nt_capwrite_close(&w, &result->stat);
+  if (status == NT_SUCCESS) {
+    status = closeStatus;
+  }
+  result->seconds = (double)(_nt_compat_now_ns() - start) / 1e9;
+  result->cpuSeconds = _nt_capwrite_cpu_seconds() - cpu;
+  if (result->seconds > 0) {
+    result->gbps = (double)result->bytes * 8 / result->seconds / 1e9;
+  }
+  if (result->cpuSeconds > 0) {
+    result->gbpsPerCore = (double)result->bytes * 8 / result->cpuSeconds / 1e9;
+  }
+
+out:
+  free(ctx.held);
+  free(ctx.netBufs);
+  if (mem != NULL) {
+    _nt_aio_free(mem);
+  }
+  _nt_seggen_free(&gen);
+  return status;
+}
+
+#endif // __CAPBENCH_H__
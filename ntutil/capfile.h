@@ -0,0 +1,909 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a read-ahead reader for Napatech capture
+ * files. Unlike @ref NT_NetFileGet, which reads one segment at a time
+ * synchronously, the reader keeps a configurable number of blocks in
+ * flight using io_uring with O_DIRECT where available and a pool of
+ * threads otherwise (see aio.h), so @ref _nt_capfile_get returns
+ * segments that are already resident in memory.
+ *
+ * Every block is delivered as a segment of whole packets. The part of a
+ * packet crossing a block boundary is moved in front of the next block,
+ * which is read into a buffer with headroom for it. The segments are
+ * initialized with the time stamp type, port offset and color map of the
+ * file header, so the packet macros work as with @ref NT_NetFileGet.
+ *
+ * In memory-mapped mode the file is mapped in windows aligned to 2 MB huge
+ * page boundaries and the segments point straight into the mapping, so the
+ * packet data is never copied. Only the packet descriptors are read to
+ * find the segment boundaries. The windows are advised for sequential
+ * access and the part ahead of the reader is advised as soon needed.
+ *
+ * File headers found after the start of the file, as in concatenated
+ * capture files, are skipped. The time stamp type, port offset and color
+ * map are taken from the first file header.
+ *
+ */
+#ifndef __CAPFILE_H__
+#define __CAPFILE_H__
+
+#include "nt.h"
+#include "aio.h"
+#include "compat.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/**
+ * Headroom in front of every block. Must hold the largest packet.
+ */
+#define NT_CAPFILE_HEADROOM 65536
+
+/**
+ * Alignment of the memory-mapped windows - the size of a huge page
+ */
+#define NT_CAPFILE_MAP_ALIGN (2 * 1024 * 1024)
+
+/**
+ * Capture file reader configuration. Zero selects the default value.
+ */
+typedef struct NtCapFileConfig_s {
+  uint32_t blockSize;       //!< Bytes per read - a multiple of @ref NT_AIO_DIRECT_ALIGN and at least @ref NT_CAPFILE_HEADROOM. Default is 4 MB
+  uint32_t depth;           //!< Number of blocks read ahead. Default is 8
+  enum NtAioBackend_e backend; //!< Asynchronous I/O backend. Default is @ref NT_AIO_BACKEND_AUTO
+  uint32_t numThreads;      //!< Number of threads used by the thread pool backend. Default is 4
+  int direct;               //!< Read with O_DIRECT when the file system supports it
+  int mapped;               //!< Memory-map the file instead of reading it. The block size is the segment size and the depth is the maximum number of segments held
+  uint64_t windowSize;      //!< Size of a memory-mapped window - a multiple of @ref NT_CAPFILE_MAP_ALIGN. Default is 1 GB
+  uint64_t length;          //!< Bytes of the file to read, e.g. the valid part of a preallocated file. Default is the whole file
+} NtCapFileConfig_t;
+
+/**
+ * Possible capture file reader read commands
+ */
+enum NtCapFileReadCmd_e {
+  NT_CAPFILE_READ_INFO_CMD = 0,     //!< Read information about the file read so far
+  NT_CAPFILE_READ_DESCRIPTOR_CMD,   //!< Read information about the descriptor and time stamp format used
+  NT_CAPFILE_READ_AIO_CMD,          //!< Read the read-ahead counters
+};
+
+/**
+ * Read-ahead counters
+ */
+typedef struct NtCapFileReadAio_s {
+  enum NtAioBackend_e backend;  //!< Asynchronous I/O backend in use
+  int direct;               //!< Set if the file is read with O_DIRECT
+  int mapped;               //!< Set if the file is memory-mapped - no reads are done
+  uint32_t depth;           //!< Configured number of blocks read ahead
+  uint32_t queueDepth;      //!< Number of reads currently in flight
+  uint32_t maxQueueDepth;   //!< Highest number of reads in flight
+  uint64_t blocks;          //!< Number of blocks read
+  uint64_t bytes;           //!< Number of bytes read
+  uint64_t stalls;          //!< Number of times @ref _nt_capfile_get had to wait for a read to complete
+  uint64_t stallNs;         //!< Total time spent waiting for reads to complete
+} NtCapFileReadAio_t;
+
+/**
+ * Capture file reader read structure
+ */
+typedef struct NtCapFileRead_s {
+  enum NtCapFileReadCmd_e cmd; //!< The read command
+  union NtCapFileRead_u {
+    NtNetFileInfo_v1_t info_v1;        //!< Used by NT_CAPFILE_READ_INFO_CMD
+    struct NtNetFileReadDesc_s desc;   //!< Used by NT_CAPFILE_READ_DESCRIPTOR_CMD
+    NtCapFileReadAio_t aio;            //!< Used by NT_CAPFILE_READ_AIO_CMD
+  } u;
+} NtCapFileRead_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+enum _NtCapFileSlotState_e {
+  _NT_CAPFILE_SLOT_IDLE = 0,
+  _NT_CAPFILE_SLOT_READING,
+  _NT_CAPFILE_SLOT_READY,
+  _NT_CAPFILE_SLOT_HELD,
+};
+
+struct _NtCapFileSlot_s {
+  struct NtNetBuf_s netBuf;  // Must be first - the segment handed out
+  enum _NtCapFileSlotState_e state;
+  uint8_t *buf;              // Headroom followed by the block
+  uint64_t block;            // Block number
+  uint32_t window;           // Memory-mapped window holding the segment
+  uint32_t expect;           // Bytes expected in the block
+  uint32_t filled;           // Bytes read so far
+  NtAioReq_t req;
+};
+
+#define _NT_CAPFILE_WINDOWS 4
+
+struct _NtCapFileWindow_s {
+  uint8_t *base;             // NULL if not mapped
+  uint64_t offset;           // File offset of the window
+  uint64_t length;
+  uint32_t refs;             // Number of segments held in the window
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Capture file reader
+ */
+typedef struct NtCapFile_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  int fd;
+  int direct;
+  NtAio_t aio;
+  NtFileHeader0_t header;
+  uint64_t fileSize;
+  uint32_t blockSize;
+  uint64_t numBlocks;
+  uint32_t numSlots;
+  struct _NtCapFileSlot_s *slots;
+  uint64_t nextSubmit;       // Next block to read
+  uint64_t nextDeliver;      // Next block to hand out
+  uint8_t *carry;            // Part of a packet crossing the block boundary
+  uint32_t carryLen;
+  uint32_t skip;             // Bytes to skip at the start of the next block
+  enum NtPacketDescriptorType_e descr;
+  NtNetFileInfo_v1_t info;
+  NtCapFileReadAio_t stat;
+  // Memory-mapped mode
+  int mapped;
+  uint64_t windowSize;
+  struct _NtCapFileWindow_s windows[_NT_CAPFILE_WINDOWS];
+  uint32_t window;           // Current window
+  uint64_t pos;              // File offset of the next packet
+  uint64_t advised;          // End of the part advised as soon needed
+#ifdef _MSC_VER
+  HANDLE hMap;
+#endif
+#endif
+} NtCapFile_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Submit the remaining part of a block
+ */
+static NT_INLINE int _nt_capfile_submit(NtCapFile_t* file, struct _NtCapFileSlot_s* slot)
+{
+  uint32_t length = slot->expect - slot->filled;
+  int status;
+  if (file->direct) {
+    length = (length + NT_AIO_DIRECT_ALIGN - 1) & ~(uint32_t)(NT_AIO_DIRECT_ALIGN - 1);
+  }
+  slot->req.op = NT_AIO_OP_READ;
+  slot->req.buf = slot->buf + NT_CAPFILE_HEADROOM + slot->filled;
+  slot->req.length = length;
+  slot->req.offset = slot->block * file->blockSize + slot->filled;
+  slot->req.arg = (uintptr_t)slot;
+  if ((status = _nt_aio_submit(&file->aio, &slot->req)) != NT_SUCCESS) {
+    return status;
+  }
+  slot->state = _NT_CAPFILE_SLOT_READING;
+  if (file->aio.outstanding > file->stat.maxQueueDepth) {
+    file->stat.maxQueueDepth = file->aio.outstanding;
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Start reading blocks into all idle slots, in file order
+ */
+static NT_INLINE int _nt_capfile_fill(NtCapFile_t* file)
+{
+  while (file->nextSubmit < file->numBlocks) {
+    struct _NtCapFileSlot_s* slot = &file->slots[file->nextSubmit % file->numSlots];
+    uint64_t offset = file->nextSubmit * file->blockSize;
+    int status;
+    if (slot->state != _NT_CAPFILE_SLOT_IDLE) {
+      break;
+    }
+    slot->block = file->nextSubmit;
+    slot->filled = 0;
+    slot->expect = file->fileSize - offset < file->blockSize ? (uint32_t)(file->fileSize - offset) : file->blockSize;
+    if ((status = _nt_capfile_submit(file, slot)) != NT_SUCCESS) {
+      return status == NT_STATUS_TRYAGAIN ? NT_SUCCESS : status;
+    }
+    file->nextSubmit++;
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Handle a completed read
+ */
+static NT_INLINE int _nt_capfile_complete(NtCapFile_t* file, NtAioReq_t* req)
+{
+  struct _NtCapFileSlot_s* slot = (struct _NtCapFileSlot_s*)req->arg;
+  if (req->result < 0) {
+    return NT_AIO_ERRNO(-req->result);
+  }
+  file->stat.bytes += (uint64_t)req->result;
+  slot->filled += (uint32_t)req->result;
+  if (slot->filled > slot->expect) {
+    slot->filled = slot->expect;
+  }
+  // Resubmit short reads unless the file has been truncated
+  if (req->result > 0 && slot->filled < slot->expect) {
+    return _nt_capfile_submit(file, slot);
+  }
+  slot->state = _NT_CAPFILE_SLOT_READY;
+  file->stat.blocks++;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE uint64_t _nt_capfile_pkt_timestamp(const uint8_t* hdr)
+{
+  uint64_t ts;
+  // Dynamic descriptors have the time stamp at offset 8
+  memcpy(&ts, hdr + ((hdr[7] & 0x80) ? 8 : 0), sizeof(ts));
+  return ts;
+}
+
+/*
+ * Check if the data at a packet position is a file header. The cookie is
+ * located where a packet descriptor can never hold the same value.
+ */
+static NT_INLINE int _nt_capfile_is_header(const uint8_t* data)
+{
+  uint32_t structid, cookie;
+  memcpy(&structid, data, sizeof(structid));
+  memcpy(&cookie, data + 12, sizeof(cookie));
+  return cookie == NT_FILE_HEADER0_COOKIE && structid == NT_STID_FILE_HEADER0;
+}
+
+/*
+ * Find the end of the last whole packet in a block and update the
+ * file information. Returns the number of bytes of whole packets and
+ * whether the scan stopped at a file header.
+ */
+static NT_INLINE int _nt_capfile_scan(NtCapFile_t* file, uint8_t* data, uint32_t length, uint32_t* used, int* header)
+{
+  struct NtNetBuf_s pktNetBuf;
+  uint32_t offset = 0;
+  uint64_t ts = 0;
+  memset(&pktNetBuf, 0, sizeof(pktNetBuf));
+  *header = 0;
+  while (length - offset >= sizeof(NtStd0Descr_t)) {
+    uint32_t capLength;
+    if (_nt_capfile_is_header(data + offset)) {
+      *header = 1;
+      break;
+    }
+    pktNetBuf.hHdr = (NtNetBufHdr_t)(data + offset);
+    capLength = NT_NET_GET_PKT_CAP_LENGTH(&pktNetBuf);
+    if (capLength < sizeof(NtDynDescr_t)) {
+      return NT_ERROR_CAP_FILE_STORED_LENGTH_INVALID;
+    }
+    if (capLength > length - offset) {
+      break;
+    }
+    ts = _nt_capfile_pkt_timestamp(data + offset);
+    if (file->info.numberOfPackets == 0) {
+      file->info.firstTimestamp = ts;
+    }
+    file->info.numberOfPackets++;
+    offset += capLength;
+  }
+  if (offset > 0) {
+    file->info.lastTimestamp = ts;
+    file->info.numberOfOctets += offset;
+  }
+  *used = offset;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE void _nt_capfile_unmap(NtCapFile_t* file, uint32_t w)
+{
+  struct _NtCapFileWindow_s* window = &file->windows[w];
+#ifdef _MSC_VER
+  UnmapViewOfFile(window->base);
+#else
+  munmap(window->base, window->length);
+#endif
+  window->base = NULL;
+}
+
+static NT_INLINE void _nt_capfile_free(NtCapFile_t* file)
+{
+  uint32_t s;
+  if (file->slots != NULL) {
+    for (s = 0; s < file->numSlots; s++) {
+      _nt_aio_free(file->slots[s].buf);
+    }
+  }
+  for (s = 0; s < _NT_CAPFILE_WINDOWS; s++) {
+    if (file->windows[s].base != NULL) {
+      _nt_capfile_unmap(file, s);
+    }
+  }
+#ifdef _MSC_VER
+  if (file->hMap != NULL) {
+    CloseHandle(file->hMap);
+  }
+#endif
+  free(file->slots);
+  free(file->carry);
+#ifdef _MSC_VER
+  _close(file->fd);
+#else
+  close(file->fd);
+#endif
+  memset(file, 0, sizeof(*file));
+  file->fd = -1;
+}
+
+/*
+ * Map a new window starting at the huge page boundary before "pos" and
+ * make it the current window
+ */
+static NT_INLINE int _nt_capfile_map(NtCapFile_t* file)
+{
+  struct _NtCapFileWindow_s* window = NULL;
+  uint64_t offset = file->pos & ~(uint64_t)(NT_CAPFILE_MAP_ALIGN - 1);
+  uint32_t w;
+  for (w = 0; w < _NT_CAPFILE_WINDOWS; w++) {
+    if (file->windows[w].base == NULL) {
+      window = &file->windows[w];
+      break;
+    }
+  }
+  if (window == NULL) {
+    // All windows hold segments
+    return NT_STATUS_TRYAGAIN;
+  }
+  window->offset = offset;
+  // The window overlaps the next one by the largest packet
+  window->length = file->windowSize + NT_CAPFILE_HEADROOM;
+  if (window->length > file->fileSize - offset) {
+    window->length = file->fileSize - offset;
+  }
+#ifdef _MSC_VER
+  window->base = (uint8_t*)MapViewOfFile(file->hMap, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)window->length);
+  if (window->base == NULL) {
+    return NT_GET_SYSTEM_ERRORS;
+  }
+#else
+  window->base = (uint8_t*)mmap(NULL, window->length, PROT_READ, MAP_SHARED, file->fd, (off_t)offset);
+  if ((void*)window->base == MAP_FAILED) {
+    window->base = NULL;
+    return NT_AIO_ERRNO(errno);
+  }
+#ifdef MADV_SEQUENTIAL
+  (void)madvise(window->base, window->length, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_HUGEPAGE
+  (void)madvise(window->base, window->length, MADV_HUGEPAGE);
+#endif
+#endif
+  // Retire the previous window when no segments are held in it
+  w = file->window;
+  file->window = (uint32_t)(window - file->windows);
+  if (w != file->window && file->windows[w].base != NULL && file->windows[w].refs == 0) {
+    _nt_capfile_unmap(file, w);
+  }
+  file->advised = offset;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE int _nt_capfile_get_mapped(NtCapFile_t* file, NtNetBuf_t* hNetBuf)
+{
+  struct _NtCapFileSlot_s* slot = NULL;
+  struct _NtCapFileWindow_s* window;
+  uint64_t avail, ahead;
+  uint32_t s, used;
+  uint8_t* data;
+  int status, header;
+
+  for (s = 0; s < file->numSlots; s++) {
+    if (file->slots[s].state == _NT_CAPFILE_SLOT_IDLE) {
+      slot = &file->slots[s];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  for (;;) {
+    uint64_t end;
+    if (file->pos >= file->fileSize) {
+      return NT_STATUS_END_OF_FILE;
+    }
+    window = &file->windows[file->window];
+    end = window->base != NULL ? window->offset + window->length : 0;
+    // Move to a new window when the rest of the current one may not hold a whole segment
+    if (window->base == NULL || file->pos < window->offset ||
+        (end < file->fileSize && end - file->pos < (uint64_t)file->blockSize + NT_CAPFILE_HEADROOM)) {
+      if ((status = _nt_capfile_map(file)) != NT_SUCCESS) {
+        return status;
+      }
+      window = &file->windows[file->window];
+      end = window->offset + window->length;
+    }
+    data = window->base + (file->pos - window->offset);
+    avail = end - file->pos < file->blockSize ? end - file->pos : file->blockSize;
+    if ((status = _nt_capfile_scan(file, data, (uint32_t)avail, &used, &header)) != NT_SUCCESS) {
+      return status;
+    }
+    if (used > 0) {
+      break;
+    }
+    if (header && avail >= sizeof(NtFileHeader0_t)) {
+      file->pos += sizeof(NtFileHeader0_t);
+      continue;
+    }
+    if (end == file->fileSize) {
+      // The file ends with a truncated packet
+      file->pos = file->fileSize;
+      return NT_STATUS_END_OF_FILE;
+    }
+    if (avail == file->blockSize) {
+      return NT_ERROR_CAP_FILE_PACKET_TOO_LARGE;
+    }
+  }
+  file->pos += used;
+
+#ifndef _MSC_VER
+  // Advise the part needed by the next segments, one block at a time
+  ahead = file->pos + (uint64_t)file->blockSize * file->numSlots;
+  if (ahead > window->offset + window->length) {
+    ahead = window->offset + window->length;
+  }
+  if (file->advised < ahead) {
+    uint64_t start = file->advised & ~(uint64_t)(NT_AIO_DIRECT_ALIGN - 1);
+#ifdef MADV_WILLNEED
+    (void)madvise(window->base + (start - window->offset), (size_t)(ahead - start), MADV_WILLNEED);
+#else
+    (void)start;
+#endif
+    file->advised = ahead;
+  }
+#else
+  (void)ahead;
+#endif
+
+  if (file->descr == NT_PACKET_DESCRIPTOR_TYPE_UNKNOWN) {
+    struct NtNetBuf_s pktNetBuf;
+    memset(&pktNetBuf, 0, sizeof(pktNetBuf));
+    pktNetBuf.hHdr = (NtNetBufHdr_t)data;
+    file->descr = (enum NtPacketDescriptorType_e)NT_NET_GET_PKT_DESCRIPTOR_TYPE(&pktNetBuf);
+  }
+  file->stat.blocks++;
+  file->stat.bytes += used;
+  window->refs++;
+  slot->window = file->window;
+  _nt_net_initialize_segment_netbuf(used, data, file->header.portOffset, &slot->netBuf);
+  slot->netBuf.netIf = NT_NET_INTERFACE_SEGMENT;
+  slot->netBuf.tsType = (enum NtTimestampType_e)file->header.tsType;
+  slot->netBuf.colorMap = file->header.colorMap;
+  slot->state = _NT_CAPFILE_SLOT_HELD;
+  *hNetBuf = &slot->netBuf;
+  return NT_SUCCESS;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Open a capture file for read-ahead or memory-mapped reading
+ *
+ * @param[out] file    Capture file reader
+ * @param[in]  name    Name of the capture file
+ * @param[in]  config  Reader configuration or NULL for the default configuration
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_NOT_NT_CAPFILE     The file does not start with a file header
+ * @retval NT_ERROR_FILE_EMPTY         The file is empty
+ * @retval otherwise                   Error
+ */
+static NT_INLINE int _nt_capfile_open(NtCapFile_t* file, const char* name, const NtCapFileConfig_t* config)
+{
+  NtCapFileConfig_t cfg;
+  uint32_t s;
+  int status;
+
+  memset(file, 0, sizeof(*file));
+  file->fd = -1;
+  if (config != NULL) {
+    cfg = *config;
+  } else {
+    memset(&cfg, 0, sizeof(cfg));
+  }
+  if (cfg.blockSize == 0) {
+    cfg.blockSize = 4 * 1024 * 1024;
+  }
+  if (cfg.depth == 0) {
+    cfg.depth = 8;
+  }
+  if (cfg.numThreads == 0) {
+    cfg.numThreads = 4;
+  }
+  if (cfg.windowSize == 0) {
+    cfg.windowSize = 1024 * 1024 * 1024;
+  }
+  if (cfg.blockSize < NT_CAPFILE_HEADROOM || (cfg.blockSize % NT_AIO_DIRECT_ALIGN) != 0 ||
+      (cfg.windowSize % NT_CAPFILE_MAP_ALIGN) != 0 || cfg.windowSize < cfg.blockSize) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+
+  // Read the file header with buffered I/O and reopen for direct I/O
+  {
+#ifdef _MSC_VER
+    struct _stat64 st;
+    int fd = _open(name, _O_RDONLY | _O_BINARY);
+    if (fd < 0) {
+      return NT_AIO_ERRNO(errno);
+    }
+    if (_fstat64(fd, &st) != 0) {
+      status = NT_AIO_ERRNO(errno);
+      _close(fd);
+      return status;
+    }
+    if (_read(fd, &file->header, sizeof(file->header)) != sizeof(file->header)) {
+      _close(fd);
+      return st.st_size == 0 ? NT_ERROR_FILE_EMPTY : NT_ERROR_NOT_NT_CAPFILE;
+    }
+#else
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+      return NT_AIO_ERRNO(errno);
+    }
+    if (fstat(fd, &st) != 0) {
+      status = NT_AIO_ERRNO(errno);
+      close(fd);
+      return status;
+    }
+    if (pread(fd, &file->header, sizeof(file->header), 0) != (ssize_t)sizeof(file->header)) {
+      close(fd);
+      return st.st_size == 0 ? NT_ERROR_FILE_EMPTY : NT_ERROR_NOT_NT_CAPFILE;
+    }
+#endif
+    if (file->header.cookie != NT_FILE_HEADER0_COOKIE || file->header.structid != NT_STID_FILE_HEADER0) {
+#ifdef _MSC_VER
+      _close(fd);
+#else
+      close(fd);
+#endif
+      return NT_ERROR_NOT_NT_CAPFILE;
+    }
+    file->fileSize = (uint64_t)st.st_size;
+    if (cfg.length != 0 && cfg.length < file->fileSize) {
+      file->fileSize = cfg.length;
+    }
+    file->fd = fd;
+#ifdef _NT_AIO_O_DIRECT
+    if (cfg.direct && !cfg.mapped) {
+      int dfd = open(name, O_RDONLY | _NT_AIO_O_DIRECT);
+      // Not all file systems support direct I/O
+      if (dfd >= 0) {
+        close(fd);
+        file->fd = dfd;
+        file->direct = 1;
+      }
+    }
+#endif
+  }
+
+  file->blockSize = cfg.blockSize;
+  file->numBlocks = (file->fileSize + cfg.blockSize - 1) / cfg.blockSize;
+  file->numSlots = cfg.depth;
+  file->slots = (struct _NtCapFileSlot_s*)calloc(cfg.depth, sizeof(struct _NtCapFileSlot_s));
+  if (file->slots == NULL) {
+    _nt_capfile_free(file);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  file->descr = NT_PACKET_DESCRIPTOR_TYPE_UNKNOWN;
+  file->stat.depth = cfg.depth;
+  if (cfg.mapped) {
+    file->mapped = 1;
+    file->stat.mapped = 1;
+    file->windowSize = cfg.windowSize;
+    file->pos = sizeof(NtFileHeader0_t);
+#ifdef _MSC_VER
+    file->hMap = CreateFileMapping((HANDLE)_get_osfhandle(file->fd), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (file->hMap == NULL) {
+      status = NT_GET_SYSTEM_ERRORS;
+      _nt_capfile_free(file);
+      return status;
+    }
+#endif
+    return NT_SUCCESS;
+  }
+  file->carry = (uint8_t*)malloc(NT_CAPFILE_HEADROOM);
+  if (file->carry == NULL) {
+    _nt_capfile_free(file);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (s = 0; s < cfg.depth; s++) {
+    if ((file->slots[s].buf = (uint8_t*)_nt_aio_alloc((size_t)NT_CAPFILE_HEADROOM + cfg.blockSize)) == NULL) {
+      _nt_capfile_free(file);
+      return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+  }
+  if ((status = _nt_aio_open(&file->aio, file->fd, cfg.backend, cfg.depth, cfg.numThreads)) != NT_SUCCESS) {
+    _nt_capfile_free(file);
+    return status;
+  }
+  file->skip = sizeof(NtFileHeader0_t);
+  file->stat.backend = file->aio.backend;
+  file->stat.direct = file->direct;
+  if ((status = _nt_capfile_fill(file)) != NT_SUCCESS) {
+    _nt_aio_close(&file->aio);
+    _nt_capfile_free(file);
+    return status;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Close a capture file reader
+ *
+ * @param[in] file  Capture file reader
+ */
+static NT_INLINE void _nt_capfile_close(NtCapFile_t* file)
+{
+  if (!file->mapped) {
+    _nt_aio_close(&file->aio);
+  }
+  _nt_capfile_free(file);
+}
+
+/**
+ * @brief Get the next segment from a capture file
+ *
+ * The segment stays valid until it is released with @ref _nt_capfile_release.
+ * Segments can be held and released in any order - while a segment is held
+ * its buffer is not used for read-ahead.
+ *
+ * @param[in]  file     Capture file reader
+ * @param[out] hNetBuf  Segment container reference
+ *
+ * @retval NT_SUCCESS              Success
+ * @retval NT_STATUS_END_OF_FILE   No more data in the file
+ * @retval NT_STATUS_TRYAGAIN      All buffers are held - release a segment
+ * @retval otherwise               Error
+ */
+static NT_INLINE int _nt_capfile_get(NtCapFile_t* file, NtNetBuf_t* hNetBuf)
+{
+  if (file->mapped) {
+    return _nt_capfile_get_mapped(file, hNetBuf);
+  }
+  for (;;) {
+    struct _NtCapFileSlot_s* slot;
+    uint8_t* data;
+    uint32_t length, used;
+    int status, header;
+
+    if (file->nextDeliver == file->numBlocks) {
+      return NT_STATUS_END_OF_FILE;
+    }
+    slot = &file->slots[file->nextDeliver % file->numSlots];
+    if (slot->state == _NT_CAPFILE_SLOT_IDLE && (status = _nt_capfile_fill(file)) != NT_SUCCESS) {
+      return status;
+    }
+    // The buffer is still held by an earlier segment
+    if (slot->state == _NT_CAPFILE_SLOT_HELD || slot->state == _NT_CAPFILE_SLOT_IDLE) {
+      return NT_STATUS_TRYAGAIN;
+    }
+    // Collect completed reads and wait if the next block is not resident yet
+    while (slot->state != _NT_CAPFILE_SLOT_READY) {
+      NtAioReq_t* req;
+      if (_nt_aio_wait(&file->aio, &req, 0) != NT_SUCCESS) {
+        uint64_t start = _nt_compat_now_ns();
+        file->stat.stalls++;
+        status = _nt_aio_wait(&file->aio, &req, 1);
+        file->stat.stallNs += _nt_compat_now_ns() - start;
+        if (status != NT_SUCCESS) {
+          return NT_ERROR_RESOURCE_UNAVAILABLE;
+        }
+      }
+      if ((status = _nt_capfile_complete(file, req)) != NT_SUCCESS) {
+        return status;
+      }
+    }
+    file->nextDeliver++;
+
+    data = slot->buf + NT_CAPFILE_HEADROOM;
+    length = slot->filled;
+    if (file->skip > 0) {
+      uint32_t skip = file->skip < length ? file->skip : length;
+      data += skip;
+      length -= skip;
+      file->skip = 0;
+    }
+    // Put the carried part of a packet in front of the block
+    data -= file->carryLen;
+    memcpy(data, file->carry, file->carryLen);
+    length += file->carryLen;
+    if ((status = _nt_capfile_scan(file, data, length, &used, &header)) != NT_SUCCESS) {
+      return status;
+    }
+    // Remove file headers by moving the packets in front of them forward
+    while (header && length - used >= sizeof(NtFileHeader0_t)) {
+      uint32_t more;
+      memmove(data + sizeof(NtFileHeader0_t), data, used);
+      data += sizeof(NtFileHeader0_t);
+      length -= (uint32_t)sizeof(NtFileHeader0_t);
+      if ((status = _nt_capfile_scan(file, data + used, length - used, &more, &header)) != NT_SUCCESS) {
+        return status;
+      }
+      used += more;
+    }
+    if (length - used > NT_CAPFILE_HEADROOM) {
+      return NT_ERROR_CAP_FILE_PACKET_TOO_LARGE;
+    }
+    file->carryLen = length - used;
+    memcpy(file->carry, data + used, file->carryLen);
+
+    if (used == 0) {
+      slot->state = _NT_CAPFILE_SLOT_IDLE;
+      if ((status = _nt_capfile_fill(file)) != NT_SUCCESS) {
+        return status;
+      }
+      continue;
+    }
+    if (file->descr == NT_PACKET_DESCRIPTOR_TYPE_UNKNOWN) {
+      struct NtNetBuf_s pktNetBuf;
+      memset(&pktNetBuf, 0, sizeof(pktNetBuf));
+      pktNetBuf.hHdr = (NtNetBufHdr_t)data;
+      file->descr = (enum NtPacketDescriptorType_e)NT_NET_GET_PKT_DESCRIPTOR_TYPE(&pktNetBuf);
+    }
+    _nt_net_initialize_segment_netbuf(used, data, file->header.portOffset, &slot->netBuf);
+    slot->netBuf.netIf = NT_NET_INTERFACE_SEGMENT;
+    slot->netBuf.tsType = (enum NtTimestampType_e)file->header.tsType;
+    slot->netBuf.colorMap = file->header.colorMap;
+    slot->state = _NT_CAPFILE_SLOT_HELD;
+    *hNetBuf = &slot->netBuf;
+    return NT_SUCCESS;
+  }
+}
+
+/**
+ * @brief Release a segment returned by @ref _nt_capfile_get
+ *
+ * The buffer of the segment is used to read ahead again.
+ *
+ * @param[in] file     Capture file reader
+ * @param[in] hNetBuf  Segment container reference
+ *
+ * @retval NT_SUCCESS   Success
+ * @retval otherwise    Error
+ */
+static NT_INLINE int _nt_capfile_release(NtCapFile_t* file, NtNetBuf_t hNetBuf)
+{
+  struct _NtCapFileSlot_s* slot = (struct _NtCapFileSlot_s*)hNetBuf;
+  if (slot < file->slots || slot >= file->slots + file->numSlots || slot->state != _NT_CAPFILE_SLOT_HELD) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  slot->state = _NT_CAPFILE_SLOT_IDLE;
+  if (file->mapped) {
+    // Unmap a retired window when its last segment is released
+    if (--file->windows[slot->window].refs == 0 && slot->window != file->window) {
+      _nt_capfile_unmap(file, slot->window);
+    }
+    return NT_SUCCESS;
+  }
+  return _nt_capfile_fill(file);
+}
+
+/**
+ * @brief Move a capture file reader to a file offset
+ *
+ * Segment delivery resumes at the offset. The offset must be the offset of
+ * a packet or a file header, e.g. found with a capture file index. All
+ * segments must be released before the reader is moved.
+ *
+ * @param[in] file    Capture file reader
+ * @param[in] offset  File offset
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_TRYAGAIN          Segments are held
+ * @retval NT_ERROR_INVALID_PARAMETER  The offset is outside the file
+ * @retval otherwise                   Error
+ */
+static NT_INLINE int _nt_capfile_seek(NtCapFile_t* file, uint64_t offset)
+{
+  NtAioReq_t* req;
+  uint32_t s;
+  for (s = 0; s < file->numSlots; s++) {
+    if (file->slots[s].state == _NT_CAPFILE_SLOT_HELD) {
+      return NT_STATUS_TRYAGAIN;
+    }
+  }
+  if (offset < sizeof(NtFileHeader0_t) || offset > file->fileSize) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (file->mapped) {
+    file->pos = offset;
+    return NT_SUCCESS;
+  }
+  // Wait for the reads in flight and discard their data
+  while (_nt_aio_wait(&file->aio, &req, 1) == NT_SUCCESS) {
+  }
+  for (s = 0; s < file->numSlots; s++) {
+    file->slots[s].state = _NT_CAPFILE_SLOT_IDLE;
+  }
+  file->nextSubmit = offset / file->blockSize;
+  file->nextDeliver = file->nextSubmit;
+  file->skip = (uint32_t)(offset % file->blockSize);
+  file->carryLen = 0;
+  return _nt_capfile_fill(file);
+}
+
+/**
+ * @brief Read information from a capture file reader
+ *
+ * @param[in]     file  Capture file reader
+ * @param[in,out] data  Read structure with the command set
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Unknown command
+ */
+static NT_INLINE int _nt_capfile_read(NtCapFile_t* file, NtCapFileRead_t* data)
+{
+  switch (data->cmd) {
+  case NT_CAPFILE_READ_INFO_CMD:
+    data->u.info_v1 = file->info;
+    return NT_SUCCESS;
+  case NT_CAPFILE_READ_DESCRIPTOR_CMD:
+    data->u.desc.tsType = (enum NtTimestampType_e)file->header.tsType;
+    data->u.desc.desc = file->descr;
+    return NT_SUCCESS;
+  case NT_CAPFILE_READ_AIO_CMD:
+    data->u.aio = file->stat;
+    data->u.aio.queueDepth = file->aio.outstanding;
+    return NT_SUCCESS;
+  default:
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+}
+
+#endif // __CAPFILE_H__
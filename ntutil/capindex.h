@@ -0,0 +1,664 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the capture file index. The index is a sparse
+ * list of time stamp to file offset entries, one per "interval" bytes of
+ * packet data, and the offsets of all file headers in the capture file.
+ * It is stored in a sidecar file next to the capture file, named as the
+ * capture file with @ref NT_CAPINDEX_SUFFIX appended.
+ *
+ * The index can be built while capturing with @ref _nt_capindex_add_packet
+ * and @ref _nt_capindex_add_header, or it is built on the first call to
+ * @ref _nt_capindex_open. @ref _nt_capfile_seek_time finds the first
+ * packet at or after a time stamp with a binary search of the index and a
+ * scan of at most one interval, and moves a capture file reader there.
+ *
+ * Sidecar file layout (native byte order):
+ *
+ *     NtCapIndexFileHeader_t
+ *     NtCapIndexEntry_t   entries[numEntries]
+ *     uint64_t            headers[numHeaders]
+ *
+ */
+#ifndef __CAPINDEX_H__
+#define __CAPINDEX_H__
+
+#include "nt.h"
+#include "capfile.h"
+
+/**
+ * Suffix added to the capture file name to get the index file name
+ */
+#define NT_CAPINDEX_SUFFIX ".ntidx"
+
+/**
+ * Index file magic - "NTCAPIDX"
+ */
+#define NT_CAPINDEX_MAGIC 0x584449504143544EULL
+
+/**
+ * Index file version
+ */
+#define NT_CAPINDEX_VERSION 2
+
+/**
+ * Default number of bytes of packet data between index entries
+ */
+#define NT_CAPINDEX_INTERVAL (1024 * 1024)
+
+// Ensure that the following is packed equally on 32 and 64bit
+#pragma pack(push, 1)
+/**
+ * Index file header
+ */
+typedef struct NtCapIndexFileHeader_s {
+  uint64_t magic;           //!< @ref NT_CAPINDEX_MAGIC
+  uint32_t version;         //!< @ref NT_CAPINDEX_VERSION
+  uint32_t interval;        //!< Bytes of packet data between entries
+  uint64_t scanned;         //!< Capture file offset up to which the index is complete
+  uint64_t numEntries;      //!< Number of entries
+  uint64_t numHeaders;      //!< Number of file headers
+  uint64_t maxTimestamp;    //!< Highest time stamp of the indexed packets
+  uint64_t fileSize;        //!< Size of the capture file when the index was saved. 0 if unknown
+  int64_t fileMtime;        //!< Modification time of the capture file when the index was saved
+  uint64_t fileHash;        //!< Hash of the first block and the block ending at "scanned" of the capture file
+} NtCapIndexFileHeader_t;
+
+/**
+ * Index entry
+ */
+typedef struct NtCapIndexEntry_s {
+  uint64_t timestamp;       //!< Highest time stamp of all packets before the offset
+  uint64_t offset;          //!< Capture file offset of a packet
+} NtCapIndexEntry_t;
+#pragma pack(pop)
+
+/**
+ * Capture file index
+ */
+typedef struct NtCapIndex_s {
+  uint32_t interval;        //!< Bytes of packet data between entries
+  uint64_t scanned;         //!< Capture file offset up to which the index is complete
+  uint64_t maxTimestamp;    //!< Highest time stamp of the indexed packets
+  uint64_t numEntries;      //!< Number of entries
+  NtCapIndexEntry_t *entries; //!< Entries sorted by offset - the time stamps never decrease
+  uint64_t numHeaders;      //!< Number of file headers
+  uint64_t *headers;        //!< File offsets of the file headers
+  uint64_t fileSize;        //!< Size of the capture file when the index was saved or loaded. 0 if unknown
+  int64_t fileMtime;        //!< Modification time of the capture file when the index was saved or loaded
+  uint64_t fileHash;        //!< Hash of the first block and the block ending at "scanned" of the capture file
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint64_t entryCapacity;
+  uint64_t headerCapacity;
+  uint64_t nextEntry;       // Offset from which the next entry is added
+  int fd;                   // Capture file - buffered, used to scan
+#endif
+} NtCapIndex_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Size of the chunks read when scanning the capture file
+ */
+#define _NT_CAPINDEX_CHUNK (4 * 1024 * 1024)
+#define _NT_CAPINDEX_SEARCH_CHUNK (256 * 1024)
+/*
+ * Size of the capture file blocks hashed to identify the capture file
+ */
+#define _NT_CAPINDEX_HASH_BLOCK 4096
+
+static NT_INLINE int _nt_capindex_grow(void** array, uint64_t* capacity, uint64_t count, size_t size)
+{
+  void* mem;
+  if (count < *capacity) {
+    return NT_SUCCESS;
+  }
+  mem = realloc(*array, (size_t)(*capacity ? *capacity * 2 : 1024) * size);
+  if (mem == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  *array = mem;
+  *capacity = *capacity ? *capacity * 2 : 1024;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE int _nt_capindex_read(int fd, void* buf, uint32_t length, uint64_t offset, uint32_t* done)
+{
+  NtAioReq_t req;
+  memset(&req, 0, sizeof(req));
+  req.op = NT_AIO_OP_READ;
+  req.buf = buf;
+  req.length = length;
+  req.offset = offset;
+  req.result = _nt_aio_do(fd, &req);
+  if (req.result < 0) {
+    return NT_AIO_ERRNO(-req.result);
+  }
+  *done = (uint32_t)req.result;
+  return NT_SUCCESS;
+}
+
+static NT_INLINE int _nt_capindex_open_fd(const char* name, int* fd)
+{
+#ifdef _MSC_VER
+  *fd = _open(name, _O_RDONLY | _O_BINARY);
+#else
+  *fd = open(name, O_RDONLY);
+#endif
+  return *fd < 0 ? NT_AIO_ERRNO(errno) : NT_SUCCESS;
+}
+
+static NT_INLINE void _nt_capindex_close_fd(int fd)
+{
+#ifdef _MSC_VER
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+/*
+ * Get the size and modification time of the capture file and hash its
+ * first block and the block ending at "scanned". Appending to the capture
+ * file changes neither block, so an index of a growing capture file stays
+ * valid, while a capture file replaced by another one is detected even if
+ * the size and the modification time happen to match.
+ */
+static NT_INLINE int _nt_capindex_identify(int fd, uint64_t scanned, uint64_t* size, int64_t* mtime, uint64_t* hash)
+{
+  uint8_t buf[_NT_CAPINDEX_HASH_BLOCK];
+  uint64_t offset[2];
+  uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+  uint32_t length, done, i, j;
+  int status;
+#ifdef _MSC_VER
+  struct _stat64 st;
+  if (_fstat64(fd, &st) != 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+#else
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+#endif
+  *size = (uint64_t)st.st_size;
+  *mtime = (int64_t)st.st_mtime;
+  length = scanned < _NT_CAPINDEX_HASH_BLOCK ? (uint32_t)scanned : _NT_CAPINDEX_HASH_BLOCK;
+  offset[0] = 0;
+  offset[1] = scanned - length;
+  for (i = 0; i < 2 && length > 0; i++) {
+    if ((status = _nt_capindex_read(fd, buf, length, offset[i], &done)) != NT_SUCCESS) {
+      return status;
+    }
+    if (done != length) {
+      // The capture file is shorter than the index - cannot match
+      *hash = ~h;
+      return NT_SUCCESS;
+    }
+    for (j = 0; j < length; j++) {
+      h = (h ^ buf[j]) * 0x100000001b3ULL;
+    }
+  }
+  *hash = h;
+  return NT_SUCCESS;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Initialize an empty capture file index
+ *
+ * @param[out] idx       Capture file index
+ * @param[in]  interval  Bytes of packet data between entries. 0 selects @ref NT_CAPINDEX_INTERVAL
+ */
+static NT_INLINE void _nt_capindex_init(NtCapIndex_t* idx, uint32_t interval)
+{
+  memset(idx, 0, sizeof(*idx));
+  idx->interval = interval ? interval : NT_CAPINDEX_INTERVAL;
+  idx->fd = -1;
+}
+
+/**
+ * @brief Free a capture file index
+ *
+ * @param[in] idx  Capture file index
+ */
+static NT_INLINE void _nt_capindex_close(NtCapIndex_t* idx)
+{
+  if (idx->fd >= 0) {
+    _nt_capindex_close_fd(idx->fd);
+  }
+  free(idx->entries);
+  free(idx->headers);
+  memset(idx, 0, sizeof(*idx));
+  idx->fd = -1;
+}
+
+/**
+ * @brief Add a packet to the index
+ *
+ * Packets must be added in file order. An entry is added when at least
+ * "interval" bytes have passed since the last entry.
+ *
+ * @param[in] idx        Capture file index
+ * @param[in] offset     Capture file offset of the packet
+ * @param[in] timestamp  Packet time stamp
+ * @param[in] length     Stored length of the packet including the descriptor
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_capindex_add_packet(NtCapIndex_t* idx, uint64_t offset, uint64_t timestamp, uint32_t length)
+{
+  if (offset >= idx->nextEntry) {
+    int status = _nt_capindex_grow((void**)&idx->entries, &idx->entryCapacity, idx->numEntries, sizeof(NtCapIndexEntry_t));
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+    idx->entries[idx->numEntries].timestamp = idx->maxTimestamp;
+    idx->entries[idx->numEntries].offset = offset;
+    idx->numEntries++;
+    idx->nextEntry = offset + idx->interval;
+  }
+  if (timestamp > idx->maxTimestamp) {
+    idx->maxTimestamp = timestamp;
+  }
+  idx->scanned = offset + length;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Add a file header to the index
+ *
+ * @param[in] idx     Capture file index
+ * @param[in] offset  Capture file offset of the file header
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_capindex_add_header(NtCapIndex_t* idx, uint64_t offset)
+{
+  int status = _nt_capindex_grow((void**)&idx->headers, &idx->headerCapacity, idx->numHeaders, sizeof(uint64_t));
+  if (status != NT_SUCCESS) {
+    return status;
+  }
+  idx->headers[idx->numHeaders++] = offset;
+  idx->scanned = offset + sizeof(NtFileHeader0_t);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Add all packets of a segment written to a capture file
+ *
+ * @param[in] idx        Capture file index
+ * @param[in] offset     Capture file offset where the segment is written
+ * @param[in] segNetBuf  Segment NtNetBuf_s * structure
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_capindex_add_segment(NtCapIndex_t* idx, uint64_t offset, struct NtNetBuf_s* segNetBuf)
+{
+  struct NtNetBuf_s pktNetBuf;
+  uint64_t segLength = NT_NET_GET_SEGMENT_LENGTH(segNetBuf);
+  if (segLength == 0) {
+    return NT_SUCCESS;
+  }
+  _nt_net_build_pkt_netbuf(segNetBuf, &pktNetBuf);
+  do {
+    uint64_t pktOffset = offset + (uint64_t)((uint8_t*)pktNetBuf.hHdr - (uint8_t*)segNetBuf->hHdr);
+    int status = _nt_capindex_add_packet(idx, pktOffset, _nt_capfile_pkt_timestamp((const uint8_t*)pktNetBuf.hHdr),
+                                         NT_NET_GET_PKT_CAP_LENGTH(&pktNetBuf));
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+  } while (_nt_net_get_next_packet(segNetBuf, segLength, &pktNetBuf) > 0);
+  return NT_SUCCESS;
+}
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Walk the packets of a capture file from "offset". When "idx" is set all
+ * packets and file headers are added to the index. Otherwise the walk stops
+ * at the first packet with a time stamp at or after "target".
+ */
+static NT_INLINE int _nt_capindex_walk(int fd, uint64_t offset, NtCapIndex_t* idx, uint64_t target, uint64_t* found)
+{
+  struct NtNetBuf_s pktNetBuf;
+  // A search normally ends within one interval
+  uint32_t chunk = idx == NULL ? _NT_CAPINDEX_SEARCH_CHUNK : _NT_CAPINDEX_CHUNK;
+  uint8_t* buf = (uint8_t*)malloc(chunk);
+  int status = NT_SUCCESS;
+  if (buf == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  memset(&pktNetBuf, 0, sizeof(pktNetBuf));
+  for (;;) {
+    uint32_t length, pos = 0;
+    if ((status = _nt_capindex_read(fd, buf, chunk, offset, &length)) != NT_SUCCESS) {
+      break;
+    }
+    while (length - pos >= sizeof(NtStd0Descr_t)) {
+      uint32_t capLength;
+      if (_nt_capfile_is_header(buf + pos)) {
+        if (length - pos < sizeof(NtFileHeader0_t)) {
+          break;
+        }
+        if (idx != NULL && (status = _nt_capindex_add_header(idx, offset + pos)) != NT_SUCCESS) {
+          goto done;
+        }
+        pos += sizeof(NtFileHeader0_t);
+        continue;
+      }
+      pktNetBuf.hHdr = (NtNetBufHdr_t)(buf + pos);
+      capLength = NT_NET_GET_PKT_CAP_LENGTH(&pktNetBuf);
+      if (capLength < sizeof(NtDynDescr_t)) {
+        status = NT_ERROR_CAP_FILE_STORED_LENGTH_INVALID;
+        goto done;
+      }
+      if (capLength > length - pos) {
+        break;
+      }
+      if (idx != NULL) {
+        if ((status = _nt_capindex_add_packet(idx, offset + pos, _nt_capfile_pkt_timestamp(buf + pos), capLength)) != NT_SUCCESS) {
+          goto done;
+        }
+      } else if (_nt_capfile_pkt_timestamp(buf + pos) >= target) {
+        *found = offset + pos;
+        goto done;
+      }
+      pos += capLength;
+    }
+    // Read again from the first packet not handled
+    if (length < chunk) {
+      *found = offset + pos;
+      break;
+    }
+    offset += pos;
+  }
+done:
+  free(buf);
+  return status;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Save a capture file index in an index file
+ *
+ * The size, modification time and hash of the capture file are stored in
+ * the index file so @ref _nt_capindex_open can detect a stale index. If the
+ * index does not know them, e.g. because it was built while capturing,
+ * they are taken from the capture file named as the index file without
+ * @ref NT_CAPINDEX_SUFFIX. If that fails they are stored as unknown and the
+ * index is rebuilt when it is opened.
+ *
+ * @param[in] idx   Capture file index
+ * @param[in] name  Name of the index file
+ *
+ * @retval NT_SUCCESS   Success
+ * @retval otherwise    Error
+ */
+static NT_INLINE int _nt_capindex_save(const NtCapIndex_t* idx, const char* name)
+{
+  NtCapIndexFileHeader_t hdr;
+  FILE* f;
+  int ok;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.fileSize = idx->fileSize;
+  hdr.fileMtime = idx->fileMtime;
+  hdr.fileHash = idx->fileHash;
+  if (hdr.fileSize == 0) {
+    size_t len = strlen(name);
+    size_t suffixLen = sizeof(NT_CAPINDEX_SUFFIX) - 1;
+    char* capName;
+    int fd;
+    if (len > suffixLen && strcmp(name + len - suffixLen, NT_CAPINDEX_SUFFIX) == 0 &&
+        (capName = (char*)malloc(len - suffixLen + 1)) != NULL) {
+      memcpy(capName, name, len - suffixLen);
+      capName[len - suffixLen] = '\0';
+      if (_nt_capindex_open_fd(capName, &fd) == NT_SUCCESS) {
+        if (_nt_capindex_identify(fd, idx->scanned, &hdr.fileSize, &hdr.fileMtime, &hdr.fileHash) != NT_SUCCESS) {
+          hdr.fileSize = 0;
+        }
+        _nt_capindex_close_fd(fd);
+      }
+      free(capName);
+    }
+  }
+  if ((f = fopen(name, "wb")) == NULL) {
+    return NT_AIO_ERRNO(errno);
+  }
+  hdr.magic = NT_CAPINDEX_MAGIC;
+  hdr.version = NT_CAPINDEX_VERSION;
+  hdr.interval = idx->interval;
+  hdr.scanned = idx->scanned;
+  hdr.numEntries = idx->numEntries;
+  hdr.numHeaders = idx->numHeaders;
+  hdr.maxTimestamp = idx->maxTimestamp;
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+       fwrite(idx->entries, sizeof(NtCapIndexEntry_t), (size_t)idx->numEntries, f) == (size_t)idx->numEntries &&
+       fwrite(idx->headers, sizeof(uint64_t), (size_t)idx->numHeaders, f) == (size_t)idx->numHeaders;
+  if (fclose(f) != 0) {
+    ok = 0;
+  }
+  return ok ? NT_SUCCESS : NT_AIO_ERRNO(errno);
+}
+
+/**
+ * @brief Load a capture file index from an index file
+ *
+ * @param[out] idx   Capture file index
+ * @param[in]  name  Name of the index file
+ *
+ * @retval NT_SUCCESS                       Success
+ * @retval NT_ERROR_CAP_FILE_NOT_RECOGNIZED The file is not an index file
+ * @retval otherwise                        Error
+ */
+static NT_INLINE int _nt_capindex_load(NtCapIndex_t* idx, const char* name)
+{
+  NtCapIndexFileHeader_t hdr;
+  FILE* f = fopen(name, "rb");
+  int status = NT_SUCCESS;
+  if (f == NULL) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != NT_CAPINDEX_MAGIC || hdr.version != NT_CAPINDEX_VERSION || hdr.interval == 0) {
+    fclose(f);
+    return NT_ERROR_CAP_FILE_NOT_RECOGNIZED;
+  }
+  _nt_capindex_init(idx, hdr.interval);
+  idx->scanned = hdr.scanned;
+  idx->maxTimestamp = hdr.maxTimestamp;
+  idx->fileSize = hdr.fileSize;
+  idx->fileMtime = hdr.fileMtime;
+  idx->fileHash = hdr.fileHash;
+  idx->entryCapacity = hdr.numEntries;
+  idx->headerCapacity = hdr.numHeaders;
+  idx->entries = (NtCapIndexEntry_t*)malloc((size_t)(hdr.numEntries ? hdr.numEntries : 1) * sizeof(NtCapIndexEntry_t));
+  idx->headers = (uint64_t*)malloc((size_t)(hdr.numHeaders ? hdr.numHeaders : 1) * sizeof(uint64_t));
+  if (idx->entries == NULL || idx->headers == NULL) {
+    status = NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  } else if (fread(idx->entries, sizeof(NtCapIndexEntry_t), (size_t)hdr.numEntries, f) != (size_t)hdr.numEntries ||
+             fread(idx->headers, sizeof(uint64_t), (size_t)hdr.numHeaders, f) != (size_t)hdr.numHeaders) {
+    status = NT_ERROR_CAP_FILE_CORRUPTED_ERROR;
+  }
+  fclose(f);
+  if (status != NT_SUCCESS) {
+    _nt_capindex_close(idx);
+    return status;
+  }
+  idx->numEntries = hdr.numEntries;
+  idx->numHeaders = hdr.numHeaders;
+  idx->nextEntry = idx->numEntries ? idx->entries[idx->numEntries - 1].offset + idx->interval : 0;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Open the index of a capture file
+ *
+ * The index file is loaded if it exists. It is stale, and the capture file
+ * is indexed from the start, if the capture file is shorter than the index
+ * file says, has the same size but another modification time, or the hash
+ * of its first block and the block ending where the index ends differs.
+ * If the index file does not exist, is stale, or does not cover the whole
+ * capture file because the capture file has grown, the capture file is
+ * scanned and the index file is written. Failing to write the index file is
+ * not an error.
+ *
+ * @param[out] idx       Capture file index
+ * @param[in]  name      Name of the capture file
+ * @param[in]  interval  Bytes of packet data between entries when the index is built. 0 selects @ref NT_CAPINDEX_INTERVAL
+ *
+ * @retval NT_SUCCESS   Success
+ * @retval otherwise    Error
+ */
+static NT_INLINE int _nt_capindex_open(NtCapIndex_t* idx, const char* name, uint32_t interval)
+{
+  size_t len = strlen(name);
+  char* idxName = (char*)malloc(len + sizeof(NT_CAPINDEX_SUFFIX));
+  NtFileHeader0_t header;
+  uint64_t fileEnd = 0;
+  uint32_t done;
+  int fd, status;
+
+  if (idxName == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  memcpy(idxName, name, len);
+  memcpy(idxName + len, NT_CAPINDEX_SUFFIX, sizeof(NT_CAPINDEX_SUFFIX));
+
+  if ((status = _nt_capindex_open_fd(name, &fd)) != NT_SUCCESS) {
+    free(idxName);
+    return status;
+  }
+  if ((status = _nt_capindex_read(fd, &header, sizeof(header), 0, &done)) != NT_SUCCESS ||
+      done != sizeof(header) || !_nt_capfile_is_header((const uint8_t*)&header)) {
+    _nt_capindex_close_fd(fd);
+    free(idxName);
+    return status != NT_SUCCESS ? status : NT_ERROR_NOT_NT_CAPFILE;
+  }
+
+  _nt_capindex_init(idx, interval);
+  if (_nt_capindex_load(idx, idxName) == NT_SUCCESS) {
+    uint64_t size, hash;
+    int64_t mtime;
+    // Only an appended capture file keeps the index valid
+    if (idx->fileSize == 0 ||
+        _nt_capindex_identify(fd, idx->scanned, &size, &mtime, &hash) != NT_SUCCESS ||
+        size < idx->fileSize || size < idx->scanned ||
+        (size == idx->fileSize && mtime != idx->fileMtime) ||
+        hash != idx->fileHash) {
+      _nt_capindex_close(idx);
+      _nt_capindex_init(idx, interval);
+    }
+  }
+  idx->fd = fd;
+  // Index the part of the capture file not covered by the index file
+  {
+    uint64_t scanned = idx->scanned;
+    if ((status = _nt_capindex_walk(fd, scanned, idx, 0, &fileEnd)) != NT_SUCCESS) {
+      _nt_capindex_close(idx);
+      free(idxName);
+      return status;
+    }
+    if (idx->scanned != scanned &&
+        _nt_capindex_identify(fd, idx->scanned, &idx->fileSize, &idx->fileMtime, &idx->fileHash) == NT_SUCCESS) {
+      (void)_nt_capindex_save(idx, idxName);
+    }
+  }
+  free(idxName);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Find the index entry to start a search for a time stamp
+ *
+ * @param[in] idx        Capture file index
+ * @param[in] timestamp  Time stamp in the time stamp format of the capture file
+ *
+ * @retval Capture file offset of the last entry with no packets at or after the time stamp before it
+ */
+static NT_INLINE uint64_t _nt_capindex_lookup(const NtCapIndex_t* idx, uint64_t timestamp)
+{
+  uint64_t lo = 0, hi = idx->numEntries;
+  if (idx->numEntries == 0) {
+    return sizeof(NtFileHeader0_t);
+  }
+  // Find the first entry with a time stamp at or after the target
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].timestamp < timestamp) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return idx->entries[lo > 0 ? lo - 1 : 0].offset;
+}
+
+/**
+ * @brief Move a capture file reader to the first packet at or after a time stamp
+ *
+ * @param[in] file       Capture file reader
+ * @param[in] idx        Index of the capture file opened with @ref _nt_capindex_open
+ * @param[in] timestamp  Time stamp in the time stamp format of the capture file
+ *
+ * @retval NT_SUCCESS          Success - the next segment starts with the packet
+ * @retval NT_STATUS_TRYAGAIN  Segments are held by the reader
+ * @retval otherwise           Error
+ */
+static NT_INLINE int _nt_capfile_seek_time(NtCapFile_t* file, const NtCapIndex_t* idx, uint64_t timestamp)
+{
+  uint64_t offset = _nt_capindex_lookup(idx, timestamp);
+  if (idx->fd >= 0) {
+    int status = _nt_capindex_walk(idx->fd, offset, NULL, timestamp, &offset);
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+  }
+  return _nt_capfile_seek(file, offset);
+}
+
+#endif // __CAPINDEX_H__
@@ -0,0 +1,905 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains ring buffer capture with rolling retention.
+ * A fixed ring of capture files is allocated once and overwritten
+ * cyclically, so the last numFiles x fileSize bytes of traffic are always
+ * kept. No files are created, deleted, truncated or extended while
+ * capturing. Moving to the next file only rewrites the small header of its
+ * index, and after the first cycle the data is written over allocated
+ * blocks, so the file system has no allocations to do either.
+ *
+ * Every capture file has an index file next to it, named as the capture
+ * file with @ref NT_CAPRING_INDEX_SUFFIX appended, which is also allocated
+ * once. It holds the generation of the file - the number of files written
+ * before it plus one - the valid length of the file, the time stamps of the
+ * first and last segments and a time stamp entry per "interval" bytes,
+ * from @ref NT_NET_GET_SEGMENT_TIMESTAMP. The index is kept in memory as
+ * well, so the time covered by the ring is known at once with
+ * @ref _nt_capring_get_coverage.
+ *
+ * The files are written with the direct capture writer of capwrite.h. The
+ * ring continues after the newest file when it is opened again.
+ * @ref _nt_capring_reader_open reads the ring back oldest file first, and
+ * @ref _nt_capring_reader_seek_time moves to a time stamp.
+ *
+ * Index file layout (native byte order):
+ *
+ *     NtCapRingIndexHeader_t
+ *     NtCapIndexEntry_t       entries[maxEntries]
+ *
+ */
+#ifndef __CAPRING_H__
+#define __CAPRING_H__
+
+#include "nt.h"
+#include "capfile.h"
+#include "capindex.h"
+#include "capwrite.h"
+#include "compat.h"
+
+#include <stdio.h>
+#ifdef _MSC_VER
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Suffix added to the capture file name to get the index file name
+ */
+#define NT_CAPRING_INDEX_SUFFIX ".ntridx"
+
+/**
+ * Index file magic - "NTRINGIX"
+ */
+#define NT_CAPRING_INDEX_MAGIC 0x5849474E4952544EULL
+
+/**
+ * Index file version
+ */
+#define NT_CAPRING_INDEX_VERSION 1
+
+/**
+ * Maximum length of a file name
+ */
+#define NT_CAPRING_MAX_PATH 1024
+
+// Ensure that the following is packed equally on 32 and 64bit
+#pragma pack(push, 1)
+/**
+ * Index file header
+ */
+typedef struct NtCapRingIndexHeader_s {
+  uint64_t magic;           //!< @ref NT_CAPRING_INDEX_MAGIC
+  uint32_t version;         //!< @ref NT_CAPRING_INDEX_VERSION
+  uint32_t file;            //!< Number of the file in the ring
+  uint64_t generation;      //!< Files written before this one plus one - 0 if the file holds no data
+  uint64_t length;          //!< Valid bytes of the capture file including the file header
+  uint64_t firstTs;         //!< Time stamp of the first segment
+  uint64_t lastTs;          //!< Time stamp of the last segment
+  uint32_t interval;        //!< Bytes of segment data between entries
+  uint32_t numEntries;      //!< Number of entries
+  uint32_t maxEntries;      //!< Room for entries in the index file
+  uint32_t reserved;        //!< Reserved
+} NtCapRingIndexHeader_t;
+#pragma pack(pop)
+
+/**
+ * Ring buffer capture configuration. Zero selects the default value.
+ */
+typedef struct NtCapRingConfig_s {
+  const char *prefix;       //!< File name prefix - file n is prefix_nnnn.ntcap. Default is "ring"
+  uint32_t numFiles;        //!< Number of files in the ring. Default is 16
+  uint64_t fileSize;        //!< Size of a file - a multiple of @ref NT_AIO_DIRECT_ALIGN. Default is 1 GB
+  uint32_t interval;        //!< Bytes of segment data between index entries. Default is 16 MB
+  NtCapWriteConfig_t write; //!< Configuration of the file writer
+} NtCapRingConfig_t;
+
+/**
+ * Ring buffer capture counters
+ */
+typedef struct NtCapRingStat_s {
+  uint64_t segments;        //!< Segments written
+  uint64_t bytes;           //!< Segment bytes written
+  uint64_t files;           //!< Files started
+  uint64_t indexWrites;     //!< Index updates written
+  NtCapWriteStat_t write;   //!< Counters of the writer of the current file
+} NtCapRingStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtCapRingFile_s {
+  char path[NT_CAPRING_MAX_PATH];
+  NtCapRingIndexHeader_t hdr;
+  NtCapIndexEntry_t *entries;
+  int idxFd;                 // Index file - kept open
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Ring buffer capture
+ */
+typedef struct NtCapRing_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtCapRingConfig_t config;
+  uint8_t header[128];
+  uint32_t headerSize;
+  NtSegRefRelease_t release;
+  void *ctx;
+  NtNetStreamRx_t hStream;
+  struct _NtCapRingFile_s *files;
+  uint32_t cur;              // File being written
+  int writing;               // Set if the writer is open
+  NtCapWrite_t w;
+  uint64_t pos;              // Offset of the next segment in the current file
+  uint64_t nextEntry;        // Offset from which the next index entry is added
+  uint64_t generation;       // Generation of the current file
+  NtCapRingStat_t stat;
+#endif
+} NtCapRing_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE int _nt_capring_pwrite(int fd, const void* buf, uint32_t length, uint64_t offset)
+{
+  NtAioReq_t req;
+  memset(&req, 0, sizeof(req));
+  req.op = NT_AIO_OP_WRITE;
+  req.buf = (void*)buf;
+  req.length = length;
+  req.offset = offset;
+  req.result = _nt_aio_do(fd, &req);
+  if (req.result < 0) {
+    return NT_AIO_ERRNO(-req.result);
+  }
+  return req.result == (int64_t)length ? NT_SUCCESS : NT_AIO_ERRNO(EIO);
+}
+
+static NT_INLINE int _nt_capring_sync(int fd)
+{
+#ifdef _MSC_VER
+  return _commit(fd) == 0 ? NT_SUCCESS : NT_AIO_ERRNO(errno);
+#elif defined(__linux__)
+  return fdatasync(fd) == 0 ? NT_SUCCESS : NT_AIO_ERRNO(errno);
+#else
+  return fsync(fd) == 0 ? NT_SUCCESS : NT_AIO_ERRNO(errno);
+#endif
+}
+
+/*
+ * Write the index header of the current file claiming only the data the
+ * writer has completed, and the entries within it
+ */
+static NT_INLINE int _nt_capring_write_header(NtCapRing_t* ring, struct _NtCapRingFile_s* file)
+{
+  NtCapRingIndexHeader_t hdr = file->hdr;
+  hdr.length = _nt_capwrite_written(&ring->w);
+  while (hdr.numEntries > 0 && file->entries[hdr.numEntries - 1].offset >= hdr.length) {
+    hdr.numEntries--;
+  }
+  return _nt_capring_pwrite(file->idxFd, &hdr, sizeof(hdr), 0);
+}
+
+/*
+ * Allocate a file of "size" bytes unless it is at least that large
+ */
+static NT_INLINE int _nt_capring_allocate(const char* name, uint64_t size, int* keepFd)
+{
+  int fd, status = NT_SUCCESS;
+#ifdef _MSC_VER
+  struct _stat64 st;
+  fd = _open(name, _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+  if (fd < 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (_fstat64(fd, &st) != 0 || ((uint64_t)st.st_size < size && _chsize_s(fd, (__int64)size) != 0)) {
+    status = NT_AIO_ERRNO(errno);
+  }
+#else
+  struct stat st;
+  fd = open(name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (fstat(fd, &st) != 0) {
+    status = NT_AIO_ERRNO(errno);
+  } else if ((uint64_t)st.st_size < size) {
+    int res = posix_fallocate(fd, 0, (off_t)size);
+    // Not all file systems can allocate - extend the file instead
+    if (res != 0 && ftruncate(fd, (off_t)size) != 0) {
+      status = NT_AIO_ERRNO(res);
+    }
+  }
+#endif
+  if (status == NT_SUCCESS && keepFd != NULL) {
+    *keepFd = fd;
+    return NT_SUCCESS;
+  }
+  _nt_capindex_close_fd(fd);
+  return status;
+}
+
+static NT_INLINE uint32_t _nt_capring_max_entries(const NtCapRingConfig_t* config)
+{
+  return (uint32_t)(config->fileSize / config->interval) + 1;
+}
+
+/*
+ * Load the index of a file, or initialize it if the index file is not valid
+ */
+static NT_INLINE void _nt_capring_load_index(struct _NtCapRingFile_s* file, uint32_t n, uint32_t maxEntries, uint32_t interval)
+{
+  uint32_t done;
+  if (_nt_capindex_read(file->idxFd, &file->hdr, sizeof(file->hdr), 0, &done) != NT_SUCCESS || done != sizeof(file->hdr) ||
+      file->hdr.magic != NT_CAPRING_INDEX_MAGIC || file->hdr.version != NT_CAPRING_INDEX_VERSION || file->hdr.file != n ||
+      file->hdr.maxEntries != maxEntries || file->hdr.interval != interval || file->hdr.numEntries > maxEntries ||
+      _nt_capindex_read(file->idxFd, file->entries, file->hdr.numEntries * (uint32_t)sizeof(NtCapIndexEntry_t),
+                        sizeof(file->hdr), &done) != NT_SUCCESS ||
+      done != file->hdr.numEntries * sizeof(NtCapIndexEntry_t)) {
+    memset(&file->hdr, 0, sizeof(file->hdr));
+    file->hdr.magic = NT_CAPRING_INDEX_MAGIC;
+    file->hdr.version = NT_CAPRING_INDEX_VERSION;
+    file->hdr.file = n;
+    file->hdr.interval = interval;
+    file->hdr.maxEntries = maxEntries;
+  }
+}
+
+/*
+ * Finish the current file - all its segments are written and released
+ */
+static NT_INLINE int _nt_capring_finish(NtCapRing_t* ring)
+{
+  struct _NtCapRingFile_s* file = &ring->files[ring->cur];
+  int status, res;
+  if (!ring->writing) {
+    return NT_SUCCESS;
+  }
+  ring->writing = 0;
+  status = _nt_capwrite_close(&ring->w, &ring->stat.write);
+  file->hdr.length = ring->pos;
+  res = _nt_capring_pwrite(file->idxFd, &file->hdr, sizeof(file->hdr), 0);
+  ring->stat.indexWrites++;
+  return status != NT_SUCCESS ? status : res;
+}
+
+/*
+ * Start writing the next file of the ring
+ */
+static NT_INLINE int _nt_capring_start(NtCapRing_t* ring, uint32_t n)
+{
+  struct _NtCapRingFile_s* file = &ring->files[n];
+  int status;
+  ring->cur = n;
+  ring->generation++;
+  // Invalidate the old content before it is overwritten
+  file->hdr.generation = ring->generation;
+  file->hdr.length = ring->headerSize;
+  file->hdr.firstTs = 0;
+  file->hdr.lastTs = 0;
+  file->hdr.numEntries = 0;
+  // The invalidated header must be on disk before the old data is overwritten
+  if ((status = _nt_capring_pwrite(file->idxFd, &file->hdr, sizeof(file->hdr), 0)) != NT_SUCCESS ||
+      (status = _nt_capring_sync(file->idxFd)) != NT_SUCCESS) {
+    return status;
+  }
+  ring->stat.indexWrites++;
+  ring->pos = ring->headerSize;
+  ring->nextEntry = 0;
+  if ((status = _nt_capwrite_open_release(&ring->w, file->path, ring->headerSize ? ring->header : NULL, ring->headerSize,
+                                          ring->release, ring->ctx, &ring->config.write)) != NT_SUCCESS) {
+    return status;
+  }
+  ring->writing = 1;
+  ring->stat.files++;
+  return NT_SUCCESS;
+}
+
+/*
+ * Release a segment the writer did not take. The current file is finished
+ * first, so the segments the writer holds are released before it.
+ */
+static NT_INLINE void _nt_capring_drop(NtCapRing_t* ring, NtNetBuf_t hNetBuf)
+{
+  (void)_nt_capring_finish(ring);
+  (void)ring->release(ring->ctx, hNetBuf);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a ring buffer capture
+ *
+ * All segments are written and released, and the index of the current
+ * file is updated.
+ *
+ * @param[in] ring  Ring buffer capture
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Write error
+ */
+static NT_INLINE int _nt_capring_close(NtCapRing_t* ring)
+{
+  int status = ring->files != NULL ? _nt_capring_finish(ring) : NT_SUCCESS;
+  uint32_t n;
+  for (n = 0; ring->files != NULL && n < ring->config.numFiles; n++) {
+    if (ring->files[n].idxFd >= 0) {
+      _nt_capindex_close_fd(ring->files[n].idxFd);
+    }
+    free(ring->files[n].entries);
+  }
+  free(ring->files);
+  memset(ring, 0, sizeof(*ring));
+  return status;
+}
+
+/**
+ * @brief Open a ring buffer capture releasing segments with a function
+ *
+ * Used to capture segments that are not received with @ref NT_NetRxGet.
+ * Missing files are created and allocated, which may take a while for a
+ * large ring. Capturing continues in the file after the newest file of
+ * the ring.
+ *
+ * @param[out] ring        Ring buffer capture
+ * @param[in]  dir         Directory of the ring
+ * @param[in]  header      File header written first in every file - NULL writes none
+ * @param[in]  headerSize  Size of the file header - at most 128 bytes
+ * @param[in]  release     Function releasing a segment when it has been written
+ * @param[in]  ctx         Context passed to the release function
+ * @param[in]  config      Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error creating or opening a file
+ */
+static NT_INLINE int _nt_capring_open_release(NtCapRing_t* ring, const char* dir, const void* header, uint32_t headerSize,
+                                              NtSegRefRelease_t release, void* ctx, const NtCapRingConfig_t* config)
+{
+  uint32_t n, newest = 0, maxEntries;
+  int status = NT_SUCCESS;
+
+  memset(ring, 0, sizeof(*ring));
+  if (config != NULL) {
+    ring->config = *config;
+  }
+  if (ring->config.prefix == NULL) {
+    ring->config.prefix = "ring";
+  }
+  if (ring->config.numFiles == 0) {
+    ring->config.numFiles = 16;
+  }
+  if (ring->config.fileSize == 0) {
+    ring->config.fileSize = 1024 * 1024 * 1024;
+  }
+  if (ring->config.interval == 0) {
+    ring->config.interval = 16 * 1024 * 1024;
+  }
+  ring->config.write.overwrite = 1;
+  if (headerSize > sizeof(ring->header) || (ring->config.fileSize % NT_AIO_DIRECT_ALIGN) != 0 || ring->config.fileSize <= headerSize) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (header != NULL) {
+    memcpy(ring->header, header, headerSize);
+    ring->headerSize = headerSize;
+  }
+  ring->release = release;
+  ring->ctx = ctx;
+  maxEntries = _nt_capring_max_entries(&ring->config);
+  ring->files = (struct _NtCapRingFile_s*)calloc(ring->config.numFiles, sizeof(struct _NtCapRingFile_s));
+  if (ring->files == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (n = 0; n < ring->config.numFiles; n++) {
+    ring->files[n].idxFd = -1;
+  }
+  for (n = 0; status == NT_SUCCESS && n < ring->config.numFiles; n++) {
+    struct _NtCapRingFile_s* file = &ring->files[n];
+    char idxName[NT_CAPRING_MAX_PATH + sizeof(NT_CAPRING_INDEX_SUFFIX)];
+    snprintf(file->path, sizeof(file->path), "%s/%s_%04u.ntcap", dir, ring->config.prefix, n);
+    snprintf(idxName, sizeof(idxName), "%s%s", file->path, NT_CAPRING_INDEX_SUFFIX);
+    if ((file->entries = (NtCapIndexEntry_t*)calloc(maxEntries, sizeof(NtCapIndexEntry_t))) == NULL) {
+      status = NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    } else if ((status = _nt_capring_allocate(file->path, ring->config.fileSize, NULL)) == NT_SUCCESS &&
+               (status = _nt_capring_allocate(idxName, sizeof(NtCapRingIndexHeader_t) + (uint64_t)maxEntries * sizeof(NtCapIndexEntry_t),
+                                              &file->idxFd)) == NT_SUCCESS) {
+      _nt_capring_load_index(file, n, maxEntries, ring->config.interval);
+      if (file->hdr.generation > ring->generation) {
+        ring->generation = file->hdr.generation;
+        newest = n;
+      }
+    }
+  }
+  if (status == NT_SUCCESS) {
+    status = _nt_capring_start(ring, ring->generation != 0 ? (newest + 1) % ring->config.numFiles : 0);
+  }
+  if (status != NT_SUCCESS) {
+    (void)_nt_capring_close(ring);
+    return status;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Open a ring buffer capture of an RX stream
+ *
+ * The file header of the stream is read with
+ * @ref NT_NETRX_READ_CMD_GET_FILE_HEADER and written first in every file,
+ * and the segments are released with @ref NT_NetRxRelease.
+ *
+ * @param[out] ring     Ring buffer capture
+ * @param[in]  hStream  Segment RX stream - read with @ref _nt_capring_rx
+ * @param[in]  dir      Directory of the ring
+ * @param[in]  config   Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref NT_NetRxRead or @ref _nt_capring_open_release
+ */
+static NT_INLINE int _nt_capring_open(NtCapRing_t* ring, NtNetStreamRx_t hStream, const char* dir, const NtCapRingConfig_t* config)
+{
+  NtNetRx_t rx;
+  int status;
+  memset(&rx, 0, sizeof(rx));
+  rx.cmd = NT_NETRX_READ_CMD_GET_FILE_HEADER;
+  if ((status = NT_NetRxRead(hStream, &rx)) != NT_SUCCESS) {
+    return status;
+  }
+  if (rx.u.fileheader.size <= 0 || rx.u.fileheader.size > (int32_t)sizeof(rx.u.fileheader.data)) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  status = _nt_capring_open_release(ring, dir, rx.u.fileheader.data, (uint32_t)rx.u.fileheader.size, _nt_segref_rx_release_cb,
+                                    (void*)hStream, config);
+  ring->hStream = hStream;
+  return status;
+}
+
+/**
+ * @brief Write a segment to the ring
+ *
+ * The writer takes the segment and releases it when it has been written.
+ * When the segment does not fit in the current file, the file is finished
+ * and the oldest file of the ring is overwritten. Finishing a file waits
+ * for its writes to complete.
+ *
+ * The index header claims only the data the writer has completed, so an
+ * index read after a crash never covers data that was not written.
+ *
+ * @param[in] ring     Ring buffer capture
+ * @param[in] hNetBuf  Segment
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  The segment is larger than a file - the segment is not taken
+ * @retval otherwise                   Write error - the segment is taken and released in order anyway
+ */
+static NT_INLINE int _nt_capring_put(NtCapRing_t* ring, NtNetBuf_t hNetBuf)
+{
+  uint64_t length = NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+  struct _NtCapRingFile_s* file;
+  uint64_t ts;
+  int status;
+
+  if (ring->headerSize + length > ring->config.fileSize) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (!ring->writing || ring->pos + length > ring->config.fileSize) {
+    if ((status = _nt_capring_finish(ring)) != NT_SUCCESS ||
+        (status = _nt_capring_start(ring, (ring->cur + 1) % ring->config.numFiles)) != NT_SUCCESS) {
+      _nt_capring_drop(ring, hNetBuf);
+      return status;
+    }
+  }
+  file = &ring->files[ring->cur];
+  ts = NT_NET_GET_SEGMENT_TIMESTAMP(hNetBuf);
+  if (length > 0 && ring->pos >= ring->nextEntry && file->hdr.numEntries < file->hdr.maxEntries) {
+    NtCapIndexEntry_t* entry = &file->entries[file->hdr.numEntries];
+    entry->timestamp = ts;
+    entry->offset = ring->pos;
+    // The entry first, then the header counting it - both in allocated blocks
+    status = _nt_capring_pwrite(file->idxFd, entry, sizeof(*entry),
+                                sizeof(NtCapRingIndexHeader_t) + (uint64_t)file->hdr.numEntries * sizeof(NtCapIndexEntry_t));
+    file->hdr.numEntries++;
+    file->hdr.lastTs = ts;
+    if (file->hdr.firstTs == 0) {
+      file->hdr.firstTs = ts;
+    }
+    if (status == NT_SUCCESS) {
+      status = _nt_capring_write_header(ring, file);
+    }
+    if (status != NT_SUCCESS) {
+      _nt_capring_drop(ring, hNetBuf);
+      return status;
+    }
+    ring->stat.indexWrites++;
+    ring->nextEntry = ring->pos + ring->config.interval;
+  }
+  if ((status = _nt_capwrite_put(&ring->w, hNetBuf)) != NT_SUCCESS) {
+    return status;
+  }
+  if (file->hdr.firstTs == 0) {
+    file->hdr.firstTs = ts;
+  }
+  file->hdr.lastTs = ts;
+  ring->pos += length;
+  ring->stat.segments++;
+  ring->stat.bytes += length;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Receive a segment and write it to the ring
+ *
+ * @param[in] ring     Ring buffer capture opened with @ref _nt_capring_open
+ * @param[in] timeout  Time to wait for data in milliseconds
+ *
+ * @retval NT_SUCCESS  A segment was received and written
+ * @retval otherwise   Status returned by @ref NT_NetRxGet or @ref _nt_capring_put
+ */
+static NT_INLINE int _nt_capring_rx(NtCapRing_t* ring, int timeout)
+{
+  NtNetBuf_t hNetBuf;
+  int status;
+  if ((status = NT_NetRxGet(ring->hStream, &hNetBuf, timeout)) != NT_SUCCESS) {
+    _nt_capwrite_poll(&ring->w, 0);
+    return status;
+  }
+  // Only a segment larger than a file is not taken by the ring
+  if ((status = _nt_capring_put(ring, hNetBuf)) == NT_ERROR_INVALID_PARAMETER) {
+    (void)NT_NetRxRelease(ring->hStream, hNetBuf);
+  }
+  return status;
+}
+
+/**
+ * @brief Get the time covered by the ring
+ *
+ * Read from the index in memory - no I/O is done.
+ *
+ * @param[in]  ring    Ring buffer capture
+ * @param[out] oldest  Time stamp of the first segment of the oldest file
+ * @param[out] newest  Time stamp of the last segment written
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_NO_DATA  No segment has been written
+ */
+static NT_INLINE int _nt_capring_get_coverage(NtCapRing_t* ring, uint64_t* oldest, uint64_t* newest)
+{
+  uint64_t gen = 0;
+  uint32_t n, o = 0, w = 0;
+  for (n = 0; n < ring->config.numFiles; n++) {
+    const NtCapRingIndexHeader_t* hdr = &ring->files[n].hdr;
+    if (hdr->generation == 0 || hdr->firstTs == 0) {
+      continue;
+    }
+    if (gen == 0 || hdr->generation < ring->files[o].hdr.generation) {
+      o = n;
+    }
+    if (gen == 0 || hdr->generation > ring->files[w].hdr.generation) {
+      w = n;
+    }
+    gen = hdr->generation;
+  }
+  if (gen == 0) {
+    return NT_STATUS_NO_DATA;
+  }
+  *oldest = ring->files[o].hdr.firstTs;
+  *newest = ring->files[w].hdr.lastTs;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the index header of a file of the ring
+ *
+ * @param[in]  ring  Ring buffer capture
+ * @param[in]  n     File number
+ * @param[out] hdr   Index header as kept in memory
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  No such file
+ */
+static NT_INLINE int _nt_capring_get_file_info(NtCapRing_t* ring, uint32_t n, NtCapRingIndexHeader_t* hdr)
+{
+  if (n >= ring->config.numFiles) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  *hdr = ring->files[n].hdr;
+  if (n == ring->cur && ring->writing) {
+    hdr->length = ring->pos;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the counters of a ring buffer capture
+ *
+ * @param[in]  ring  Ring buffer capture
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_capring_get_stat(NtCapRing_t* ring, NtCapRingStat_t* stat)
+{
+  *stat = ring->stat;
+  if (ring->writing) {
+    _nt_capwrite_get_stat(&ring->w, &stat->write);
+  }
+}
+
+/**
+ * Ring buffer capture reader
+ */
+typedef struct NtCapRingReader_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  struct _NtCapRingFile_s *files; // Files holding data, oldest first
+  uint32_t numFiles;
+  uint32_t next;             // Next file to open
+  int opened;                // Set if "file" is open
+  uint32_t held;             // Segments held by the caller
+  NtCapFile_t file;
+  NtCapFileConfig_t config;
+#endif
+} NtCapRingReader_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE int _nt_capring_reader_open_file(NtCapRingReader_t* reader, uint32_t n, uint64_t offset)
+{
+  NtCapFileConfig_t cfg = reader->config;
+  int status;
+  if (reader->opened) {
+    _nt_capfile_close(&reader->file);
+    reader->opened = 0;
+  }
+  cfg.length = reader->files[n].hdr.length;
+  if ((status = _nt_capfile_open(&reader->file, reader->files[n].path, &cfg)) != NT_SUCCESS) {
+    return status;
+  }
+  reader->opened = 1;
+  reader->next = n + 1;
+  if (offset > sizeof(NtFileHeader0_t) && (status = _nt_capfile_seek(&reader->file, offset)) != NT_SUCCESS) {
+    return status;
+  }
+  return NT_SUCCESS;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a ring buffer capture reader
+ *
+ * @param[in] reader  Ring buffer capture reader
+ */
+static NT_INLINE void _nt_capring_reader_close(NtCapRingReader_t* reader)
+{
+  uint32_t n;
+  if (reader->opened) {
+    _nt_capfile_close(&reader->file);
+  }
+  for (n = 0; reader->files != NULL && n < reader->numFiles; n++) {
+    free(reader->files[n].entries);
+  }
+  free(reader->files);
+  memset(reader, 0, sizeof(*reader));
+}
+
+/**
+ * @brief Open a reader of a ring buffer capture
+ *
+ * The indexes are read once, so data written by a capture running at the
+ * same time is seen as it was indexed when the reader was opened. The
+ * oldest files may be overwritten while they are read if the capture is
+ * running.
+ *
+ * @param[out] reader    Ring buffer capture reader
+ * @param[in]  dir       Directory of the ring
+ * @param[in]  prefix    File name prefix - NULL selects "ring"
+ * @param[in]  numFiles  Number of files in the ring
+ * @param[in]  config    Configuration of the capture file reader - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_STATUS_NO_DATA                 The ring holds no data
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error opening the first file
+ */
+static NT_INLINE int _nt_capring_reader_open(NtCapRingReader_t* reader, const char* dir, const char* prefix, uint32_t numFiles,
+                                             const NtCapFileConfig_t* config)
+{
+  uint32_t n, i;
+  int status;
+  memset(reader, 0, sizeof(*reader));
+  if (config != NULL) {
+    reader->config = *config;
+  }
+  if (prefix == NULL) {
+    prefix = "ring";
+  }
+  if ((reader->files = (struct _NtCapRingFile_s*)calloc(numFiles ? numFiles : 1, sizeof(struct _NtCapRingFile_s))) == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (n = 0; n < numFiles; n++) {
+    struct _NtCapRingFile_s file;
+    char idxName[NT_CAPRING_MAX_PATH + sizeof(NT_CAPRING_INDEX_SUFFIX)];
+    uint32_t done;
+    int fd;
+    memset(&file, 0, sizeof(file));
+    snprintf(file.path, sizeof(file.path), "%s/%s_%04u.ntcap", dir, prefix, n);
+    snprintf(idxName, sizeof(idxName), "%s%s", file.path, NT_CAPRING_INDEX_SUFFIX);
+    if (_nt_capindex_open_fd(idxName, &fd) != NT_SUCCESS) {
+      continue;
+    }
+    if (_nt_capindex_read(fd, &file.hdr, sizeof(file.hdr), 0, &done) == NT_SUCCESS && done == sizeof(file.hdr) &&
+        file.hdr.magic == NT_CAPRING_INDEX_MAGIC && file.hdr.version == NT_CAPRING_INDEX_VERSION && file.hdr.generation != 0 &&
+        file.hdr.length > sizeof(NtFileHeader0_t) && file.hdr.numEntries <= file.hdr.maxEntries) {
+      uint32_t size = file.hdr.numEntries * (uint32_t)sizeof(NtCapIndexEntry_t);
+      file.entries = (NtCapIndexEntry_t*)malloc(size ? size : 1);
+      if (file.entries == NULL) {
+        _nt_capindex_close_fd(fd);
+        _nt_capring_reader_close(reader);
+        return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+      }
+      if (_nt_capindex_read(fd, file.entries, size, sizeof(file.hdr), &done) != NT_SUCCESS || done != size) {
+        free(file.entries);
+        file.entries = NULL;
+      }
+    }
+    _nt_capindex_close_fd(fd);
+    if (file.entries == NULL) {
+      continue;
+    }
+    // Insert sorted by generation
+    for (i = reader->numFiles; i > 0 && reader->files[i - 1].hdr.generation > file.hdr.generation; i--) {
+      reader->files[i] = reader->files[i - 1];
+    }
+    reader->files[i] = file;
+    reader->numFiles++;
+  }
+  if (reader->numFiles == 0) {
+    _nt_capring_reader_close(reader);
+    return NT_STATUS_NO_DATA;
+  }
+  if ((status = _nt_capring_reader_open_file(reader, 0, 0)) != NT_SUCCESS) {
+    _nt_capring_reader_close(reader);
+    return status;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Move a ring buffer capture reader to a time stamp
+ *
+ * The reader is moved to the index entry before the first segment at or
+ * after the time stamp, so the next segments may hold up to one index
+ * interval of older packets. A time stamp before the ring moves to the
+ * oldest data.
+ *
+ * @param[in] reader     Ring buffer capture reader
+ * @param[in] timestamp  Time stamp in the time stamp format of the capture
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_TRYAGAIN     Segments are held by the caller
+ * @retval NT_STATUS_END_OF_FILE  The time stamp is after the ring
+ * @retval otherwise              Error
+ */
+static NT_INLINE int _nt_capring_reader_seek_time(NtCapRingReader_t* reader, uint64_t timestamp)
+{
+  NtCapIndex_t idx;
+  uint32_t n;
+  if (reader->held != 0) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  for (n = 0; n < reader->numFiles && reader->files[n].hdr.lastTs < timestamp; n++) {
+  }
+  if (n == reader->numFiles) {
+    if (reader->opened) {
+      _nt_capfile_close(&reader->file);
+      reader->opened = 0;
+    }
+    reader->next = n;
+    return NT_STATUS_END_OF_FILE;
+  }
+  memset(&idx, 0, sizeof(idx));
+  idx.entries = reader->files[n].entries;
+  idx.numEntries = reader->files[n].hdr.numEntries;
+  idx.fd = -1;
+  return _nt_capring_reader_open_file(reader, n, _nt_capindex_lookup(&idx, timestamp));
+}
+
+/**
+ * @brief Get the next segment of a ring buffer capture
+ *
+ * The files are read oldest first. Moving to the next file waits until
+ * the caller has released all segments of the current file.
+ *
+ * @param[in]  reader   Ring buffer capture reader
+ * @param[out] hNetBuf  Segment - released with @ref _nt_capring_reader_release
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_END_OF_FILE  No more data in the ring
+ * @retval NT_STATUS_TRYAGAIN     Release segments and try again
+ * @retval otherwise              Error
+ */
+static NT_INLINE int _nt_capring_reader_get(NtCapRingReader_t* reader, NtNetBuf_t* hNetBuf)
+{
+  int status;
+  for (;;) {
+    if (reader->opened) {
+      status = _nt_capfile_get(&reader->file, hNetBuf);
+      if (status == NT_SUCCESS) {
+        reader->held++;
+      }
+      if (status != NT_STATUS_END_OF_FILE) {
+        return status;
+      }
+      if (reader->held != 0) {
+        return NT_STATUS_TRYAGAIN;
+      }
+    }
+    if (reader->next >= reader->numFiles) {
+      return NT_STATUS_END_OF_FILE;
+    }
+    if ((status = _nt_capring_reader_open_file(reader, reader->next, 0)) != NT_SUCCESS) {
+      return status;
+    }
+  }
+}
+
+/**
+ * @brief Release a segment of a ring buffer capture
+ *
+ * @param[in] reader   Ring buffer capture reader
+ * @param[in] hNetBuf  Segment returned by @ref _nt_capring_reader_get
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref _nt_capfile_release
+ */
+static NT_INLINE int _nt_capring_reader_release(NtCapRingReader_t* reader, NtNetBuf_t hNetBuf)
+{
+  int status = _nt_capfile_release(&reader->file, hNetBuf);
+  if (status == NT_SUCCESS) {
+    reader->held--;
+  }
+  return status;
+}
+
+#endif // __CAPRING_H__
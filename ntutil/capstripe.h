@@ -0,0 +1,789 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains striped capture to several disks. The
+ * segments of an RX stream are spread over one capture file per target
+ * directory, round robin or to the disk with the fewest bytes queued, and
+ * every file is written by its own thread with @ref _nt_capwrite_put. A
+ * writer thread can be pinned to the CPUs of a NUMA node, normally the
+ * node the disk controller is attached to, and allocates its write
+ * buffers there.
+ *
+ * The receiving thread never waits for a disk. A segment is only queued
+ * to a disk with room for it, and when all disks are full
+ * @ref _nt_capstripe_rx stops receiving, so the host buffer fills and the
+ * adapter drops as set by the host buffer allowance of the stream. The
+ * segments are released by the receiving thread in the order they were
+ * received, when the writer threads have written them.
+ *
+ * On close a manifest listing the files is written. The files each hold
+ * whole segments in time order, and @ref _nt_capstripe_reader_open merges
+ * them back into a single stream ordered by time stamp with
+ * @ref _nt_merge_get.
+ *
+ */
+#ifndef __CAPSTRIPE_H__
+#define __CAPSTRIPE_H__
+
+#include "nt.h"
+#include "atomic.h"
+#include "capwrite.h"
+#include "compat.h"
+#include "merge.h"
+#include "ring.h"
+#include "segref.h"
+
+#include <stdio.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Maximum length of a file name in the manifest
+ */
+#define NT_CAPSTRIPE_MAX_PATH 1024
+
+/**
+ * Segment distribution policies
+ */
+enum NtCapStripePolicy_e {
+  NT_CAPSTRIPE_ROUND_ROBIN = 0,  //!< Disks in turn - a full disk is skipped
+  NT_CAPSTRIPE_FILL_LEVEL,       //!< The disk with the fewest bytes queued
+};
+
+/**
+ * Striped capture configuration. Zero selects the default value.
+ */
+typedef struct NtCapStripeConfig_s {
+  enum NtCapStripePolicy_e policy; //!< Segment distribution policy
+  const char *prefix;       //!< File name prefix - the file of directory n is prefix_n.ntcap. Default is "stripe"
+  const char *manifest;     //!< Manifest file name. Default is prefix.manifest in the first directory
+  const int *numaNodes;     //!< NUMA node to pin the writer thread of every directory to, -1 for none - NULL pins none
+  uint32_t depth;           //!< Segments queued per disk - a power of 2. Default is 16
+  uint64_t maxQueuedBytes;  //!< Bytes queued per disk, including the writes in flight - 0 for no limit
+  NtCapWriteConfig_t write; //!< Configuration of the writer of every disk
+} NtCapStripeConfig_t;
+
+/**
+ * Disk counters
+ */
+typedef struct NtCapStripeDiskStat_s {
+  uint64_t segments;        //!< Segments queued to the disk
+  uint64_t bytes;           //!< Bytes queued to the disk
+  uint64_t written;         //!< Bytes written to the disk
+  uint64_t queuedBytes;     //!< Bytes queued and not yet written
+  uint64_t full;            //!< Times the disk was skipped because its queue was full
+  uint64_t firstTs;         //!< Time stamp of the first packet of the first segment
+  uint64_t lastTs;          //!< Time stamp of the first packet of the last segment
+  int pinned;               //!< Set if the writer thread is pinned to its NUMA node
+  int error;                //!< Write error - the disk is no longer used
+} NtCapStripeDiskStat_t;
+
+/**
+ * Striped capture counters
+ */
+typedef struct NtCapStripeStat_s {
+  uint64_t segments;        //!< Segments received
+  uint64_t bytes;           //!< Bytes received
+  uint64_t empty;           //!< Empty segments - released without being written
+  uint64_t allFull;         //!< Times no disk had room for a segment
+  NtSegRefStat_t pool;      //!< Segments held
+} NtCapStripeStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtCapStripeDisk_s {
+  struct NtCapStripe_s *stripe;
+  char path[NT_CAPSTRIPE_MAX_PATH];
+  int numaNode;
+  NtRing_t ready;            // Segments to write - the receiving thread produces
+  NtRing_t taken;            // Segments given to the writer - writer thread only
+  volatile uint64_t written; // Bytes written - the writer thread updates
+  volatile uint32_t error;
+  volatile uint32_t started;
+  int pinned;                // Set by the writer thread before started
+  NtCapStripeDiskStat_t stat; // Receiving thread only
+#ifndef _MSC_VER
+  pthread_t thread;
+  int running;
+#endif
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Striped capture
+ */
+typedef struct NtCapStripe_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtCapStripeConfig_t config;
+  char manifest[NT_CAPSTRIPE_MAX_PATH];
+  uint8_t header[128];
+  uint32_t headerSize;
+  NtNetStreamRx_t hStream;
+  NtSegRefPool_t pool;
+  struct _NtCapStripeDisk_s *disks;
+  uint32_t numDisks;
+  uint32_t next;             // Next disk in round robin
+  NtNetBuf_t pending;        // Segment received and not yet queued
+  int opened;                // Set when all writer threads have opened their files
+  volatile uint32_t stop;
+  NtCapStripeStat_t stat;
+#endif
+} NtCapStripe_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Pin the calling thread to the CPUs of a NUMA node
+ */
+static NT_INLINE int _nt_capstripe_pin(int node)
+{
+#if defined(__linux__) && defined(__NR_sched_setaffinity)
+  unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+  const uint32_t bits = 8 * sizeof(unsigned long);
+  char path[64];
+  FILE* f;
+  int first, last, c;
+  memset(mask, 0, sizeof(mask));
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  if ((f = fopen(path, "r")) == NULL) {
+    return 0;
+  }
+  // The list is like 0-15,32-47
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    if ((c = fgetc(f)) == '-') {
+      if (fscanf(f, "%d", &last) != 1) {
+        break;
+      }
+      c = fgetc(f);
+    }
+    for (; first <= last && first < 1024; first++) {
+      mask[first / bits] |= 1UL << (first % bits);
+    }
+    if (c != ',') {
+      break;
+    }
+  }
+  fclose(f);
+  return syscall(__NR_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+#else
+  (void)node;
+  return 0;
+#endif
+}
+
+/*
+ * Release function of the disk writers - drops the reference of the
+ * oldest segment given to the writer
+ */
+static NT_INLINE int _nt_capstripe_written(void* ctx, NtNetBuf_t hNetBuf)
+{
+  struct _NtCapStripeDisk_s* disk = (struct _NtCapStripeDisk_s*)ctx;
+  NtSegRef_t* ref;
+  if (_nt_ring_dequeue(&disk->taken, &ref) != NT_SUCCESS || ref->hNetBuf != hNetBuf) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  _nt_atomic_store_release_u64(&disk->written, disk->written + NT_NET_GET_SEGMENT_LENGTH(hNetBuf));
+  _nt_segref_drop(ref);
+  return NT_SUCCESS;
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_capstripe_thread(void* arg)
+{
+  struct _NtCapStripeDisk_s* disk = (struct _NtCapStripeDisk_s*)arg;
+  NtCapStripe_t* stripe = disk->stripe;
+  NtCapWrite_t w;
+  NtSegRef_t* ref;
+  int status, open;
+
+  if (disk->numaNode >= 0) {
+    disk->pinned = _nt_capstripe_pin(disk->numaNode);
+  }
+  // Opened after pinning, so the write buffers are allocated on the node
+  status = _nt_capwrite_open_release(&w, disk->path, stripe->header, stripe->headerSize, _nt_capstripe_written, disk,
+                                     &stripe->config.write);
+  open = status == NT_SUCCESS;
+  if (!open) {
+    _nt_atomic_store_release_u32(&disk->error, (uint32_t)status);
+  }
+  _nt_atomic_store_release_u32(&disk->started, 1);
+  for (;;) {
+    int idle = 1;
+    while (_nt_ring_dequeue(&disk->ready, &ref) == NT_SUCCESS) {
+      idle = 0;
+      if (!open) {
+        _nt_atomic_store_release_u64(&disk->written, disk->written + NT_NET_GET_SEGMENT_LENGTH(ref->hNetBuf));
+        _nt_segref_drop(ref);
+        continue;
+      }
+      (void)_nt_ring_enqueue(&disk->taken, &ref);
+      if ((status = _nt_capwrite_put(&w, ref->hNetBuf)) != NT_SUCCESS) {
+        // The writer has taken the segment - close releases what it holds, then drop any left
+        _nt_atomic_store_release_u32(&disk->error, (uint32_t)status);
+        (void)_nt_capwrite_close(&w, NULL);
+        open = 0;
+        while (_nt_ring_dequeue(&disk->taken, &ref) == NT_SUCCESS) {
+          _nt_atomic_store_release_u64(&disk->written, disk->written + NT_NET_GET_SEGMENT_LENGTH(ref->hNetBuf));
+          _nt_segref_drop(ref);
+        }
+      }
+    }
+    if (_nt_atomic_load_acquire_u32(&stripe->stop) && _nt_ring_count(&disk->ready) == 0) {
+      break;
+    }
+    if (open && _nt_capwrite_poll(&w, 0) != NT_SUCCESS) {
+      _nt_atomic_store_release_u32(&disk->error, (uint32_t)w.error);
+    }
+    if (idle) {
+      _nt_compat_sleep_ns(20000);
+    }
+  }
+  if (open && (status = _nt_capwrite_close(&w, NULL)) != NT_SUCCESS) {
+    _nt_atomic_store_release_u32(&disk->error, (uint32_t)status);
+  }
+  return NULL;
+}
+#endif
+
+/*
+ * Choose the disk for a segment - returns numDisks if none has room
+ */
+static NT_INLINE uint32_t _nt_capstripe_choose(NtCapStripe_t* stripe, uint64_t length)
+{
+  uint32_t d, best = stripe->numDisks, k;
+  uint64_t bestQueued = 0;
+  for (k = 0; k < stripe->numDisks; k++) {
+    struct _NtCapStripeDisk_s* disk;
+    uint64_t queued;
+    d = stripe->next + k < stripe->numDisks ? stripe->next + k : stripe->next + k - stripe->numDisks;
+    disk = &stripe->disks[d];
+    if (_nt_atomic_load_acquire_u32(&disk->error) != 0) {
+      continue;
+    }
+    queued = disk->stat.bytes - _nt_atomic_load_acquire_u64(&disk->written);
+    if (_nt_ring_count(&disk->ready) == stripe->config.depth ||
+        (stripe->config.maxQueuedBytes != 0 && queued != 0 && queued + length > stripe->config.maxQueuedBytes)) {
+      disk->stat.full++;
+      continue;
+    }
+    if (stripe->config.policy == NT_CAPSTRIPE_ROUND_ROBIN) {
+      best = d;
+      break;
+    }
+    if (best == stripe->numDisks || queued < bestQueued) {
+      best = d;
+      bestQueued = queued;
+    }
+  }
+  if (best != stripe->numDisks) {
+    stripe->next = best + 1 == stripe->numDisks ? 0 : best + 1;
+  }
+  return best;
+}
+
+static NT_INLINE int _nt_capstripe_write_manifest(NtCapStripe_t* stripe)
+{
+  FILE* f = fopen(stripe->manifest, "w");
+  uint32_t d;
+  if (f == NULL) {
+    return NT_AIO_ERRNO(errno);
+  }
+  fprintf(f, "ntcapstripe 1\n");
+  for (d = 0; d < stripe->numDisks; d++) {
+    struct _NtCapStripeDisk_s* disk = &stripe->disks[d];
+    fprintf(f, "file %llu %llu %llu %llu %d %s\n", (unsigned long long)disk->stat.segments, (unsigned long long)disk->stat.bytes,
+            (unsigned long long)disk->stat.firstTs, (unsigned long long)disk->stat.lastTs, (int)disk->error, disk->path);
+  }
+  if (fclose(f) != 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+  return NT_SUCCESS;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Get the counters of a striped capture - receiving thread only
+ *
+ * @param[in]  stripe  Striped capture
+ * @param[out] stat    Counters
+ */
+static NT_INLINE void _nt_capstripe_get_stat(NtCapStripe_t* stripe, NtCapStripeStat_t* stat)
+{
+  *stat = stripe->stat;
+  _nt_segref_get_stat(&stripe->pool, &stat->pool);
+}
+
+/**
+ * @brief Get the counters of a disk of a striped capture - receiving thread only
+ *
+ * @param[in]  stripe  Striped capture
+ * @param[in]  disk    Disk number in the order of the directories
+ * @param[out] stat    Counters
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  No such disk
+ */
+static NT_INLINE int _nt_capstripe_get_disk_stat(NtCapStripe_t* stripe, uint32_t disk, NtCapStripeDiskStat_t* stat)
+{
+  struct _NtCapStripeDisk_s* d;
+  if (disk >= stripe->numDisks) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  d = &stripe->disks[disk];
+  *stat = d->stat;
+  stat->written = _nt_atomic_load_acquire_u64(&d->written);
+  stat->queuedBytes = stat->bytes - stat->written;
+  stat->error = (int)_nt_atomic_load_acquire_u32(&d->error);
+  stat->pinned = _nt_atomic_load_acquire_u32(&d->started) ? d->pinned : 0;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Close a striped capture - receiving thread only
+ *
+ * The writer threads write all segments queued and stop, all segments are
+ * released and the manifest is written.
+ *
+ * @param[in] stripe  Striped capture
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   The first write error of a disk, or the error writing the manifest
+ */
+static NT_INLINE int _nt_capstripe_close(NtCapStripe_t* stripe)
+{
+  int status = NT_SUCCESS, manifest = stripe->opened;
+  uint32_t d;
+  _nt_atomic_store_release_u32(&stripe->stop, 1);
+  for (d = 0; stripe->disks != NULL && d < stripe->numDisks; d++) {
+    struct _NtCapStripeDisk_s* disk = &stripe->disks[d];
+#ifndef _MSC_VER
+    if (disk->running) {
+      pthread_join(disk->thread, NULL);
+    }
+#endif
+    if (status == NT_SUCCESS && disk->error != 0) {
+      status = (int)disk->error;
+    }
+    _nt_ring_free(&disk->ready);
+    _nt_ring_free(&disk->taken);
+  }
+  if (stripe->pool.slots != NULL) {
+    (void)_nt_segref_reclaim(&stripe->pool);
+    _nt_segref_close(&stripe->pool);
+  }
+  if (stripe->pending != NULL) {
+    (void)NT_NetRxRelease(stripe->hStream, stripe->pending);
+  }
+  if (manifest) {
+    int res = _nt_capstripe_write_manifest(stripe);
+    if (status == NT_SUCCESS) {
+      status = res;
+    }
+  }
+  free(stripe->disks);
+  memset(stripe, 0, sizeof(*stripe));
+  return status;
+}
+
+/**
+ * @brief Open a striped capture releasing segments with a function
+ *
+ * Used to capture segments that are not received with @ref NT_NetRxGet.
+ * The files are created or truncated, and the writer threads are started.
+ *
+ * @param[out] stripe      Striped capture
+ * @param[in]  dirs        Target directories - normally one per disk
+ * @param[in]  numDirs     Number of directories
+ * @param[in]  header      File header written first in every file - NULL writes none
+ * @param[in]  headerSize  Size of the file header - at most 128 bytes
+ * @param[in]  release     Function releasing a segment - called by the receiving thread
+ * @param[in]  ctx         Context passed to the release function
+ * @param[in]  config      Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                      Success
+ * @retval NT_ERROR_INVALID_PARAMETER      Invalid parameter
+ * @retval NT_ERROR_RESOURCE_UNAVAILABLE   A thread could not be started
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED  Not supported on Windows
+ * @retval otherwise                       Error opening a file
+ */
+static NT_INLINE int _nt_capstripe_open_release(NtCapStripe_t* stripe, const char* const* dirs, uint32_t numDirs,
+                                                const void* header, uint32_t headerSize, NtSegRefRelease_t release,
+                                                void* ctx, const NtCapStripeConfig_t* config)
+{
+#ifndef _MSC_VER
+  uint32_t d, taken;
+  int status;
+  memset(stripe, 0, sizeof(*stripe));
+  if (config != NULL) {
+    stripe->config = *config;
+  }
+  if (stripe->config.prefix == NULL) {
+    stripe->config.prefix = "stripe";
+  }
+  if (stripe->config.depth == 0) {
+    stripe->config.depth = 16;
+  }
+  if (stripe->config.write.maxSegments == 0) {
+    stripe->config.write.maxSegments = 64;
+  }
+  if (numDirs == 0 || headerSize > sizeof(stripe->header) ||
+      (stripe->config.depth & (stripe->config.depth - 1)) != 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (header != NULL) {
+    memcpy(stripe->header, header, headerSize);
+    stripe->headerSize = headerSize;
+  }
+  if (stripe->config.manifest != NULL) {
+    snprintf(stripe->manifest, sizeof(stripe->manifest), "%s", stripe->config.manifest);
+  } else {
+    snprintf(stripe->manifest, sizeof(stripe->manifest), "%s/%s.manifest", dirs[0], stripe->config.prefix);
+  }
+  stripe->disks = (struct _NtCapStripeDisk_s*)calloc(numDirs, sizeof(struct _NtCapStripeDisk_s));
+  if (stripe->disks == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  stripe->numDisks = numDirs;
+  // Every disk holds the segments queued, the segments taken by its writer and the one being taken
+  status = _nt_segref_open(&stripe->pool, numDirs * (stripe->config.depth + stripe->config.write.maxSegments + 1), release, ctx);
+  taken = _nt_merge_pow2(stripe->config.write.maxSegments + 1);
+  for (d = 0; status == NT_SUCCESS && d < numDirs; d++) {
+    struct _NtCapStripeDisk_s* disk = &stripe->disks[d];
+    disk->stripe = stripe;
+    disk->numaNode = stripe->config.numaNodes != NULL ? stripe->config.numaNodes[d] : -1;
+    snprintf(disk->path, sizeof(disk->path), "%s/%s_%u.ntcap", dirs[d], stripe->config.prefix, d);
+    if ((status = _nt_ring_init(&disk->ready, stripe->config.depth, sizeof(NtSegRef_t*))) == NT_SUCCESS) {
+      status = _nt_ring_init(&disk->taken, taken, sizeof(NtSegRef_t*));
+    }
+  }
+  for (d = 0; status == NT_SUCCESS && d < numDirs; d++) {
+    struct _NtCapStripeDisk_s* disk = &stripe->disks[d];
+    if (pthread_create(&disk->thread, NULL, _nt_capstripe_thread, disk) != 0) {
+      status = NT_ERROR_RESOURCE_UNAVAILABLE;
+      break;
+    }
+    disk->running = 1;
+  }
+  // Wait for the files to be opened
+  for (d = 0; status == NT_SUCCESS && d < numDirs; d++) {
+    struct _NtCapStripeDisk_s* disk = &stripe->disks[d];
+    while (!_nt_atomic_load_acquire_u32(&disk->started)) {
+      _nt_compat_sleep_ns(100000);
+    }
+    status = (int)_nt_atomic_load_acquire_u32(&disk->error);
+  }
+  if (status != NT_SUCCESS) {
+    (void)_nt_capstripe_close(stripe);
+    return status;
+  }
+  stripe->opened = 1;
+  return NT_SUCCESS;
+#else
+  (void)stripe;
+  (void)dirs;
+  (void)numDirs;
+  (void)header;
+  (void)headerSize;
+  (void)release;
+  (void)ctx;
+  (void)config;
+  return NT_ERROR_FEATURE_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Open a striped capture of an RX stream
+ *
+ * The file header of the stream is read with
+ * @ref NT_NETRX_READ_CMD_GET_FILE_HEADER and written first in every file,
+ * and the segments are released with @ref NT_NetRxRelease.
+ *
+ * @param[out] stripe   Striped capture
+ * @param[in]  hStream  Segment RX stream - read with @ref _nt_capstripe_rx
+ * @param[in]  dirs     Target directories - normally one per disk
+ * @param[in]  numDirs  Number of directories
+ * @param[in]  config   Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref NT_NetRxRead or @ref _nt_capstripe_open_release
+ */
+static NT_INLINE int _nt_capstripe_open(NtCapStripe_t* stripe, NtNetStreamRx_t hStream, const char* const* dirs, uint32_t numDirs,
+                                        const NtCapStripeConfig_t* config)
+{
+  NtNetRx_t rx;
+  int status;
+  memset(&rx, 0, sizeof(rx));
+  rx.cmd = NT_NETRX_READ_CMD_GET_FILE_HEADER;
+  if ((status = NT_NetRxRead(hStream, &rx)) != NT_SUCCESS) {
+    return status;
+  }
+  if (rx.u.fileheader.size <= 0 || rx.u.fileheader.size > (int32_t)sizeof(rx.u.fileheader.data)) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  status = _nt_capstripe_open_release(stripe, dirs, numDirs, rx.u.fileheader.data, (uint32_t)rx.u.fileheader.size,
+                                      _nt_segref_rx_release_cb, (void*)hStream, config);
+  stripe->hStream = hStream;
+  return status;
+}
+
+/**
+ * @brief Queue a segment to a disk - receiving thread only
+ *
+ * Never waits for a disk. Written segments are released first.
+ *
+ * @param[in] stripe   Striped capture
+ * @param[in] hNetBuf  Segment
+ *
+ * @retval NT_SUCCESS          The segment is queued and will be released when written
+ * @retval NT_STATUS_TRYAGAIN  No disk has room - the segment is not taken
+ * @retval otherwise           All disks have failed, or the error returned by the release function
+ */
+static NT_INLINE int _nt_capstripe_put(NtCapStripe_t* stripe, NtNetBuf_t hNetBuf)
+{
+  uint64_t length = NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+  struct _NtCapStripeDisk_s* disk;
+  NtSegRef_t* ref;
+  uint32_t d;
+  int status;
+
+  if ((status = _nt_segref_reclaim(&stripe->pool)) != NT_SUCCESS) {
+    return status;
+  }
+  d = _nt_capstripe_choose(stripe, length);
+  if (d == stripe->numDisks) {
+    for (d = 0; d < stripe->numDisks; d++) {
+      if (_nt_atomic_load_acquire_u32(&stripe->disks[d].error) == 0) {
+        stripe->stat.allFull++;
+        return NT_STATUS_TRYAGAIN;
+      }
+    }
+    return (int)stripe->disks[0].error;
+  }
+  if ((status = _nt_segref_add(&stripe->pool, hNetBuf, &ref)) != NT_SUCCESS) {
+    return status;
+  }
+  stripe->stat.segments++;
+  stripe->stat.bytes += length;
+  if (length == 0) {
+    // Nothing to write - released in order with the others
+    stripe->stat.empty++;
+    _nt_segref_drop(ref);
+    return NT_SUCCESS;
+  }
+  disk = &stripe->disks[d];
+  {
+    struct NtNetBuf_s pkt;
+    _nt_net_build_pkt_netbuf(hNetBuf, &pkt);
+    disk->stat.lastTs = _nt_merge_pkt_timestamp(&pkt);
+    if (disk->stat.segments == 0) {
+      disk->stat.firstTs = disk->stat.lastTs;
+    }
+  }
+  disk->stat.segments++;
+  disk->stat.bytes += length;
+  (void)_nt_ring_enqueue(&disk->ready, &ref);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Receive a segment and queue it to a disk - receiving thread only
+ *
+ * A segment no disk had room for, or that could not be queued because
+ * of an error, is kept and queued first on the next call, and released by
+ * @ref _nt_capstripe_close if it is still kept, so segments are always
+ * released in order. While it is kept no segment is received, so the
+ * stream is only read as fast as the disks write and the adapter applies
+ * the host buffer allowance.
+ *
+ * @param[in] stripe   Striped capture opened with @ref _nt_capstripe_open
+ * @param[in] timeout  Time to wait for data in milliseconds
+ *
+ * @retval NT_SUCCESS          A segment was received
+ * @retval NT_STATUS_TRYAGAIN  No disk has room - no segment was received
+ * @retval otherwise           Status returned by @ref NT_NetRxGet or @ref _nt_capstripe_put - a received segment is kept
+ */
+static NT_INLINE int _nt_capstripe_rx(NtCapStripe_t* stripe, int timeout)
+{
+  NtNetBuf_t hNetBuf;
+  int status;
+  if (stripe->pending != NULL) {
+    if ((status = _nt_capstripe_put(stripe, stripe->pending)) != NT_SUCCESS) {
+      return status;
+    }
+    stripe->pending = NULL;
+  }
+  if ((status = NT_NetRxGet(stripe->hStream, &hNetBuf, timeout)) != NT_SUCCESS) {
+    return status;
+  }
+  if ((status = _nt_capstripe_put(stripe, hNetBuf)) != NT_SUCCESS) {
+    // Not taken - releasing it now would release it before older segments
+    stripe->pending = hNetBuf;
+    return status == NT_STATUS_TRYAGAIN ? NT_SUCCESS : status;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * Striped capture reader
+ */
+typedef struct NtCapStripeReader_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtMerge_t merge;
+  NtCapFile_t *files;
+  uint32_t numFiles;
+#endif
+} NtCapStripeReader_t;
+
+/**
+ * @brief Close a striped capture reader
+ *
+ * @param[in] reader  Striped capture reader
+ */
+static NT_INLINE void _nt_capstripe_reader_close(NtCapStripeReader_t* reader)
+{
+  uint32_t f;
+  _nt_merge_close(&reader->merge);
+  for (f = 0; f < reader->numFiles; f++) {
+    _nt_capfile_close(&reader->files[f]);
+  }
+  free(reader->files);
+  memset(reader, 0, sizeof(*reader));
+}
+
+/**
+ * @brief Open the files of a striped capture as one stream in time stamp order
+ *
+ * The files listed in the manifest are opened with @ref _nt_capfile_open
+ * and merged with @ref _nt_merge_get. Files without segments are skipped.
+ *
+ * @param[out] reader      Striped capture reader
+ * @param[in]  manifest    Manifest file name
+ * @param[in]  config      Configuration of the file readers - NULL selects the defaults
+ * @param[in]  numThreads  Number of read-ahead threads of the merge reader
+ *
+ * @retval NT_SUCCESS               Success
+ * @retval NT_ERROR_NOT_NT_CAPFILE  The manifest is not valid
+ * @retval otherwise                Error opening the manifest or a file
+ */
+static NT_INLINE int _nt_capstripe_reader_open(NtCapStripeReader_t* reader, const char* manifest, const NtCapFileConfig_t* config,
+                                               uint32_t numThreads)
+{
+  char line[NT_CAPSTRIPE_MAX_PATH + 128];
+  uint32_t maxFiles = 0;
+  int status = NT_SUCCESS, version;
+  FILE* f;
+
+  memset(reader, 0, sizeof(*reader));
+  if ((f = fopen(manifest, "r")) == NULL) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "ntcapstripe %d", &version) != 1 || version != 1) {
+    fclose(f);
+    return NT_ERROR_NOT_NT_CAPFILE;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    maxFiles++;
+  }
+  reader->files = (NtCapFile_t*)calloc(maxFiles ? maxFiles : 1, sizeof(NtCapFile_t));
+  if (reader->files == NULL) {
+    fclose(f);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  if ((status = _nt_merge_init(&reader->merge, maxFiles ? maxFiles : 1, 4, numThreads)) != NT_SUCCESS) {
+    free(reader->files);
+    reader->files = NULL;
+    fclose(f);
+    return status;
+  }
+  // Skip the version line
+  rewind(f);
+  if (fgets(line, sizeof(line), f) == NULL) {
+    status = NT_ERROR_NOT_NT_CAPFILE;
+  }
+  while (status == NT_SUCCESS && fgets(line, sizeof(line), f) != NULL) {
+    unsigned long long segments, bytes, firstTs, lastTs;
+    int error, pos = 0;
+    size_t len;
+    if (sscanf(line, "file %llu %llu %llu %llu %d %n", &segments, &bytes, &firstTs, &lastTs, &error, &pos) != 5 || pos == 0) {
+      status = NT_ERROR_NOT_NT_CAPFILE;
+      break;
+    }
+    len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (segments == 0) {
+      continue;
+    }
+    if ((status = _nt_capfile_open(&reader->files[reader->numFiles], line + pos, config)) != NT_SUCCESS) {
+      break;
+    }
+    reader->numFiles++;
+    status = _nt_merge_add_capfile(&reader->merge, &reader->files[reader->numFiles - 1]);
+  }
+  fclose(f);
+  if (status != NT_SUCCESS) {
+    _nt_capstripe_reader_close(reader);
+  }
+  return status;
+}
+
+/**
+ * @brief Get the next packet of a striped capture in time stamp order
+ *
+ * See @ref _nt_merge_get.
+ */
+static NT_INLINE int _nt_capstripe_reader_get(NtCapStripeReader_t* reader, NtNetBuf_t* hNetBuf)
+{
+  return _nt_merge_get(&reader->merge, hNetBuf);
+}
+
+#endif // __CAPSTRIPE_H__
@@ -0,0 +1,683 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a capture file writer that writes segments
+ * from the host buffer without copying them. The file is opened with
+ * O_DIRECT and the segment memory is submitted straight to asynchronous
+ * writes, io_uring when available. A segment is released with
+ * @ref NT_NetRxRelease only when all writes of it have completed, and the
+ * segments are released in the order they were received.
+ *
+ * Direct I/O needs the memory and the file offset aligned to
+ * @ref NT_AIO_DIRECT_ALIGN. The bytes of a segment before the first
+ * aligned file offset and after the last one are copied into write
+ * buffers that also hold the file header, and the aligned part in between
+ * is written from the host buffer when its memory address is aligned as
+ * direct I/O requires. Linux reports the memory alignment of the file
+ * system with statx, commonly a few bytes for NVMe drives, so nearly all
+ * segments are written without copying them. Otherwise the memory must
+ * have the alignment of the file offset, which holds for consecutive
+ * segments until the host buffer wraps. Segments not aligned are copied.
+ * The write buffers are registered with io_uring.
+ *
+ * Without O_DIRECT, when the file system does not support it or
+ * buffered mode is configured, every segment is written from the host
+ * buffer and the kernel copies it into the page cache.
+ *
+ */
+#ifndef __CAPWRITE_H__
+#define __CAPWRITE_H__
+
+#include "nt.h"
+#include "aio.h"
+#include "compat.h"
+#include "segref.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/stat.h>)
+#include <linux/stat.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+// AT_FDCWD is only defined by fcntl.h when _ATFILE_SOURCE is defined
+#if defined(AT_FDCWD)
+#define _NT_CAPWRITE_AT_FDCWD AT_FDCWD
+#elif defined(__linux__)
+#define _NT_CAPWRITE_AT_FDCWD -100
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Capture file writer configuration. Zero selects the default value.
+ */
+typedef struct NtCapWriteConfig_s {
+  uint32_t bufferSize;      //!< Size of a write buffer - a multiple of @ref NT_AIO_DIRECT_ALIGN. Default is 1 MB
+  uint32_t numBuffers;      //!< Number of write buffers. Default is 8
+  uint32_t depth;           //!< Maximum number of writes in flight. Default is 32
+  uint32_t maxSegments;     //!< Maximum number of segments held. Default is 64
+  enum NtAioBackend_e backend; //!< Asynchronous I/O backend. Default is @ref NT_AIO_BACKEND_AUTO
+  uint32_t numThreads;      //!< Number of threads used by the thread pool backend. Default is 4
+  int buffered;             //!< Do not open the file with O_DIRECT
+  int copy;                 //!< Copy all segments into the write buffers - the baseline of the benchmark
+  int overwrite;            //!< Overwrite an existing file in place instead of truncating it, e.g. a preallocated file. The file size is not changed
+} NtCapWriteConfig_t;
+
+/**
+ * Capture file writer counters
+ */
+typedef struct NtCapWriteStat_s {
+  enum NtAioBackend_e backend;  //!< Asynchronous I/O backend in use
+  int direct;               //!< Set if the file is written with O_DIRECT
+  int registered;           //!< Set if the write buffers are registered with io_uring
+  uint32_t memAlign;        //!< Memory alignment required to write segments from the host buffer
+  uint64_t segments;        //!< Segments written
+  uint64_t released;        //!< Segments released
+  uint64_t bytes;           //!< Bytes written to the file including the file header
+  uint64_t zeroCopyBytes;   //!< Segment bytes written from the host buffer
+  uint64_t copiedBytes;     //!< Segment bytes copied into the write buffers
+  uint64_t writes;          //!< Writes submitted
+  uint32_t queueDepth;      //!< Writes in flight
+  uint32_t maxQueueDepth;   //!< Highest number of writes in flight
+  uint64_t stalls;          //!< Times the writer waited for a write to complete
+  uint64_t stallNs;         //!< Total time spent waiting for writes to complete
+} NtCapWriteStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtCapWriteReq_s {
+  NtAioReq_t req;            // Must be first
+  int32_t buffer;            // Write buffer or -1 for segment memory
+  uint64_t seg;              // Segment written from - segment memory only
+  int busy;                  // Submitted and not completed
+};
+
+struct _NtCapWriteSeg_s {
+  NtNetBuf_t hNetBuf;
+  uint32_t pending;          // Writes not completed
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Capture file writer
+ */
+typedef struct NtCapWrite_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtCapWriteConfig_t config;
+  int fd;
+  NtAio_t aio;
+  NtSegRefRelease_t release;
+  void *releaseCtx;
+  uint8_t **bufs;
+  uint32_t *freeBufs;
+  uint32_t numFreeBufs;
+  int32_t cur;               // Write buffer being filled or -1
+  uint64_t curOffset;        // File offset of the write buffer
+  uint32_t curFill;
+  struct _NtCapWriteReq_s *reqs;
+  uint32_t *freeReqs;
+  uint32_t numFreeReqs;
+  struct _NtCapWriteSeg_s *segs;
+  uint64_t segHead;          // Next segment to release
+  uint64_t segTail;          // Next segment to add
+  uint64_t pos;              // File length
+  int error;
+  NtCapWriteStat_t stat;
+#endif
+} NtCapWrite_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Release the segments with all writes completed, oldest first
+ */
+static NT_INLINE void _nt_capwrite_release_done(NtCapWrite_t* w)
+{
+  while (w->segHead != w->segTail) {
+    struct _NtCapWriteSeg_s* seg = &w->segs[w->segHead % w->config.maxSegments];
+    if (seg->pending != 0) {
+      break;
+    }
+    (void)w->release(w->releaseCtx, seg->hNetBuf);
+    w->segHead++;
+    w->stat.released++;
+  }
+}
+
+static NT_INLINE void _nt_capwrite_complete(NtCapWrite_t* w, NtAioReq_t* req)
+{
+  struct _NtCapWriteReq_s* r = (struct _NtCapWriteReq_s*)req;
+  r->busy = 0;
+  if (req->result != (int64_t)req->length && w->error == NT_SUCCESS) {
+    w->error = req->result < 0 ? NT_AIO_ERRNO(-req->result) : NT_AIO_ERRNO(EIO);
+  }
+  if (r->buffer >= 0) {
+    w->freeBufs[w->numFreeBufs++] = (uint32_t)r->buffer;
+  } else {
+    w->segs[r->seg % w->config.maxSegments].pending--;
+  }
+  w->freeReqs[w->numFreeReqs++] = (uint32_t)(r - w->reqs);
+}
+
+/*
+ * Complete the finished writes - waits for one if block is set and none
+ * has finished
+ */
+static NT_INLINE void _nt_capwrite_reap(NtCapWrite_t* w, int block)
+{
+  NtAioReq_t* req = NULL;
+  int status = _nt_aio_wait(&w->aio, &req, 0);
+  if (status == NT_STATUS_TRYAGAIN && block) {
+    uint64_t start = _nt_compat_now_ns();
+    status = _nt_aio_wait(&w->aio, &req, 1);
+    w->stat.stalls++;
+    w->stat.stallNs += _nt_compat_now_ns() - start;
+  }
+  while (status == NT_SUCCESS) {
+    _nt_capwrite_complete(w, req);
+    status = _nt_aio_wait(&w->aio, &req, 0);
+  }
+  w->stat.queueDepth = w->aio.outstanding;
+}
+
+/*
+ * Submit a write from a write buffer or, if buffer is -1, from the memory
+ * of segment seg
+ */
+static NT_INLINE int _nt_capwrite_submit(NtCapWrite_t* w, int32_t buffer, uint64_t seg, void* data, uint32_t length, uint64_t offset)
+{
+  struct _NtCapWriteReq_s* r;
+  int status;
+  while (w->numFreeReqs == 0) {
+    _nt_capwrite_reap(w, 1);
+  }
+  r = &w->reqs[w->freeReqs[--w->numFreeReqs]];
+  memset(&r->req, 0, sizeof(r->req));
+  r->req.op = NT_AIO_OP_WRITE;
+  r->req.buf = data;
+  r->req.length = length;
+  r->req.offset = offset;
+  r->req.fixed = buffer >= 0 && w->aio.registered != 0 ? (uint32_t)buffer + 1 : 0;
+  r->buffer = buffer;
+  r->seg = seg;
+  r->busy = 1;
+  if (buffer < 0) {
+    w->segs[seg % w->config.maxSegments].pending++;
+  }
+  if ((status = _nt_aio_submit(&w->aio, &r->req)) != NT_SUCCESS) {
+    // Complete the write as failed so the buffer or segment is returned
+    r->req.result = -EIO;
+    _nt_capwrite_complete(w, &r->req);
+    w->error = status;
+    return status;
+  }
+  w->stat.writes++;
+  if (w->aio.outstanding > w->stat.maxQueueDepth) {
+    w->stat.maxQueueDepth = w->aio.outstanding;
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Submit the write buffer being filled. With O_DIRECT the length is padded
+ * to the direct I/O alignment with zeros, which are overwritten or
+ * truncated later.
+ */
+static NT_INLINE int _nt_capwrite_flush(NtCapWrite_t* w)
+{
+  int32_t buffer = w->cur;
+  uint32_t length = w->curFill;
+  if (w->stat.direct) {
+    length = (length + NT_AIO_DIRECT_ALIGN - 1) & ~(uint32_t)(NT_AIO_DIRECT_ALIGN - 1);
+  }
+  if (buffer < 0) {
+    return NT_SUCCESS;
+  }
+  w->cur = -1;
+  if (w->curFill == 0) {
+    w->freeBufs[w->numFreeBufs++] = (uint32_t)buffer;
+    return NT_SUCCESS;
+  }
+  memset(w->bufs[buffer] + w->curFill, 0, length - w->curFill);
+  return _nt_capwrite_submit(w, buffer, 0, w->bufs[buffer], length, w->curOffset);
+}
+
+/*
+ * Append data to the file through the write buffers
+ */
+static NT_INLINE int _nt_capwrite_copy(NtCapWrite_t* w, const uint8_t* data, uint64_t length)
+{
+  while (length > 0) {
+    uint32_t n;
+    if (w->cur < 0) {
+      while (w->numFreeBufs == 0) {
+        _nt_capwrite_reap(w, 1);
+      }
+      // A new write buffer always starts at an aligned file offset
+      w->cur = (int32_t)w->freeBufs[--w->numFreeBufs];
+      w->curOffset = w->pos;
+      w->curFill = 0;
+    }
+    n = w->config.bufferSize - w->curFill;
+    if ((uint64_t)n > length) {
+      n = (uint32_t)length;
+    }
+    memcpy(w->bufs[w->cur] + w->curFill, data, n);
+    w->curFill += n;
+    w->pos += n;
+    data += n;
+    length -= n;
+    if (w->curFill == w->config.bufferSize) {
+      int status = _nt_capwrite_flush(w);
+      if (status != NT_SUCCESS) {
+        return status;
+      }
+    }
+  }
+  return NT_SUCCESS;
+}
+
+static NT_INLINE void _nt_capwrite_free(NtCapWrite_t* w)
+{
+  uint32_t i;
+  for (i = 0; w->bufs != NULL && i < w->config.numBuffers; i++) {
+    _nt_aio_free(w->bufs[i]);
+  }
+  free(w->bufs);
+  free(w->freeBufs);
+  free(w->reqs);
+  free(w->freeReqs);
+  free(w->segs);
+  if (w->fd >= 0) {
+#ifdef _MSC_VER
+    _close(w->fd);
+#else
+    close(w->fd);
+#endif
+  }
+  memset(w, 0, sizeof(*w));
+  w->fd = -1;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Open a capture file writer releasing segments with a function
+ *
+ * Used to write segments that are not received with @ref NT_NetRxGet.
+ *
+ * @param[out] w           Capture file writer
+ * @param[in]  name        File name - the file is created, and truncated unless overwrite is configured
+ * @param[in]  header      File header written first - NULL writes none
+ * @param[in]  headerSize  Size of the file header
+ * @param[in]  release     Function releasing a segment when it has been written
+ * @param[in]  ctx         Context passed to the release function
+ * @param[in]  config      Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error opening the file
+ */
+static NT_INLINE int _nt_capwrite_open_release(NtCapWrite_t* w, const char* name, const void* header, uint32_t headerSize,
+                                               NtSegRefRelease_t release, void* ctx, const NtCapWriteConfig_t* config)
+{
+  uint32_t i;
+  int status;
+#ifndef _MSC_VER
+  int flags;
+#endif
+  memset(w, 0, sizeof(*w));
+  w->fd = -1;
+  w->cur = -1;
+  if (config != NULL) {
+    w->config = *config;
+  }
+  if (w->config.bufferSize == 0) {
+    w->config.bufferSize = 1024 * 1024;
+  }
+  if (w->config.numBuffers == 0) {
+    w->config.numBuffers = 8;
+  }
+  if (w->config.depth == 0) {
+    w->config.depth = 32;
+  }
+  if (w->config.maxSegments == 0) {
+    w->config.maxSegments = 64;
+  }
+  if (w->config.numThreads == 0) {
+    w->config.numThreads = 4;
+  }
+  if ((w->config.bufferSize % NT_AIO_DIRECT_ALIGN) != 0 || release == NULL) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  w->release = release;
+  w->releaseCtx = ctx;
+
+#ifdef _MSC_VER
+  w->fd = _open(name, _O_WRONLY | _O_CREAT | (w->config.overwrite ? 0 : _O_TRUNC) | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+  flags = O_WRONLY | O_CREAT | (w->config.overwrite ? 0 : O_TRUNC);
+#ifdef _NT_AIO_O_DIRECT
+  if (!w->config.buffered) {
+    // Not all file systems support direct I/O
+    w->fd = open(name, flags | _NT_AIO_O_DIRECT, 0644);
+    w->stat.direct = w->fd >= 0;
+  }
+#endif
+#if defined(STATX_DIOALIGN) && defined(__NR_statx) && defined(_NT_CAPWRITE_AT_FDCWD)
+  if (w->stat.direct) {
+    struct statx stx;
+    memset(&stx, 0, sizeof(stx));
+    if (syscall(__NR_statx, _NT_CAPWRITE_AT_FDCWD, name, 0, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) != 0 &&
+        stx.stx_dio_mem_align != 0 && stx.stx_dio_mem_align < NT_AIO_DIRECT_ALIGN) {
+      w->stat.memAlign = stx.stx_dio_mem_align;
+    }
+  }
+#endif
+  if (w->fd < 0) {
+    w->fd = open(name, flags, 0644);
+  }
+#endif
+  if (w->fd < 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+  if (w->stat.memAlign == 0) {
+    w->stat.memAlign = NT_AIO_DIRECT_ALIGN;
+  }
+
+  w->bufs = (uint8_t**)calloc(w->config.numBuffers, sizeof(uint8_t*));
+  w->freeBufs = (uint32_t*)calloc(w->config.numBuffers, sizeof(uint32_t));
+  w->reqs = (struct _NtCapWriteReq_s*)calloc(w->config.depth, sizeof(struct _NtCapWriteReq_s));
+  w->freeReqs = (uint32_t*)calloc(w->config.depth, sizeof(uint32_t));
+  w->segs = (struct _NtCapWriteSeg_s*)calloc(w->config.maxSegments, sizeof(struct _NtCapWriteSeg_s));
+  if (w->bufs == NULL || w->freeBufs == NULL || w->reqs == NULL || w->freeReqs == NULL || w->segs == NULL) {
+    _nt_capwrite_free(w);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (i = 0; i < w->config.numBuffers; i++) {
+    if ((w->bufs[i] = (uint8_t*)_nt_aio_alloc(w->config.bufferSize)) == NULL) {
+      _nt_capwrite_free(w);
+      return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+    w->freeBufs[w->numFreeBufs++] = w->config.numBuffers - 1 - i;
+  }
+  for (i = 0; i < w->config.depth; i++) {
+    w->freeReqs[w->numFreeReqs++] = w->config.depth - 1 - i;
+  }
+  if ((status = _nt_aio_open(&w->aio, w->fd, w->config.backend, w->config.depth, w->config.numThreads)) != NT_SUCCESS) {
+    _nt_capwrite_free(w);
+    return status;
+  }
+  // Registration needs locked memory - the buffers are used unregistered if it fails
+  (void)_nt_aio_register(&w->aio, (void* const*)w->bufs, w->config.numBuffers, w->config.bufferSize);
+  w->stat.backend = w->aio.backend;
+  w->stat.registered = w->aio.registered != 0;
+  if (header != NULL && (status = _nt_capwrite_copy(w, (const uint8_t*)header, headerSize)) != NT_SUCCESS) {
+    _nt_aio_close(&w->aio);
+    _nt_capwrite_free(w);
+    return status;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Open a capture file writer for an RX stream
+ *
+ * The file header of the stream is read with
+ * @ref NT_NETRX_READ_CMD_GET_FILE_HEADER and written first, and the
+ * segments are released with @ref NT_NetRxRelease.
+ *
+ * @param[out] w        Capture file writer
+ * @param[in]  name     File name - the file is created or truncated
+ * @param[in]  hStream  Segment RX stream the segments are received from
+ * @param[in]  config   Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref NT_NetRxRead or @ref _nt_capwrite_open_release
+ */
+static NT_INLINE int _nt_capwrite_open(NtCapWrite_t* w, const char* name, NtNetStreamRx_t hStream, const NtCapWriteConfig_t* config)
+{
+  NtNetRx_t rx;
+  int status;
+  memset(&rx, 0, sizeof(rx));
+  rx.cmd = NT_NETRX_READ_CMD_GET_FILE_HEADER;
+  if ((status = NT_NetRxRead(hStream, &rx)) != NT_SUCCESS) {
+    return status;
+  }
+  if (rx.u.fileheader.size <= 0 || rx.u.fileheader.size > (int32_t)sizeof(rx.u.fileheader.data)) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  return _nt_capwrite_open_release(w, name, rx.u.fileheader.data, (uint32_t)rx.u.fileheader.size,
+                                   _nt_segref_rx_release_cb, (void*)hStream, config);
+}
+
+/**
+ * @brief Write a segment
+ *
+ * The writer takes the segment and releases it when it has been written.
+ * Completed writes are processed, and the call waits for writes to
+ * complete when the maximum number of segments is held.
+ *
+ * The segment is taken also when an error is returned. It is then
+ * released in order with the others once the writes in flight have
+ * completed, at the latest by @ref _nt_capwrite_close, so the caller must
+ * never release a segment given to the writer.
+ *
+ * @param[in] w        Capture file writer
+ * @param[in] hNetBuf  Segment
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   A write has failed - the segment is taken anyway
+ */
+static NT_INLINE int _nt_capwrite_put(NtCapWrite_t* w, NtNetBuf_t hNetBuf)
+{
+  uint8_t* data = (uint8_t*)NT_NET_GET_SEGMENT_PTR(hNetBuf);
+  uint64_t length = NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+  uint64_t seq;
+  int status = NT_SUCCESS;
+
+  _nt_capwrite_reap(w, 0);
+  _nt_capwrite_release_done(w);
+  // Writes in flight complete also after an error, so this always ends
+  while (w->segTail - w->segHead == w->config.maxSegments) {
+    _nt_capwrite_reap(w, 1);
+    _nt_capwrite_release_done(w);
+  }
+  seq = w->segTail++;
+  w->segs[seq % w->config.maxSegments].hNetBuf = hNetBuf;
+  w->segs[seq % w->config.maxSegments].pending = 0;
+  if (w->error != NT_SUCCESS) {
+    // Nothing is written after an error - release the segment in order
+    _nt_capwrite_release_done(w);
+    return w->error;
+  }
+  w->stat.segments++;
+  w->stat.bytes += length;
+
+  if (!w->config.copy && !w->stat.direct) {
+    // The kernel copies into the page cache - no alignment needed
+    status = w->cur >= 0 ? _nt_capwrite_flush(w) : NT_SUCCESS;
+    while (status == NT_SUCCESS && length > 0) {
+      uint32_t n = length > 0x40000000 ? 0x40000000 : (uint32_t)length;
+      status = _nt_capwrite_submit(w, -1, seq, data, n, w->pos);
+      w->pos += n;
+      w->stat.zeroCopyBytes += n;
+      data += n;
+      length -= n;
+    }
+  } else {
+    uint64_t head = (NT_AIO_DIRECT_ALIGN - (w->pos % NT_AIO_DIRECT_ALIGN)) % NT_AIO_DIRECT_ALIGN;
+    if (!w->config.copy && ((uintptr_t)data + head) % w->stat.memAlign == 0 && length >= head + NT_AIO_DIRECT_ALIGN) {
+      uint64_t middle = (length - head) & ~(uint64_t)(NT_AIO_DIRECT_ALIGN - 1);
+      // Complete the write buffer up to the aligned file offset
+      status = _nt_capwrite_copy(w, data, head);
+      if (status == NT_SUCCESS) {
+        status = _nt_capwrite_flush(w);
+      }
+      w->stat.copiedBytes += head;
+      data += head;
+      length -= head;
+      while (status == NT_SUCCESS && middle > 0) {
+        uint32_t n = middle > 0x40000000 ? 0x40000000 : (uint32_t)middle;
+        status = _nt_capwrite_submit(w, -1, seq, data, n, w->pos);
+        w->pos += n;
+        w->stat.zeroCopyBytes += n;
+        data += n;
+        length -= n;
+        middle -= n;
+      }
+    }
+    if (status == NT_SUCCESS) {
+      status = _nt_capwrite_copy(w, data, length);
+      w->stat.copiedBytes += length;
+    }
+  }
+  _nt_capwrite_release_done(w);
+  return status;
+}
+/**
+ * @brief Process completed writes
+ *
+ * Releases the segments written. Called when no segment is put for a
+ * while, so the segments are not held until the next one.
+ *
+ * @param[in] w      Capture file writer
+ * @param[in] block  Wait for a write to complete if any is in flight
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   A write has failed
+ */
+static NT_INLINE int _nt_capwrite_poll(NtCapWrite_t* w, int block)
+{
+  _nt_capwrite_reap(w, block && w->aio.outstanding > 0);
+  _nt_capwrite_release_done(w);
+  return w->error;
+}
+
+/**
+ * @brief Get the file length up to which all writes have completed
+ *
+ * Data before it is in the file, data after it may still be in a write
+ * buffer or in flight. Scans the writes in flight, so call it now and then,
+ * not per segment.
+ *
+ * @param[in] w  Capture file writer
+ *
+ * @retval File offset up to which all writes have completed
+ */
+static NT_INLINE uint64_t _nt_capwrite_written(const NtCapWrite_t* w)
+{
+  uint64_t written = w->cur >= 0 ? w->curOffset : w->pos;
+  uint32_t i;
+  for (i = 0; i < w->config.depth; i++) {
+    if (w->reqs[i].busy && w->reqs[i].req.offset < written) {
+      written = w->reqs[i].req.offset;
+    }
+  }
+  return written;
+}
+
+/**
+ * @brief Get the counters of a capture file writer
+ *
+ * @param[in]  w     Capture file writer
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_capwrite_get_stat(NtCapWrite_t* w, NtCapWriteStat_t* stat)
+{
+  *stat = w->stat;
+  stat->queueDepth = w->aio.outstanding;
+}
+
+/**
+ * @brief Close a capture file writer
+ *
+ * The buffered data is written, all segments are released and the file
+ * is closed.
+ *
+ * @param[in]  w     Capture file writer
+ * @param[out] stat  Counters after the last write - may be NULL
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   A write has failed
+ */
+static NT_INLINE int _nt_capwrite_close(NtCapWrite_t* w, NtCapWriteStat_t* stat)
+{
+  NtAioReq_t* req;
+  int status = _nt_capwrite_flush(w);
+  while (_nt_aio_wait(&w->aio, &req, 1) == NT_SUCCESS) {
+    _nt_capwrite_complete(w, req);
+  }
+  _nt_capwrite_release_done(w);
+  if (status == NT_SUCCESS) {
+    status = w->error;
+  }
+  // Remove the padding of the last direct write
+  if (status == NT_SUCCESS && (w->pos % NT_AIO_DIRECT_ALIGN) != 0 && !w->config.overwrite) {
+#ifdef _MSC_VER
+    if (_chsize_s(w->fd, (__int64)w->pos) != 0) {
+      status = NT_AIO_ERRNO(errno);
+    }
+#else
+    if (ftruncate(w->fd, (off_t)w->pos) != 0) {
+      status = NT_AIO_ERRNO(errno);
+    }
+#endif
+  }
+  if (stat != NULL) {
+    _nt_capwrite_get_stat(w, stat);
+  }
+  _nt_aio_close(&w->aio);
+  _nt_capwrite_free(w);
+  return status;
+}
+
+#endif // __CAPWRITE_H__
@@ -0,0 +1,153 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the portability helpers shared by the NTUTIL
+ * headers. It owns the decision of which POSIX and Linux declarations the
+ * C library hides in strict ISO C modes (e.g. -std=c99) and supplies them
+ * where they are missing, so the other headers build unchanged in every
+ * language mode.
+ *
+ */
+#ifndef __COMPAT_H__
+#define __COMPAT_H__
+
+#include "nt.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Set when the C library may hide the POSIX declarations - glibc only
+ * declares them when _POSIX_C_SOURCE asks for them, and strict ISO C
+ * modes leave it undefined
+ */
+#if defined(__linux__) && !defined(__cplusplus) && (!defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L)
+#define _NT_COMPAT_POSIX_HIDDEN 1
+#endif
+
+#ifdef _NT_COMPAT_POSIX_HIDDEN
+/*
+ * struct timespec is incomplete before C11, so the clock and sleep pass
+ * this layout compatible copy to the C library
+ */
+struct _NtCompatTimespec_s {
+  time_t tv_sec;
+  long tv_nsec;
+};
+#define _NT_COMPAT_TIMESPEC struct _NtCompatTimespec_s
+#define _NT_COMPAT_CLOCK_MONOTONIC 1 // CLOCK_MONOTONIC of Linux
+
+struct timespec;
+extern int clock_gettime(int clk, struct timespec* tp);
+extern int nanosleep(const struct timespec* req, struct timespec* rem);
+extern ssize_t pread(int fd, void* buf, size_t count, off_t offset);
+extern ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset);
+extern int ftruncate(int fd, off_t length);
+extern int fdatasync(int fd);
+extern int posix_fallocate(int fd, off_t offset, off_t len);
+extern int posix_memalign(void** memptr, size_t alignment, size_t size);
+#elif !defined(_MSC_VER)
+#define _NT_COMPAT_TIMESPEC struct timespec
+#define _NT_COMPAT_CLOCK_MONOTONIC CLOCK_MONOTONIC
+#endif
+
+// syscall is a BSD extension that glibc only declares with _DEFAULT_SOURCE
+#if defined(__linux__) && !defined(__cplusplus) && !defined(_DEFAULT_SOURCE)
+extern long syscall(long number, ...);
+#endif
+
+#ifndef _MSC_VER
+// MAP_ANONYMOUS is only defined by sys/mman.h when _DEFAULT_SOURCE is defined
+#if defined(MAP_ANONYMOUS)
+#define _NT_COMPAT_MAP_ANONYMOUS MAP_ANONYMOUS
+#elif defined(MAP_ANON)
+#define _NT_COMPAT_MAP_ANONYMOUS MAP_ANON
+#elif defined(__linux__)
+#define _NT_COMPAT_MAP_ANONYMOUS 0x20
+#endif
+#endif
+
+/*
+ * Monotonic clock in nanoseconds
+ */
+static NT_INLINE uint64_t _nt_compat_now_ns(void)
+{
+#ifdef _MSC_VER
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)((double)now.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+  _NT_COMPAT_TIMESPEC ts;
+  (void)clock_gettime(_NT_COMPAT_CLOCK_MONOTONIC, (struct timespec*)(void*)&ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+ * Sleep for ns nanoseconds - Windows sleeps whole milliseconds, rounded down
+ */
+static NT_INLINE void _nt_compat_sleep_ns(uint64_t ns)
+{
+#ifdef _MSC_VER
+  Sleep((DWORD)(ns / 1000000));
+#else
+  _NT_COMPAT_TIMESPEC ts;
+  ts.tv_sec = (time_t)(ns / 1000000000ULL);
+  ts.tv_nsec = (long)(ns % 1000000000ULL);
+  (void)nanosleep((const struct timespec*)(const void*)&ts, NULL);
+#endif
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+#endif // __COMPAT_H__
@@ -0,0 +1,521 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a benchmark of the packet descriptor
+ * accessors. Each @ref PacketMacros accessor that the descriptor layout
+ * of a segment supports is run on every packet of the segment, and the
+ * cost is reported in nanoseconds, cycles, instructions and cache misses
+ * per packet. The segment walks - @ref _nt_net_get_next_packet,
+ * @ref _nt_net_get_packet_burst and @ref _nt_segindex_build - are
+ * measured the same way. Each accessor is measured including the walk,
+ * so the cost of the accessor itself is the difference to the
+ * "SEGMENT_WALK" entry.
+ *
+ * @ref _nt_descbench_replay replays an NT capture file through
+ * @ref NT_NetFileGet and @ref _nt_net_get_packet_burst and reports the
+ * packets per second for burst sizes of 1, 8, 32 and 256 packets.
+ *
+ * Segments with any descriptor layout can be made with the segment
+ * generator in seggen.h. The cycle, instruction and cache miss counts
+ * come from perf.h and are 0 where the counters are not available.
+ *
+ */
+#ifndef __DESCBENCH_H__
+#define __DESCBENCH_H__
+
+#include "nt.h"
+#include "compat.h"
+#include "perf.h"
+#include "segindex.h"
+
+/**
+ * @defgroup DescBenchFormats Descriptor layout flags
+ * @{
+ */
+#define NT_DESCBENCH_STD0 (1U << 0)   //!< Standard descriptor 0
+#define NT_DESCBENCH_EXT7 (1U << 7)   //!< Extended descriptor 7
+#define NT_DESCBENCH_EXT8 (1U << 8)   //!< Extended descriptor 8
+#define NT_DESCBENCH_EXT9 (1U << 9)   //!< Extended descriptor 9
+#define NT_DESCBENCH_DYN1 (1U << 17)  //!< Dynamic descriptor 1
+#define NT_DESCBENCH_DYN2 (1U << 18)  //!< Dynamic descriptor 2
+#define NT_DESCBENCH_DYN3 (1U << 19)  //!< Dynamic descriptor 3
+#define NT_DESCBENCH_EXT (NT_DESCBENCH_EXT7 | NT_DESCBENCH_EXT8 | NT_DESCBENCH_EXT9) //!< Extended descriptors
+#define NT_DESCBENCH_NT (NT_DESCBENCH_STD0 | NT_DESCBENCH_EXT)                      //!< Standard and extended descriptors
+#define NT_DESCBENCH_DYN (NT_DESCBENCH_DYN1 | NT_DESCBENCH_DYN2 | NT_DESCBENCH_DYN3) //!< Dynamic descriptors
+#define NT_DESCBENCH_ALL (NT_DESCBENCH_NT | NT_DESCBENCH_DYN)                       //!< All descriptors
+/** @} */
+
+/**
+ * Benchmark function - returns a checksum of the values read and the
+ * number of packets visited. idx is a segment index with room for 1024
+ * packets, used by the entries that index the segment.
+ */
+typedef uint64_t (*NtDescBenchFn_t)(struct NtNetBuf_s *segNetBuf, NtSegIndex_t *idx, uint64_t *pkts);
+
+/**
+ * Benchmark entry
+ */
+typedef struct NtDescBench_s {
+  const char *name;         //!< Accessor name without the NT_NET_GET_PKT_ prefix
+  uint32_t formats;         //!< Descriptor layouts the accessor supports. See @ref DescBenchFormats
+  NtDescBenchFn_t fn;       //!< Benchmark function
+} NtDescBench_t;
+
+/**
+ * Benchmark result
+ */
+typedef struct NtDescBenchResult_s {
+  const char *name;         //!< Accessor name
+  uint64_t pkts;            //!< Packets measured - the packets of the segment times the repeat count
+  double ns;                //!< Nanoseconds per packet
+  double pps;               //!< Packets per second
+  double cycles;            //!< CPU cycles per packet
+  double instructions;      //!< Instructions per packet
+  double llcMisses;         //!< Last level cache misses per packet
+  double l1dMisses;         //!< Level 1 data cache read misses per packet
+  uint64_t checksum;        //!< Sum of the values read in one pass
+} NtDescBenchResult_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * The accessors and the descriptor layouts supporting them. The
+ * expression reads the accessor on the packet h.
+ */
+#define _NT_DESCBENCH_ACCESSORS(X)                                                          \
+  X(DESCRIPTOR_TYPE, NT_DESCBENCH_ALL, NT_NET_GET_PKT_DESCRIPTOR_TYPE(h))                   \
+  X(DESCRIPTOR_FORMAT, NT_DESCBENCH_ALL, NT_NET_GET_PKT_DESCRIPTOR_FORMAT(h))               \
+  X(DESCR_LENGTH, NT_DESCBENCH_ALL, NT_NET_GET_PKT_DESCR_LENGTH(h))                         \
+  X(TIMESTAMP, NT_DESCBENCH_NT, NT_NET_GET_PKT_TIMESTAMP(h))                                \
+  X(TIMESTAMP_TYPE, NT_DESCBENCH_ALL, NT_NET_GET_PKT_TIMESTAMP_TYPE(h))                     \
+  X(CAP_LENGTH, NT_DESCBENCH_ALL, NT_NET_GET_PKT_CAP_LENGTH(h))                             \
+  X(WIRE_LENGTH, NT_DESCBENCH_ALL, NT_NET_GET_PKT_WIRE_LENGTH(h))                           \
+  X(L2_PTR, NT_DESCBENCH_ALL, (uintptr_t)NT_NET_GET_PKT_L2_PTR(h))                          \
+  X(CRC_ERROR, NT_DESCBENCH_NT, NT_NET_GET_PKT_CRC_ERROR(h))                                \
+  X(TCP_CSUM_OK, NT_DESCBENCH_NT, NT_NET_GET_PKT_TCP_CSUM_OK(h))                            \
+  X(UDP_CSUM_OK, NT_DESCBENCH_NT, NT_NET_GET_PKT_UDP_CSUM_OK(h))                            \
+  X(IP_CSUM_OK, NT_DESCBENCH_NT, NT_NET_GET_PKT_IP_CSUM_OK(h))                              \
+  X(CV_ERROR, NT_DESCBENCH_NT, NT_NET_GET_PKT_CV_ERROR(h))                                  \
+  X(SLICED, NT_DESCBENCH_NT, NT_NET_GET_PKT_SLICED(h))                                      \
+  X(HARD_SLICED, NT_DESCBENCH_NT, NT_NET_GET_PKT_HARD_SLICED(h))                            \
+  X(RXPORT, NT_DESCBENCH_NT, NT_NET_GET_PKT_RXPORT(h))                                      \
+  X(IS_TCP, NT_DESCBENCH_NT, NT_NET_GET_PKT_IS_TCP(h))                                      \
+  X(IS_UDP, NT_DESCBENCH_NT, NT_NET_GET_PKT_IS_UDP(h))                                      \
+  X(IS_IP, NT_DESCBENCH_NT, NT_NET_GET_PKT_IS_IP(h))                                        \
+  X(HASH, NT_DESCBENCH_EXT, NT_NET_GET_PKT_HASH(h))                                         \
+  X(HASH_TYPE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_HASH_TYPE(h))                               \
+  X(HASH_VALID, NT_DESCBENCH_EXT, NT_NET_GET_PKT_HASH_VALID(h))                             \
+  X(JUMBO, NT_DESCBENCH_EXT, NT_NET_GET_PKT_JUMBO(h))                                       \
+  X(BROADCAST, NT_DESCBENCH_EXT, NT_NET_GET_PKT_BROADCAST(h))                               \
+  X(L4_PORT_TYPE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L4_PORT_TYPE(h))                         \
+  X(L4_FRAME_TYPE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L4_FRAME_TYPE(h))                       \
+  X(L3_FRAME_TYPE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L3_FRAME_TYPE(h))                       \
+  X(L2_FRAME_TYPE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L2_FRAME_TYPE(h))                       \
+  X(L4_LENGTH, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L4_LENGTH(h))                               \
+  X(L3_LENGTH, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L3_LENGTH(h))                               \
+  X(MPLS_COUNT, NT_DESCBENCH_EXT, NT_NET_GET_PKT_MPLS_COUNT(h))                             \
+  X(VLAN_COUNT, NT_DESCBENCH_EXT, NT_NET_GET_PKT_VLAN_COUNT(h))                             \
+  X(ISL, NT_DESCBENCH_EXT, NT_NET_GET_PKT_ISL(h))                                           \
+  X(DECODE_ERROR, NT_DESCBENCH_EXT, NT_NET_GET_PKT_DECODE_ERROR(h))                         \
+  X(FRAME_LARGE, NT_DESCBENCH_EXT, NT_NET_GET_PKT_FRAME_LARGE(h))                           \
+  X(FRAME_SMALL, NT_DESCBENCH_EXT, NT_NET_GET_PKT_FRAME_SMALL(h))                           \
+  X(IPV6_FR_HEADER, NT_DESCBENCH_EXT, NT_NET_GET_PKT_IPV6_FR_HEADER(h))                     \
+  X(IPV6_RT_HEADER, NT_DESCBENCH_EXT, NT_NET_GET_PKT_IPV6_RT_HEADER(h))                     \
+  X(L4_PROTOCOL_NUM, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L4_PROTOCOL_NUM(h))                   \
+  X(L3_FRAGMENTED, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L3_FRAGMENTED(h))                       \
+  X(L3_FIRST_FRAG, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L3_FIRST_FRAG(h))                       \
+  X(COLOR, NT_DESCBENCH_EXT, NT_NET_GET_PKT_COLOR(h))                                       \
+  X(L5_OFFSET, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L5_OFFSET(h))                               \
+  X(L4_OFFSET, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L4_OFFSET(h))                               \
+  X(L3_OFFSET, NT_DESCBENCH_EXT, NT_NET_GET_PKT_L3_OFFSET(h))                               \
+  X(IPF_UNMATCHED_STREAMID, NT_DESCBENCH_EXT8 | NT_DESCBENCH_EXT9, NT_NET_GET_PKT_IPF_UNMATCHED_STREAMID(h)) \
+  X(IPF_UNMATCHED_FLAG, NT_DESCBENCH_EXT8 | NT_DESCBENCH_EXT9, NT_NET_GET_PKT_IPF_UNMATCHED_FLAG(h)) \
+  X(IPF_LAST_FRAGMENT, NT_DESCBENCH_EXT8 | NT_DESCBENCH_EXT9, NT_NET_GET_PKT_IPF_LAST_FRAGMENT(h)) \
+  X(DEDUPLICATION_CRC, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_DEDUPLICATION_CRC(h))              \
+  X(INNER_L3_OFFSET, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L3_OFFSET(h))                  \
+  X(INNER_L4_OFFSET, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L4_OFFSET(h))                  \
+  X(INNER_L5_OFFSET, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L5_OFFSET(h))                  \
+  X(INNER_L3_FRAME_TYPE, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L3_FRAME_TYPE(h))          \
+  X(INNER_L4_FRAME_TYPE, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L4_FRAME_TYPE(h))          \
+  X(INNER_L3_FRAGMENT_TYPE, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_L3_FRAGMENT_TYPE(h))    \
+  X(TUNNEL_TYPE, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_TUNNEL_TYPE(h))                          \
+  X(TUNNEL_HDR_LENGTH, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_TUNNEL_HDR_LENGTH(h))              \
+  X(INNER_DECODE_ERROR, NT_DESCBENCH_EXT9, NT_NET_GET_PKT_INNER_DECODE_ERROR(h))            \
+  X(DYN1_TIMESTAMP, NT_DESCBENCH_DYN1, NT_NET_DESCR_PTR_DYN1(h)->timestamp)                 \
+  X(DYN1_OFFSET0, NT_DESCBENCH_DYN1, NT_NET_DESCR_PTR_DYN1(h)->offset0)                     \
+  X(DYN1_COLOR, NT_DESCBENCH_DYN1, NT_NET_DESCR_PTR_DYN1(h)->color)                         \
+  X(DYN2_TIMESTAMP, NT_DESCBENCH_DYN2, NT_NET_DESCR_PTR_DYN2(h)->timestamp)                 \
+  X(DYN2_OFFSET0, NT_DESCBENCH_DYN2, NT_NET_DESCR_PTR_DYN2(h)->offset0)                     \
+  X(DYN2_COLOR, NT_DESCBENCH_DYN2, NT_NET_DESCR_PTR_DYN2(h)->color)                         \
+  X(DYN3_TIMESTAMP, NT_DESCBENCH_DYN3, NT_NET_DESCR_PTR_DYN3(h)->timestamp)                 \
+  X(DYN3_OFFSET0, NT_DESCBENCH_DYN3, NT_NET_DESCR_PTR_DYN3(h)->offset0)                     \
+  X(DYN3_COLOR, NT_DESCBENCH_DYN3, (uint64_t)NT_NET_DESCR_PTR_DYN3(h)->color_hi << 14 | NT_NET_DESCR_PTR_DYN3(h)->color_lo)
+
+#define _NT_DESCBENCH_FN(_name_, _formats_, _expr_)                                         \
+static NT_INLINE uint64_t _nt_descbench_##_name_(struct NtNetBuf_s* segNetBuf, NtSegIndex_t* idx, uint64_t* pkts) \
+{                                                                                          \
+  struct NtNetBuf_s pkt;                                                                   \
+  struct NtNetBuf_s* h = &pkt;                                                             \
+  uint64_t segLength = NT_NET_GET_SEGMENT_LENGTH(segNetBuf), sum = 0, n = 0;               \
+  (void)idx;                                                                               \
+  if (segLength == 0) {                                                                    \
+    *pkts = 0;                                                                             \
+    return 0;                                                                              \
+  }                                                                                        \
+  _nt_net_build_pkt_netbuf(segNetBuf, &pkt);                                               \
+  do {                                                                                     \
+    sum += (uint64_t)(_expr_);                                                             \
+    n++;                                                                                   \
+  } while (_nt_net_get_next_packet(segNetBuf, segLength, &pkt) > 0);                      \
+  *pkts = n;                                                                               \
+  return sum;                                                                              \
+}
+
+_NT_DESCBENCH_ACCESSORS(_NT_DESCBENCH_FN)
+
+/*
+ * Walk the segment with _nt_net_get_next_packet without reading any field
+ */
+static NT_INLINE uint64_t _nt_descbench_SEGMENT_WALK(struct NtNetBuf_s* segNetBuf, NtSegIndex_t* idx, uint64_t* pkts)
+{
+  struct NtNetBuf_s pkt;
+  uint64_t segLength = NT_NET_GET_SEGMENT_LENGTH(segNetBuf), sum = 0, n = 0;
+  (void)idx;
+  if (segLength == 0) {
+    *pkts = 0;
+    return 0;
+  }
+  _nt_net_build_pkt_netbuf(segNetBuf, &pkt);
+  do {
+    sum += (uint64_t)(uintptr_t)pkt.hHdr;
+    n++;
+  } while (_nt_net_get_next_packet(segNetBuf, segLength, &pkt) > 0);
+  *pkts = n;
+  return sum;
+}
+
+/*
+ * Walk the segment with _nt_net_get_packet_burst and read the capture length
+ */
+static NT_INLINE uint64_t _nt_descbench_SEGMENT_BURST(struct NtNetBuf_s* segNetBuf, NtSegIndex_t* idx, uint64_t* pkts)
+{
+  struct NtNetBuf_s burst[64];
+  uint64_t offset = 0, sum = 0, n = 0;
+  unsigned count, i;
+  (void)idx;
+  while ((count = _nt_net_get_packet_burst(segNetBuf, &offset, burst, 64)) > 0) {
+    for (i = 0; i < count; i++) {
+      sum += NT_NET_GET_PKT_CAP_LENGTH(&burst[i]);
+    }
+    n += count;
+  }
+  *pkts = n;
+  return sum;
+}
+
+/*
+ * Index the segment with _nt_segindex_build and read the time stamps
+ */
+static NT_INLINE uint64_t _nt_descbench_SEGMENT_INDEX(struct NtNetBuf_s* segNetBuf, NtSegIndex_t* idx, uint64_t* pkts)
+{
+  uint64_t offset = 0, sum = 0, n = 0;
+  uint32_t i;
+  while (offset < NT_NET_GET_SEGMENT_LENGTH(segNetBuf) && _nt_segindex_build(idx, segNetBuf, offset) == NT_SUCCESS && idx->count > 0) {
+    for (i = 0; i < idx->count; i++) {
+      sum += idx->timestamp[i];
+    }
+    n += idx->count;
+    offset = idx->next;
+  }
+  *pkts = n;
+  return sum;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Get the benchmark entries
+ *
+ * @param[out] count  Number of entries
+ *
+ * @return The benchmark entries. The segment walks come first.
+ */
+static NT_INLINE const NtDescBench_t* _nt_descbench_entries(uint32_t* count)
+{
+#define _NT_DESCBENCH_ENTRY(_name_, _formats_, _expr_) { #_name_, _formats_, _nt_descbench_##_name_ },
+  static const NtDescBench_t entries[] = {
+    { "SEGMENT_WALK", NT_DESCBENCH_ALL, _nt_descbench_SEGMENT_WALK },
+    { "SEGMENT_BURST", NT_DESCBENCH_ALL, _nt_descbench_SEGMENT_BURST },
+    { "SEGMENT_INDEX", NT_DESCBENCH_NT | NT_DESCBENCH_DYN, _nt_descbench_SEGMENT_INDEX },
+    _NT_DESCBENCH_ACCESSORS(_NT_DESCBENCH_ENTRY)
+  };
+#undef _NT_DESCBENCH_ENTRY
+  *count = (uint32_t)(sizeof(entries) / sizeof(entries[0]));
+  return entries;
+}
+
+/**
+ * @brief Get the descriptor layout of the first packet in a segment
+ *
+ * @param[in] segNetBuf  Segment
+ *
+ * @return The descriptor layout flag - see @ref DescBenchFormats - or 0
+ *         for an empty segment or a layout not covered by the benchmark
+ */
+static NT_INLINE uint32_t _nt_descbench_format(struct NtNetBuf_s* segNetBuf)
+{
+  struct NtNetBuf_s pkt;
+  uint32_t format;
+  if (NT_NET_GET_SEGMENT_LENGTH(segNetBuf) == 0) {
+    return 0;
+  }
+  _nt_net_build_pkt_netbuf(segNetBuf, &pkt);
+  switch (NT_NET_GET_PKT_DESCRIPTOR_TYPE(&pkt)) {
+  case NT_PACKET_DESCRIPTOR_TYPE_NT:
+    return NT_DESCBENCH_STD0;
+  case NT_PACKET_DESCRIPTOR_TYPE_NT_EXTENDED:
+    format = NT_NET_GET_PKT_DESCRIPTOR_FORMAT(&pkt);
+    return format >= 7 && format <= 9 ? 1U << format : 0;
+  case NT_PACKET_DESCRIPTOR_TYPE_DYNAMIC:
+    format = NT_NET_GET_PKT_DESCRIPTOR_FORMAT(&pkt);
+    return format >= 1 && format <= 3 ? 1U << (16 + format) : 0;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Run the benchmark on a segment
+ *
+ * Runs every entry that supports the descriptor layout of the segment.
+ * All packets of the segment must have the same layout. Each entry is
+ * run once to warm the caches and then measured over repeat passes.
+ *
+ * @param[in]  segNetBuf   Segment
+ * @param[in]  repeat      Number of measured passes per entry
+ * @param[in]  perf        Opened performance counters - NULL to measure time only
+ * @param[out] results     Results
+ * @param[in]  maxResults  Number of entries in results
+ * @param[out] count       Number of results stored
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         The segment is empty or its descriptor layout is not supported
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_descbench_run(struct NtNetBuf_s* segNetBuf, uint32_t repeat, NtPerf_t* perf,
+                                       NtDescBenchResult_t* results, uint32_t maxResults, uint32_t* count)
+{
+  uint32_t format = _nt_descbench_format(segNetBuf), numEntries, i, r;
+  const NtDescBench_t* entries = _nt_descbench_entries(&numEntries);
+  NtSegIndex_t idx;
+  volatile uint64_t sink = 0;
+  *count = 0;
+  if (format == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (_nt_segindex_alloc(&idx, 1024) != NT_SUCCESS) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  if (repeat == 0) {
+    repeat = 1;
+  }
+  for (i = 0; i < numEntries && *count < maxResults; i++) {
+    NtDescBenchResult_t* res = &results[*count];
+    uint64_t pkts = 0, start, ns;
+    if ((entries[i].formats & format) == 0) {
+      continue;
+    }
+    memset(res, 0, sizeof(*res));
+    res->name = entries[i].name;
+    res->checksum = entries[i].fn(segNetBuf, &idx, &pkts);
+    if (perf != NULL) {
+      _nt_perf_start(perf);
+    }
+    start = _nt_compat_now_ns();
+    for (r = 0; r < repeat; r++) {
+      sink += entries[i].fn(segNetBuf, &idx, &pkts);
+    }
+    ns = _nt_compat_now_ns() - start;
+    if (perf != NULL) {
+      _nt_perf_stop(perf);
+    }
+    res->pkts = pkts * repeat;
+    if (res->pkts > 0) {
+      double n = (double)res->pkts;
+      res->ns = (double)ns / n;
+      res->pps = ns > 0 ? n * 1e9 / (double)ns : 0;
+      if (perf != NULL) {
+        res->cycles = (double)perf->value[NT_PERF_CYCLES] / n;
+        res->instructions = (double)perf->value[NT_PERF_INSTRUCTIONS] / n;
+        res->llcMisses = (double)perf->value[NT_PERF_LLC_MISSES] / n;
+        res->l1dMisses = (double)perf->value[NT_PERF_L1D_MISSES] / n;
+      }
+    }
+    (*count)++;
+  }
+  _nt_segindex_free(&idx);
+  return NT_SUCCESS;
+}
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Read the file once with NT_NetFileGet and walk every segment in bursts
+ * of burstSize packets, reading the capture length of each packet
+ */
+static NT_INLINE int _nt_descbench_replay_pass(const char* fileName, unsigned burstSize, uint64_t* pkts, uint64_t* sum)
+{
+  struct NtNetBuf_s burst[256];
+  NtNetStreamFile_t hFile;
+  NtNetBuf_t hNetBuf;
+  int status;
+
+  *pkts = 0;
+  *sum = 0;
+  if ((status = NT_NetFileOpen(&hFile, "descbench", NT_NET_INTERFACE_SEGMENT, fileName)) != NT_SUCCESS) {
+    return status;
+  }
+  while ((status = NT_NetFileGet(hFile, &hNetBuf)) == NT_SUCCESS) {
+    uint64_t offset = 0;
+    unsigned count, i;
+    while ((count = _nt_net_get_packet_burst(hNetBuf, &offset, burst, burstSize)) > 0) {
+      for (i = 0; i < count; i++) {
+        *sum += NT_NET_GET_PKT_CAP_LENGTH(&burst[i]);
+      }
+      *pkts += count;
+    }
+    if ((status = NT_NetFileRelease(hFile, hNetBuf)) != NT_SUCCESS) {
+      break;
+    }
+  }
+  (void)NT_NetFileClose(hFile);
+  return status == NT_STATUS_END_OF_FILE ? NT_SUCCESS : status;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Replay an NT capture file in bursts of packets
+ *
+ * The file is read with @ref NT_NetFileGet once per burst size - 1, 8, 32
+ * and 256 packets - and each segment is walked with
+ * @ref _nt_net_get_packet_burst, reading the capture length of every
+ * packet. A burst of 1 costs the same as walking the segment one packet
+ * per call. The time includes reading the file, so the file is read once
+ * before the measurements to get it into the page cache.
+ *
+ * @param[in]  fileName    NT capture file
+ * @param[in]  perf        Opened performance counters - NULL to measure time only
+ * @param[out] results     Results, one per burst size
+ * @param[in]  maxResults  Number of entries in results
+ * @param[out] count       Number of results stored
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval Otherwise   The error of @ref NT_NetFileOpen or @ref NT_NetFileGet
+ */
+static NT_INLINE int _nt_descbench_replay(const char* fileName, NtPerf_t* perf, NtDescBenchResult_t* results, uint32_t maxResults, uint32_t* count)
+{
+  static const struct {
+    const char* name;
+    unsigned size;
+  } bursts[] = { { "REPLAY_BURST_1", 1 }, { "REPLAY_BURST_8", 8 }, { "REPLAY_BURST_32", 32 }, { "REPLAY_BURST_256", 256 } };
+  uint64_t pkts, sum;
+  uint32_t i;
+  int status;
+
+  *count = 0;
+  if ((status = _nt_descbench_replay_pass(fileName, 256, &pkts, &sum)) != NT_SUCCESS) {
+    return status;
+  }
+  for (i = 0; i < sizeof(bursts) / sizeof(bursts[0]) && *count < maxResults; i++) {
+    NtDescBenchResult_t* res = &results[*count];
+    uint64_t start, ns;
+    memset(res, 0, sizeof(*res));
+    res->name = bursts[i].name;
+    if (perf != NULL) {
+      _nt_perf_start(perf);
+    }
+    start = _nt_compat_now_ns();
+    status = _nt_descbench_replay_pass(fileName, bursts[i].size, &pkts, &sum);
+    ns = _nt_compat_now_ns() - start;
+    if (perf != NULL) {
+      _nt_perf_stop(perf);
+    }
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+    res->pkts = pkts;
+    res->checksum = sum;
+    if (pkts > 0) {
+      double n = (double)pkts;
+      res->ns = (double)ns / n;
+      res->pps = ns > 0 ? n * 1e9 / (double)ns : 0;
+      if (perf != NULL) {
+        res->cycles = (double)perf->value[NT_PERF_CYCLES] / n;
+        res->instructions = (double)perf->value[NT_PERF_INSTRUCTIONS] / n;
+        res->llcMisses = (double)perf->value[NT_PERF_LLC_MISSES] / n;
+        res->l1dMisses = (double)perf->value[NT_PERF_L1D_MISSES] / n;
+      }
+    }
+    (*count)++;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Print benchmark results as a table
+ *
+ * @param[in] stream   Output stream
+ * @param[in] results  Results from @ref _nt_descbench_run or @ref _nt_descbench_replay
+ * @param[in] count    Number of results
+ */
+static NT_INLINE void _nt_descbench_print(FILE* stream, const NtDescBenchResult_t* results, uint32_t count)
+{
+  uint32_t i;
+  fprintf(stream, "%-24s %10s %12s %10s %10s %10s %10s\n", "accessor", "ns/pkt", "pkts/s", "cyc/pkt", "ins/pkt", "llc/pkt", "l1d/pkt");
+  for (i = 0; i < count; i++) {
+    fprintf(stream, "%-24s %10.3f %12.0f %10.3f %10.3f %10.4f %10.4f\n", results[i].name, results[i].ns, results[i].pps,
+            results[i].cycles, results[i].instructions, results[i].llcMisses, results[i].l1dMisses);
+  }
+}
+
+#endif // __DESCBENCH_H__
@@ -0,0 +1,1019 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains an emulated network stream, so code using the
+ * segment interface can be load tested without an adapter or ntservice.
+ *
+ * The RX side owns a host buffer filled by a producer from a fill
+ * function - e.g. packets copied from an NT or PCAP file opened with
+ * @ref NT_NetFileOpen, from a @ref _nt_capfile_open reader or from a
+ * packet generator. The producer runs in a thread of its own or, without
+ * a thread, in @ref _nt_emu_rx_get when no segment is available.
+ * Segments are handed out with @ref _nt_emu_rx_get and must be released
+ * in order with @ref _nt_emu_rx_release, as with @ref NT_NetRxGet.
+ *
+ * Two host buffer layouts are emulated:
+ *   - @ref NT_NET_HOSTBUFFER_LAYOUT_SLABS - the host buffer is divided in
+ *     1 MB slabs. Packets never cross a slab, and a slab is terminated
+ *     when the next packet does not fit in it.
+ *   - @ref NT_NET_HOSTBUFFER_LAYOUT_CIRCULAR - the host buffer is mapped
+ *     twice back to back, so packets and segments continue from the end
+ *     of the host buffer at its start and are still contiguous in memory.
+ *     Only supported on Linux.
+ *
+ * The emulated port either delivers as fast as the application releases
+ * segments or at a fixed bit rate. At a fixed bit rate data arriving when
+ * the host buffer is full is dropped, like on an adapter. With a host
+ * buffer allowance data is dropped when the host buffer fill level
+ * reaches the allowance, until it falls to half of it. The drops are
+ * read with @ref NT_NETRX_READ_CMD_STREAM_DROP and
+ * @ref NT_NETRX_READ_CMD_STREAM_HOSTBUFFER_ALLOWANCE_DROP.
+ *
+ * The TX side hands out packet and segment buffers with the semantics of
+ * @ref NT_NetTxGet. Released buffers are passed to a sink function in
+ * order, e.g. to count or verify the transmitted data.
+ *
+ */
+#ifndef __EMU_H__
+#define __EMU_H__
+
+#include "nt.h"
+#include "atomic.h"
+#include "capfile.h"
+#include "compat.h"
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Size of a host buffer slab
+ */
+#define NT_EMU_SLAB_SIZE (1024 * 1024)
+
+/**
+ * Fill function writing whole packets to the host buffer
+ *
+ * @param[in]  ctx   Context given with the function
+ * @param[in]  buf   Where to write the packets
+ * @param[in]  size  Room at buf
+ * @param[out] used  Bytes written - 0 if the next packet does not fit
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_TRYAGAIN          No packets are available right now
+ * @retval NT_STATUS_END_OF_FILE       No more packets
+ * @retval NT_ERROR_INVALID_PARAMETER  The next packet does not fit - same as NT_SUCCESS with used 0
+ * @retval otherwise                   Error
+ */
+typedef int (*NtEmuFill_t)(void *ctx, uint8_t *buf, uint32_t size, uint32_t *used);
+
+/**
+ * Sink function receiving transmitted buffers in order
+ */
+typedef void (*NtEmuSink_t)(void *ctx, NtNetBuf_t hNetBuf);
+
+/**
+ * Emulated RX stream configuration. Zero selects the default value.
+ */
+typedef struct NtEmuConfig_s {
+  enum NtNetHostBufferLayout_e layout; //!< Host buffer layout. Default is @ref NT_NET_HOSTBUFFER_LAYOUT_SLABS
+  uint64_t hostBufferSize;  //!< Host buffer size - rounded up to whole slabs or pages. Default is 16 MB
+  uint32_t segmentSize;     //!< Largest segment in the circular layout. Default is 1 MB
+  uint32_t maxSegments;     //!< Largest number of segments in the host buffer. Default is 256
+  int hostBufferAllowance;  //!< Fill level in percent at which data is dropped - 0 or -1 disables it
+  uint64_t bitRate;         //!< Port speed in bits per second. Default is to never drop because the host buffer is full
+  int thread;               //!< Run the producer in a thread of its own - not supported on Windows
+  enum NtTimestampType_e tsType; //!< Time stamp type of the segments
+  uint8_t portOffset;       //!< Port offset of the segments
+  uint8_t adapterNo;        //!< Adapter number of the segments
+} NtEmuConfig_t;
+
+/**
+ * Emulated RX stream counters
+ */
+typedef struct NtEmuStat_s {
+  uint64_t segments;        //!< Segments delivered to the host buffer
+  uint64_t bytes;           //!< Bytes delivered to the host buffer
+  uint64_t dropPkts;        //!< Packets dropped
+  uint64_t dropBytes;       //!< Bytes dropped
+  uint64_t allowanceDropPkts;  //!< Packets dropped because of the host buffer allowance
+  uint64_t allowanceDropBytes; //!< Bytes dropped because of the host buffer allowance
+} NtEmuStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtEmuSeg_s {
+  struct NtNetBuf_s netBuf;  // Must be first - the segment handed out
+  uint64_t end;              // Host buffer position after the segment
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Emulated RX stream
+ */
+typedef struct NtEmu_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  enum NtNetHostBufferLayout_e layout;
+  uint8_t *base;
+  uint64_t size;
+  uint32_t segmentSize;
+  int allowance;
+  uint64_t bitRate;
+  NtEmuFill_t fill;
+  void *ctx;
+  struct _NtEmuSeg_s *segs;
+  uint32_t segMask;
+  uint8_t *scratch;          // Data dropped is filled here
+  enum NtTimestampType_e tsType;
+  uint8_t portOffset;
+  uint8_t adapterNo;
+  uint8_t colorMap[64];      // Identity filter color map
+  // Producer
+  uint64_t head;             // Host buffer position of the next packet
+  uint64_t startNs;
+  uint64_t emitted;          // Bytes received by the port
+  int dropping;              // Host buffer allowance hysteresis
+  volatile uint64_t produced;
+  volatile uint32_t eof;
+  volatile uint32_t error;
+  NtEmuStat_t stat;
+  // Consumer
+  uint64_t delivered;
+  volatile uint64_t released;
+  volatile uint64_t tail;    // Host buffer position of the oldest segment held
+  // Producer thread
+  int threaded;
+  volatile uint32_t stop;
+#ifndef _MSC_VER
+  pthread_t thread;
+#endif
+#endif
+} NtEmu_t;
+
+/**
+ * Segment source copying the packets of segments to the host buffer
+ */
+typedef struct NtEmuSource_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  int (*get)(void *ctx, NtNetBuf_t *hNetBuf);
+  int (*release)(void *ctx, NtNetBuf_t hNetBuf);
+  void *ctx;
+  NtNetBuf_t seg;
+  struct NtNetBuf_s pkt;     // Next packet to copy
+  int active;
+#endif
+} NtEmuSource_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Stream ID table of the unmatched IP fragment feeds - all feeds map to
+ * stream 0
+ */
+static NT_INLINE int* _nt_emu_stream_info(void)
+{
+  static int streamInfo[256 << _FEED2STREAM_SHL_];
+  return streamInfo;
+}
+
+static NT_INLINE void _nt_emu_sleep(void)
+{
+  _nt_compat_sleep_ns(10000);
+}
+
+/*
+ * Count the packets of a batch the port could not deliver
+ */
+static NT_INLINE void _nt_emu_drop(NtEmu_t* emu, uint32_t used)
+{
+  struct NtNetBuf_s seg, pkt;
+  uint64_t pkts = 1;
+  _nt_net_initialize_segment_netbuf(used, emu->scratch, emu->portOffset, &seg);
+  _nt_net_build_pkt_netbuf(&seg, &pkt);
+  while (_nt_net_get_next_packet(&seg, used, &pkt) > 0) {
+    pkts++;
+  }
+  emu->stat.dropPkts += pkts;
+  emu->stat.dropBytes += used;
+  if (emu->dropping) {
+    emu->stat.allowanceDropPkts += pkts;
+    emu->stat.allowanceDropBytes += used;
+  }
+}
+
+/*
+ * Let the port receive one batch of packets
+ *
+ * Returns NT_STATUS_TRYAGAIN when nothing could be done right now.
+ */
+static NT_INLINE int _nt_emu_produce(NtEmu_t* emu)
+{
+  uint64_t used, free, pos, max;
+  uint32_t filled;
+  int status, room;
+  if (emu->eof) {
+    return NT_STATUS_END_OF_FILE;
+  }
+  if (emu->bitRate) {
+    // Wait until the port has received the previous batch
+    uint64_t due = emu->startNs + (uint64_t)((double)emu->emitted * 8e9 / (double)emu->bitRate);
+    if (_nt_compat_now_ns() < due) {
+      return NT_STATUS_TRYAGAIN;
+    }
+  }
+  used = emu->head - _nt_atomic_load_acquire_u64(&emu->tail);
+  free = emu->size - used;
+  if (emu->allowance > 0) {
+    if (emu->dropping && used * 200 < emu->size * (uint64_t)emu->allowance) {
+      emu->dropping = 0;
+    } else if (!emu->dropping && used * 100 >= emu->size * (uint64_t)emu->allowance) {
+      emu->dropping = 1;
+    }
+  }
+  room = !emu->dropping && emu->produced - _nt_atomic_load_acquire_u64(&emu->released) <= emu->segMask;
+  if (room) {
+    if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_SLABS) {
+      pos = emu->head % emu->size;
+      max = NT_EMU_SLAB_SIZE - pos % NT_EMU_SLAB_SIZE;
+    } else {
+      pos = emu->head % emu->size;
+      max = emu->segmentSize;
+    }
+    if (max > free) {
+      max = free;
+    }
+    if (max > 0) {
+      status = emu->fill(emu->ctx, emu->base + pos, (uint32_t)max, &filled);
+      if (status == NT_ERROR_INVALID_PARAMETER) {
+        filled = 0;
+      } else if (status != NT_SUCCESS) {
+        if (status == NT_STATUS_END_OF_FILE) {
+          _nt_atomic_store_release_u32(&emu->eof, 1);
+        }
+        return status;
+      }
+      if (filled > 0) {
+        struct _NtEmuSeg_s* seg = &emu->segs[emu->produced & emu->segMask];
+        _nt_net_initialize_segment_netbuf(filled, emu->base + pos, emu->portOffset, &seg->netBuf);
+        seg->netBuf.tsType = emu->tsType;
+        seg->netBuf.adapterNo = emu->adapterNo;
+        seg->netBuf.colorMap = emu->colorMap;
+        seg->netBuf.streamInfo = _nt_emu_stream_info();
+        seg->netBuf.netIf = NT_NET_INTERFACE_SEGMENT;
+        emu->head += filled;
+        seg->end = emu->head;
+        emu->emitted += filled;
+        emu->stat.segments++;
+        emu->stat.bytes += filled;
+        _nt_atomic_store_release_u64(&emu->produced, emu->produced + 1);
+        return NT_SUCCESS;
+      }
+      if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_SLABS && max == NT_EMU_SLAB_SIZE - pos % NT_EMU_SLAB_SIZE) {
+        if (max == NT_EMU_SLAB_SIZE) {
+          return NT_ERROR_CAP_FILE_PACKET_TOO_LARGE;
+        }
+        // Terminate the slab
+        emu->head += max;
+        return NT_SUCCESS;
+      }
+      if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_CIRCULAR && max == emu->segmentSize) {
+        return NT_ERROR_CAP_FILE_PACKET_TOO_LARGE;
+      }
+    }
+    // The host buffer is full
+    if (!emu->bitRate) {
+      return NT_STATUS_TRYAGAIN;
+    }
+  }
+  // The packets arrive anyway - drop them
+  status = emu->fill(emu->ctx, emu->scratch, emu->segmentSize, &filled);
+  if (status == NT_ERROR_INVALID_PARAMETER) {
+    filled = 0;
+  } else if (status != NT_SUCCESS) {
+    if (status == NT_STATUS_END_OF_FILE) {
+      _nt_atomic_store_release_u32(&emu->eof, 1);
+    }
+    return status;
+  }
+  if (filled == 0) {
+    return NT_ERROR_CAP_FILE_PACKET_TOO_LARGE;
+  }
+  _nt_emu_drop(emu, filled);
+  emu->emitted += filled;
+  return NT_SUCCESS;
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_emu_thread(void* arg)
+{
+  NtEmu_t* emu = (NtEmu_t*)arg;
+  while (!_nt_atomic_load_acquire_u32(&emu->stop)) {
+    int status = _nt_emu_produce(emu);
+    if (status == NT_STATUS_TRYAGAIN) {
+      _nt_emu_sleep();
+    } else if (status != NT_SUCCESS) {
+      if (status != NT_STATUS_END_OF_FILE) {
+        _nt_atomic_store_release_u32(&emu->error, (uint32_t)status);
+      }
+      break;
+    }
+  }
+  return NULL;
+}
+#endif
+
+static NT_INLINE void _nt_emu_unmap(NtEmu_t* emu)
+{
+  if (emu->base == NULL) {
+    return;
+  }
+#ifdef _MSC_VER
+  _aligned_free(emu->base);
+#else
+  if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_CIRCULAR) {
+    munmap(emu->base, 2 * emu->size);
+  } else {
+    munmap(emu->base, emu->size);
+  }
+#endif
+  emu->base = NULL;
+}
+
+/*
+ * Map the host buffer - twice back to back in the circular layout
+ */
+static NT_INLINE int _nt_emu_map(NtEmu_t* emu)
+{
+#ifdef _MSC_VER
+  if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_CIRCULAR) {
+    return NT_ERROR_FEATURE_NOT_SUPPORTED;
+  }
+  emu->base = (uint8_t*)_aligned_malloc((size_t)emu->size, 4096);
+  return emu->base != NULL ? NT_SUCCESS : NT_ERROR_MEMORY_ALLOCATION_FAILED;
+#else
+  void* base;
+  if (emu->layout == NT_NET_HOSTBUFFER_LAYOUT_SLABS) {
+    base = mmap(NULL, emu->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | _NT_COMPAT_MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+      return NT_AIO_ERRNO(errno);
+    }
+#ifdef MADV_HUGEPAGE
+    (void)madvise(base, emu->size, MADV_HUGEPAGE);
+#endif
+    emu->base = (uint8_t*)base;
+    return NT_SUCCESS;
+  }
+#ifdef SYS_memfd_create
+  {
+    int fd = (int)syscall(SYS_memfd_create, "ntemu", 0);
+    int status = NT_SUCCESS;
+    if (fd < 0) {
+      return NT_AIO_ERRNO(errno);
+    }
+    // Reserve room for both mappings and map the buffer into each half
+    base = mmap(NULL, 2 * emu->size, PROT_NONE, MAP_PRIVATE | _NT_COMPAT_MAP_ANONYMOUS, -1, 0);
+    if (ftruncate(fd, (off_t)emu->size) != 0 || base == MAP_FAILED) {
+      status = NT_AIO_ERRNO(errno);
+    } else if (mmap(base, emu->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+               mmap((uint8_t*)base + emu->size, emu->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      status = NT_AIO_ERRNO(errno);
+    }
+    close(fd);
+    if (status != NT_SUCCESS) {
+      if (base != MAP_FAILED) {
+        munmap(base, 2 * emu->size);
+      }
+      return status;
+    }
+    emu->base = (uint8_t*)base;
+    return NT_SUCCESS;
+  }
+#else
+  return NT_ERROR_FEATURE_NOT_SUPPORTED;
+#endif
+#endif
+}
+
+static NT_INLINE int _nt_emu_source_fill(void* ctx, uint8_t* buf, uint32_t size, uint32_t* used)
+{
+  NtEmuSource_t* src = (NtEmuSource_t*)ctx;
+  int status;
+  *used = 0;
+  for (;;) {
+    uint8_t* start;
+    uint64_t run = 0;
+    if (!src->active) {
+      if ((status = src->get(src->ctx, &src->seg)) != NT_SUCCESS) {
+        // Deliver what has been copied so far
+        return *used > 0 ? NT_SUCCESS : status;
+      }
+      if (NT_NET_GET_SEGMENT_LENGTH(src->seg) == 0) {
+        if ((status = src->release(src->ctx, src->seg)) != NT_SUCCESS) {
+          return status;
+        }
+        continue;
+      }
+      _nt_net_build_pkt_netbuf(src->seg, &src->pkt);
+      src->active = 1;
+    }
+    // Copy the packets that fit in one go
+    start = (uint8_t*)src->pkt.hHdr;
+    for (;;) {
+      uint64_t length = NT_NET_GET_PKT_CAP_LENGTH(&src->pkt);
+      if (*used + run + length > size) {
+        if (run > 0) {
+          memcpy(buf + *used, start, (size_t)run);
+          *used += (uint32_t)run;
+        }
+        return NT_SUCCESS;
+      }
+      run += length;
+      if (_nt_net_get_next_packet(src->seg, NT_NET_GET_SEGMENT_LENGTH(src->seg), &src->pkt) == 0) {
+        break;
+      }
+    }
+    memcpy(buf + *used, start, (size_t)run);
+    *used += (uint32_t)run;
+    src->active = 0;
+    if ((status = src->release(src->ctx, src->seg)) != NT_SUCCESS) {
+      return status;
+    }
+  }
+}
+
+static NT_INLINE int _nt_emu_netfile_get(void* ctx, NtNetBuf_t* hNetBuf)
+{
+  return NT_NetFileGet((NtNetStreamFile_t)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_emu_netfile_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return NT_NetFileRelease((NtNetStreamFile_t)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_emu_capfile_get(void* ctx, NtNetBuf_t* hNetBuf)
+{
+  return _nt_capfile_get((NtCapFile_t*)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_emu_capfile_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return _nt_capfile_release((NtCapFile_t*)ctx, hNetBuf);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Initialize a source copying the packets of a file stream to the host buffer
+ *
+ * NT and PCAP files can be used. The stream must be opened with
+ * @ref NT_NetFileOpen using NT_NET_INTERFACE_SEGMENT. Use
+ * @ref _nt_emu_source_fill as fill function and the source as context.
+ *
+ * @param[out] src      Source
+ * @param[in]  hStream  File stream
+ */
+static NT_INLINE void _nt_emu_source_netfile(NtEmuSource_t* src, NtNetStreamFile_t hStream)
+{
+  memset(src, 0, sizeof(*src));
+  src->get = _nt_emu_netfile_get;
+  src->release = _nt_emu_netfile_release;
+  src->ctx = (void*)hStream;
+}
+
+/**
+ * @brief Initialize a source copying the packets of a capture file reader to the host buffer
+ *
+ * @param[out] src   Source
+ * @param[in]  file  Capture file reader opened with @ref _nt_capfile_open
+ */
+static NT_INLINE void _nt_emu_source_capfile(NtEmuSource_t* src, NtCapFile_t* file)
+{
+  memset(src, 0, sizeof(*src));
+  src->get = _nt_emu_capfile_get;
+  src->release = _nt_emu_capfile_release;
+  src->ctx = (void*)file;
+}
+
+/**
+ * @brief Release the segment held by a source
+ *
+ * @param[in] src  Source
+ */
+static NT_INLINE void _nt_emu_source_close(NtEmuSource_t* src)
+{
+  if (src->active) {
+    (void)src->release(src->ctx, src->seg);
+    src->active = 0;
+  }
+}
+
+/**
+ * @brief Open an emulated RX stream
+ *
+ * @param[out] emu     Emulated stream
+ * @param[in]  config  Configuration - NULL selects the defaults
+ * @param[in]  fill    Function filling the host buffer, e.g. @ref _nt_emu_source_fill
+ * @param[in]  ctx     Context passed to the fill function
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         Invalid configuration
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED     The layout is not supported on this platform
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ * @retval otherwise                          System error
+ */
+static NT_INLINE int _nt_emu_open(NtEmu_t* emu, const NtEmuConfig_t* config, NtEmuFill_t fill, void* ctx)
+{
+  NtEmuConfig_t cfg;
+  uint32_t maxSegments = 1, i;
+  int status;
+  memset(emu, 0, sizeof(*emu));
+  if (config != NULL) {
+    cfg = *config;
+  } else {
+    memset(&cfg, 0, sizeof(cfg));
+  }
+  if (cfg.layout == NT_NET_HOSTBUFFER_LAYOUT_UNKNOWN) {
+    cfg.layout = NT_NET_HOSTBUFFER_LAYOUT_SLABS;
+  }
+  if (cfg.hostBufferSize == 0) {
+    cfg.hostBufferSize = 16 * 1024 * 1024;
+  }
+  if (cfg.segmentSize == 0) {
+    cfg.segmentSize = 1024 * 1024;
+  }
+  if (cfg.maxSegments == 0) {
+    cfg.maxSegments = 256;
+  }
+  if (cfg.layout != NT_NET_HOSTBUFFER_LAYOUT_SLABS && cfg.layout != NT_NET_HOSTBUFFER_LAYOUT_CIRCULAR) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (cfg.hostBufferAllowance > 100 || fill == NULL) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+#ifdef _MSC_VER
+  if (cfg.thread) {
+    return NT_ERROR_FEATURE_NOT_SUPPORTED;
+  }
+#endif
+  emu->layout = cfg.layout;
+  if (cfg.layout == NT_NET_HOSTBUFFER_LAYOUT_SLABS) {
+    emu->size = (cfg.hostBufferSize + NT_EMU_SLAB_SIZE - 1) & ~(uint64_t)(NT_EMU_SLAB_SIZE - 1);
+    // Dropped data is filled in slabs too
+    cfg.segmentSize = NT_EMU_SLAB_SIZE;
+  } else {
+    emu->size = (cfg.hostBufferSize + NT_AIO_DIRECT_ALIGN - 1) & ~(uint64_t)(NT_AIO_DIRECT_ALIGN - 1);
+    if (cfg.segmentSize > emu->size) {
+      cfg.segmentSize = (uint32_t)emu->size;
+    }
+  }
+  while (maxSegments < cfg.maxSegments) {
+    maxSegments <<= 1;
+  }
+  emu->segmentSize = cfg.segmentSize;
+  emu->allowance = cfg.hostBufferAllowance;
+  emu->bitRate = cfg.bitRate;
+  emu->fill = fill;
+  emu->ctx = ctx;
+  emu->segMask = maxSegments - 1;
+  emu->tsType = cfg.tsType;
+  emu->portOffset = cfg.portOffset;
+  emu->adapterNo = cfg.adapterNo;
+  for (i = 0; i < 64; i++) {
+    emu->colorMap[i] = (uint8_t)i;
+  }
+  emu->segs = (struct _NtEmuSeg_s*)calloc(maxSegments, sizeof(struct _NtEmuSeg_s));
+  emu->scratch = (uint8_t*)malloc(emu->segmentSize);
+  if (emu->segs == NULL || emu->scratch == NULL) {
+    free(emu->segs);
+    free(emu->scratch);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  if ((status = _nt_emu_map(emu)) != NT_SUCCESS) {
+    free(emu->segs);
+    free(emu->scratch);
+    return status;
+  }
+  emu->startNs = _nt_compat_now_ns();
+#ifndef _MSC_VER
+  if (cfg.thread) {
+    if (pthread_create(&emu->thread, NULL, _nt_emu_thread, emu) != 0) {
+      _nt_emu_unmap(emu);
+      free(emu->segs);
+      free(emu->scratch);
+      return NT_ERROR_RESOURCE_UNAVAILABLE;
+    }
+    emu->threaded = 1;
+  }
+#endif
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Close an emulated RX stream
+ *
+ * The fill function is not called after this function returns.
+ *
+ * @param[in] emu  Emulated stream
+ */
+static NT_INLINE void _nt_emu_close(NtEmu_t* emu)
+{
+#ifndef _MSC_VER
+  if (emu->threaded) {
+    _nt_atomic_store_release_u32(&emu->stop, 1);
+    pthread_join(emu->thread, NULL);
+  }
+#endif
+  _nt_emu_unmap(emu);
+  free(emu->segs);
+  free(emu->scratch);
+  memset(emu, 0, sizeof(*emu));
+}
+
+/**
+ * @brief Get a segment from an emulated RX stream
+ *
+ * @param[in]  emu      Emulated stream
+ * @param[out] hNetBuf  Segment container reference
+ * @param[in]  timeout  Time in milliseconds to wait for a segment - -1 waits indefinitely
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_TIMEOUT      No segment within the timeout
+ * @retval NT_STATUS_END_OF_FILE  The fill function has no more packets and all segments have been returned
+ * @retval otherwise              Error returned by the fill function
+ */
+static NT_INLINE int _nt_emu_rx_get(NtEmu_t* emu, NtNetBuf_t* hNetBuf, int timeout)
+{
+  uint64_t endNs = 0;
+  int status;
+  for (;;) {
+    if (emu->delivered != _nt_atomic_load_acquire_u64(&emu->produced)) {
+      *hNetBuf = &emu->segs[emu->delivered & emu->segMask].netBuf;
+      emu->delivered++;
+      return NT_SUCCESS;
+    }
+    if (_nt_atomic_load_acquire_u32(&emu->error)) {
+      return (int)emu->error;
+    }
+    if (_nt_atomic_load_acquire_u32(&emu->eof)) {
+      // End of file is set after the last segment is produced
+      if (emu->delivered == _nt_atomic_load_acquire_u64(&emu->produced)) {
+        return NT_STATUS_END_OF_FILE;
+      }
+      continue;
+    }
+    status = NT_STATUS_TRYAGAIN;
+    if (!emu->threaded) {
+      status = _nt_emu_produce(emu);
+      if (status != NT_SUCCESS && status != NT_STATUS_TRYAGAIN && status != NT_STATUS_END_OF_FILE) {
+        return status;
+      }
+    }
+    if (status == NT_STATUS_TRYAGAIN) {
+      if (timeout == 0) {
+        return NT_STATUS_TIMEOUT;
+      }
+      if (timeout > 0) {
+        uint64_t now = _nt_compat_now_ns();
+        if (endNs == 0) {
+          endNs = now + (uint64_t)timeout * 1000000;
+        } else if (now >= endNs) {
+          return NT_STATUS_TIMEOUT;
+        }
+      }
+      _nt_emu_sleep();
+    }
+  }
+}
+
+/**
+ * @brief Release a segment of an emulated RX stream
+ *
+ * Segments must be released in the order they were returned.
+ *
+ * @param[in] emu      Emulated stream
+ * @param[in] hNetBuf  Segment to release
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Not the oldest segment held
+ */
+static NT_INLINE int _nt_emu_rx_release(NtEmu_t* emu, NtNetBuf_t hNetBuf)
+{
+  struct _NtEmuSeg_s* seg = &emu->segs[emu->released & emu->segMask];
+  if (emu->released == emu->delivered || hNetBuf != &seg->netBuf) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  _nt_atomic_store_release_u64(&emu->tail, seg->end);
+  _nt_atomic_store_release_u64(&emu->released, emu->released + 1);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Read information from an emulated RX stream
+ *
+ * Supports @ref NT_NETRX_READ_CMD_STREAM_DROP and
+ * @ref NT_NETRX_READ_CMD_STREAM_HOSTBUFFER_ALLOWANCE_DROP. With a producer
+ * thread the counters are read without synchronization.
+ *
+ * @param[in]     emu   Emulated stream
+ * @param[in,out] data  Read structure with the command set
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Unsupported command
+ */
+static NT_INLINE int _nt_emu_rx_read(NtEmu_t* emu, NtNetRx_t* data)
+{
+  switch (data->cmd) {
+  case NT_NETRX_READ_CMD_STREAM_DROP:
+    data->u.streamDrop.pktsDropped = emu->stat.dropPkts;
+    data->u.streamDrop.octetsDropped = emu->stat.dropBytes;
+    return NT_SUCCESS;
+  case NT_NETRX_READ_CMD_STREAM_HOSTBUFFER_ALLOWANCE_DROP:
+    data->u.streamDrop.pktsDropped = emu->stat.allowanceDropPkts;
+    data->u.streamDrop.octetsDropped = emu->stat.allowanceDropBytes;
+    return NT_SUCCESS;
+  default:
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+}
+
+/**
+ * @brief Get the counters of an emulated RX stream
+ *
+ * @param[in]  emu   Emulated stream
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_emu_get_stat(NtEmu_t* emu, NtEmuStat_t* stat)
+{
+  *stat = emu->stat;
+}
+
+/**
+ * Emulated TX stream
+ */
+typedef struct NtEmuTx_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint8_t *base;
+  uint64_t size;
+  uint64_t portMask;
+  NtEmuSink_t sink;
+  void *ctx;
+  struct _NtEmuSeg_s *bufs;
+  uint32_t bufMask;
+  uint64_t head;             // Host buffer position of the next buffer
+  uint64_t tail;             // Host buffer position of the oldest buffer held
+  uint64_t dequeued;         // Buffers handed out
+  uint64_t released;         // Buffers transmitted
+  uint64_t pkts;
+  uint64_t bytes;
+#endif
+} NtEmuTx_t;
+
+/**
+ * @brief Open an emulated TX stream
+ *
+ * @param[out] tx              Emulated stream
+ * @param[in]  portMask        Ports the stream can transmit on
+ * @param[in]  hostBufferSize  Host buffer size - 0 selects 4 MB
+ * @param[in]  sink            Function receiving the transmitted buffers - NULL discards them
+ * @param[in]  ctx             Context passed to the sink function
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_emu_tx_open(NtEmuTx_t* tx, uint64_t portMask, uint64_t hostBufferSize, NtEmuSink_t sink, void* ctx)
+{
+  memset(tx, 0, sizeof(*tx));
+  tx->size = hostBufferSize ? (hostBufferSize + 7) & ~(uint64_t)7 : 4 * 1024 * 1024;
+  tx->portMask = portMask;
+  tx->sink = sink;
+  tx->ctx = ctx;
+  tx->bufMask = 1023;
+  tx->base = (uint8_t*)_nt_aio_alloc((size_t)tx->size);
+  tx->bufs = (struct _NtEmuSeg_s*)calloc(tx->bufMask + 1, sizeof(struct _NtEmuSeg_s));
+  if (tx->base == NULL || tx->bufs == NULL) {
+    _nt_aio_free(tx->base);
+    free(tx->bufs);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Close an emulated TX stream
+ *
+ * Buffers not released are not transmitted.
+ *
+ * @param[in] tx  Emulated stream
+ */
+static NT_INLINE void _nt_emu_tx_close(NtEmuTx_t* tx)
+{
+  _nt_aio_free(tx->base);
+  free(tx->bufs);
+  memset(tx, 0, sizeof(*tx));
+}
+
+/**
+ * @brief Get a buffer from an emulated TX stream
+ *
+ * Works as @ref NT_NetTxGet. With @ref NT_NETTX_PACKET_OPTION_DEFAULT a
+ * standard descriptor is written in front of the packet. A buffer never
+ * wraps at the end of the host buffer.
+ *
+ * @param[in]  tx            Emulated stream
+ * @param[out] hNetBuf       Packet or segment container reference
+ * @param[in]  port          Port to transmit on
+ * @param[in]  packetSize    Packet size including the 4-byte CRC, or the segment size
+ * @param[in]  packetOption  Kind of buffer
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_STATUS_TRYAGAIN           The host buffer is full - release buffers first
+ * @retval NT_ERROR_INVALID_PARAMETER   Invalid port, size or option
+ */
+static NT_INLINE int _nt_emu_tx_get(NtEmuTx_t* tx, NtNetBuf_t* hNetBuf, uint32_t port, size_t packetSize, enum NtNetTxPacketOption_e packetOption)
+{
+  struct _NtEmuSeg_s* buf;
+  uint64_t length, pos;
+  if (port >= 64 || !((tx->portMask >> port) & 1)) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  switch (packetOption) {
+  case NT_NETTX_PACKET_OPTION_DEFAULT:
+    if (packetSize > 0xFFFF - sizeof(NtStd0Descr_t)) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    length = (sizeof(NtStd0Descr_t) + packetSize + 7) & ~(uint64_t)7;
+    break;
+  case NT_NETTX_PACKET_OPTION_RAW:
+    if (packetSize & 7) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    length = packetSize;
+    break;
+  case NT_NETTX_SEGMENT_OPTION_RAW:
+    length = (packetSize + 7) & ~(uint64_t)7;
+    break;
+  default:
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (length == 0 || length > tx->size) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  pos = tx->head % tx->size;
+  if (pos + length > tx->size) {
+    // Skip the end of the host buffer
+    length += tx->size - pos;
+    pos = 0;
+  }
+  if (tx->head + length - tx->tail > tx->size || tx->dequeued - tx->released > tx->bufMask) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  buf = &tx->bufs[tx->dequeued & tx->bufMask];
+  tx->head += length;
+  buf->end = tx->head;
+  _nt_net_initialize_segment_netbuf(packetSize, tx->base + pos, 0, &buf->netBuf);
+  buf->netBuf.netIf = packetOption == NT_NETTX_SEGMENT_OPTION_RAW ? NT_NET_INTERFACE_SEGMENT : NT_NET_INTERFACE_PACKET;
+  buf->netBuf.egressPort = (int8_t)port;
+  if (packetOption == NT_NETTX_PACKET_OPTION_DEFAULT) {
+    NtStd0Descr_t* descr = (NtStd0Descr_t*)(tx->base + pos);
+    memset(descr, 0, sizeof(*descr));
+    descr->storedLength = (uint16_t)((sizeof(NtStd0Descr_t) + packetSize + 7) & ~(size_t)7);
+    descr->wireLength = (uint16_t)packetSize;
+    descr->txPort = port;
+    descr->descriptorType = 1;
+    buf->netBuf.hPkt = (NtNetBufPkt_t)(descr + 1);
+    buf->netBuf.length = descr->storedLength;
+  }
+  tx->dequeued++;
+  *hNetBuf = &buf->netBuf;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Release a buffer of an emulated TX stream for transmission
+ *
+ * Buffers must be released in the order they were returned and are passed
+ * to the sink function right away.
+ *
+ * @param[in] tx       Emulated stream
+ * @param[in] hNetBuf  Buffer to transmit
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Not the oldest buffer held
+ */
+static NT_INLINE int _nt_emu_tx_release(NtEmuTx_t* tx, NtNetBuf_t hNetBuf)
+{
+  struct _NtEmuSeg_s* buf = &tx->bufs[tx->released & tx->bufMask];
+  if (tx->released == tx->dequeued || hNetBuf != &buf->netBuf) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (hNetBuf->netIf == NT_NET_INTERFACE_SEGMENT) {
+    struct NtNetBuf_s pkt;
+    uint64_t length = NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+    if (length > 0) {
+      _nt_net_build_pkt_netbuf(hNetBuf, &pkt);
+      do {
+        tx->pkts++;
+      } while (_nt_net_get_next_packet(hNetBuf, length, &pkt) > 0);
+    }
+  } else {
+    tx->pkts++;
+  }
+  tx->bytes += NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+  if (tx->sink != NULL) {
+    tx->sink(tx->ctx, hNetBuf);
+  }
+  tx->tail = buf->end;
+  tx->released++;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Read information from an emulated TX stream
+ *
+ * Supports @ref NT_NETTX_READ_CMD_GET_HB_INFO.
+ *
+ * @param[in]     tx    Emulated stream
+ * @param[in,out] data  Read structure with the command set
+ *
+ * @retval NT_SUCCESS                   Success
+ * @retval NT_ERROR_INVALID_PARAMETER   Unsupported command
+ */
+static NT_INLINE int _nt_emu_tx_read(NtEmuTx_t* tx, NtNetTx_t* data)
+{
+  uint64_t dequeued = tx->head - tx->tail;
+  if (data->cmd != NT_NETTX_READ_CMD_GET_HB_INFO) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  data->u.hbInfo.numHostBuffers = 1;
+  data->u.hbInfo.aHostBuffer[0].size = (size_t)tx->size;
+  data->u.hbInfo.aHostBuffer[0].available = (size_t)(tx->size - dequeued);
+  data->u.hbInfo.aHostBuffer[0].dequeued = (size_t)dequeued;
+  data->u.hbInfo.aHostBuffer[0].released = 0;
+  data->u.hbInfo.aHostBuffer[0].layout = NT_NET_HOSTBUFFER_LAYOUT_SLABS;
+  data->u.hbInfo.aHostBuffer[0].index = 0;
+  data->u.hbInfo.aHostBuffer[0].portMask = tx->portMask;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the number of packets and bytes transmitted by an emulated TX stream
+ *
+ * @param[in]  tx     Emulated stream
+ * @param[out] pkts   Packets transmitted
+ * @param[out] bytes  Bytes transmitted
+ */
+static NT_INLINE void _nt_emu_tx_get_stat(NtEmuTx_t* tx, uint64_t* pkts, uint64_t* bytes)
+{
+  *pkts = tx->pkts;
+  *bytes = tx->bytes;
+}
+
+#endif // __EMU_H__
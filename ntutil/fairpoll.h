@@ -0,0 +1,361 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a fair multi-stream poller. One thread can
+ * serve many stream IDs without a busy stream starving the others:
+ * instead of a single @ref NT_NetRxOpenMulti stream, which delivers
+ * segments in the order the host buffers fill, every stream ID gets its
+ * own segment stream and the poller delivers segments by deficit round
+ * robin. Each visit gives a stream ID a byte budget of its weight times
+ * the quantum, a segment is delivered when the budget covers it, and an
+ * idle stream ID loses its unused budget.
+ *
+ * The delivered segments and bytes, the segment waiting for budget and,
+ * when a statistics stream is given, the host buffer bytes queued for a
+ * stream ID are read with @ref _nt_fairpoll_read.
+ *
+ */
+#ifndef __FAIRPOLL_H__
+#define __FAIRPOLL_H__
+
+#include "nt.h"
+#include "compat.h"
+
+/**
+ * Fair poller configuration. Zero selects the default value.
+ */
+typedef struct NtFairPollConfig_s {
+  uint32_t quantum;         //!< Bytes a stream ID of weight 1 may receive per round. Default is 262144
+  int hostBufferAllowance;  //!< Host buffer allowance of the streams in percent. See @ref NT_NetRxOpen. 0 or -1 disables it
+  NtStatStream_t hStat;     //!< Optional statistics stream used to read the host buffer backlog of a stream ID
+  uint32_t idleUs;          //!< Sleep in microseconds when all stream IDs are idle. Default is 20
+} NtFairPollConfig_t;
+
+/**
+ * Stream ID statistics
+ */
+typedef struct NtFairPollIdStat_s {
+  uint32_t streamId;        //!< Stream ID
+  uint32_t weight;          //!< Weight
+  uint64_t segments;        //!< Segments delivered
+  uint64_t bytes;           //!< Bytes delivered
+  uint64_t polls;           //!< NT_NetRxGet calls
+  uint64_t deferred;        //!< Visits ending with a segment waiting for budget
+  int64_t deficit;          //!< Byte budget left in the current round
+  uint64_t pendingBytes;    //!< Bytes of the segment waiting for budget
+  uint64_t backlogBytes;    //!< Host buffer bytes queued for the stream ID - only read with a statistics stream, otherwise 0
+} NtFairPollIdStat_t;
+
+/**
+ * Fair poller read commands
+ */
+enum NtFairPollCmd_e {
+  NT_FAIRPOLL_READ_CMD_UNKNOWN = 0,  //!< Unknown read command
+  NT_FAIRPOLL_READ_CMD_ID_STAT,      //!< Get the statistics and backlog of a stream ID
+};
+
+/**
+ * Fair poller read command
+ */
+typedef struct NtFairPollRead_s {
+  enum NtFairPollCmd_e cmd; //!< The read command
+  uint32_t index;           //!< Index of the stream ID in the array given to @ref _nt_fairpoll_open
+  union NtFairPollRead_u {
+    NtFairPollIdStat_t idStat; //!< The structure to use for NT_FAIRPOLL_READ_CMD_ID_STAT
+  } u;
+} NtFairPollRead_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtFairPollId_s {
+  NtNetStreamRx_t hStream;
+  NtNetBuf_t head;           // Segment waiting for budget
+  uint64_t headLength;
+  int visiting;              // Budget for the current visit has been added
+  NtFairPollIdStat_t stat;
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Fair poller
+ */
+typedef struct NtFairPoll_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtFairPollConfig_t config;
+  struct _NtFairPollId_s *ids;
+  uint32_t numIds;
+  uint32_t cur;
+  NtStatistics_t *usage;
+#endif
+} NtFairPoll_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE void _nt_fairpoll_sleep(uint32_t us)
+{
+  _nt_compat_sleep_ns((uint64_t)us * 1000);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a fair poller
+ *
+ * Segments waiting for budget are released and the streams are closed.
+ * Segments delivered must have been released.
+ *
+ * @param[in] poll  Fair poller
+ */
+static NT_INLINE void _nt_fairpoll_close(NtFairPoll_t* poll)
+{
+  uint32_t i;
+  for (i = 0; poll->ids != NULL && i < poll->numIds; i++) {
+    struct _NtFairPollId_s* id = &poll->ids[i];
+    if (id->hStream == NULL) {
+      continue;
+    }
+    if (id->head != NULL) {
+      (void)NT_NetRxRelease(id->hStream, id->head);
+    }
+    (void)NT_NetRxClose(id->hStream);
+  }
+  free(poll->ids);
+  free(poll->usage);
+  memset(poll, 0, sizeof(*poll));
+}
+
+/**
+ * @brief Open a fair poller
+ *
+ * A segment stream is opened per stream ID with @ref NT_NetRxOpen.
+ *
+ * @param[out] poll       Fair poller
+ * @param[in]  name       Stream name
+ * @param[in]  streamIds  Stream IDs
+ * @param[in]  weights    Weight of every stream ID - NULL gives all a weight of 1
+ * @param[in]  numIds     Number of stream IDs
+ * @param[in]  config     Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error returned by @ref NT_NetRxOpen
+ */
+static NT_INLINE int _nt_fairpoll_open(NtFairPoll_t* poll, const char* name, const uint32_t* streamIds,
+                                       const uint32_t* weights, uint32_t numIds, const NtFairPollConfig_t* config)
+{
+  uint32_t i;
+  int status;
+  memset(poll, 0, sizeof(*poll));
+  if (config != NULL) {
+    poll->config = *config;
+  }
+  if (poll->config.quantum == 0) {
+    poll->config.quantum = 262144;
+  }
+  if (poll->config.idleUs == 0) {
+    poll->config.idleUs = 20;
+  }
+  if (poll->config.idleUs >= 1000000) {
+    poll->config.idleUs = 999999;
+  }
+  // NT_NetRxOpen drops everything at an allowance of 0 percent
+  if (poll->config.hostBufferAllowance == 0) {
+    poll->config.hostBufferAllowance = -1;
+  }
+  if (numIds == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  poll->ids = (struct _NtFairPollId_s*)calloc(numIds, sizeof(struct _NtFairPollId_s));
+  if (poll->ids == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  if (poll->config.hStat != NULL && (poll->usage = (NtStatistics_t*)malloc(sizeof(NtStatistics_t))) == NULL) {
+    free(poll->ids);
+    poll->ids = NULL;
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  poll->numIds = numIds;
+  for (i = 0; i < numIds; i++) {
+    struct _NtFairPollId_s* id = &poll->ids[i];
+    id->stat.streamId = streamIds[i];
+    id->stat.weight = weights != NULL ? weights[i] : 1;
+    if (id->stat.weight == 0) {
+      _nt_fairpoll_close(poll);
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    status = NT_NetRxOpen(&id->hStream, name, NT_NET_INTERFACE_SEGMENT, streamIds[i], poll->config.hostBufferAllowance);
+    if (status != NT_SUCCESS) {
+      id->hStream = NULL;
+      _nt_fairpoll_close(poll);
+      return status;
+    }
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the next segment in fair order
+ *
+ * @param[in]  poll     Fair poller
+ * @param[out] hNetBuf  Segment
+ * @param[out] index    Index of the stream ID the segment belongs to - pass it to @ref _nt_fairpoll_release
+ * @param[in]  timeout  Time to wait for data in milliseconds - negative waits forever
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_TIMEOUT  No data within the timeout
+ * @retval otherwise          Error returned by @ref NT_NetRxGet for the stream ID at index
+ */
+static NT_INLINE int _nt_fairpoll_get(NtFairPoll_t* poll, NtNetBuf_t* hNetBuf, uint32_t* index, int timeout)
+{
+  uint64_t waitedUs = 0;
+  uint32_t idle = 0;
+  for (;;) {
+    struct _NtFairPollId_s* id = &poll->ids[poll->cur];
+    if (!id->visiting) {
+      id->stat.deficit += (int64_t)poll->config.quantum * id->stat.weight;
+      id->visiting = 1;
+    }
+    if (id->head == NULL) {
+      int status = NT_NetRxGet(id->hStream, &id->head, 0);
+      id->stat.polls++;
+      if (status == NT_SUCCESS) {
+        id->headLength = NT_NET_GET_SEGMENT_LENGTH(id->head);
+        id->stat.pendingBytes = id->headLength;
+      } else {
+        id->head = NULL;
+        if (status != NT_STATUS_TIMEOUT && status != NT_STATUS_TRYAGAIN) {
+          *index = poll->cur;
+          return status;
+        }
+      }
+    }
+    if (id->head != NULL && (int64_t)id->headLength <= id->stat.deficit) {
+      *hNetBuf = id->head;
+      *index = poll->cur;
+      id->stat.deficit -= (int64_t)id->headLength;
+      id->stat.segments++;
+      id->stat.bytes += id->headLength;
+      id->stat.pendingBytes = 0;
+      id->head = NULL;
+      return NT_SUCCESS;
+    }
+    // End of the visit
+    if (id->head == NULL) {
+      id->stat.deficit = 0;
+      idle++;
+    } else {
+      id->stat.deferred++;
+      idle = 0;
+    }
+    id->visiting = 0;
+    poll->cur = poll->cur + 1 == poll->numIds ? 0 : poll->cur + 1;
+    if (idle >= poll->numIds) {
+      // A whole round without data
+      if (timeout >= 0 && waitedUs >= (uint64_t)timeout * 1000) {
+        return NT_STATUS_TIMEOUT;
+      }
+      _nt_fairpoll_sleep(poll->config.idleUs);
+      waitedUs += poll->config.idleUs;
+      idle = 0;
+    }
+  }
+}
+
+/**
+ * @brief Release a segment returned by @ref _nt_fairpoll_get
+ *
+ * Segments of a stream ID must be released in the order they were
+ * returned.
+ *
+ * @param[in] poll     Fair poller
+ * @param[in] index    Index of the stream ID returned with the segment
+ * @param[in] hNetBuf  Segment
+ *
+ * @retval See @ref NT_NetRxRelease
+ */
+static NT_INLINE int _nt_fairpoll_release(NtFairPoll_t* poll, uint32_t index, NtNetBuf_t hNetBuf)
+{
+  return NT_NetRxRelease(poll->ids[index].hStream, hNetBuf);
+}
+
+/**
+ * @brief Read fair poller information
+ *
+ * NT_FAIRPOLL_READ_CMD_ID_STAT reads the host buffer backlog with
+ * @ref NT_StatRead when the poller has a statistics stream. The backlog is
+ * the bytes available to or held by the stream ID in all its host
+ * buffers.
+ *
+ * @param[in]     poll  Fair poller
+ * @param[in,out] cmd   Read command
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  Unknown command or index
+ * @retval otherwise                   Error returned by @ref NT_StatRead
+ */
+static NT_INLINE int _nt_fairpoll_read(NtFairPoll_t* poll, NtFairPollRead_t* cmd)
+{
+  struct _NtFairPollId_s* id;
+  if (cmd->cmd != NT_FAIRPOLL_READ_CMD_ID_STAT || cmd->index >= poll->numIds) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  id = &poll->ids[cmd->index];
+  cmd->u.idStat = id->stat;
+  cmd->u.idStat.backlogBytes = 0;
+  if (poll->usage != NULL) {
+    uint32_t i;
+    int status;
+    poll->usage->cmd = NT_STATISTICS_READ_CMD_USAGE_DATA_V0;
+    poll->usage->u.usageData_v0.streamid = (uint8_t)id->stat.streamId;
+    if ((status = NT_StatRead(poll->config.hStat, poll->usage)) != NT_SUCCESS) {
+      return status;
+    }
+    for (i = 0; i < poll->usage->u.usageData_v0.data.numHostBufferUsed && i < 256; i++) {
+      cmd->u.idStat.backlogBytes += poll->usage->u.usageData_v0.data.hb[i].deQueued;
+    }
+  }
+  return NT_SUCCESS;
+}
+
+#endif // __FAIRPOLL_H__
@@ -0,0 +1,453 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the software fan-out engine. A reader thread
+ * reads segments from a capture file, calculates the hash of every packet
+ * with the hash reference and places a packet reference in the ring of
+ * the worker selected by the hash reference result. Offline processing
+ * thereby gets the same flow to worker affinity as the adapter
+ * distribution configured with the same streams, seed and hash mask.
+ *
+ * The engine does not create threads. The reader thread calls
+ * @ref _nt_fanout_read and every worker thread calls @ref _nt_fanout_get
+ * and @ref _nt_fanout_release. Segments are released in order when all
+ * workers have released the packets referencing them.
+ *
+ */
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include "nt.h"
+#include "hashref_pkt.h"
+#include "ring.h"
+#include "compat.h"
+
+/**
+ * Packet reference placed in a worker ring
+ */
+typedef struct NtFanoutPkt_s {
+  NtNetBufHdr_t hHdr;       //!< Packet descriptor within the segment
+  uint32_t slot;            //!< Segment slot holding the packet
+  uint32_t hashvalue;       //!< Calculated hash value - 0 if the packet does not carry the fields used by the hash mode
+} NtFanoutPkt_t;
+
+/**
+ * Fan-out worker statistics
+ */
+typedef struct NtFanoutWorkerStat_s {
+  uint64_t pkts;            //!< Packets dispatched to the worker
+  uint64_t bytes;           //!< Wire bytes dispatched to the worker
+  uint64_t queued;          //!< Packets in the worker ring
+  uint64_t ringFull;        //!< Number of times the reader found the worker ring full
+} NtFanoutWorkerStat_t;
+
+/**
+ * Fan-out statistics
+ */
+typedef struct NtFanoutStat_s {
+  uint64_t segments;        //!< Segments read from the file
+  uint64_t pkts;            //!< Packets dispatched
+  uint64_t bytes;           //!< Wire bytes dispatched
+  uint64_t unhashed;        //!< Packets without the fields used by the hash mode - dispatched to worker 0
+  uint64_t elapsedNs;       //!< Time since the engine was opened
+  uint64_t pktsPerSec;      //!< Average dispatch rate in packets per second
+  uint64_t bitsPerSec;      //!< Average dispatch rate in wire bits per second
+  uint32_t skew;            //!< Packets dispatched to the busiest worker in percent of the mean - 100 is a perfect balance
+} NtFanoutStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtFanoutWorker_s {
+  NtRing_t ring;            // Packet references - the reader produces and the worker consumes
+  NtFanoutWorkerStat_t stat; // Written by the reader only
+};
+
+struct _NtFanoutSlot_s {
+  NtNetBuf_t hNetBuf;       // Segment
+  uint64_t *heads;          // Head of every worker ring after the last packet of the segment
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Fan-out engine
+ */
+typedef struct NtFanout_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtNetStreamFile_t hFile;
+  NtHashRefPkt_t hashRef;
+  uint32_t numWorkers;
+  struct _NtFanoutWorker_s *workers;
+  uint32_t numSlots;
+  struct _NtFanoutSlot_s *slots;
+  uint64_t *heads;
+  uint32_t first;           // Oldest segment slot in use
+  uint32_t used;            // Number of segment slots in use
+  int active;               // Set while the newest segment is being dispatched
+  struct NtNetBuf_s pktNetBuf; // Next packet to dispatch
+  int pending;              // Set if the worker of the next packet is calculated
+  NtFanoutPkt_t pendingPkt;
+  uint32_t pendingWorker;
+  volatile uint32_t eof;
+  uint64_t startNs;
+  NtFanoutStat_t stat;
+#endif
+} NtFanout_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Release the oldest segments that no worker references any longer
+ */
+static NT_INLINE int _nt_fanout_reclaim(NtFanout_t* fanout)
+{
+  while (fanout->used > 0) {
+    struct _NtFanoutSlot_s* slot = &fanout->slots[fanout->first];
+    uint32_t w;
+    int status;
+    if (fanout->active && fanout->used == 1) {
+      break;
+    }
+    for (w = 0; w < fanout->numWorkers; w++) {
+      if (_nt_atomic_load_acquire_u64(&fanout->workers[w].ring.tail) < slot->heads[w]) {
+        return NT_SUCCESS;
+      }
+    }
+    if ((status = NT_NetFileRelease(fanout->hFile, slot->hNetBuf)) != NT_SUCCESS) {
+      return status;
+    }
+    slot->hNetBuf = NULL;
+    fanout->first = (fanout->first + 1) % fanout->numSlots;
+    fanout->used--;
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Record the worker ring heads for the newest segment
+ */
+static NT_INLINE void _nt_fanout_seal(NtFanout_t* fanout)
+{
+  struct _NtFanoutSlot_s* slot = &fanout->slots[(fanout->first + fanout->used - 1) % fanout->numSlots];
+  uint32_t w;
+  for (w = 0; w < fanout->numWorkers; w++) {
+    slot->heads[w] = fanout->workers[w].ring.head;
+  }
+  fanout->active = 0;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Open a fan-out engine
+ *
+ * The hash reference must be configured with "streams" equal to the number
+ * of workers. The file stream must be opened with NT_NET_INTERFACE_SEGMENT
+ * and is not closed by @ref _nt_fanout_close.
+ *
+ * @param[out] fanout       Fan-out engine
+ * @param[in]  hFile        File stream opened with @ref NT_NetFileOpen
+ * @param[in]  hashRef      Packet hash reference handle
+ * @param[in]  numWorkers   Number of workers
+ * @param[in]  ringSize     Number of packet references in each worker ring - must be a power of 2
+ * @param[in]  numSegments  Maximum number of segments held at the same time
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_fanout_open(NtFanout_t* fanout, NtNetStreamFile_t hFile, const NtHashRefPkt_t* hashRef,
+                                     uint32_t numWorkers, uint32_t ringSize, uint32_t numSegments)
+{
+  uint32_t w, s;
+  int status;
+  memset(fanout, 0, sizeof(*fanout));
+  if (numWorkers == 0 || numSegments == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  fanout->hFile = hFile;
+  fanout->hashRef = *hashRef;
+  fanout->numWorkers = numWorkers;
+  fanout->numSlots = numSegments;
+#ifdef _MSC_VER
+  fanout->workers = (struct _NtFanoutWorker_s*)_aligned_malloc(numWorkers * sizeof(struct _NtFanoutWorker_s), NT_CACHE_LINE_SIZE);
+#else
+  if (posix_memalign((void**)&fanout->workers, NT_CACHE_LINE_SIZE, numWorkers * sizeof(struct _NtFanoutWorker_s)) != 0) {
+    fanout->workers = NULL;
+  }
+#endif
+  fanout->slots = (struct _NtFanoutSlot_s*)calloc(numSegments, sizeof(struct _NtFanoutSlot_s));
+  fanout->heads = (uint64_t*)calloc((size_t)numSegments * numWorkers, sizeof(uint64_t));
+  if (fanout->workers == NULL || fanout->slots == NULL || fanout->heads == NULL) {
+    status = NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    goto error;
+  }
+  memset(fanout->workers, 0, numWorkers * sizeof(struct _NtFanoutWorker_s));
+  for (s = 0; s < numSegments; s++) {
+    fanout->slots[s].heads = &fanout->heads[(size_t)s * numWorkers];
+  }
+  for (w = 0; w < numWorkers; w++) {
+    if ((status = _nt_ring_init(&fanout->workers[w].ring, ringSize, sizeof(NtFanoutPkt_t))) != NT_SUCCESS) {
+      goto error;
+    }
+  }
+  fanout->startNs = _nt_compat_now_ns();
+  return NT_SUCCESS;
+
+error:
+  if (fanout->workers != NULL) {
+    for (w = 0; w < numWorkers; w++) {
+      _nt_ring_free(&fanout->workers[w].ring);
+    }
+  }
+#ifdef _MSC_VER
+  _aligned_free(fanout->workers);
+#else
+  free(fanout->workers);
+#endif
+  free(fanout->slots);
+  free(fanout->heads);
+  memset(fanout, 0, sizeof(*fanout));
+  return status;
+}
+
+/**
+ * @brief Close a fan-out engine
+ *
+ * All segments still held are released. The workers must have stopped.
+ *
+ * @param[in] fanout  Fan-out engine
+ */
+static NT_INLINE void _nt_fanout_close(NtFanout_t* fanout)
+{
+  uint32_t w;
+  while (fanout->used > 0) {
+    (void)NT_NetFileRelease(fanout->hFile, fanout->slots[fanout->first].hNetBuf);
+    fanout->first = (fanout->first + 1) % fanout->numSlots;
+    fanout->used--;
+  }
+  for (w = 0; w < fanout->numWorkers; w++) {
+    _nt_ring_free(&fanout->workers[w].ring);
+  }
+#ifdef _MSC_VER
+  _aligned_free(fanout->workers);
+#else
+  free(fanout->workers);
+#endif
+  free(fanout->slots);
+  free(fanout->heads);
+  memset(fanout, 0, sizeof(*fanout));
+}
+
+/**
+ * @brief Read from the file and dispatch packets to the workers - reader thread only
+ *
+ * Dispatches the rest of the current segment, or reads and dispatches the
+ * next segment. Segments released by all workers are released to the file
+ * stream first.
+ *
+ * @param[in] fanout  Fan-out engine
+ *
+ * @retval NT_SUCCESS             A segment has been dispatched
+ * @retval NT_STATUS_TRYAGAIN     A worker ring is full or all segment slots are in use - call again
+ * @retval NT_STATUS_END_OF_FILE  All packets have been dispatched and released by the workers
+ * @retval otherwise              Error returned by the file stream or the hash reference
+ */
+static NT_INLINE int _nt_fanout_read(NtFanout_t* fanout)
+{
+  int status;
+  if ((status = _nt_fanout_reclaim(fanout)) != NT_SUCCESS) {
+    return status;
+  }
+  while (!fanout->active) {
+    NtNetBuf_t hNetBuf;
+    if (fanout->eof) {
+      return fanout->used > 0 ? NT_STATUS_TRYAGAIN : NT_STATUS_END_OF_FILE;
+    }
+    if (fanout->used == fanout->numSlots) {
+      return NT_STATUS_TRYAGAIN;
+    }
+    status = NT_NetFileGet(fanout->hFile, &hNetBuf);
+    if (status == NT_STATUS_END_OF_FILE) {
+      _nt_atomic_store_release_u32(&fanout->eof, 1);
+      continue;
+    }
+    if (status != NT_SUCCESS) {
+      return status;
+    }
+    fanout->slots[(fanout->first + fanout->used) % fanout->numSlots].hNetBuf = hNetBuf;
+    fanout->used++;
+    fanout->stat.segments++;
+    fanout->active = 1;
+    if (NT_NET_GET_SEGMENT_LENGTH(hNetBuf) == 0) {
+      _nt_fanout_seal(fanout);
+      continue;
+    }
+    _nt_net_build_pkt_netbuf(hNetBuf, &fanout->pktNetBuf);
+  }
+
+  {
+    uint32_t slotNo = (fanout->first + fanout->used - 1) % fanout->numSlots;
+    NtNetBuf_t hNetBuf = fanout->slots[slotNo].hNetBuf;
+    do {
+      struct _NtFanoutWorker_s* worker;
+      if (!fanout->pending) {
+        NtHashRefResult_t result;
+        uint32_t length = (uint32_t)(NT_NET_GET_PKT_CAP_LENGTH(&fanout->pktNetBuf) - NT_NET_GET_PKT_DESCR_LENGTH(&fanout->pktNetBuf));
+        status = _nt_hashref_calc_pkt(&fanout->hashRef, NT_NET_GET_PKT_L2_PTR(&fanout->pktNetBuf), length, &result);
+        if (status == NT_STATUS_NO_DATA) {
+          result.hashvalue = 0;
+          result.stream = 0;
+          fanout->stat.unhashed++;
+        } else if (status != NT_SUCCESS) {
+          return status;
+        }
+        fanout->pendingPkt.hHdr = fanout->pktNetBuf.hHdr;
+        fanout->pendingPkt.slot = slotNo;
+        fanout->pendingPkt.hashvalue = result.hashvalue;
+        fanout->pendingWorker = result.stream % fanout->numWorkers;
+        fanout->pending = 1;
+      }
+      worker = &fanout->workers[fanout->pendingWorker];
+      if (_nt_ring_enqueue(&worker->ring, &fanout->pendingPkt) != NT_SUCCESS) {
+        worker->stat.ringFull++;
+        return NT_STATUS_TRYAGAIN;
+      }
+      fanout->pending = 0;
+      worker->stat.pkts++;
+      worker->stat.bytes += NT_NET_GET_PKT_WIRE_LENGTH(&fanout->pktNetBuf);
+      fanout->stat.pkts++;
+      fanout->stat.bytes += NT_NET_GET_PKT_WIRE_LENGTH(&fanout->pktNetBuf);
+    } while (_nt_net_get_next_packet(hNetBuf, NT_NET_GET_SEGMENT_LENGTH(hNetBuf), &fanout->pktNetBuf) > 0);
+  }
+  _nt_fanout_seal(fanout);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the next packet reference of a worker - worker thread only
+ *
+ * The reference stays valid until it is released with @ref _nt_fanout_release.
+ *
+ * @param[in]  fanout  Fan-out engine
+ * @param[in]  worker  Worker number
+ * @param[out] pkt     Packet reference
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_TRYAGAIN     No packet is available
+ * @retval NT_STATUS_END_OF_FILE  The file has been read and all packets of the worker have been processed
+ */
+static NT_INLINE int _nt_fanout_get(NtFanout_t* fanout, uint32_t worker, const NtFanoutPkt_t** pkt)
+{
+  NtRing_t* ring = &fanout->workers[worker].ring;
+  if ((*pkt = (const NtFanoutPkt_t*)_nt_ring_peek(ring)) != NULL) {
+    return NT_SUCCESS;
+  }
+  if (_nt_atomic_load_acquire_u32(&fanout->eof)) {
+    // The reader has dispatched everything before setting end of file
+    if ((*pkt = (const NtFanoutPkt_t*)_nt_ring_peek(ring)) != NULL) {
+      return NT_SUCCESS;
+    }
+    return NT_STATUS_END_OF_FILE;
+  }
+  return NT_STATUS_TRYAGAIN;
+}
+
+/**
+ * @brief Release the packet reference returned by @ref _nt_fanout_get - worker thread only
+ *
+ * @param[in] fanout  Fan-out engine
+ * @param[in] worker  Worker number
+ */
+static NT_INLINE void _nt_fanout_release(NtFanout_t* fanout, uint32_t worker)
+{
+  _nt_ring_advance(&fanout->workers[worker].ring, 1);
+}
+
+/**
+ * @brief Build a packet NtNetBuf_s structure from a packet reference
+ *
+ * The packet macros can be used on the result until the packet reference
+ * is released.
+ *
+ * @param[in]  fanout     Fan-out engine
+ * @param[in]  pkt        Packet reference
+ * @param[out] pktNetBuf  Packet NtNetBuf_s * structure
+ */
+static NT_INLINE void _nt_fanout_build_pkt_netbuf(NtFanout_t* fanout, const NtFanoutPkt_t* pkt, struct NtNetBuf_s* pktNetBuf)
+{
+  memcpy((void*)pktNetBuf, (void*)fanout->slots[pkt->slot].hNetBuf, sizeof(struct NtNetBuf_s));
+  pktNetBuf->hHdr = pkt->hHdr;
+  pktNetBuf->hPkt = (NtNetBufPkt_t)((uint8_t*)pkt->hHdr + NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+}
+
+/**
+ * @brief Get the fan-out statistics - reader thread only
+ *
+ * @param[in]  fanout   Fan-out engine
+ * @param[out] stat     Engine statistics
+ * @param[out] workers  Optional array with an entry per worker
+ */
+static NT_INLINE void _nt_fanout_get_stat(NtFanout_t* fanout, NtFanoutStat_t* stat, NtFanoutWorkerStat_t* workers)
+{
+  uint64_t maxPkts = 0;
+  uint32_t w;
+  *stat = fanout->stat;
+  stat->elapsedNs = _nt_compat_now_ns() - fanout->startNs;
+  if (stat->elapsedNs > 0) {
+    stat->pktsPerSec = (uint64_t)((double)stat->pkts * 1e9 / (double)stat->elapsedNs);
+    stat->bitsPerSec = (uint64_t)((double)stat->bytes * 8e9 / (double)stat->elapsedNs);
+  }
+  for (w = 0; w < fanout->numWorkers; w++) {
+    struct _NtFanoutWorker_s* worker = &fanout->workers[w];
+    if (worker->stat.pkts > maxPkts) {
+      maxPkts = worker->stat.pkts;
+    }
+    if (workers != NULL) {
+      workers[w] = worker->stat;
+      workers[w].queued = _nt_ring_count(&worker->ring);
+    }
+  }
+  stat->skew = stat->pkts > 0 ? (uint32_t)(maxPkts * 100 * fanout->numWorkers / stat->pkts) : 100;
+}
+
+#endif // __FANOUT_H__
@@ -0,0 +1,597 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+/**
+ * @file
+ *
+ * This header file contains idle timeout aging of the flows of a
+ * @ref NtFlowTab_t with a hierarchical timer wheel, so expiry never scans
+ * the table. The wheel has 4 levels of 256 slots: level 0 has a slot per
+ * tick and each higher level a slot per 256 slots of the level below. A
+ * flow is armed in the slot of its deadline and moved down a level when
+ * the wheel reaches the slot, so arming, disarming and expiring a flow is
+ * O(1).
+ *
+ * Time is stream time, not wall clock time: it is advanced by the packet
+ * time stamps, by the time stamp of empty segments, which the adapter
+ * delivers when the stream is idle, and by
+ * NT_NETRX_READ_CMD_STREAM_TIME. Replaying a capture file therefore ages
+ * the flows as when they were captured.
+ *
+ * A packet of a flow only stores the time in the per-flow timer with
+ * @ref _nt_flowage_touch - the timer is not moved. When the wheel reaches
+ * the timer and the flow has been active, the timer is armed again at the
+ * new deadline, so a flow costs at most one rearm per timeout. The wheel
+ * is run by @ref _nt_flowage_expire, which handles at most the configured
+ * budget of timers per call, so calling it once per packet batch spreads
+ * the work of a time jump or of many flows timing out at once over
+ * several batches.
+ *
+ * Example:
+ * @code
+ * while (run) {
+ *   status = _nt_net_get_packet_burst(hStream, &burst, pkts, 64, &count);
+ *   if (count == 0 && burst.hNetBuf != NULL) {
+ *     _nt_flowage_segment(&age, burst.hNetBuf);
+ *   }
+ *   _nt_flowtab_lookup_burst(&tab, pkts, count, 1, values);
+ *   for (i = 0; i < count; i++) {
+ *     if (values[i] != NULL) {
+ *       _nt_flowage_touch_pkt(&age, values[i], &pkts[i]);
+ *     }
+ *   }
+ *   n = _nt_flowage_expire(&age, expired, 64);
+ *   for (i = 0; i < n; i++) {
+ *     report(expired[i]);
+ *     _nt_flowage_remove(&age, expired[i]);
+ *   }
+ * }
+ * @endcode
+ *
+ */
+#ifndef __FLOWAGE_H__
+#define __FLOWAGE_H__
+
+#include "nt.h"
+#include "flowtab.h"
+
+/**
+ * Levels of the timer wheel
+ */
+#define NT_FLOWAGE_LEVELS 4
+
+/**
+ * Slots per level of the timer wheel
+ */
+#define NT_FLOWAGE_SLOTS 256
+
+/**
+ * Flow aging configuration. Zero selects the default value.
+ */
+typedef struct NtFlowAgeConfig_s {
+  uint64_t tick;            //!< Nanoseconds per tick - the resolution of the timeouts. Default is 1 ms
+  uint64_t timeout;         //!< Idle timeout in nanoseconds of flows without their own timeout. Default is 60 s
+  uint32_t budget;          //!< Maximum timers handled per call to @ref _nt_flowage_expire. Default is 256
+} NtFlowAgeConfig_t;
+
+/**
+ * Flow aging counters
+ */
+typedef struct NtFlowAgeStat_s {
+  uint64_t armed;           //!< Flows with an armed timer
+  uint64_t expired;         //!< Flows returned as expired
+  uint64_t rearmed;         //!< Timers armed again because the flow was active
+  uint64_t cascaded;        //!< Timers moved down a level
+  uint64_t deferred;        //!< Calls to @ref _nt_flowage_expire that stopped on the budget
+  uint64_t time;            //!< Stream time in nanoseconds
+} NtFlowAgeStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#define _NT_FLOWAGE_NONE 0xFFFFFFFFU
+
+struct _NtFlowAgeNode_s {
+  uint32_t next;
+  uint32_t prev;             // _NT_FLOWAGE_NONE if first in the slot
+  uint32_t slot;             // Level * NT_FLOWAGE_SLOTS + slot, _NT_FLOWAGE_NONE if not armed
+  uint32_t timeout;          // Ticks, 0 for the configured timeout
+  uint64_t last;             // Tick of the last packet
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Flow aging state of a flow table. Must be used by the thread using the table.
+ */
+typedef struct NtFlowAge_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtFlowAgeConfig_t config;
+  NtFlowTab_t *tab;
+  struct _NtFlowAgeNode_s *nodes;   // Per flow entry index
+  uint32_t head[NT_FLOWAGE_LEVELS * NT_FLOWAGE_SLOTS];
+  uint64_t used[NT_FLOWAGE_LEVELS][NT_FLOWAGE_SLOTS / 64]; // Non-empty slots
+  uint64_t timeout;          // Configured timeout in ticks
+  uint64_t now;              // Tick of the stream time
+  uint64_t wheel;            // Next tick to run. At most now + 1
+  uint64_t cascadeTick;      // Tick whose cascade is in progress or done
+  uint32_t cascadeLevel;     // Next level to cascade, 0 when done
+  enum NtTimestampType_e tsType; // Time stamp type of the last packet or segment
+  NtFlowAgeStat_t stat;
+#endif
+} NtFlowAge_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE void _nt_flowage_link(NtFlowAge_t* age, uint32_t index, uint32_t slot)
+{
+  struct _NtFlowAgeNode_s* node = &age->nodes[index];
+  uint32_t first = age->head[slot];
+  node->slot = slot;
+  node->prev = _NT_FLOWAGE_NONE;
+  node->next = first;
+  if (first != _NT_FLOWAGE_NONE) {
+    age->nodes[first].prev = index;
+  }
+  age->head[slot] = index;
+  age->used[slot / NT_FLOWAGE_SLOTS][(slot % NT_FLOWAGE_SLOTS) / 64] |= 1ULL << (slot % 64);
+}
+
+static NT_INLINE void _nt_flowage_unlink(NtFlowAge_t* age, uint32_t index)
+{
+  struct _NtFlowAgeNode_s* node = &age->nodes[index];
+  if (node->prev != _NT_FLOWAGE_NONE) {
+    age->nodes[node->prev].next = node->next;
+  } else {
+    age->head[node->slot] = node->next;
+    if (node->next == _NT_FLOWAGE_NONE) {
+      age->used[node->slot / NT_FLOWAGE_SLOTS][(node->slot % NT_FLOWAGE_SLOTS) / 64] &= ~(1ULL << (node->slot % 64));
+    }
+  }
+  if (node->next != _NT_FLOWAGE_NONE) {
+    age->nodes[node->next].prev = node->prev;
+  }
+  node->slot = _NT_FLOWAGE_NONE;
+}
+
+/*
+ * Link a timer in the slot of its deadline relative to the next tick to run
+ */
+static NT_INLINE void _nt_flowage_arm(NtFlowAge_t* age, uint32_t index, uint64_t deadline)
+{
+  uint64_t delta;
+  uint32_t level;
+  if (deadline < age->wheel) {
+    deadline = age->wheel;
+  }
+  delta = deadline - age->wheel;
+  if (delta >= 1ULL << (8 * NT_FLOWAGE_LEVELS)) {
+    // Beyond the wheel - the flow is checked again at the end of the wheel
+    delta = (1ULL << (8 * NT_FLOWAGE_LEVELS)) - 1;
+    deadline = age->wheel + delta;
+  }
+  for (level = 0; level < NT_FLOWAGE_LEVELS - 1 && delta >= 1ULL << (8 * (level + 1)); level++) {
+  }
+  _nt_flowage_link(age, index, level * NT_FLOWAGE_SLOTS + (uint32_t)((deadline >> (8 * level)) % NT_FLOWAGE_SLOTS));
+}
+
+static NT_INLINE uint64_t _nt_flowage_deadline(const NtFlowAge_t* age, const struct _NtFlowAgeNode_s* node)
+{
+  return node->last + (node->timeout != 0 ? node->timeout : age->timeout);
+}
+
+/*
+ * First non-empty slot of a level from slot "from", or NT_FLOWAGE_SLOTS
+ */
+static NT_INLINE uint32_t _nt_flowage_next_used(const NtFlowAge_t* age, uint32_t level, uint32_t from)
+{
+  uint32_t word = from / 64;
+  uint64_t bits;
+  if (from >= NT_FLOWAGE_SLOTS) {
+    return NT_FLOWAGE_SLOTS;
+  }
+  bits = age->used[level][word] & (~0ULL << (from % 64));
+  for (;;) {
+    if (bits != 0) {
+#if defined(_MSC_VER)
+      unsigned long n;
+      _BitScanForward64(&n, bits);
+      return word * 64 + n;
+#else
+      return word * 64 + (uint32_t)__builtin_ctzll(bits);
+#endif
+    }
+    if (++word == NT_FLOWAGE_SLOTS / 64) {
+      return NT_FLOWAGE_SLOTS;
+    }
+    bits = age->used[level][word];
+  }
+}
+
+/*
+ * Tick of the next cascade of a level with timers once level 0 has no
+ * timers left in the current round, or ~0 if the wheel is empty
+ */
+static NT_INLINE uint64_t _nt_flowage_next_cascade(const NtFlowAge_t* age)
+{
+  uint64_t next = ~0ULL, tick;
+  uint32_t level;
+  for (level = 0; level < NT_FLOWAGE_LEVELS; level++) {
+    uint64_t index = age->wheel >> (8 * level);
+    uint32_t current = (uint32_t)(index % NT_FLOWAGE_SLOTS);
+    uint32_t used = level == 0 ? NT_FLOWAGE_SLOTS : _nt_flowage_next_used(age, level, current + 1);
+    if (used < NT_FLOWAGE_SLOTS) {
+      tick = (index - current + used) << (8 * level);
+    } else if (_nt_flowage_next_used(age, level, 0) < NT_FLOWAGE_SLOTS) {
+      // Timers of the next round of the level
+      tick = ((index / NT_FLOWAGE_SLOTS) + 1) << (8 * (level + 1));
+    } else {
+      continue;
+    }
+    next = tick < next ? tick : next;
+  }
+  return next;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close flow aging
+ *
+ * @param[in] age  Flow aging state
+ */
+static NT_INLINE void _nt_flowage_close(NtFlowAge_t* age)
+{
+  free(age->nodes);
+  age->nodes = NULL;
+}
+
+/**
+ * @brief Open flow aging of a flow table
+ *
+ * The flows of the table must from now on be removed with
+ * @ref _nt_flowage_remove, so their timers are disarmed.
+ *
+ * @param[out] age     Flow aging state
+ * @param[in]  tab     Open flow table
+ * @param[in]  config  Optional configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        The timeout does not fit the wheel
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_flowage_open(NtFlowAge_t* age, NtFlowTab_t* tab, const NtFlowAgeConfig_t* config)
+{
+  uint64_t i;
+  memset(age, 0, sizeof(*age));
+  if (config != NULL) {
+    age->config = *config;
+  }
+  if (age->config.tick == 0) {
+    age->config.tick = 1000000;
+  }
+  if (age->config.timeout == 0) {
+    age->config.timeout = 60ULL * 1000000000ULL;
+  }
+  if (age->config.budget == 0) {
+    age->config.budget = 256;
+  }
+  age->timeout = (age->config.timeout + age->config.tick - 1) / age->config.tick;
+  if (age->timeout >= 1ULL << 32) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  age->tab = tab;
+  age->nodes = (struct _NtFlowAgeNode_s*)malloc((size_t)tab->config.maxFlows * sizeof(struct _NtFlowAgeNode_s));
+  if (age->nodes == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (i = 0; i < tab->config.maxFlows; i++) {
+    age->nodes[i].slot = _NT_FLOWAGE_NONE;
+    age->nodes[i].timeout = 0;
+  }
+  for (i = 0; i < NT_FLOWAGE_LEVELS * NT_FLOWAGE_SLOTS; i++) {
+    age->head[i] = _NT_FLOWAGE_NONE;
+  }
+  age->cascadeTick = ~0ULL;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Convert a time stamp to nanoseconds
+ *
+ * @param[in] ts      Time stamp
+ * @param[in] tsType  Time stamp type
+ *
+ * @retval Nanoseconds from the base of the time stamp type
+ */
+static NT_INLINE uint64_t _nt_flowage_ts_ns(uint64_t ts, enum NtTimestampType_e tsType)
+{
+  switch (tsType) {
+  case NT_TIMESTAMP_TYPE_PCAP:
+    return (ts >> 32) * 1000000000ULL + (ts & 0xFFFFFFFF) * 1000;
+  case NT_TIMESTAMP_TYPE_PCAP_NANOTIME:
+    return (ts >> 32) * 1000000000ULL + (ts & 0xFFFFFFFF);
+  default:
+    return ts * 10;
+  }
+}
+
+/**
+ * @brief Advance the stream time
+ *
+ * Time never moves backwards, so time stamps older than the stream time
+ * are ignored. When no timer is armed the wheel jumps to the new time.
+ *
+ * @param[in] age  Flow aging state
+ * @param[in] ns   Stream time in nanoseconds
+ */
+static NT_INLINE void _nt_flowage_set_time(NtFlowAge_t* age, uint64_t ns)
+{
+  uint64_t now = ns / age->config.tick;
+  if (ns <= age->stat.time) {
+    return;
+  }
+  age->stat.time = ns;
+  age->now = now;
+  if (age->stat.armed == 0 && now > age->wheel) {
+    age->wheel = now;
+    age->cascadeLevel = 0;
+  }
+}
+
+/**
+ * @brief Advance the stream time from the time stamp of a segment
+ *
+ * Used with the empty segments only containing a time stamp update, which
+ * the adapter returns when the stream is idle.
+ *
+ * @param[in] age      Flow aging state
+ * @param[in] hNetBuf  Segment
+ */
+static NT_INLINE void _nt_flowage_segment(NtFlowAge_t* age, NtNetBuf_t hNetBuf)
+{
+  age->tsType = (enum NtTimestampType_e)NT_NET_GET_SEGMENT_TIMESTAMP_TYPE(hNetBuf);
+  _nt_flowage_set_time(age, _nt_flowage_ts_ns(NT_NET_GET_SEGMENT_TIMESTAMP(hNetBuf), age->tsType));
+}
+
+/**
+ * @brief Advance the stream time from NT_NETRX_READ_CMD_STREAM_TIME
+ *
+ * Used when @ref NT_NetRxGet returns a timeout. The stream time is
+ * converted with the time stamp type of the last packet or segment.
+ *
+ * @param[in] age      Flow aging state
+ * @param[in] hStream  RX stream
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref NT_NetRxRead
+ */
+static NT_INLINE int _nt_flowage_stream_time(NtFlowAge_t* age, NtNetStreamRx_t hStream)
+{
+  NtNetRx_t rx;
+  int status;
+  memset(&rx, 0, sizeof(rx));
+  rx.cmd = NT_NETRX_READ_CMD_STREAM_TIME;
+  if ((status = NT_NetRxRead(hStream, &rx)) != NT_SUCCESS) {
+    return status;
+  }
+  _nt_flowage_set_time(age, _nt_flowage_ts_ns(rx.u.streamTime.ts, age->tsType));
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Record activity of a flow at the stream time
+ *
+ * Arms the timer of a new flow. For an armed flow only the time is stored.
+ *
+ * @param[in] age    Flow aging state
+ * @param[in] value  User data of the flow
+ */
+static NT_INLINE void _nt_flowage_touch(NtFlowAge_t* age, void* value)
+{
+  uint32_t index = _nt_flowtab_index(age->tab, value);
+  struct _NtFlowAgeNode_s* node = &age->nodes[index];
+  node->last = age->now;
+  if (node->slot == _NT_FLOWAGE_NONE) {
+    _nt_flowage_arm(age, index, _nt_flowage_deadline(age, node));
+    age->stat.armed++;
+  }
+}
+
+/**
+ * @brief Advance the stream time to the time stamp of a packet
+ *
+ * @param[in] age        Flow aging state
+ * @param[in] pktNetBuf  Packet
+ */
+static NT_INLINE void _nt_flowage_set_time_pkt(NtFlowAge_t* age, struct NtNetBuf_s* pktNetBuf)
+{
+  age->tsType = (enum NtTimestampType_e)NT_NET_GET_PKT_TIMESTAMP_TYPE(pktNetBuf);
+  _nt_flowage_set_time(age, _nt_flowage_ts_ns(NT_NET_GET_PKT_TIMESTAMP(pktNetBuf), age->tsType));
+}
+
+/**
+ * @brief Advance the stream time to a packet and record activity of its flow
+ *
+ * @param[in] age        Flow aging state
+ * @param[in] value      User data of the flow of the packet
+ * @param[in] pktNetBuf  Packet
+ */
+static NT_INLINE void _nt_flowage_touch_pkt(NtFlowAge_t* age, void* value, struct NtNetBuf_s* pktNetBuf)
+{
+  _nt_flowage_set_time_pkt(age, pktNetBuf);
+  _nt_flowage_touch(age, value);
+}
+
+/**
+ * @brief Set the idle timeout of a flow
+ *
+ * E.g. a shorter timeout for a TCP flow that has been closed. The timeout
+ * applies from the last activity of the flow and is reset to the
+ * configured timeout when the flow is removed.
+ *
+ * @param[in] age      Flow aging state
+ * @param[in] value    User data of the flow
+ * @param[in] timeout  Idle timeout in nanoseconds - 0 selects the configured timeout
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  The timeout does not fit the wheel
+ */
+static NT_INLINE int _nt_flowage_set_timeout(NtFlowAge_t* age, void* value, uint64_t timeout)
+{
+  uint32_t index = _nt_flowtab_index(age->tab, value);
+  struct _NtFlowAgeNode_s* node = &age->nodes[index];
+  uint64_t ticks = (timeout + age->config.tick - 1) / age->config.tick;
+  if (ticks >= 1ULL << 32) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if (timeout != 0 && ticks == 0) {
+    ticks = 1;
+  }
+  node->timeout = (uint32_t)ticks;
+  if (node->slot != _NT_FLOWAGE_NONE) {
+    // A later deadline is found when the timer runs, an earlier one needs the timer moved
+    _nt_flowage_unlink(age, index);
+    _nt_flowage_arm(age, index, _nt_flowage_deadline(age, node));
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Remove a flow from the flow table and disarm its timer
+ *
+ * @param[in] age    Flow aging state
+ * @param[in] value  User data of the flow
+ */
+static NT_INLINE void _nt_flowage_remove(NtFlowAge_t* age, void* value)
+{
+  uint32_t index = _nt_flowtab_index(age->tab, value);
+  struct _NtFlowAgeNode_s* node = &age->nodes[index];
+  if (node->slot != _NT_FLOWAGE_NONE) {
+    _nt_flowage_unlink(age, index);
+    age->stat.armed--;
+  }
+  node->timeout = 0;
+  _nt_flowtab_remove(age->tab, value);
+}
+
+/**
+ * @brief Run the timer wheel up to the stream time
+ *
+ * Returns the flows that have been idle for their timeout. Their timers
+ * are disarmed, but the flows stay in the table until removed with
+ * @ref _nt_flowage_remove; a flow touched again instead is armed again.
+ * At most the configured budget of timers is handled per call, and the
+ * call stops when "max" flows have expired, so the caller must call again
+ * - e.g. after the next packet batch - to catch up.
+ *
+ * @param[in]  age     Flow aging state
+ * @param[out] values  User data of the expired flows
+ * @param[in]  max     Maximum number of expired flows to return
+ *
+ * @retval The number of expired flows returned
+ */
+static NT_INLINE uint32_t _nt_flowage_expire(NtFlowAge_t* age, void** values, uint32_t max)
+{
+  uint32_t work = 0, count = 0;
+  while (age->wheel <= age->now) {
+    uint32_t slot = (uint32_t)(age->wheel % NT_FLOWAGE_SLOTS);
+    uint64_t step;
+    if (slot == 0 && age->cascadeTick != age->wheel) {
+      age->cascadeTick = age->wheel;
+      age->cascadeLevel = 1;
+    }
+    // Move the timers of the next slot of the levels above down
+    while (age->cascadeLevel != 0) {
+      uint32_t upper = (uint32_t)((age->wheel >> (8 * age->cascadeLevel)) % NT_FLOWAGE_SLOTS);
+      uint32_t* head = &age->head[age->cascadeLevel * NT_FLOWAGE_SLOTS + upper];
+      while (*head != _NT_FLOWAGE_NONE) {
+        uint32_t index = *head;
+        if (work == age->config.budget) {
+          age->stat.deferred++;
+          return count;
+        }
+        work++;
+        _nt_flowage_unlink(age, index);
+        _nt_flowage_arm(age, index, _nt_flowage_deadline(age, &age->nodes[index]));
+        age->stat.cascaded++;
+      }
+      age->cascadeLevel = upper == 0 && age->cascadeLevel < NT_FLOWAGE_LEVELS - 1 ? age->cascadeLevel + 1 : 0;
+    }
+    // Expire or rearm the timers of the tick
+    while (age->head[slot] != _NT_FLOWAGE_NONE) {
+      uint32_t index = age->head[slot];
+      struct _NtFlowAgeNode_s* node = &age->nodes[index];
+      uint64_t deadline = _nt_flowage_deadline(age, node);
+      if (work == age->config.budget || count == max) {
+        age->stat.deferred++;
+        return count;
+      }
+      work++;
+      _nt_flowage_unlink(age, index);
+      if (deadline <= age->wheel) {
+        values[count++] = _nt_flowtab_value(age->tab, index);
+        age->stat.armed--;
+        age->stat.expired++;
+      } else {
+        _nt_flowage_arm(age, index, deadline);
+        age->stat.rearmed++;
+      }
+    }
+    // Skip the empty ticks up to the next timer or cascade
+    step = _nt_flowage_next_used(age, 0, slot + 1) - slot;
+    if (slot + step == NT_FLOWAGE_SLOTS) {
+      uint64_t next = _nt_flowage_next_cascade(age);
+      step = next == ~0ULL ? age->now + 1 - age->wheel : next - age->wheel;
+    }
+    age->wheel += step < age->now + 1 - age->wheel ? step : age->now + 1 - age->wheel;
+  }
+  return count;
+}
+
+/**
+ * @brief Get the counters of flow aging
+ *
+ * @param[in]  age   Flow aging state
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_flowage_get_stat(const NtFlowAge_t* age, NtFlowAgeStat_t* stat)
+{
+  *stat = age->stat;
+}
+
+#endif // __FLOWAGE_H__
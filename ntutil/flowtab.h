@@ -0,0 +1,792 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a flow table keyed on the hash calculated by
+ * the adapter. Extended descriptors 7, 8 and 9 carry the 24-bit hash of
+ * the configured hash mode, so the packet headers only need to be parsed
+ * to get the exact key - only a cheap multiply fold of the key is
+ * calculated in software.
+ *
+ * The table uses open addressing over 64-byte buckets. A bucket holds 12
+ * one-byte tags, the number of flows that probed past it, and the indexes
+ * of 12 flow entries. The bucket is selected by the hash mixed with a fold
+ * of the key, and the tag is taken from the fold as well, so the tags of a bucket are compared in
+ * one SSE2 instruction and the key of a flow entry is normally compared
+ * only when it matches. A lookup touches the bucket and one entry.
+ * @ref _nt_flowtab_lookup_burst prefetches all buckets of a burst first
+ * and then the matching entries, so the cache misses of a burst overlap.
+ *
+ * Packets without a valid descriptor hash, e.g. packets read from a file
+ * or with standard and dynamic descriptors, get the hash from the hash
+ * reference library instead. The hash reference configuration must match
+ * the adapter hash configuration, so a flow gets the same hash both ways.
+ * The key is the @ref NtHashRefInput_t built by @ref _nt_hashref_parse,
+ * so flows are directional. With a sorted 2-tuple or 5-tuple hash mode the
+ * addresses and ports of the key are sorted as well, so both directions
+ * are one flow.
+ *
+ * The table can also be used with any fixed-size key and hash through
+ * @ref _nt_flowtab_find, @ref _nt_flowtab_insert and @ref _nt_flowtab_remove.
+ *
+ */
+#ifndef __FLOWTAB_H__
+#define __FLOWTAB_H__
+
+#include "nt.h"
+#include "hashref_pkt.h"
+#include "compat.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#endif
+
+/**
+ * Number of flows per bucket
+ */
+#define NT_FLOWTAB_BUCKET_SLOTS 12
+
+/**
+ * Flow table configuration. Zero selects the default value.
+ */
+typedef struct NtFlowTabConfig_s {
+  uint64_t maxFlows;        //!< Maximum number of flows. Default is 1M
+  uint32_t keySize;         //!< Bytes of key. Default is sizeof(@ref NtHashRefInput_t) as used by the packet functions
+  uint32_t valueSize;       //!< Bytes of user data per flow - zeroed when a flow is inserted
+  uint32_t burst;           //!< Maximum packets per call to @ref _nt_flowtab_lookup_burst. Default is 64
+  const NtHashRefConfig_t *hashRef; //!< Hash reference configuration matching the adapter hash. Needed by the packet functions
+} NtFlowTabConfig_t;
+
+/**
+ * Flow table counters
+ */
+typedef struct NtFlowTabStat_s {
+  uint64_t flows;           //!< Flows in the table
+  uint64_t lookups;         //!< Lookups
+  uint64_t hits;            //!< Lookups finding a flow
+  uint64_t inserts;         //!< Flows inserted
+  uint64_t removes;         //!< Flows removed
+  uint64_t full;            //!< Flows not inserted because the table was full
+  uint64_t probes;          //!< Buckets visited after the first
+  uint64_t tagFalse;        //!< Keys compared on a tag match that differed
+  uint64_t descrHash;       //!< Packets with the hash taken from the descriptor
+  uint64_t refHash;         //!< Packets with the hash calculated by the hash reference library
+  uint64_t noKey;           //!< Packets without the fields of the hash mode
+} NtFlowTabStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtFlowTabBucket_s {
+  uint8_t tags[NT_FLOWTAB_BUCKET_SLOTS];  // 0 if the slot is empty, otherwise 0x80 | 7 bits of the key fold
+  uint32_t overflow;                      // Flows stored after this bucket that have it as home or passed it
+  uint32_t entry[NT_FLOWTAB_BUCKET_SLOTS];
+};
+
+struct _NtFlowTabEntryHdr_s {
+  uint32_t hash;             // Hash the flow was inserted with
+  uint32_t reserved;
+};
+
+struct _NtFlowTabBurst_s {
+  uint64_t fold;
+  uint32_t hash;
+  uint32_t bucket;
+  int status;
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Flow table. A flow table must only be used by one thread.
+ */
+typedef struct NtFlowTab_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtFlowTabConfig_t config;
+  struct _NtFlowTabBucket_s *buckets;
+  uint64_t bucketMask;
+  uint8_t *entries;
+  uint64_t entrySize;
+  uint64_t valueOffset;      // Key padded so the value is 8 byte aligned
+  uint32_t *freeList;        // Stack of free entry indexes
+  uint64_t numFree;
+  size_t bucketBytes;
+  size_t entryBytes;
+  NtHashRefPkt_t hashRef;
+  int hashRefOpen;
+  NtHashRefInput_t *keys;    // Burst scratch
+  struct _NtFlowTabBurst_s *burst;
+  NtFlowTabStat_t stat;
+#endif
+} NtFlowTab_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Large allocation backed by transparent huge pages where possible, so the
+ * random accesses do not miss the TLB as well
+ */
+static NT_INLINE void* _nt_flowtab_alloc(size_t size)
+{
+#ifdef _MSC_VER
+  void* mem = _aligned_malloc(size, 64);
+  if (mem != NULL) {
+    memset(mem, 0, size);
+  }
+  return mem;
+#else
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | _NT_COMPAT_MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  (void)madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  return mem;
+#endif
+}
+
+static NT_INLINE void _nt_flowtab_free_mem(void* mem, size_t size)
+{
+#ifdef _MSC_VER
+  (void)size;
+  _aligned_free(mem);
+#else
+  if (mem != NULL) {
+    munmap(mem, size);
+  }
+#endif
+}
+
+static NT_INLINE void _nt_flowtab_prefetch(const void* p)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(p, 0, 3);
+#elif defined(_M_X64)
+  _mm_prefetch((const char*)p, _MM_HINT_T0);
+#else
+  (void)p;
+#endif
+}
+
+/*
+ * Fold of the key used for the tag and mixed into the bucket index so a
+ * hash mode with few distinct values does not pile flows into few buckets
+ */
+static NT_INLINE uint64_t _nt_flowtab_fold(const void* key, uint32_t keySize)
+{
+  const uint8_t* p = (const uint8_t*)key;
+  uint64_t h = 0, w;
+  uint32_t i;
+  for (i = 0; i + 8 <= keySize; i += 8) {
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+  }
+  if (i < keySize) {
+    w = 0;
+    memcpy(&w, p + i, keySize - i);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+static NT_INLINE uint64_t _nt_flowtab_home(const NtFlowTab_t* tab, uint32_t hash, uint64_t fold)
+{
+  return (((uint64_t)(hash & 0xFFFFFF) | ((fold >> 16) << 24)) ^ (fold & 0xFFFFFF)) & tab->bucketMask;
+}
+
+static NT_INLINE uint8_t _nt_flowtab_tag(uint64_t fold)
+{
+  return (uint8_t)(0x80 | (fold >> 57));
+}
+
+/*
+ * Bit mask of the slots of a bucket holding a tag
+ */
+static NT_INLINE uint32_t _nt_flowtab_match(const struct _NtFlowTabBucket_s* bucket, uint8_t tag)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+  __m128i tags = _mm_loadu_si128((const __m128i*)bucket->tags);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag))) & ((1U << NT_FLOWTAB_BUCKET_SLOTS) - 1);
+#else
+  uint32_t i, mask = 0;
+  for (i = 0; i < NT_FLOWTAB_BUCKET_SLOTS; i++) {
+    mask |= (uint32_t)(bucket->tags[i] == tag) << i;
+  }
+  return mask;
+#endif
+}
+
+static NT_INLINE uint32_t _nt_flowtab_ctz(uint32_t v)
+{
+#if defined(__GNUC__)
+  return (uint32_t)__builtin_ctz(v);
+#else
+  uint32_t n = 0;
+  while ((v & 1) == 0) {
+    v >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+static NT_INLINE uint8_t* _nt_flowtab_entry(const NtFlowTab_t* tab, uint32_t index)
+{
+  return tab->entries + (uint64_t)index * tab->entrySize;
+}
+
+/*
+ * Find a flow from its home bucket
+ */
+static NT_INLINE void* _nt_flowtab_find_at(NtFlowTab_t* tab, uint64_t b, uint8_t tag, const void* key)
+{
+  uint64_t n;
+  for (n = 0; n <= tab->bucketMask; n++) {
+    const struct _NtFlowTabBucket_s* bucket = &tab->buckets[b];
+    uint32_t mask = _nt_flowtab_match(bucket, tag);
+    while (mask != 0) {
+      uint32_t slot = _nt_flowtab_ctz(mask);
+      uint8_t* entry = _nt_flowtab_entry(tab, bucket->entry[slot]);
+      if (memcmp(entry + sizeof(struct _NtFlowTabEntryHdr_s), key, tab->config.keySize) == 0) {
+        tab->stat.hits++;
+        return entry + tab->valueOffset;
+      }
+      tab->stat.tagFalse++;
+      mask &= mask - 1;
+    }
+    if (bucket->overflow == 0) {
+      return NULL;
+    }
+    tab->stat.probes++;
+    b = (b + 1) & tab->bucketMask;
+  }
+  return NULL;
+}
+
+/*
+ * Insert a flow known not to be in the table
+ */
+static NT_INLINE void* _nt_flowtab_insert_at(NtFlowTab_t* tab, uint64_t b, uint8_t tag, uint32_t hash, const void* key)
+{
+  struct _NtFlowTabEntryHdr_s hdr;
+  uint32_t index;
+  uint8_t* entry;
+  if (tab->numFree == 0) {
+    tab->stat.full++;
+    return NULL;
+  }
+  for (;;) {
+    struct _NtFlowTabBucket_s* bucket = &tab->buckets[b];
+    uint32_t mask = _nt_flowtab_match(bucket, 0);
+    if (mask != 0) {
+      uint32_t slot = _nt_flowtab_ctz(mask);
+      index = tab->freeList[--tab->numFree];
+      bucket->tags[slot] = tag;
+      bucket->entry[slot] = index;
+      break;
+    }
+    // Never all buckets full - there are more slots than entries
+    bucket->overflow++;
+    b = (b + 1) & tab->bucketMask;
+  }
+  entry = _nt_flowtab_entry(tab, index);
+  hdr.hash = hash;
+  hdr.reserved = 0;
+  memcpy(entry, &hdr, sizeof(hdr));
+  memcpy(entry + sizeof(hdr), key, tab->config.keySize);
+  memset(entry + tab->valueOffset, 0, tab->config.valueSize);
+  tab->stat.inserts++;
+  tab->stat.flows++;
+  return entry + tab->valueOffset;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a flow table
+ *
+ * @param[in] tab  Flow table
+ */
+static NT_INLINE void _nt_flowtab_close(NtFlowTab_t* tab)
+{
+  _nt_flowtab_free_mem(tab->buckets, tab->bucketBytes);
+  _nt_flowtab_free_mem(tab->entries, tab->entryBytes);
+  free(tab->freeList);
+  free(tab->keys);
+  free(tab->burst);
+  if (tab->hashRefOpen) {
+    (void)_nt_hashref_pkt_close(&tab->hashRef);
+  }
+  memset(tab, 0, sizeof(*tab));
+}
+
+/**
+ * @brief Open a flow table
+ *
+ * The buckets are sized for at most 10 flows per bucket on average, and
+ * the buckets and flow entries are allocated once.
+ *
+ * @param[out] tab     Flow table
+ * @param[in]  config  Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval otherwise                         Error returned by @ref _nt_hashref_pkt_open
+ */
+static NT_INLINE int _nt_flowtab_open(NtFlowTab_t* tab, const NtFlowTabConfig_t* config)
+{
+  uint64_t numBuckets = 1, i;
+  int status;
+
+  memset(tab, 0, sizeof(*tab));
+  if (config != NULL) {
+    tab->config = *config;
+  }
+  if (tab->config.maxFlows == 0) {
+    tab->config.maxFlows = 1024 * 1024;
+  }
+  if (tab->config.keySize == 0) {
+    tab->config.keySize = sizeof(NtHashRefInput_t);
+  }
+  if (tab->config.burst == 0) {
+    tab->config.burst = 64;
+  }
+  if (tab->config.maxFlows > 0xFFFFFFFFULL) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  while (numBuckets * 10 < tab->config.maxFlows) {
+    numBuckets <<= 1;
+  }
+  tab->bucketMask = numBuckets - 1;
+  tab->valueOffset = (sizeof(struct _NtFlowTabEntryHdr_s) + tab->config.keySize + 7) & ~7ULL;
+  tab->entrySize = (tab->valueOffset + tab->config.valueSize + 7) & ~7ULL;
+  tab->bucketBytes = (size_t)(numBuckets * sizeof(struct _NtFlowTabBucket_s));
+  tab->entryBytes = (size_t)(tab->config.maxFlows * tab->entrySize);
+  tab->buckets = (struct _NtFlowTabBucket_s*)_nt_flowtab_alloc(tab->bucketBytes);
+  tab->entries = (uint8_t*)_nt_flowtab_alloc(tab->entryBytes);
+  tab->freeList = (uint32_t*)malloc((size_t)tab->config.maxFlows * sizeof(uint32_t));
+  tab->keys = (NtHashRefInput_t*)malloc(tab->config.burst * sizeof(NtHashRefInput_t));
+  tab->burst = (struct _NtFlowTabBurst_s*)malloc(tab->config.burst * sizeof(struct _NtFlowTabBurst_s));
+  if (tab->buckets == NULL || tab->entries == NULL || tab->freeList == NULL || tab->keys == NULL || tab->burst == NULL) {
+    _nt_flowtab_close(tab);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  // Hand out the lowest entries first
+  for (i = 0; i < tab->config.maxFlows; i++) {
+    tab->freeList[i] = (uint32_t)(tab->config.maxFlows - 1 - i);
+  }
+  tab->numFree = tab->config.maxFlows;
+  if (tab->config.hashRef != NULL) {
+    if ((status = _nt_hashref_pkt_open(&tab->hashRef, tab->config.hashRef)) != NT_SUCCESS) {
+      _nt_flowtab_close(tab);
+      return status;
+    }
+    tab->hashRefOpen = 1;
+  }
+  tab->config.hashRef = NULL;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Find a flow
+ *
+ * @param[in] tab   Flow table
+ * @param[in] hash  24-bit hash of the key
+ * @param[in] key   Key of configured size
+ *
+ * @retval The user data of the flow, or NULL if the flow is not in the table
+ */
+static NT_INLINE void* _nt_flowtab_find(NtFlowTab_t* tab, uint32_t hash, const void* key)
+{
+  uint64_t fold = _nt_flowtab_fold(key, tab->config.keySize);
+  tab->stat.lookups++;
+  return _nt_flowtab_find_at(tab, _nt_flowtab_home(tab, hash, fold), _nt_flowtab_tag(fold), key);
+}
+
+/**
+ * @brief Find a flow and insert it if it is not in the table
+ *
+ * @param[in]  tab       Flow table
+ * @param[in]  hash      24-bit hash of the key
+ * @param[in]  key       Key of configured size
+ * @param[out] inserted  Optional - set to 1 if the flow was inserted and 0 if it was found
+ *
+ * @retval The user data of the flow - zeroed when inserted - or NULL if the table is full
+ */
+static NT_INLINE void* _nt_flowtab_insert(NtFlowTab_t* tab, uint32_t hash, const void* key, int* inserted)
+{
+  uint64_t fold = _nt_flowtab_fold(key, tab->config.keySize);
+  uint64_t b = _nt_flowtab_home(tab, hash, fold);
+  uint8_t tag = _nt_flowtab_tag(fold);
+  void* value;
+  tab->stat.lookups++;
+  if ((value = _nt_flowtab_find_at(tab, b, tag, key)) != NULL) {
+    if (inserted != NULL) {
+      *inserted = 0;
+    }
+    return value;
+  }
+  value = _nt_flowtab_insert_at(tab, b, tag, hash, key);
+  if (inserted != NULL) {
+    *inserted = value != NULL;
+  }
+  return value;
+}
+
+/**
+ * @brief Get the key of a flow
+ *
+ * @param[in] tab    Flow table
+ * @param[in] value  User data of the flow
+ *
+ * @retval The key of the flow
+ */
+static NT_INLINE const void* _nt_flowtab_key(const NtFlowTab_t* tab, const void* value)
+{
+  return (const uint8_t*)value - tab->valueOffset + sizeof(struct _NtFlowTabEntryHdr_s);
+}
+
+/**
+ * @brief Get the entry index of a flow
+ *
+ * The index is below the configured maximum number of flows and stays the
+ * same until the flow is removed, so per-flow state can be kept in arrays
+ * outside the table.
+ *
+ * @param[in] tab    Flow table
+ * @param[in] value  User data of the flow
+ *
+ * @retval The entry index of the flow
+ */
+static NT_INLINE uint32_t _nt_flowtab_index(const NtFlowTab_t* tab, const void* value)
+{
+  return (uint32_t)((uint64_t)((const uint8_t*)value - tab->valueOffset - tab->entries) / tab->entrySize);
+}
+
+/**
+ * @brief Get the user data of a flow from its entry index
+ *
+ * @param[in] tab    Flow table
+ * @param[in] index  Entry index as returned by @ref _nt_flowtab_index
+ *
+ * @retval The user data of the flow
+ */
+static NT_INLINE void* _nt_flowtab_value(const NtFlowTab_t* tab, uint32_t index)
+{
+  return _nt_flowtab_entry(tab, index) + tab->valueOffset;
+}
+
+/**
+ * @brief Remove a flow
+ *
+ * The user data is not valid after the flow has been removed. Removing
+ * a flow while iterating with @ref _nt_flowtab_next is allowed.
+ *
+ * @param[in] tab    Flow table
+ * @param[in] value  User data of the flow as returned by the table
+ */
+static NT_INLINE void _nt_flowtab_remove(NtFlowTab_t* tab, void* value)
+{
+  uint8_t* entry = (uint8_t*)value - tab->valueOffset;
+  uint32_t index = _nt_flowtab_index(tab, value);
+  struct _NtFlowTabEntryHdr_s hdr;
+  uint64_t fold, b;
+  uint8_t tag;
+  memcpy(&hdr, entry, sizeof(hdr));
+  fold = _nt_flowtab_fold(entry + sizeof(hdr), tab->config.keySize);
+  b = _nt_flowtab_home(tab, hdr.hash, fold);
+  tag = _nt_flowtab_tag(fold);
+  for (;;) {
+    struct _NtFlowTabBucket_s* bucket = &tab->buckets[b];
+    uint32_t mask = _nt_flowtab_match(bucket, tag);
+    while (mask != 0) {
+      uint32_t slot = _nt_flowtab_ctz(mask);
+      if (bucket->entry[slot] == index) {
+        bucket->tags[slot] = 0;
+        tab->freeList[tab->numFree++] = index;
+        tab->stat.removes++;
+        tab->stat.flows--;
+        return;
+      }
+      mask &= mask - 1;
+    }
+    // The flow was stored after this bucket
+    bucket->overflow--;
+    b = (b + 1) & tab->bucketMask;
+  }
+}
+
+/**
+ * @brief Iterate over the flows of a table
+ *
+ * @param[in]     tab       Flow table
+ * @param[in,out] position  Iteration position - must be 0 on the first call
+ *
+ * @retval The user data of the next flow, or NULL when all flows have been returned
+ */
+static NT_INLINE void* _nt_flowtab_next(NtFlowTab_t* tab, uint64_t* position)
+{
+  uint64_t end = (tab->bucketMask + 1) * NT_FLOWTAB_BUCKET_SLOTS;
+  while (*position < end) {
+    const struct _NtFlowTabBucket_s* bucket = &tab->buckets[*position / NT_FLOWTAB_BUCKET_SLOTS];
+    uint32_t slot = (uint32_t)(*position % NT_FLOWTAB_BUCKET_SLOTS);
+    (*position)++;
+    if (bucket->tags[slot] != 0) {
+      return _nt_flowtab_entry(tab, bucket->entry[slot]) + tab->valueOffset;
+    }
+  }
+  return NULL;
+}
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE void _nt_flowtab_swap(void* a, void* b, size_t size)
+{
+  uint8_t tmp[16];
+  memcpy(tmp, a, size);
+  memcpy(a, b, size);
+  memcpy(b, tmp, size);
+}
+
+/*
+ * Sort the addresses and ports of the key for the sorted hash modes
+ */
+static NT_INLINE void _nt_flowtab_sort_key(enum NtHashRefHashMode_e hashmode, NtHashRefInput_t* key)
+{
+  uint8_t *src, *dst;
+  uint16_t *srcPort = NULL, *dstPort = NULL;
+  size_t size;
+  int cmp;
+  if (hashmode != NT_HASHREF_HASHMODE_2_TUPLE_SORTED && hashmode != NT_HASHREF_HASHMODE_INNER_2_TUPLE_SORTED &&
+      hashmode != NT_HASHREF_HASHMODE_5_TUPLE_SORTED && hashmode != NT_HASHREF_HASHMODE_INNER_5_TUPLE_SORTED) {
+    return;
+  }
+  switch (key->inputType) {
+  case NT_HASHREF_INPUT_TYPE_TUPLE_2_IP_V4:
+    src = (uint8_t*)&key->u.tuple2IPv4.srcIP;
+    dst = (uint8_t*)&key->u.tuple2IPv4.dstIP;
+    size = 4;
+    break;
+  case NT_HASHREF_INPUT_TYPE_TUPLE_2_IP_V6:
+    src = key->u.tuple2IPv6.srcIP;
+    dst = key->u.tuple2IPv6.dstIP;
+    size = 16;
+    break;
+  case NT_HASHREF_INPUT_TYPE_TUPLE_5_IP_V4:
+    src = (uint8_t*)&key->u.tuple5IPv4.srcIP;
+    dst = (uint8_t*)&key->u.tuple5IPv4.dstIP;
+    srcPort = &key->u.tuple5IPv4.srcPort;
+    dstPort = &key->u.tuple5IPv4.dstPort;
+    size = 4;
+    break;
+  case NT_HASHREF_INPUT_TYPE_TUPLE_5_IP_V6:
+    src = key->u.tuple5IPv6.srcIP;
+    dst = key->u.tuple5IPv6.dstIP;
+    srcPort = &key->u.tuple5IPv6.srcPort;
+    dstPort = &key->u.tuple5IPv6.dstPort;
+    size = 16;
+    break;
+  default:
+    return;
+  }
+  cmp = memcmp(src, dst, size);
+  if (cmp == 0 && srcPort != NULL) {
+    cmp = memcmp(srcPort, dstPort, sizeof(uint16_t));
+  }
+  if (cmp > 0) {
+    _nt_flowtab_swap(src, dst, size);
+    if (srcPort != NULL) {
+      _nt_flowtab_swap(srcPort, dstPort, sizeof(uint16_t));
+    }
+  }
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Get the hash and key of a packet
+ *
+ * The hash is taken from extended descriptor 7, 8 and 9 when it is valid,
+ * and calculated with the hash reference library otherwise.
+ *
+ * @param[in]  tab        Flow table opened with a hash reference configuration
+ * @param[in]  pktNetBuf  Packet
+ * @param[out] hash       24-bit hash
+ * @param[out] key        Key
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_NO_DATA           The packet does not carry the fields used by the hash mode
+ * @retval NT_ERROR_INVALID_PARAMETER  The table has no hash reference configuration
+ * @retval otherwise                   Error returned by @ref NT_HashRefCalc
+ */
+static NT_INLINE int _nt_flowtab_pkt_key(NtFlowTab_t* tab, struct NtNetBuf_s* pktNetBuf, uint32_t* hash, NtHashRefInput_t* key)
+{
+  uint32_t length = (uint32_t)(NT_NET_GET_PKT_CAP_LENGTH(pktNetBuf) - NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+  NtHashRefResult_t result;
+  int status;
+  if (!tab->hashRefOpen || tab->config.keySize != sizeof(NtHashRefInput_t)) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  if ((status = _nt_hashref_parse(tab->hashRef.hashmode, NT_NET_GET_PKT_L2_PTR(pktNetBuf), length, key)) != NT_SUCCESS) {
+    tab->stat.noKey++;
+    return status;
+  }
+  if (_NT_NET_GET_PKT_DESCR_PTR_DYN(pktNetBuf)->ntDynDescr == 0 &&
+      _NT_NET_GET_PKT_NT_DESCR_TYPE(pktNetBuf) == NT_PACKET_DESCRIPTOR_TYPE_NT_EXTENDED &&
+      _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) >= 7 && _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) <= 9 &&
+      _NT_NET_GET_PKT_HASH_VALID_EXT7(pktNetBuf)) {
+    *hash = (uint32_t)_NT_NET_GET_PKT_HASH_EXT7(pktNetBuf);
+    tab->stat.descrHash++;
+  } else {
+    // The hash reference library sorts the input itself
+    if ((status = NT_HashRefCalc(tab->hashRef.handle, key, &result)) != NT_SUCCESS) {
+      return status;
+    }
+    *hash = result.hashvalue;
+    tab->stat.refHash++;
+  }
+  _nt_flowtab_sort_key(tab->hashRef.hashmode, key);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Find the flow of a packet and optionally insert it
+ *
+ * @param[in]  tab        Flow table opened with a hash reference configuration
+ * @param[in]  pktNetBuf  Packet
+ * @param[in]  insert     Insert the flow if it is not in the table
+ * @param[out] value      User data of the flow - NULL if the flow is not in the table or the table is full
+ * @param[out] inserted   Optional - set to 1 if the flow was inserted
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_NO_DATA  The packet does not carry the fields used by the hash mode
+ * @retval otherwise          Error returned by @ref _nt_flowtab_pkt_key
+ */
+static NT_INLINE int _nt_flowtab_lookup_pkt(NtFlowTab_t* tab, struct NtNetBuf_s* pktNetBuf, int insert, void** value, int* inserted)
+{
+  uint32_t hash;
+  int status;
+  *value = NULL;
+  if (inserted != NULL) {
+    *inserted = 0;
+  }
+  if ((status = _nt_flowtab_pkt_key(tab, pktNetBuf, &hash, &tab->keys[0])) != NT_SUCCESS) {
+    return status;
+  }
+  *value = insert ? _nt_flowtab_insert(tab, hash, &tab->keys[0], inserted) : _nt_flowtab_find(tab, hash, &tab->keys[0]);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Find the flows of a burst of packets and optionally insert them
+ *
+ * All keys are built and the home buckets prefetched first, then the
+ * entries matching the tags are prefetched, and finally the flows are
+ * looked up, so the memory accesses of the packets overlap. Packets of
+ * the same new flow in one burst all get the flow inserted by the first.
+ *
+ * @param[in]  tab         Flow table opened with a hash reference configuration
+ * @param[in]  pktNetBufs  Packets, e.g. from @ref _nt_net_get_packet_burst
+ * @param[in]  count       Number of packets - at most the configured burst
+ * @param[in]  insert      Insert the flows that are not in the table
+ * @param[out] values      User data of the flow of each packet - NULL if the packet has no flow, the flow is not in the table or the table is full
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  Too many packets or no hash reference configuration
+ * @retval otherwise                   Error returned by @ref NT_HashRefCalc
+ */
+static NT_INLINE int _nt_flowtab_lookup_burst(NtFlowTab_t* tab, struct NtNetBuf_s* pktNetBufs, uint32_t count, int insert, void** values)
+{
+  uint32_t i;
+  if (count > tab->config.burst) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  for (i = 0; i < count; i++) {
+    struct _NtFlowTabBurst_s* b = &tab->burst[i];
+    b->status = _nt_flowtab_pkt_key(tab, &pktNetBufs[i], &b->hash, &tab->keys[i]);
+    if (b->status == NT_SUCCESS) {
+      b->fold = _nt_flowtab_fold(&tab->keys[i], tab->config.keySize);
+      b->bucket = (uint32_t)_nt_flowtab_home(tab, b->hash, b->fold);
+      _nt_flowtab_prefetch(&tab->buckets[b->bucket]);
+    } else if (b->status != NT_STATUS_NO_DATA) {
+      return b->status;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    const struct _NtFlowTabBurst_s* b = &tab->burst[i];
+    if (b->status == NT_SUCCESS) {
+      const struct _NtFlowTabBucket_s* bucket = &tab->buckets[b->bucket];
+      uint32_t mask = _nt_flowtab_match(bucket, _nt_flowtab_tag(b->fold));
+      if (mask != 0) {
+        _nt_flowtab_prefetch(_nt_flowtab_entry(tab, bucket->entry[_nt_flowtab_ctz(mask)]));
+      }
+    }
+  }
+  for (i = 0; i < count; i++) {
+    const struct _NtFlowTabBurst_s* b = &tab->burst[i];
+    void* value = NULL;
+    if (b->status == NT_SUCCESS) {
+      uint8_t tag = _nt_flowtab_tag(b->fold);
+      tab->stat.lookups++;
+      value = _nt_flowtab_find_at(tab, b->bucket, tag, &tab->keys[i]);
+      if (value == NULL && insert) {
+        value = _nt_flowtab_insert_at(tab, b->bucket, tag, b->hash, &tab->keys[i]);
+      }
+    }
+    values[i] = value;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the counters of a flow table
+ *
+ * @param[in]  tab   Flow table
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_flowtab_get_stat(const NtFlowTab_t* tab, NtFlowTabStat_t* stat)
+{
+  *stat = tab->stat;
+}
+
+#endif // __FLOWTAB_H__
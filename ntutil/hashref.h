@@ -275,6 +275,36 @@ int NT_HashRefOpen(NtHashRef_t *handle, const NtHashRefConfig_t *config);
 int NT_HashRefCalc(const NtHashRef_t handle, const NtHashRefInput_t *input,
                    NtHashRefResult_t *result);
 
+/**
+ * @brief Calculate hash values for an array of inputs
+ *
+ * This function calculates the hash value for each of the "n" inputs
+ * based on the configuration associated with the handle. The results are
+ * identical to calling @ref NT_HashRefCalc for each input. Inputs may use
+ * different input types as long as they match the configured hash mode.
+ *
+ * @param[in]  handle      Hash reference handle
+ * @param[in]  in          Array of "n" inputs for hash calculation
+ * @param[out] out         Array of "n" results
+ * @param[in]  n           Number of inputs
+ *
+ * @retval 0               Success
+ * @retval !=0             Error returned by @ref NT_HashRefCalc. Results are
+ *                         only valid for the inputs before the failing input
+ */
+static NT_INLINE int _nt_hashref_calc_batch(const NtHashRef_t handle, const NtHashRefInput_t *in,
+                                            NtHashRefResult_t *out, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++) {
+    int status = NT_HashRefCalc(handle, &in[i], &out[i]);
+    if (status != 0) {
+      return status;
+    }
+  }
+  return 0;
+}
+
 /**
  * @brief Close the hash reference handle and free associated resources
  *
@@ -0,0 +1,699 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains hash reference calculation directly from
+ * packet data. The packet headers (Ethernet, VLAN, MPLS, IPv4, IPv6, GRE,
+ * GTP, SCTP, TCP and UDP) are parsed according to the configured hash mode
+ * and the hash input is built internally, so the adapter distribution can
+ * be reproduced from a pointer to L2 data or from a whole segment.
+ *
+ */
+#ifndef __HASHREF_PKT_H__
+#define __HASHREF_PKT_H__
+
+#include "hashref.h"
+
+/**
+ * Packet hash reference handle
+ */
+typedef struct NtHashRefPkt_s {
+  NtHashRef_t handle;                  //!< Hash reference handle
+  enum NtHashRefHashMode_e hashmode;   //!< The configured hash mode
+} NtHashRefPkt_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#define _NT_HASHREF_ETHERTYPE_IPV4    0x0800
+#define _NT_HASHREF_ETHERTYPE_IPV6    0x86DD
+#define _NT_HASHREF_ETHERTYPE_VLAN    0x8100
+#define _NT_HASHREF_ETHERTYPE_QINQ    0x88A8
+#define _NT_HASHREF_ETHERTYPE_QINQ_OLD 0x9100
+#define _NT_HASHREF_ETHERTYPE_MPLS_UC 0x8847
+#define _NT_HASHREF_ETHERTYPE_MPLS_MC 0x8848
+
+#define _NT_HASHREF_PROTO_IPIP  4
+#define _NT_HASHREF_PROTO_TCP   6
+#define _NT_HASHREF_PROTO_UDP   17
+#define _NT_HASHREF_PROTO_IPV6  41
+#define _NT_HASHREF_PROTO_GRE   47
+#define _NT_HASHREF_PROTO_SCTP  132
+
+#define _NT_HASHREF_PORT_GTPV0    3386
+#define _NT_HASHREF_PORT_GTPV1V2C 2123
+#define _NT_HASHREF_PORT_GTPV1U   2152
+
+/*
+ * Location of the parsed headers within the packet
+ */
+struct _NtHashRefPktInfo_s {
+  uint32_t numVlan;
+  uint16_t vlanId[3];       // Network order
+  uint32_t numMpls;
+  uint32_t mplsLabel[7];
+  // Outer IP header
+  uint32_t l3Offset;        // 0 if no IP header was found
+  uint8_t ipv6;
+  uint8_t protocol;         // L4 protocol number
+  uint32_t l4Offset;        // 0 if no L4 header is present (e.g. a non-first fragment)
+  uint8_t fragmented;
+  uint32_t fragId;          // IPv4 identification or IPv6 fragment identifier, network order
+  // GRE and GTP
+  uint8_t greKeyValid;
+  uint32_t greKey;          // Network order
+  uint8_t gtp;              // Set if a GTP header was found
+  uint8_t gtpVersion;
+  uint8_t gtpTeidValid;
+  uint32_t gtpTeid;         // Network order
+  uint16_t gtpFlowLabel;    // Network order
+  // Inner IP header - only found behind IP-in-IP, GRE and GTP-U G-PDU
+  uint32_t innerL3Offset;
+  uint8_t innerIpv6;
+  uint8_t innerProtocol;
+  uint32_t innerL4Offset;
+};
+
+static NT_INLINE uint16_t _nt_hashref_rd16(const uint8_t* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/*
+ * Parse an IP header and its extension headers. Returns 0 if the header is
+ * not complete within the captured data.
+ */
+static NT_INLINE int _nt_hashref_parse_ip(const uint8_t* pkt, uint32_t length, uint32_t offset, int ipv6,
+                                          uint8_t* protocol, uint32_t* l4Offset, uint8_t* fragmented, uint32_t* fragId)
+{
+  const uint8_t* ip = pkt + offset;
+  *fragmented = 0;
+  *fragId = 0;
+  *l4Offset = 0;
+  if (!ipv6) {
+    uint32_t ihl;
+    uint16_t frag;
+    if (length < offset + 20 || (ip[0] >> 4) != 4) {
+      return 0;
+    }
+    ihl = (uint32_t)(ip[0] & 0x0F) << 2;
+    if (ihl < 20 || length < offset + ihl) {
+      return 0;
+    }
+    *protocol = ip[9];
+    frag = _nt_hashref_rd16(ip + 6);
+    memcpy(fragId, ip + 4, sizeof(uint16_t));
+    if (frag & 0x3FFF) {
+      *fragmented = 1;
+    }
+    // Only the first fragment carries the L4 header
+    if ((frag & 0x1FFF) == 0) {
+      *l4Offset = offset + ihl;
+    }
+    return 1;
+  } else {
+    uint8_t next;
+    uint32_t hdr = offset + 40;
+    int first = 1;
+    if (length < offset + 40 || (ip[0] >> 4) != 6) {
+      return 0;
+    }
+    next = ip[6];
+    for (;;) {
+      switch (next) {
+      case 0:   // Hop-by-hop options
+      case 43:  // Routing
+      case 60:  // Destination options
+        if (length < hdr + 8) {
+          return 0;
+        }
+        next = pkt[hdr];
+        hdr += ((uint32_t)pkt[hdr + 1] + 1) << 3;
+        continue;
+      case 51:  // Authentication header
+        if (length < hdr + 8) {
+          return 0;
+        }
+        next = pkt[hdr];
+        hdr += ((uint32_t)pkt[hdr + 1] + 2) << 2;
+        continue;
+      case 44:  // Fragment
+        if (length < hdr + 8) {
+          return 0;
+        }
+        *fragmented = 1;
+        memcpy(fragId, pkt + hdr + 4, sizeof(uint32_t));
+        first = (_nt_hashref_rd16(pkt + hdr + 2) & 0xFFF8) == 0;
+        next = pkt[hdr];
+        hdr += 8;
+        continue;
+      default:
+        break;
+      }
+      break;
+    }
+    *protocol = next;
+    if (first) {
+      *l4Offset = hdr;
+    }
+    return 1;
+  }
+}
+
+/*
+ * Parse a tunneled IP header - the version is taken from the first nibble
+ */
+static NT_INLINE void _nt_hashref_parse_inner(const uint8_t* pkt, uint32_t length, uint32_t offset, struct _NtHashRefPktInfo_s* info)
+{
+  uint8_t fragmented;
+  uint32_t fragId;
+  int ipv6;
+  if (length <= offset) {
+    return;
+  }
+  ipv6 = (pkt[offset] >> 4) == 6;
+  if (_nt_hashref_parse_ip(pkt, length, offset, ipv6, &info->innerProtocol, &info->innerL4Offset, &fragmented, &fragId)) {
+    info->innerL3Offset = offset;
+    info->innerIpv6 = (uint8_t)ipv6;
+  }
+}
+
+/*
+ * Parse a packet from L2 and locate all headers used by the hash modes
+ */
+static NT_INLINE void _nt_hashref_parse_pkt(const uint8_t* pkt, uint32_t length, struct _NtHashRefPktInfo_s* info)
+{
+  uint32_t offset = 12;
+  uint16_t etherType;
+
+  memset(info, 0, sizeof(*info));
+  if (length < 14) {
+    return;
+  }
+  etherType = _nt_hashref_rd16(pkt + offset);
+  offset += 2;
+  // VLAN tags - the last three tags are kept
+  while (etherType == _NT_HASHREF_ETHERTYPE_VLAN || etherType == _NT_HASHREF_ETHERTYPE_QINQ ||
+         etherType == _NT_HASHREF_ETHERTYPE_QINQ_OLD) {
+    uint8_t vid[2];
+    if (length < offset + 4) {
+      return;
+    }
+    vid[0] = (uint8_t)(pkt[offset] & 0x0F);
+    vid[1] = pkt[offset + 1];
+    if (info->numVlan == 3) {
+      info->vlanId[0] = info->vlanId[1];
+      info->vlanId[1] = info->vlanId[2];
+      info->numVlan--;
+    }
+    // Keep the 12-bit VLAN ID in network order
+    memcpy(&info->vlanId[info->numVlan++], vid, sizeof(uint16_t));
+    etherType = _nt_hashref_rd16(pkt + offset + 2);
+    offset += 4;
+  }
+  // MPLS labels - the IP version is taken from the payload after bottom of stack
+  if (etherType == _NT_HASHREF_ETHERTYPE_MPLS_UC || etherType == _NT_HASHREF_ETHERTYPE_MPLS_MC) {
+    uint32_t shim;
+    do {
+      if (length < offset + 4) {
+        return;
+      }
+      shim = ((uint32_t)_nt_hashref_rd16(pkt + offset) << 16) | _nt_hashref_rd16(pkt + offset + 2);
+      if (info->numMpls < 7) {
+        info->mplsLabel[info->numMpls++] = shim >> 12;
+      } else {
+        info->mplsLabel[6] = shim >> 12;
+      }
+      offset += 4;
+    } while ((shim & 0x100) == 0);
+    if (length <= offset) {
+      return;
+    }
+    etherType = (pkt[offset] >> 4) == 6 ? _NT_HASHREF_ETHERTYPE_IPV6 :
+                (pkt[offset] >> 4) == 4 ? _NT_HASHREF_ETHERTYPE_IPV4 : 0;
+  }
+  if (etherType != _NT_HASHREF_ETHERTYPE_IPV4 && etherType != _NT_HASHREF_ETHERTYPE_IPV6) {
+    return;
+  }
+  info->ipv6 = etherType == _NT_HASHREF_ETHERTYPE_IPV6;
+  if (!_nt_hashref_parse_ip(pkt, length, offset, info->ipv6, &info->protocol, &info->l4Offset,
+                            &info->fragmented, &info->fragId)) {
+    return;
+  }
+  info->l3Offset = offset;
+  if (info->l4Offset == 0) {
+    return;
+  }
+  offset = info->l4Offset;
+
+  switch (info->protocol) {
+  case _NT_HASHREF_PROTO_IPIP:
+  case _NT_HASHREF_PROTO_IPV6:
+    _nt_hashref_parse_inner(pkt, length, offset, info);
+    break;
+  case _NT_HASHREF_PROTO_GRE:
+    if (length >= offset + 4) {
+      uint16_t flags = _nt_hashref_rd16(pkt + offset);
+      uint16_t protocol = _nt_hashref_rd16(pkt + offset + 2);
+      uint32_t hdr = offset + 4;
+      // Only GRE version 0 carries a key
+      if ((flags & 0x7) != 0) {
+        break;
+      }
+      if (flags & 0x8000) {
+        hdr += 4;
+      }
+      if (flags & 0x2000) {
+        if (length < hdr + 4) {
+          break;
+        }
+        memcpy(&info->greKey, pkt + hdr, sizeof(uint32_t));
+        info->greKeyValid = 1;
+        hdr += 4;
+      }
+      if (flags & 0x1000) {
+        hdr += 4;
+      }
+      if (protocol == _NT_HASHREF_ETHERTYPE_IPV4 || protocol == _NT_HASHREF_ETHERTYPE_IPV6) {
+        _nt_hashref_parse_inner(pkt, length, hdr, info);
+      }
+    }
+    break;
+  case _NT_HASHREF_PROTO_UDP:
+    if (length >= offset + 8) {
+      uint16_t srcPort = _nt_hashref_rd16(pkt + offset);
+      uint16_t dstPort = _nt_hashref_rd16(pkt + offset + 2);
+      uint32_t gtp = offset + 8;
+      if (dstPort == _NT_HASHREF_PORT_GTPV0 || srcPort == _NT_HASHREF_PORT_GTPV0) {
+        // GTPv0: 20 byte header with the flow label at offset 6
+        if (length >= gtp + 20 && (pkt[gtp] >> 5) == 0) {
+          info->gtp = 1;
+          info->gtpVersion = 0;
+          memcpy(&info->gtpFlowLabel, pkt + gtp + 6, sizeof(uint16_t));
+        }
+      } else if (dstPort == _NT_HASHREF_PORT_GTPV1U || dstPort == _NT_HASHREF_PORT_GTPV1V2C ||
+                 srcPort == _NT_HASHREF_PORT_GTPV1U || srcPort == _NT_HASHREF_PORT_GTPV1V2C) {
+        uint8_t version;
+        if (length < gtp + 8) {
+          break;
+        }
+        version = pkt[gtp] >> 5;
+        if (version == 1) {
+          uint32_t payload = gtp + 8;
+          info->gtp = 1;
+          info->gtpVersion = 1;
+          info->gtpTeidValid = 1;
+          memcpy(&info->gtpTeid, pkt + gtp + 4, sizeof(uint32_t));
+          // G-PDU carries an inner IP packet
+          if (pkt[gtp + 1] == 0xFF) {
+            if (pkt[gtp] & 0x07) {
+              uint8_t next;
+              if (length < gtp + 12) {
+                break;
+              }
+              next = pkt[gtp + 11];
+              payload = gtp + 12;
+              // Extension header chain - the length is in units of 4 bytes
+              while (next != 0) {
+                if (length < payload + 1 || pkt[payload] == 0 || length < payload + ((uint32_t)pkt[payload] << 2)) {
+                  return;
+                }
+                payload += (uint32_t)pkt[payload] << 2;
+                next = pkt[payload - 1];
+              }
+            }
+            _nt_hashref_parse_inner(pkt, length, payload, info);
+          }
+        } else if (version == 2) {
+          info->gtp = 1;
+          info->gtpVersion = 2;
+          // The TEID is only present when the T flag is set
+          if (pkt[gtp] & 0x08) {
+            info->gtpTeidValid = 1;
+            memcpy(&info->gtpTeid, pkt + gtp + 4, sizeof(uint32_t));
+          }
+        }
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * Copy the source and destination addresses of an IP header
+ */
+static NT_INLINE void _nt_hashref_copy_ip(const uint8_t* pkt, uint32_t l3Offset, int ipv6, void* srcIP, void* dstIP)
+{
+  if (ipv6) {
+    memcpy(srcIP, pkt + l3Offset + 8, 16);
+    memcpy(dstIP, pkt + l3Offset + 24, 16);
+  } else {
+    memcpy(srcIP, pkt + l3Offset + 12, 4);
+    memcpy(dstIP, pkt + l3Offset + 16, 4);
+  }
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Build the hash input from packet data
+ *
+ * This function parses the packet headers and fills the hash input
+ * structure matching the hash mode.
+ *
+ * @param[in]  hashmode    The hash mode to build the input for
+ * @param[in]  l2          Pointer to the L2 packet data, see @ref NT_NET_GET_PKT_L2_PTR
+ * @param[in]  length      Length of the captured L2 packet data
+ * @param[out] input       The hash input
+ *
+ * @retval NT_SUCCESS      Success
+ * @retval NT_STATUS_NO_DATA  The packet does not carry the fields used by the hash mode
+ */
+static NT_INLINE int _nt_hashref_parse(enum NtHashRefHashMode_e hashmode, const void* l2, uint32_t length, NtHashRefInput_t* input)
+{
+  const uint8_t* pkt = (const uint8_t*)l2;
+  struct _NtHashRefPktInfo_s info;
+  uint32_t l3Offset, l4Offset;
+  uint8_t protocol;
+  int ipv6;
+
+  _nt_hashref_parse_pkt(pkt, length, &info);
+  memset(input, 0, sizeof(*input));
+
+  // Inner modes hash on the tunneled header when present and on the outer header otherwise
+  if ((hashmode == NT_HASHREF_HASHMODE_INNER_2_TUPLE || hashmode == NT_HASHREF_HASHMODE_INNER_2_TUPLE_SORTED ||
+       hashmode == NT_HASHREF_HASHMODE_INNER_5_TUPLE || hashmode == NT_HASHREF_HASHMODE_INNER_5_TUPLE_SORTED) &&
+      info.innerL3Offset != 0) {
+    l3Offset = info.innerL3Offset;
+    l4Offset = info.innerL4Offset;
+    protocol = info.innerProtocol;
+    ipv6 = info.innerIpv6;
+  } else {
+    l3Offset = info.l3Offset;
+    l4Offset = info.l4Offset;
+    protocol = info.protocol;
+    ipv6 = info.ipv6;
+  }
+
+  switch (hashmode) {
+  case NT_HASHREF_HASHMODE_LAST_MPLS_LABEL:
+    if (info.numMpls == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    input->inputType = NT_HASHREF_INPUT_TYPE_LAST_MPLS_LABEL;
+    input->u.lastMplsLabel.label = info.mplsLabel[info.numMpls - 1];
+    return NT_SUCCESS;
+  case NT_HASHREF_HASHMODE_ALL_MPLS_LABELS:
+    if (info.numMpls == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    input->inputType = NT_HASHREF_INPUT_TYPE_ALL_MPLS_LABELS;
+    memcpy(input->u.allMplsLabels.label, info.mplsLabel, info.numMpls * sizeof(uint32_t));
+    return NT_SUCCESS;
+  case NT_HASHREF_HASHMODE_LAST_VLAN_ID:
+    if (info.numVlan == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    input->inputType = NT_HASHREF_INPUT_TYPE_LAST_VLAN_ID;
+    input->u.lastVlanId.vlanId = info.vlanId[info.numVlan - 1];
+    return NT_SUCCESS;
+  case NT_HASHREF_HASHMODE_ALL_VLAN_IDS:
+    if (info.numVlan == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    input->inputType = NT_HASHREF_INPUT_TYPE_ALL_VLAN_IDS;
+    memcpy(input->u.allVlanIds.vlanId, info.vlanId, info.numVlan * sizeof(uint16_t));
+    return NT_SUCCESS;
+  default:
+    break;
+  }
+
+  if (l3Offset == 0) {
+    return NT_STATUS_NO_DATA;
+  }
+
+  switch (hashmode) {
+  case NT_HASHREF_HASHMODE_2_TUPLE:
+  case NT_HASHREF_HASHMODE_2_TUPLE_SORTED:
+  case NT_HASHREF_HASHMODE_INNER_2_TUPLE:
+  case NT_HASHREF_HASHMODE_INNER_2_TUPLE_SORTED:
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_2_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple2IPv6.srcIP, input->u.tuple2IPv6.dstIP);
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_2_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple2IPv4.srcIP, &input->u.tuple2IPv4.dstIP);
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_5_TUPLE:
+  case NT_HASHREF_HASHMODE_5_TUPLE_SORTED:
+  case NT_HASHREF_HASHMODE_INNER_5_TUPLE:
+  case NT_HASHREF_HASHMODE_INNER_5_TUPLE_SORTED:
+    if (l4Offset == 0 || length < l4Offset + 4 ||
+        (protocol != _NT_HASHREF_PROTO_TCP && protocol != _NT_HASHREF_PROTO_UDP && protocol != _NT_HASHREF_PROTO_SCTP)) {
+      return NT_STATUS_NO_DATA;
+    }
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_5_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple5IPv6.srcIP, input->u.tuple5IPv6.dstIP);
+      memcpy(&input->u.tuple5IPv6.srcPort, pkt + l4Offset, sizeof(uint16_t));
+      memcpy(&input->u.tuple5IPv6.dstPort, pkt + l4Offset + 2, sizeof(uint16_t));
+      input->u.tuple5IPv6.protocol = protocol;
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_5_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple5IPv4.srcIP, &input->u.tuple5IPv4.dstIP);
+      memcpy(&input->u.tuple5IPv4.srcPort, pkt + l4Offset, sizeof(uint16_t));
+      memcpy(&input->u.tuple5IPv4.dstPort, pkt + l4Offset + 2, sizeof(uint16_t));
+      input->u.tuple5IPv4.protocol = protocol;
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_3_TUPLE_GRE_V0:
+  case NT_HASHREF_HASHMODE_3_TUPLE_GRE_V0_SORTED:
+    if (!info.greKeyValid) {
+      return NT_STATUS_NO_DATA;
+    }
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GRE_V0_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple3GREv0IPv6.srcIP, input->u.tuple3GREv0IPv6.dstIP);
+      input->u.tuple3GREv0IPv6.key = info.greKey;
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GRE_V0_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple3GREv0IPv4.srcIP, &input->u.tuple3GREv0IPv4.dstIP);
+      input->u.tuple3GREv0IPv4.key = info.greKey;
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_5_TUPLE_SCTP:
+  case NT_HASHREF_HASHMODE_5_TUPLE_SCTP_SORTED:
+    if (protocol != _NT_HASHREF_PROTO_SCTP || l4Offset == 0 || length < l4Offset + 8) {
+      return NT_STATUS_NO_DATA;
+    }
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_5_SCTP_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple5SCTPIPv6.srcIP, input->u.tuple5SCTPIPv6.dstIP);
+      memcpy(&input->u.tuple5SCTPIPv6.srcPort, pkt + l4Offset, sizeof(uint16_t));
+      memcpy(&input->u.tuple5SCTPIPv6.dstPort, pkt + l4Offset + 2, sizeof(uint16_t));
+      memcpy(&input->u.tuple5SCTPIPv6.verificationTag, pkt + l4Offset + 4, sizeof(uint32_t));
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_5_SCTP_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple5SCTPIPv4.srcIP, &input->u.tuple5SCTPIPv4.dstIP);
+      memcpy(&input->u.tuple5SCTPIPv4.srcPort, pkt + l4Offset, sizeof(uint16_t));
+      memcpy(&input->u.tuple5SCTPIPv4.dstPort, pkt + l4Offset + 2, sizeof(uint16_t));
+      memcpy(&input->u.tuple5SCTPIPv4.verificationTag, pkt + l4Offset + 4, sizeof(uint32_t));
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_3_TUPLE_GTP_V0:
+  case NT_HASHREF_HASHMODE_3_TUPLE_GTP_V0_SORTED:
+    if (!info.gtp || info.gtpVersion != 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GTP_V0_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple3GTPv0IPv6.srcIP, input->u.tuple3GTPv0IPv6.dstIP);
+      input->u.tuple3GTPv0IPv6.flowLabel = info.gtpFlowLabel;
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GTP_V0_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple3GTPv0IPv4.srcIP, &input->u.tuple3GTPv0IPv4.dstIP);
+      input->u.tuple3GTPv0IPv4.flowLabel = info.gtpFlowLabel;
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_3_TUPLE_GTP_V1V2:
+  case NT_HASHREF_HASHMODE_3_TUPLE_GTP_V1V2_SORTED:
+    if (!info.gtpTeidValid) {
+      return NT_STATUS_NO_DATA;
+    }
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GTP_V1_V2_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.tuple3GTPv1v2IPv6.srcIP, input->u.tuple3GTPv1v2IPv6.dstIP);
+      input->u.tuple3GTPv1v2IPv6.teid = info.gtpTeid;
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_TUPLE_3_GTP_V1_V2_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.tuple3GTPv1v2IPv4.srcIP, &input->u.tuple3GTPv1v2IPv4.dstIP);
+      input->u.tuple3GTPv1v2IPv4.teid = info.gtpTeid;
+    }
+    return NT_SUCCESS;
+
+  case NT_HASHREF_HASHMODE_IP_FRAGMENT_TUPLE:
+    if (ipv6) {
+      input->inputType = NT_HASHREF_INPUT_TYPE_IP_FRAGMENT_TUPLE_IP_V6;
+      _nt_hashref_copy_ip(pkt, l3Offset, 1, input->u.ipFragmentTupleIPv6.srcIP, input->u.ipFragmentTupleIPv6.dstIP);
+      input->u.ipFragmentTupleIPv6.id = info.fragId;
+    } else {
+      input->inputType = NT_HASHREF_INPUT_TYPE_IP_FRAGMENT_TUPLE_IP_V4;
+      _nt_hashref_copy_ip(pkt, l3Offset, 0, &input->u.ipFragmentTupleIPv4.srcIP, &input->u.ipFragmentTupleIPv4.dstIP);
+      memcpy(&input->u.ipFragmentTupleIPv4.ipId, &info.fragId, sizeof(uint16_t));
+      input->u.ipFragmentTupleIPv4.ipProt = pkt[l3Offset + 9];
+    }
+    return NT_SUCCESS;
+
+  default:
+    return NT_STATUS_NO_DATA;
+  }
+}
+
+/**
+ * @brief Allocate and configure a packet hash reference handle
+ *
+ * @param[out] hashRef     Packet hash reference handle
+ * @param[in]  config      Hash reference configuration
+ *
+ * @retval 0               Success
+ * @retval !=0             Error
+ */
+static NT_INLINE int _nt_hashref_pkt_open(NtHashRefPkt_t* hashRef, const NtHashRefConfig_t* config)
+{
+  if (config->config != NT_HASHREF_CONFIG_V0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  hashRef->hashmode = config->u.config_v0.hashmode;
+  return NT_HashRefOpen(&hashRef->handle, config);
+}
+
+/**
+ * @brief Close a packet hash reference handle
+ *
+ * @retval 0               Success
+ * @retval !=0             Error
+ */
+static NT_INLINE int _nt_hashref_pkt_close(NtHashRefPkt_t* hashRef)
+{
+  return NT_HashRefClose(hashRef->handle);
+}
+
+/**
+ * @brief Calculate the hash value of a packet
+ *
+ * @param[in]  hashRef     Packet hash reference handle
+ * @param[in]  l2          Pointer to the L2 packet data, see @ref NT_NET_GET_PKT_L2_PTR
+ * @param[in]  length      Length of the captured L2 packet data
+ * @param[out] result      The result of the hash calculation
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_NO_DATA  The packet does not carry the fields used by the hash mode
+ * @retval otherwise          Error returned by @ref NT_HashRefCalc
+ */
+static NT_INLINE int _nt_hashref_calc_pkt(const NtHashRefPkt_t* hashRef, const void* l2, uint32_t length, NtHashRefResult_t* result)
+{
+  NtHashRefInput_t input;
+  int status = _nt_hashref_parse(hashRef->hashmode, l2, length, &input);
+  if (status != NT_SUCCESS) {
+    return status;
+  }
+  return NT_HashRefCalc(hashRef->handle, &input, result);
+}
+
+/**
+ * @brief Calculate the hash value of the packets in a segment
+ *
+ * Up to max packets are processed starting at offset, which is moved
+ * past them, so the function can be called again until count is 0 to
+ * process the whole segment, like @ref _nt_net_get_packet_burst.
+ * Packets that do not carry the fields used by the hash mode get a result
+ * of 0 and are flagged in the "valid" array if given.
+ *
+ * @param[in]     hashRef     Packet hash reference handle
+ * @param[in]     segNetBuf   Segment NtNetBuf_s * structure
+ * @param[in,out] offset      Offset of the next packet in the segment. Must be 0 on the first call for a segment
+ * @param[out]    results     Array of results - one per packet
+ * @param[out]    valid       Optional array set to 1 for packets with a calculated hash and 0 otherwise
+ * @param[in]     max         Number of entries in the results and valid arrays
+ * @param[out]    count       Number of packets processed. 0 means that there are no more packets in the segment
+ *
+ * @retval NT_SUCCESS      Success
+ * @retval otherwise       Error returned by @ref NT_HashRefCalc. offset is past the failed packet, which is not counted in count
+ */
+static NT_INLINE int _nt_hashref_calc_segment(const NtHashRefPkt_t* hashRef, struct NtNetBuf_s* segNetBuf, uint64_t* offset,
+                                              NtHashRefResult_t* results, uint8_t* valid, uint32_t max, uint32_t* count)
+{
+  struct NtNetBuf_s burst[64];
+  uint32_t n = 0;
+  unsigned num, i;
+  *count = 0;
+  while (n < max && (num = _nt_net_get_packet_burst(segNetBuf, offset, burst, max - n < 64 ? max - n : 64)) > 0) {
+    for (i = 0; i < num; i++, n++) {
+      uint32_t length = (uint32_t)(NT_NET_GET_PKT_CAP_LENGTH(&burst[i]) - NT_NET_GET_PKT_DESCR_LENGTH(&burst[i]));
+      int status = _nt_hashref_calc_pkt(hashRef, NT_NET_GET_PKT_L2_PTR(&burst[i]), length, &results[n]);
+      if (status == NT_STATUS_NO_DATA) {
+        results[n].hashvalue = 0;
+        results[n].stream = 0;
+      } else if (status != NT_SUCCESS) {
+        // Resume after the failed packet
+        *offset = (uint64_t)((const uint8_t*)burst[i].hHdr - (const uint8_t*)segNetBuf->hHdr) + NT_NET_GET_PKT_CAP_LENGTH(&burst[i]);
+        *count = n;
+        return status;
+      }
+      if (valid != NULL) {
+        valid[n] = (uint8_t)(status == NT_SUCCESS);
+      }
+    }
+  }
+  *count = n;
+  return NT_SUCCESS;
+}
+
+#endif // __HASHREF_PKT_H__
@@ -0,0 +1,676 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+/**
+ * @file
+ *
+ * This header file contains an IPv4 and IPv6 reassembly engine. The state
+ * of the datagrams being reassembled is kept in a @ref NtFlowTab_t keyed
+ * by the IP fragment tuple (addresses, identification and, for IPv4, the
+ * protocol), the fragment data in a pool of fixed-size chunks and the
+ * timeouts in the timer wheel of @ref NtFlowAge_t. Everything is allocated
+ * when the engine is opened, so no memory is allocated per fragment.
+ *
+ * With extended descriptors 7, 8 and 9 the adapter has already classified
+ * the packet: packets without the L3 fragmented flag or an IPv6 fragment
+ * header are returned right away, and the L3 offset is taken from the
+ * descriptor, so only fragments are parsed. Other descriptors are parsed
+ * from L2.
+ *
+ * A reassembled datagram is passed to the sink function as a frame with
+ * the L2 header of the first fragment followed by the IP datagram: the
+ * IPv4 header gets the total length and fragment fields updated and the
+ * checksum recalculated, and the IPv6 fragment header is removed.
+ * Fragments overlapping other fragments of the datagram drop the whole
+ * datagram, as IPv6 requires (RFC 5722); exact duplicates are ignored.
+ *
+ * When the adapter performs IP fragment matching (IPF), fragments it
+ * could not match are delivered to the stream given by
+ * NT_NET_GET_PKT_IPF_UNMATCHED_STREAMID, so packets from that stream must
+ * be passed to the engine as well.
+ *
+ */
+#ifndef __IPDEFRAG_H__
+#define __IPDEFRAG_H__
+
+#include "nt.h"
+#include "flowtab.h"
+#include "flowage.h"
+
+/**
+ * Largest IP datagram
+ */
+#define NT_IPDEFRAG_MAX_DATAGRAM 65535
+
+/**
+ * Sink function receiving reassembled datagrams
+ *
+ * @param[in] ctx        Context given with the function
+ * @param[in] frame      L2 header of the first fragment followed by the reassembled IP datagram
+ * @param[in] length     Bytes of frame
+ * @param[in] l3Offset   Offset of the IP header in frame
+ * @param[in] pktNetBuf  The fragment that completed the datagram
+ */
+typedef void (*NtIpDefragSink_t)(void *ctx, const uint8_t *frame, uint32_t length, uint32_t l3Offset, struct NtNetBuf_s *pktNetBuf);
+
+/**
+ * IP reassembly configuration. Zero selects the default value.
+ */
+typedef struct NtIpDefragConfig_s {
+  uint32_t maxDatagrams;    //!< Datagrams reassembled at the same time. Default is 4096
+  uint32_t chunks;          //!< Chunks of fragment data in the pool. Default is 8 per datagram
+  uint32_t chunkSize;       //!< Bytes per chunk - must hold the L2 and IP headers of a fragment. Default is 2048
+  uint32_t maxFragments;    //!< Fragments per datagram before it is dropped. Default is 64
+  uint64_t timeout;         //!< Nanoseconds of stream time to wait for the missing fragments. Default is 30 s
+} NtIpDefragConfig_t;
+
+/**
+ * IP reassembly counters
+ */
+typedef struct NtIpDefragStat_s {
+  uint64_t fragments;       //!< Fragments received
+  uint64_t unmatched;       //!< Fragments flagged as unmatched by the adapter IP fragment matching
+  uint64_t datagrams;       //!< Datagrams reassembled
+  uint64_t duplicates;      //!< Fragments ignored as duplicates
+  uint64_t overlaps;        //!< Datagrams dropped for overlapping fragments
+  uint64_t invalid;         //!< Fragments or datagrams dropped for truncated or inconsistent headers or lengths
+  uint64_t tooMany;         //!< Datagrams dropped for exceeding the maximum number of fragments
+  uint64_t timeouts;        //!< Datagrams dropped for missing fragments at the timeout
+  uint64_t noResource;      //!< Fragments dropped because the table or the chunk pool was full
+  uint64_t pending;         //!< Datagrams being reassembled
+  uint64_t chunksUsed;      //!< Chunks holding fragment data
+} NtIpDefragStat_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#define _NT_IPDEFRAG_NONE 0xFFFFFFFFU
+
+struct _NtIpDefragChunk_s {
+  uint32_t next;             // Next chunk of the fragment
+  uint32_t nextFrag;         // First chunk of the next fragment by offset - first chunk only
+  uint32_t offset;           // Payload offset of the fragment - first chunk only
+  uint32_t length;           // Payload bytes of the fragment - first chunk only
+};
+
+// Flow table user data
+struct _NtIpDefragDatagram_s {
+  uint32_t first;            // First chunk of the first fragment by offset
+  uint32_t header;           // Chunk holding L2 and the unfragmentable headers of the first fragment
+  uint32_t headerLength;     // Bytes in the header chunk
+  uint32_t l3Offset;
+  uint32_t nextHdrPos;       // IPv6: offset of the next header field pointing at the fragment header
+  uint32_t total;            // Payload bytes - 0 until the last fragment has been received
+  uint32_t received;         // Payload bytes received
+  uint32_t end;              // End of the fragment with the highest offset
+  uint32_t maxPayload;       // Largest payload allowed by the headers of the first fragment
+  uint16_t numFragments;
+  uint8_t ipv6;
+  uint8_t nextHeader;        // IPv6: next header of the fragment header
+};
+
+// Fragment fields of a packet
+struct _NtIpDefragFrag_s {
+  uint32_t l3Offset;
+  uint32_t payload;          // Offset of the fragment payload
+  uint32_t length;           // Payload bytes
+  uint32_t offset;           // Payload offset in the datagram
+  uint32_t nextHdrPos;
+  uint32_t maxPayload;
+  uint8_t more;
+  uint8_t ipv6;
+  uint8_t nextHeader;
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * IP reassembly engine. Must only be used by one thread.
+ */
+typedef struct NtIpDefrag_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtIpDefragConfig_t config;
+  NtIpDefragSink_t sink;
+  void *ctx;
+  NtFlowTab_t tab;
+  NtFlowAge_t age;
+  uint8_t *chunks;
+  uint64_t chunkBytes;       // Chunk header and data
+  uint32_t *freeList;        // Stack of free chunks
+  uint32_t numFree;
+  uint8_t *frame;            // Reassembled frame
+  void **expired;
+  NtIpDefragStat_t stat;
+#endif
+} NtIpDefrag_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE struct _NtIpDefragChunk_s* _nt_ipdefrag_chunk(const NtIpDefrag_t* defrag, uint32_t index)
+{
+  return (struct _NtIpDefragChunk_s*)(defrag->chunks + (uint64_t)index * defrag->chunkBytes);
+}
+
+static NT_INLINE uint8_t* _nt_ipdefrag_chunk_data(const NtIpDefrag_t* defrag, uint32_t index)
+{
+  return (uint8_t*)_nt_ipdefrag_chunk(defrag, index) + sizeof(struct _NtIpDefragChunk_s);
+}
+
+static NT_INLINE void _nt_ipdefrag_free_chain(NtIpDefrag_t* defrag, uint32_t index)
+{
+  while (index != _NT_IPDEFRAG_NONE) {
+    defrag->freeList[defrag->numFree++] = index;
+    index = _nt_ipdefrag_chunk(defrag, index)->next;
+  }
+}
+
+/*
+ * Copy data into a new chain of chunks. Returns _NT_IPDEFRAG_NONE if the
+ * pool does not have enough chunks.
+ */
+static NT_INLINE uint32_t _nt_ipdefrag_store(NtIpDefrag_t* defrag, const uint8_t* data, uint32_t length)
+{
+  uint32_t needed = length == 0 ? 1 : (length + defrag->config.chunkSize - 1) / defrag->config.chunkSize;
+  uint32_t first = _NT_IPDEFRAG_NONE, *link = &first;
+  if (needed > defrag->numFree) {
+    return _NT_IPDEFRAG_NONE;
+  }
+  do {
+    uint32_t index = defrag->freeList[--defrag->numFree];
+    uint32_t size = length < defrag->config.chunkSize ? length : defrag->config.chunkSize;
+    *link = index;
+    link = &_nt_ipdefrag_chunk(defrag, index)->next;
+    memcpy(_nt_ipdefrag_chunk_data(defrag, index), data, size);
+    data += size;
+    length -= size;
+  } while (length != 0);
+  *link = _NT_IPDEFRAG_NONE;
+  return first;
+}
+
+static NT_INLINE void _nt_ipdefrag_drop(NtIpDefrag_t* defrag, struct _NtIpDefragDatagram_s* dg)
+{
+  uint32_t frag = dg->first;
+  while (frag != _NT_IPDEFRAG_NONE) {
+    uint32_t next = _nt_ipdefrag_chunk(defrag, frag)->nextFrag;
+    _nt_ipdefrag_free_chain(defrag, frag);
+    frag = next;
+  }
+  if (dg->header != _NT_IPDEFRAG_NONE) {
+    _nt_ipdefrag_free_chain(defrag, dg->header);
+  }
+  _nt_flowage_remove(&defrag->age, dg);
+  defrag->stat.pending--;
+}
+
+/*
+ * Parse the fragment fields of the IP header at l3Offset. Returns
+ * NT_STATUS_NO_DATA if the packet is not a fragment and
+ * NT_ERROR_INVALID_PARAMETER if the headers are not within the captured
+ * data or inconsistent.
+ */
+static NT_INLINE int _nt_ipdefrag_parse(const uint8_t* pkt, uint32_t length, uint32_t l3Offset, int ipv6, struct _NtIpDefragFrag_s* frag)
+{
+  const uint8_t* ip = pkt + l3Offset;
+  uint32_t end;
+  memset(frag, 0, sizeof(*frag));
+  frag->l3Offset = l3Offset;
+  frag->ipv6 = (uint8_t)ipv6;
+  if (!ipv6) {
+    uint32_t ihl;
+    uint16_t field;
+    if (length < l3Offset + 20 || (ip[0] >> 4) != 4) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    field = _nt_hashref_rd16(ip + 6);
+    if ((field & 0x3FFF) == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    ihl = (uint32_t)(ip[0] & 0x0F) << 2;
+    end = l3Offset + _nt_hashref_rd16(ip + 2);
+    if (ihl < 20 || end < l3Offset + ihl || end > length) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    frag->more = (field & 0x2000) != 0;
+    frag->offset = (uint32_t)(field & 0x1FFF) << 3;
+    frag->payload = l3Offset + ihl;
+    frag->maxPayload = NT_IPDEFRAG_MAX_DATAGRAM - ihl;
+  } else {
+    uint32_t hdr = l3Offset + 40, pos = l3Offset + 6;
+    uint8_t next;
+    uint16_t field;
+    if (length < l3Offset + 40 || (ip[0] >> 4) != 6) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    end = l3Offset + 40 + _nt_hashref_rd16(ip + 4);
+    if (end > length) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    // Extension headers before the fragment header are the unfragmentable part
+    for (next = pkt[pos]; next != 44; next = pkt[pos]) {
+      if (next != 0 && next != 43 && next != 60) {
+        return NT_STATUS_NO_DATA;
+      }
+      if (end < hdr + 8) {
+        return NT_ERROR_INVALID_PARAMETER;
+      }
+      pos = hdr;
+      hdr += ((uint32_t)pkt[hdr + 1] + 1) << 3;
+    }
+    if (end < hdr + 8) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    field = _nt_hashref_rd16(pkt + hdr + 2);
+    if ((field & 0xFFF9) == 0) {
+      // Atomic fragment - a complete datagram (RFC 6946)
+      return NT_STATUS_NO_DATA;
+    }
+    frag->more = (field & 1) != 0;
+    frag->offset = field & 0xFFF8;
+    frag->nextHeader = pkt[hdr];
+    frag->nextHdrPos = pos;
+    frag->payload = hdr + 8;
+    frag->maxPayload = NT_IPDEFRAG_MAX_DATAGRAM - (hdr - l3Offset - 40);
+  }
+  frag->length = end - frag->payload;
+  // All but the last fragment carry a multiple of 8 bytes
+  if ((frag->more && (frag->length == 0 || (frag->length & 7) != 0)) || frag->offset + frag->length > frag->maxPayload) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  return NT_SUCCESS;
+}
+
+static NT_INLINE void _nt_ipdefrag_key(const uint8_t* pkt, const struct _NtIpDefragFrag_s* frag, NtHashRefInput_t* key, uint32_t* hash)
+{
+  const uint8_t* ip = pkt + frag->l3Offset;
+  memset(key, 0, sizeof(*key));
+  if (frag->ipv6) {
+    key->inputType = NT_HASHREF_INPUT_TYPE_IP_FRAGMENT_TUPLE_IP_V6;
+    memcpy(key->u.ipFragmentTupleIPv6.srcIP, ip + 8, 16);
+    memcpy(key->u.ipFragmentTupleIPv6.dstIP, ip + 24, 16);
+    memcpy(&key->u.ipFragmentTupleIPv6.id, pkt + frag->payload - 4, sizeof(uint32_t));
+    *hash = key->u.ipFragmentTupleIPv6.id;
+  } else {
+    key->inputType = NT_HASHREF_INPUT_TYPE_IP_FRAGMENT_TUPLE_IP_V4;
+    memcpy(&key->u.ipFragmentTupleIPv4.srcIP, ip + 12, sizeof(uint32_t));
+    memcpy(&key->u.ipFragmentTupleIPv4.dstIP, ip + 16, sizeof(uint32_t));
+    memcpy(&key->u.ipFragmentTupleIPv4.ipId, ip + 4, sizeof(uint16_t));
+    key->u.ipFragmentTupleIPv4.ipProt = ip[9];
+    *hash = key->u.ipFragmentTupleIPv4.ipId;
+  }
+}
+
+static NT_INLINE void _nt_ipdefrag_ipv4_csum(uint8_t* ip)
+{
+  uint32_t ihl = (uint32_t)(ip[0] & 0x0F) << 2, sum = 0, i;
+  ip[10] = ip[11] = 0;
+  for (i = 0; i < ihl; i += 2) {
+    sum += _nt_hashref_rd16(ip + i);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  sum = ~sum & 0xFFFF;
+  ip[10] = (uint8_t)(sum >> 8);
+  ip[11] = (uint8_t)sum;
+}
+
+/*
+ * Build the reassembled frame, pass it to the sink and free the datagram
+ */
+static NT_INLINE void _nt_ipdefrag_complete(NtIpDefrag_t* defrag, struct _NtIpDefragDatagram_s* dg, struct NtNetBuf_s* pktNetBuf)
+{
+  uint8_t* frame = defrag->frame;
+  uint8_t* ip = frame + dg->l3Offset;
+  uint32_t length = dg->headerLength, frag;
+  memcpy(frame, _nt_ipdefrag_chunk_data(defrag, dg->header), dg->headerLength);
+  for (frag = dg->first; frag != _NT_IPDEFRAG_NONE; frag = _nt_ipdefrag_chunk(defrag, frag)->nextFrag) {
+    const struct _NtIpDefragChunk_s* chunk = _nt_ipdefrag_chunk(defrag, frag);
+    uint32_t left = chunk->length, index = frag;
+    uint8_t* out = frame + dg->headerLength + chunk->offset;
+    while (left != 0) {
+      uint32_t size = left < defrag->config.chunkSize ? left : defrag->config.chunkSize;
+      memcpy(out, _nt_ipdefrag_chunk_data(defrag, index), size);
+      out += size;
+      left -= size;
+      index = _nt_ipdefrag_chunk(defrag, index)->next;
+    }
+  }
+  length += dg->total;
+  if (dg->ipv6) {
+    uint32_t payload = length - dg->l3Offset - 40;
+    frame[dg->nextHdrPos] = dg->nextHeader;
+    ip[4] = (uint8_t)(payload >> 8);
+    ip[5] = (uint8_t)payload;
+  } else {
+    uint32_t total = length - dg->l3Offset;
+    ip[2] = (uint8_t)(total >> 8);
+    ip[3] = (uint8_t)total;
+    ip[6] &= 0x40;   // Keep don't fragment
+    ip[7] = 0;
+    _nt_ipdefrag_ipv4_csum(ip);
+  }
+  defrag->stat.datagrams++;
+  if (defrag->sink != NULL) {
+    defrag->sink(defrag->ctx, frame, length, dg->l3Offset, pktNetBuf);
+  }
+  _nt_ipdefrag_drop(defrag, dg);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Drop the datagrams whose missing fragments have timed out
+ *
+ * Called by @ref _nt_ipdefrag_pkt. When the stream is idle call it after
+ * @ref _nt_ipdefrag_segment. At most the flow aging budget of timers is
+ * handled per call.
+ *
+ * @param[in] defrag  IP reassembly engine
+ */
+static NT_INLINE void _nt_ipdefrag_expire(NtIpDefrag_t* defrag)
+{
+  uint32_t n, i;
+  n = _nt_flowage_expire(&defrag->age, defrag->expired, defrag->age.config.budget);
+  for (i = 0; i < n; i++) {
+    _nt_ipdefrag_drop(defrag, (struct _NtIpDefragDatagram_s*)defrag->expired[i]);
+    defrag->stat.timeouts++;
+  }
+}
+
+/**
+ * @brief Advance the stream time from the time stamp of a segment
+ *
+ * Lets the timeouts run when no fragments arrive. See @ref _nt_flowage_segment.
+ *
+ * @param[in] defrag   IP reassembly engine
+ * @param[in] hNetBuf  Segment
+ */
+static NT_INLINE void _nt_ipdefrag_segment(NtIpDefrag_t* defrag, NtNetBuf_t hNetBuf)
+{
+  _nt_flowage_segment(&defrag->age, hNetBuf);
+}
+
+/**
+ * @brief Close an IP reassembly engine
+ *
+ * Datagrams not yet reassembled are dropped.
+ *
+ * @param[in] defrag  IP reassembly engine
+ */
+static NT_INLINE void _nt_ipdefrag_close(NtIpDefrag_t* defrag)
+{
+  _nt_flowage_close(&defrag->age);
+  _nt_flowtab_close(&defrag->tab);
+  free(defrag->chunks);
+  free(defrag->freeList);
+  free(defrag->frame);
+  free(defrag->expired);
+  defrag->chunks = NULL;
+  defrag->freeList = NULL;
+  defrag->frame = NULL;
+  defrag->expired = NULL;
+}
+
+/**
+ * @brief Open an IP reassembly engine
+ *
+ * @param[out] defrag  IP reassembly engine
+ * @param[in]  config  Optional configuration - NULL selects the defaults
+ * @param[in]  sink    Function receiving the reassembled datagrams
+ * @param[in]  ctx     Context passed to the sink function
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         Invalid configuration
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_ipdefrag_open(NtIpDefrag_t* defrag, const NtIpDefragConfig_t* config, NtIpDefragSink_t sink, void* ctx)
+{
+  NtFlowTabConfig_t tabConfig;
+  NtFlowAgeConfig_t ageConfig;
+  uint32_t i;
+  int status;
+
+  memset(defrag, 0, sizeof(*defrag));
+  if (config != NULL) {
+    defrag->config = *config;
+  }
+  if (defrag->config.maxDatagrams == 0) {
+    defrag->config.maxDatagrams = 4096;
+  }
+  if (defrag->config.chunks == 0) {
+    defrag->config.chunks = defrag->config.maxDatagrams * 8;
+  }
+  if (defrag->config.chunkSize == 0) {
+    defrag->config.chunkSize = 2048;
+  }
+  if (defrag->config.maxFragments == 0) {
+    defrag->config.maxFragments = 64;
+  }
+  if (defrag->config.timeout == 0) {
+    defrag->config.timeout = 30ULL * 1000000000ULL;
+  }
+  // The L3 offset of the descriptor is at most 0x1FF
+  if (defrag->config.chunkSize < 256 || defrag->config.maxFragments > 0xFFFF) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  defrag->sink = sink;
+  defrag->ctx = ctx;
+
+  memset(&tabConfig, 0, sizeof(tabConfig));
+  tabConfig.maxFlows = defrag->config.maxDatagrams;
+  tabConfig.valueSize = sizeof(struct _NtIpDefragDatagram_s);
+  if ((status = _nt_flowtab_open(&defrag->tab, &tabConfig)) != NT_SUCCESS) {
+    return status;
+  }
+  memset(&ageConfig, 0, sizeof(ageConfig));
+  ageConfig.timeout = defrag->config.timeout;
+  if ((status = _nt_flowage_open(&defrag->age, &defrag->tab, &ageConfig)) != NT_SUCCESS) {
+    _nt_ipdefrag_close(defrag);
+    return status;
+  }
+  defrag->chunkBytes = (sizeof(struct _NtIpDefragChunk_s) + defrag->config.chunkSize + 7) & ~7ULL;
+  defrag->chunks = (uint8_t*)malloc((size_t)(defrag->config.chunks * defrag->chunkBytes));
+  defrag->freeList = (uint32_t*)malloc(defrag->config.chunks * sizeof(uint32_t));
+  defrag->frame = (uint8_t*)malloc(defrag->config.chunkSize + NT_IPDEFRAG_MAX_DATAGRAM);
+  defrag->expired = (void**)malloc(defrag->age.config.budget * sizeof(void*));
+  if (defrag->chunks == NULL || defrag->freeList == NULL || defrag->frame == NULL || defrag->expired == NULL) {
+    _nt_ipdefrag_close(defrag);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (i = 0; i < defrag->config.chunks; i++) {
+    defrag->freeList[i] = defrag->config.chunks - 1 - i;
+  }
+  defrag->numFree = defrag->config.chunks;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Pass a packet to the IP reassembly engine
+ *
+ * Fragments are consumed - the datagram is passed to the sink function
+ * when its last missing fragment arrives. Other packets are left to the
+ * caller.
+ *
+ * @param[in] defrag     IP reassembly engine
+ * @param[in] pktNetBuf  Packet
+ *
+ * @retval NT_SUCCESS         The packet was a fragment and has been consumed, also when it was dropped
+ * @retval NT_STATUS_NO_DATA  The packet is not a fragment
+ */
+static NT_INLINE int _nt_ipdefrag_pkt(NtIpDefrag_t* defrag, struct NtNetBuf_s* pktNetBuf)
+{
+  const uint8_t* pkt = (const uint8_t*)NT_NET_GET_PKT_L2_PTR(pktNetBuf);
+  uint32_t length = (uint32_t)(NT_NET_GET_PKT_CAP_LENGTH(pktNetBuf) - NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+  struct _NtIpDefragFrag_s frag;
+  struct _NtIpDefragDatagram_s* dg;
+  NtHashRefInput_t key;
+  uint32_t hash, index, *link;
+  int status, inserted;
+
+  if (_NT_NET_GET_PKT_DESCR_PTR_DYN(pktNetBuf)->ntDynDescr == 0 &&
+      _NT_NET_GET_PKT_NT_DESCR_TYPE(pktNetBuf) == NT_PACKET_DESCRIPTOR_TYPE_NT_EXTENDED &&
+      _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) >= 7 && _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) <= 9) {
+    // The adapter has decoded the packet
+    uint32_t l3Type = (uint32_t)_NT_NET_GET_PKT_L3_FRAME_TYPE_EXT7(pktNetBuf);
+    if (!_NT_NET_GET_PKT_L3_FRAGMENTED_EXT7(pktNetBuf) && !_NT_NET_GET_PKT_IPV6_FR_HEADER_EXT7(pktNetBuf)) {
+      return NT_STATUS_NO_DATA;
+    }
+    if ((l3Type != NT_L3_FRAME_TYPE_IPv4 && l3Type != NT_L3_FRAME_TYPE_IPv6) || _NT_NET_GET_PKT_L3_OFFSET_EXT7(pktNetBuf) == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    status = _nt_ipdefrag_parse(pkt, length, (uint32_t)_NT_NET_GET_PKT_L3_OFFSET_EXT7(pktNetBuf), l3Type == NT_L3_FRAME_TYPE_IPv6, &frag);
+    if (status != NT_STATUS_NO_DATA && _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) >= 8 && _NT_NET_GET_PKT_IPF_UNMATCHED_FLAG_EXT8(pktNetBuf)) {
+      defrag->stat.unmatched++;
+    }
+  } else {
+    struct _NtHashRefPktInfo_s info;
+    _nt_hashref_parse_pkt(pkt, length, &info);
+    if (info.l3Offset == 0 || !info.fragmented) {
+      return NT_STATUS_NO_DATA;
+    }
+    status = _nt_ipdefrag_parse(pkt, length, info.l3Offset, info.ipv6, &frag);
+  }
+  if (status == NT_STATUS_NO_DATA) {
+    return NT_STATUS_NO_DATA;
+  }
+  defrag->stat.fragments++;
+  if (status != NT_SUCCESS) {
+    defrag->stat.invalid++;
+    return NT_SUCCESS;
+  }
+
+  _nt_ipdefrag_key(pkt, &frag, &key, &hash);
+  dg = (struct _NtIpDefragDatagram_s*)_nt_flowtab_insert(&defrag->tab, hash, &key, &inserted);
+  if (dg == NULL) {
+    _nt_ipdefrag_expire(defrag);
+    if ((dg = (struct _NtIpDefragDatagram_s*)_nt_flowtab_insert(&defrag->tab, hash, &key, &inserted)) == NULL) {
+      defrag->stat.noResource++;
+      return NT_SUCCESS;
+    }
+  }
+  // The timeout runs from the first fragment, so a trickle of fragments cannot hold on to the state
+  _nt_flowage_set_time_pkt(&defrag->age, pktNetBuf);
+  if (inserted) {
+    dg->first = _NT_IPDEFRAG_NONE;
+    dg->header = _NT_IPDEFRAG_NONE;
+    dg->maxPayload = NT_IPDEFRAG_MAX_DATAGRAM;
+    dg->ipv6 = frag.ipv6;
+    _nt_flowage_touch(&defrag->age, dg);
+    defrag->stat.pending++;
+  }
+
+  // Insert the fragment in offset order - overlaps drop the datagram
+  for (link = &dg->first; *link != _NT_IPDEFRAG_NONE; link = &_nt_ipdefrag_chunk(defrag, *link)->nextFrag) {
+    const struct _NtIpDefragChunk_s* chunk = _nt_ipdefrag_chunk(defrag, *link);
+    if (chunk->offset == frag.offset && chunk->length == frag.length) {
+      defrag->stat.duplicates++;
+      return NT_SUCCESS;
+    }
+    if (chunk->offset + chunk->length <= frag.offset) {
+      continue;
+    }
+    if (frag.offset + frag.length > chunk->offset) {
+      defrag->stat.overlaps++;
+      _nt_ipdefrag_drop(defrag, dg);
+      return NT_SUCCESS;
+    }
+    break;
+  }
+  if ((!frag.more && (dg->total != 0 || dg->end > frag.offset + frag.length)) ||
+      (dg->total != 0 && frag.offset + frag.length > dg->total) ||
+      (frag.offset == 0 && dg->end > frag.maxPayload) || frag.offset + frag.length > dg->maxPayload) {
+    // A second last fragment, data after the last fragment or beyond the size allowed by the first fragment
+    defrag->stat.invalid++;
+    _nt_ipdefrag_drop(defrag, dg);
+    return NT_SUCCESS;
+  }
+  if (dg->numFragments == defrag->config.maxFragments) {
+    defrag->stat.tooMany++;
+    _nt_ipdefrag_drop(defrag, dg);
+    return NT_SUCCESS;
+  }
+  if (frag.offset == 0) {
+    if ((frag.payload > defrag->config.chunkSize) ||
+        (dg->header = _nt_ipdefrag_store(defrag, pkt, frag.payload)) == _NT_IPDEFRAG_NONE) {
+      defrag->stat.noResource++;
+      _nt_ipdefrag_drop(defrag, dg);
+      return NT_SUCCESS;
+    }
+    dg->headerLength = frag.ipv6 ? frag.payload - 8 : frag.payload;
+    dg->maxPayload = frag.maxPayload;
+    dg->l3Offset = frag.l3Offset;
+    dg->nextHdrPos = frag.nextHdrPos;
+    dg->nextHeader = frag.nextHeader;
+  }
+  if ((index = _nt_ipdefrag_store(defrag, pkt + frag.payload, frag.length)) == _NT_IPDEFRAG_NONE) {
+    defrag->stat.noResource++;
+    _nt_ipdefrag_drop(defrag, dg);
+    return NT_SUCCESS;
+  }
+  _nt_ipdefrag_chunk(defrag, index)->offset = frag.offset;
+  _nt_ipdefrag_chunk(defrag, index)->length = frag.length;
+  _nt_ipdefrag_chunk(defrag, index)->nextFrag = *link;
+  *link = index;
+  dg->numFragments++;
+  dg->received += frag.length;
+  if (frag.offset + frag.length > dg->end) {
+    dg->end = frag.offset + frag.length;
+  }
+  if (!frag.more) {
+    dg->total = frag.offset + frag.length;
+  }
+  if (dg->total != 0 && dg->received == dg->total && dg->header != _NT_IPDEFRAG_NONE) {
+    _nt_ipdefrag_complete(defrag, dg, pktNetBuf);
+  }
+  _nt_ipdefrag_expire(defrag);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the counters of an IP reassembly engine
+ *
+ * @param[in]  defrag  IP reassembly engine
+ * @param[out] stat    Counters
+ */
+static NT_INLINE void _nt_ipdefrag_get_stat(const NtIpDefrag_t* defrag, NtIpDefragStat_t* stat)
+{
+  *stat = defrag->stat;
+  stat->chunksUsed = defrag->config.chunks - defrag->numFree;
+}
+
+#endif // __IPDEFRAG_H__
@@ -0,0 +1,568 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the time stamp merge reader. It merges the
+ * packets of several segment sources - e.g. one capture file per stream
+ * ID - into a single packet stream ordered by time stamp. The current
+ * packet of every source is kept in a loser tree, so each packet costs
+ * log2(number of sources) comparisons, and the reader scales to hundreds
+ * of sources.
+ *
+ * Segments are read ahead into a ring per source by a pool of threads.
+ * Each thread serves a fixed subset of the sources and is the only thread
+ * calling their get and release functions, as required by
+ * @ref NT_NetFileGet. Without threads the sources are read by the thread
+ * calling @ref _nt_merge_get. Empty segments are skipped.
+ *
+ */
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+#include "nt.h"
+#include "ring.h"
+#include "capfile.h"
+#include "compat.h"
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
+/**
+ * Get the next segment of a merge source
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_END_OF_FILE  No more data
+ * @retval NT_STATUS_TRYAGAIN     No segment is available right now
+ * @retval otherwise              Error
+ */
+typedef int (*NtMergeGet_t)(void *ctx, NtNetBuf_t *hNetBuf);
+
+/**
+ * Release a segment of a merge source
+ */
+typedef int (*NtMergeRelease_t)(void *ctx, NtNetBuf_t hNetBuf);
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtMergeSource_s {
+  NtMergeGet_t get;
+  NtMergeRelease_t release;
+  void *ctx;
+  NtRing_t ready;            // Segments read ahead - the read-ahead thread produces
+  NtRing_t done;             // Segments to release - the merging thread produces
+  volatile uint32_t eof;
+  volatile uint32_t error;
+  // Merging thread only
+  NtNetBuf_t seg;            // Segment holding the current packet
+  struct NtNetBuf_s pkt;     // Current packet
+  uint64_t key;              // Time stamp of the current packet
+  int active;                // Set if "pkt" is a packet of "seg"
+  NtNetBuf_t pending;        // Segment whose release failed - retried before advancing
+  int exhausted;             // Set when all packets have been merged
+};
+
+struct _NtMergeThread_s {
+  struct NtMerge_s *merge;
+  uint32_t index;
+#ifndef _MSC_VER
+  pthread_t thread;
+#endif
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Time stamp merge reader
+ */
+typedef struct NtMerge_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint32_t maxSources;
+  uint32_t numSources;
+  struct _NtMergeSource_s *sources;
+  uint32_t *loser;           // loser[0] is the winner
+  uint32_t *winner;          // Winner of every node - only used to build the tree
+  uint32_t depth;            // Segments read ahead per source
+  uint32_t numThreads;
+  struct _NtMergeThread_s *threads;
+  volatile uint32_t stop;
+  uint32_t initNext;         // Next source to get the first packet of
+  int started;
+  uint32_t pending;          // Source of the packet returned by the last call to get
+#endif
+} NtMerge_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#define _NT_MERGE_NONE 0xFFFFFFFF
+
+static NT_INLINE uint64_t _nt_merge_pkt_timestamp(struct NtNetBuf_s* pktNetBuf)
+{
+  // Dynamic descriptors hold the time stamp in the second 64-bit word
+  if (_NT_NET_GET_PKT_DESCR_PTR_DYN(pktNetBuf)->ntDynDescr) {
+    return ((NtDyn1Descr_t*)pktNetBuf->hHdr)->timestamp;
+  }
+  return NT_NET_GET_PKT_TIMESTAMP(pktNetBuf);
+}
+
+static NT_INLINE uint32_t _nt_merge_pow2(uint32_t v)
+{
+  uint32_t p = 1;
+  while (p < v) {
+    p <<= 1;
+  }
+  return p;
+}
+
+/*
+ * Loser tree order - exhausted sources last and ties by source number
+ */
+static NT_INLINE int _nt_merge_less(NtMerge_t* merge, uint32_t a, uint32_t b)
+{
+  struct _NtMergeSource_s* sa = &merge->sources[a];
+  struct _NtMergeSource_s* sb = &merge->sources[b];
+  if (sa->exhausted != sb->exhausted) {
+    return sb->exhausted;
+  }
+  return sa->key < sb->key || (sa->key == sb->key && a < b);
+}
+
+static NT_INLINE void _nt_merge_build(NtMerge_t* merge)
+{
+  uint32_t k = merge->numSources;
+  uint32_t* winner = merge->winner;
+  uint32_t n;
+  // The leaves are nodes k..2k-1 of an implicit binary tree
+  for (n = 0; n < k; n++) {
+    winner[k + n] = n;
+  }
+  for (n = k - 1; n > 0; n--) {
+    uint32_t l = winner[2 * n], r = winner[2 * n + 1];
+    if (_nt_merge_less(merge, l, r)) {
+      winner[n] = l;
+      merge->loser[n] = r;
+    } else {
+      winner[n] = r;
+      merge->loser[n] = l;
+    }
+  }
+  merge->loser[0] = k > 1 ? winner[1] : 0;
+}
+
+static NT_INLINE void _nt_merge_replay(NtMerge_t* merge, uint32_t s)
+{
+  uint32_t n = (s + merge->numSources) / 2;
+  while (n > 0) {
+    if (_nt_merge_less(merge, merge->loser[n], s)) {
+      uint32_t t = merge->loser[n];
+      merge->loser[n] = s;
+      s = t;
+    }
+    n /= 2;
+  }
+  merge->loser[0] = s;
+}
+
+/*
+ * Release a segment. If that fails the segment is kept in "pending" and
+ * the release is retried by the next advance, so a segment is never lost
+ * when the release ring is full.
+ */
+static NT_INLINE int _nt_merge_release(NtMerge_t* merge, struct _NtMergeSource_s* src, NtNetBuf_t hNetBuf)
+{
+  int status;
+  if (merge->numThreads > 0) {
+    status = _nt_ring_enqueue(&src->done, &hNetBuf);
+  } else {
+    status = src->release(src->ctx, hNetBuf);
+  }
+  src->pending = status == NT_SUCCESS ? NULL : hNetBuf;
+  return status;
+}
+
+/*
+ * Move a source to its next packet
+ */
+static NT_INLINE int _nt_merge_advance(NtMerge_t* merge, struct _NtMergeSource_s* src)
+{
+  int status;
+  if (src->pending != NULL && (status = _nt_merge_release(merge, src, src->pending)) != NT_SUCCESS) {
+    return status;
+  }
+  if (src->active) {
+    if (_nt_net_get_next_packet(src->seg, NT_NET_GET_SEGMENT_LENGTH(src->seg), &src->pkt) > 0) {
+      src->key = _nt_merge_pkt_timestamp(&src->pkt);
+      return NT_SUCCESS;
+    }
+    src->active = 0;
+    if ((status = _nt_merge_release(merge, src, src->seg)) != NT_SUCCESS) {
+      return status;
+    }
+  }
+  for (;;) {
+    NtNetBuf_t hNetBuf;
+    if (merge->numThreads > 0) {
+      if (_nt_ring_dequeue(&src->ready, &hNetBuf) != NT_SUCCESS) {
+        if (_nt_atomic_load_acquire_u32(&src->error)) {
+          return (int)src->error;
+        }
+        if (!_nt_atomic_load_acquire_u32(&src->eof)) {
+          return NT_STATUS_TRYAGAIN;
+        }
+        // End of file is set after the last segment is queued
+        if (_nt_ring_dequeue(&src->ready, &hNetBuf) != NT_SUCCESS) {
+          src->exhausted = 1;
+          return NT_SUCCESS;
+        }
+      }
+    } else {
+      status = src->get(src->ctx, &hNetBuf);
+      if (status == NT_STATUS_END_OF_FILE) {
+        src->exhausted = 1;
+        return NT_SUCCESS;
+      }
+      if (status != NT_SUCCESS) {
+        return status;
+      }
+    }
+    if (NT_NET_GET_SEGMENT_LENGTH(hNetBuf) == 0) {
+      if ((status = _nt_merge_release(merge, src, hNetBuf)) != NT_SUCCESS) {
+        return status;
+      }
+      continue;
+    }
+    src->seg = hNetBuf;
+    _nt_net_build_pkt_netbuf(hNetBuf, &src->pkt);
+    src->key = _nt_merge_pkt_timestamp(&src->pkt);
+    src->active = 1;
+    return NT_SUCCESS;
+  }
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_merge_thread(void* arg)
+{
+  struct _NtMergeThread_s* thread = (struct _NtMergeThread_s*)arg;
+  NtMerge_t* merge = thread->merge;
+  while (!_nt_atomic_load_acquire_u32(&merge->stop)) {
+    int idle = 1;
+    uint32_t s;
+    for (s = thread->index; s < merge->numSources; s += merge->numThreads) {
+      struct _NtMergeSource_s* src = &merge->sources[s];
+      NtNetBuf_t hNetBuf;
+      for (;;) {
+        int status;
+        // Release before every get so the release ring never fills up
+        while (_nt_ring_dequeue(&src->done, &hNetBuf) == NT_SUCCESS) {
+          (void)src->release(src->ctx, hNetBuf);
+          idle = 0;
+        }
+        if (src->eof || src->error || _nt_ring_count(&src->ready) >= merge->depth) {
+          break;
+        }
+        status = src->get(src->ctx, &hNetBuf);
+        if (status == NT_SUCCESS) {
+          (void)_nt_ring_enqueue(&src->ready, &hNetBuf);
+          idle = 0;
+        } else if (status == NT_STATUS_END_OF_FILE) {
+          _nt_atomic_store_release_u32(&src->eof, 1);
+        } else if (status != NT_STATUS_TRYAGAIN) {
+          _nt_atomic_store_release_u32(&src->error, (uint32_t)status);
+        } else {
+          break;
+        }
+      }
+    }
+    if (idle) {
+      _nt_compat_sleep_ns(20000);
+    }
+  }
+  return NULL;
+}
+#endif
+
+static NT_INLINE int _nt_merge_netfile_get(void* ctx, NtNetBuf_t* hNetBuf)
+{
+  return NT_NetFileGet((NtNetStreamFile_t)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_merge_netfile_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return NT_NetFileRelease((NtNetStreamFile_t)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_merge_capfile_get(void* ctx, NtNetBuf_t* hNetBuf)
+{
+  return _nt_capfile_get((NtCapFile_t*)ctx, hNetBuf);
+}
+
+static NT_INLINE int _nt_merge_capfile_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return _nt_capfile_release((NtCapFile_t*)ctx, hNetBuf);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Initialize a time stamp merge reader
+ *
+ * @param[out] merge       Merge reader
+ * @param[in]  maxSources  Maximum number of sources
+ * @param[in]  depth       Number of segments read ahead per source when read-ahead threads are used
+ * @param[in]  numThreads  Number of read-ahead threads - 0 reads the sources in the merging thread. Ignored on Windows
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         No sources
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_merge_init(NtMerge_t* merge, uint32_t maxSources, uint32_t depth, uint32_t numThreads)
+{
+  memset(merge, 0, sizeof(*merge));
+  if (maxSources == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+#ifdef _MSC_VER
+  numThreads = 0;
+#endif
+  merge->maxSources = maxSources;
+  merge->depth = depth ? depth : 4;
+  merge->numThreads = numThreads < maxSources ? numThreads : maxSources;
+  merge->pending = _NT_MERGE_NONE;
+  merge->sources = (struct _NtMergeSource_s*)calloc(maxSources, sizeof(struct _NtMergeSource_s));
+  merge->loser = (uint32_t*)calloc(maxSources, sizeof(uint32_t));
+  merge->winner = (uint32_t*)calloc(2 * (size_t)maxSources, sizeof(uint32_t));
+  if (merge->sources == NULL || merge->loser == NULL || merge->winner == NULL) {
+    free(merge->sources);
+    free(merge->loser);
+    free(merge->winner);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Add a segment source to a merge reader
+ *
+ * Sources must be added before the first call to @ref _nt_merge_get.
+ *
+ * @param[in] merge    Merge reader
+ * @param[in] get      Function getting the next segment
+ * @param[in] release  Function releasing a segment
+ * @param[in] ctx      Context passed to the functions
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         Too many sources or the reader has started
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_merge_add_source(NtMerge_t* merge, NtMergeGet_t get, NtMergeRelease_t release, void* ctx)
+{
+  struct _NtMergeSource_s* src;
+  int status;
+  if (merge->numSources == merge->maxSources || merge->started) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  src = &merge->sources[merge->numSources];
+  src->get = get;
+  src->release = release;
+  src->ctx = ctx;
+  if (merge->numThreads > 0) {
+    if ((status = _nt_ring_init(&src->ready, _nt_merge_pow2(merge->depth), sizeof(NtNetBuf_t))) != NT_SUCCESS) {
+      return status;
+    }
+    // Room for all segments read ahead, the current one and an empty one.
+    // A release that still finds it full is retried by the next advance
+    if ((status = _nt_ring_init(&src->done, _nt_merge_pow2(merge->depth + 2), sizeof(NtNetBuf_t))) != NT_SUCCESS) {
+      _nt_ring_free(&src->ready);
+      return status;
+    }
+  }
+  merge->numSources++;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Add a file stream opened with @ref NT_NetFileOpen to a merge reader
+ *
+ * The stream must be opened with NT_NET_INTERFACE_SEGMENT.
+ */
+static NT_INLINE int _nt_merge_add_netfile(NtMerge_t* merge, NtNetStreamFile_t hStream)
+{
+  return _nt_merge_add_source(merge, _nt_merge_netfile_get, _nt_merge_netfile_release, (void*)hStream);
+}
+
+/**
+ * @brief Add a capture file reader opened with @ref _nt_capfile_open to a merge reader
+ *
+ * The reader depth must be larger than the merge read-ahead depth.
+ */
+static NT_INLINE int _nt_merge_add_capfile(NtMerge_t* merge, NtCapFile_t* file)
+{
+  return _nt_merge_add_source(merge, _nt_merge_capfile_get, _nt_merge_capfile_release, (void*)file);
+}
+
+/**
+ * @brief Get the next packet in time stamp order
+ *
+ * The packet is valid until the next call. Starts the read-ahead threads
+ * on the first call.
+ *
+ * @param[in]  merge    Merge reader
+ * @param[out] hNetBuf  Packet container reference - use the packet macros to access the packet
+ *
+ * @retval NT_SUCCESS             Success
+ * @retval NT_STATUS_TRYAGAIN     The next segment of a source has not been read yet - call again
+ * @retval NT_STATUS_END_OF_FILE  All packets of all sources have been returned
+ * @retval otherwise              Error returned by a source
+ */
+static NT_INLINE int _nt_merge_get(NtMerge_t* merge, NtNetBuf_t* hNetBuf)
+{
+  int status;
+  uint32_t w;
+  if (!merge->started) {
+#ifndef _MSC_VER
+    if (merge->numThreads > 0 && merge->threads == NULL) {
+      uint32_t t;
+      merge->threads = (struct _NtMergeThread_s*)calloc(merge->numThreads, sizeof(struct _NtMergeThread_s));
+      if (merge->threads == NULL) {
+        return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+      }
+      for (t = 0; t < merge->numThreads; t++) {
+        merge->threads[t].merge = merge;
+        merge->threads[t].index = t;
+        if (pthread_create(&merge->threads[t].thread, NULL, _nt_merge_thread, &merge->threads[t]) != 0) {
+          merge->stop = 1;
+          while (t-- > 0) {
+            pthread_join(merge->threads[t].thread, NULL);
+          }
+          free(merge->threads);
+          merge->threads = NULL;
+          merge->stop = 0;
+          return NT_ERROR_RESOURCE_UNAVAILABLE;
+        }
+      }
+    }
+#endif
+    if (merge->numSources == 0) {
+      return NT_STATUS_END_OF_FILE;
+    }
+    // Get the first packet of every source before building the tree
+    while (merge->initNext < merge->numSources) {
+      if ((status = _nt_merge_advance(merge, &merge->sources[merge->initNext])) != NT_SUCCESS) {
+        return status;
+      }
+      merge->initNext++;
+    }
+    _nt_merge_build(merge);
+    merge->started = 1;
+  } else if (merge->pending != _NT_MERGE_NONE) {
+    if ((status = _nt_merge_advance(merge, &merge->sources[merge->pending])) != NT_SUCCESS) {
+      return status;
+    }
+    _nt_merge_replay(merge, merge->pending);
+    merge->pending = _NT_MERGE_NONE;
+  }
+  w = merge->loser[0];
+  if (merge->sources[w].exhausted) {
+    return NT_STATUS_END_OF_FILE;
+  }
+  merge->pending = w;
+  *hNetBuf = &merge->sources[w].pkt;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the source of the packet returned by the last call to @ref _nt_merge_get
+ *
+ * @retval Source number in the order the sources were added
+ */
+static NT_INLINE uint32_t _nt_merge_get_source(NtMerge_t* merge)
+{
+  return merge->pending;
+}
+
+/**
+ * @brief Close a merge reader
+ *
+ * The read-ahead threads are stopped and all segments held are released.
+ * The sources are not closed.
+ *
+ * @param[in] merge  Merge reader
+ */
+static NT_INLINE void _nt_merge_close(NtMerge_t* merge)
+{
+  uint32_t s;
+#ifndef _MSC_VER
+  if (merge->threads != NULL) {
+    uint32_t t;
+    _nt_atomic_store_release_u32(&merge->stop, 1);
+    for (t = 0; t < merge->numThreads; t++) {
+      pthread_join(merge->threads[t].thread, NULL);
+    }
+    free(merge->threads);
+  }
+#endif
+  for (s = 0; s < merge->numSources; s++) {
+    struct _NtMergeSource_s* src = &merge->sources[s];
+    NtNetBuf_t hNetBuf;
+    if (src->active) {
+      (void)src->release(src->ctx, src->seg);
+    }
+    if (src->pending != NULL) {
+      (void)src->release(src->ctx, src->pending);
+    }
+    if (merge->numThreads > 0) {
+      while (_nt_ring_dequeue(&src->done, &hNetBuf) == NT_SUCCESS) {
+        (void)src->release(src->ctx, hNetBuf);
+      }
+      while (_nt_ring_dequeue(&src->ready, &hNetBuf) == NT_SUCCESS) {
+        (void)src->release(src->ctx, hNetBuf);
+      }
+      _nt_ring_free(&src->ready);
+      _nt_ring_free(&src->done);
+    }
+  }
+  free(merge->sources);
+  free(merge->loser);
+  free(merge->winner);
+  memset(merge, 0, sizeof(*merge));
+}
+
+#endif // __MERGE_H__
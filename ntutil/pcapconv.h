@@ -0,0 +1,747 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the pcap and pcapng converter. Whole segments
+ * of NT standard, extended 7, 8, 9 or dynamic 1, 2, 3 descriptors are
+ * converted into pcap records or pcapng enhanced packet blocks in a large
+ * output buffer, which can be written to a file with a single write.
+ *
+ * Each segment is indexed with @ref _nt_segindex_build, after which the
+ * time stamps of a batch of packets are converted to nanosecond pcap time
+ * stamps in one vectorized pass - with AVX2 when compiled with AVX2
+ * support, SSE4.2 when compiled with SSE4.2 support, and plain C
+ * otherwise. The records are then built in one pass copying the frames.
+ *
+ * pcap files are written with the nanosecond magic number
+ * (PCAP_TSTAMP_PRECISION_NANO) and pcapng files with an if_tsresol of 9.
+ * The Ethernet FCS is kept or stripped as configured. Use
+ * @ref _nt_pcapconv_config_stream to strip it the same way the stream
+ * does for pcap descriptors (@ref NT_NETRX_READ_CMD_PCAP_FCS).
+ *
+ * @ref _nt_pcapconv_pool_run converts many independent segments on
+ * multiple threads, each into its own output buffer.
+ *
+ */
+#ifndef __PCAPCONV_H__
+#define __PCAPCONV_H__
+
+#include "nt.h"
+#include "atomic.h"
+#include "compat.h"
+#include "segindex.h"
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
+/**
+ * pcap file magic number of files with nanosecond time stamps
+ */
+#define NT_PCAPCONV_MAGIC_NANO 0xA1B23C4D
+
+/**
+ * Link type of the converted packets - LINKTYPE_ETHERNET
+ */
+#define NT_PCAPCONV_LINKTYPE_ETHERNET 1
+
+/**
+ * NT_TIMESTAMP_TYPE_NATIVE_NDIS time stamp of January 1, 1970
+ */
+#define NT_PCAPCONV_NDIS_UNIX_OFFSET 1164447360000000000ULL
+
+/**
+ * Output file formats
+ */
+enum NtPcapConvFormat_e {
+  NT_PCAPCONV_FORMAT_PCAP = 0,  //!< pcap with nanosecond time stamps
+  NT_PCAPCONV_FORMAT_PCAPNG,    //!< pcapng with enhanced packet blocks
+};
+
+/**
+ * Converter configuration. Zero selects the default value.
+ */
+typedef struct NtPcapConvConfig_s {
+  enum NtPcapConvFormat_e format; //!< Output file format. Default is @ref NT_PCAPCONV_FORMAT_PCAP
+  int stripFcs;             //!< Remove the 4 byte Ethernet FCS from every frame
+  uint32_t snaplen;         //!< Maximum bytes stored per frame. Default is 65535
+  uint32_t batch;           //!< Packets indexed and converted per pass. Default is 256
+  uint32_t numPorts;        //!< pcapng: write an interface per port and use the receiving port as interface ID. Default is one interface for all ports
+} NtPcapConvConfig_t;
+
+/**
+ * Converter counters
+ */
+typedef struct NtPcapConvStat_s {
+  uint64_t segments;        //!< Segments converted
+  uint64_t packets;         //!< Packets converted
+  uint64_t bytes;           //!< Bytes of records written
+} NtPcapConvStat_t;
+
+/**
+ * Segment converter. One converter must only be used by one thread.
+ */
+typedef struct NtPcapConv_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtPcapConvConfig_t config;
+  NtSegIndex_t idx;
+  uint64_t *ts;             // Converted time stamps - stored as in the record
+  NtPcapConvStat_t stat;
+#endif
+} NtPcapConv_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+// Ensure that the following is packed equally on 32 and 64bit
+#pragma pack(push, 1)
+struct _NtPcapConvFileHeader_s {
+  uint32_t magic;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t linktype;
+};
+
+struct _NtPcapConvRecord_s {
+  uint64_t ts;              // Seconds in the low and nanoseconds in the high 32 bits
+  uint32_t caplen;
+  uint32_t len;
+};
+
+struct _NtPcapConvShb_s {
+  uint32_t type;
+  uint32_t length;
+  uint32_t byteOrder;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  int64_t sectionLength;
+  uint32_t length2;
+};
+
+struct _NtPcapConvIdb_s {
+  uint32_t type;
+  uint32_t length;
+  uint16_t linktype;
+  uint16_t reserved;
+  uint32_t snaplen;
+  uint16_t tsresolCode;
+  uint16_t tsresolLength;
+  uint8_t tsresol;
+  uint8_t pad[3];
+  uint32_t endOfOpt;
+  uint32_t length2;
+};
+
+struct _NtPcapConvEpb_s {
+  uint32_t type;
+  uint32_t length;
+  uint32_t interfaceId;
+  uint64_t ts;              // Time stamp high and low 32 bits
+  uint32_t caplen;
+  uint32_t len;
+};
+#pragma pack(pop)
+
+/*
+ * Time stamp base to subtract to get a 10 ns Unix time stamp
+ */
+static NT_INLINE uint64_t _nt_pcapconv_ts_base(enum NtTimestampType_e tsType)
+{
+  return tsType == NT_TIMESTAMP_TYPE_NATIVE_NDIS || tsType == NT_TIMESTAMP_TYPE_NDIS ? NT_PCAPCONV_NDIS_UNIX_OFFSET : 0;
+}
+
+static NT_INLINE uint64_t _nt_pcapconv_ts_scalar(uint64_t t, uint64_t base, int ng)
+{
+  uint64_t sec, ns;
+  t -= base;
+  if (ng) {
+    ns = t * 10;
+    return (ns >> 32) | (ns << 32);
+  }
+  sec = t / 100000000;
+  return sec | (((t - sec * 100000000) * 10) << 32);
+}
+
+#if defined(__AVX2__)
+/*
+ * The seconds are estimated by a double multiply, which is off by at most
+ * one, and corrected from the sign of the remainder. Valid until 2106.
+ */
+static NT_INLINE uint32_t _nt_pcapconv_ts_simd(const uint64_t* in, uint64_t* out, uint32_t count, uint64_t base, int ng)
+{
+  const __m256i vbase = _mm256_set1_epi64x((long long)base);
+  const __m256i magicI = _mm256_set1_epi64x(0x4330000000000000LL);
+  const __m256d magicD = _mm256_set1_pd(4503599627370496.0);
+  const __m256d inv = _mm256_set1_pd(1.0 / 390625.0);
+  const __m256i e8 = _mm256_set1_epi64x(100000000);
+  const __m256i ten = _mm256_set1_epi64x(10);
+  uint32_t i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m256i t = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)&in[i]), vbase);
+    if (ng) {
+      __m256i ns = _mm256_add_epi64(_mm256_slli_epi64(t, 3), _mm256_slli_epi64(t, 1));
+      _mm256_storeu_si256((__m256i*)&out[i], _mm256_shuffle_epi32(ns, _MM_SHUFFLE(2, 3, 0, 1)));
+    } else {
+      __m256d d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(t, 8), magicI)), magicD);
+      __m256i sec = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(_mm256_mul_pd(d, inv), magicD)), magicI);
+      __m256i r = _mm256_sub_epi64(t, _mm256_add_epi64(_mm256_mul_epu32(sec, e8),
+                                                       _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(sec, 32), e8), 32)));
+      __m256i neg = _mm256_cmpgt_epi64(_mm256_setzero_si256(), r);
+      sec = _mm256_add_epi64(sec, neg);
+      r = _mm256_add_epi64(r, _mm256_and_si256(neg, e8));
+      _mm256_storeu_si256((__m256i*)&out[i], _mm256_or_si256(sec, _mm256_slli_epi64(_mm256_mul_epu32(r, ten), 32)));
+    }
+  }
+  return i;
+}
+#elif defined(__SSE4_2__)
+static NT_INLINE uint32_t _nt_pcapconv_ts_simd(const uint64_t* in, uint64_t* out, uint32_t count, uint64_t base, int ng)
+{
+  const __m128i vbase = _mm_set1_epi64x((long long)base);
+  const __m128i magicI = _mm_set1_epi64x(0x4330000000000000LL);
+  const __m128d magicD = _mm_set1_pd(4503599627370496.0);
+  const __m128d inv = _mm_set1_pd(1.0 / 390625.0);
+  const __m128i e8 = _mm_set1_epi64x(100000000);
+  const __m128i ten = _mm_set1_epi64x(10);
+  uint32_t i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    __m128i t = _mm_sub_epi64(_mm_loadu_si128((const __m128i*)&in[i]), vbase);
+    if (ng) {
+      __m128i ns = _mm_add_epi64(_mm_slli_epi64(t, 3), _mm_slli_epi64(t, 1));
+      _mm_storeu_si128((__m128i*)&out[i], _mm_shuffle_epi32(ns, _MM_SHUFFLE(2, 3, 0, 1)));
+    } else {
+      __m128d d = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(t, 8), magicI)), magicD);
+      __m128i sec = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(_mm_mul_pd(d, inv), magicD)), magicI);
+      __m128i r = _mm_sub_epi64(t, _mm_add_epi64(_mm_mul_epu32(sec, e8), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(sec, 32), e8), 32)));
+      __m128i neg = _mm_cmpgt_epi64(_mm_setzero_si128(), r);
+      sec = _mm_add_epi64(sec, neg);
+      r = _mm_add_epi64(r, _mm_and_si128(neg, e8));
+      _mm_storeu_si128((__m128i*)&out[i], _mm_or_si128(sec, _mm_slli_epi64(_mm_mul_epu32(r, ten), 32)));
+    }
+  }
+  return i;
+}
+#endif
+
+/*
+ * Convert the time stamps of a batch to the record layout
+ */
+static NT_INLINE void _nt_pcapconv_ts(NtPcapConv_t* conv, enum NtTimestampType_e tsType)
+{
+  const uint64_t* in = conv->idx.timestamp;
+  uint32_t i = 0, count = conv->idx.count;
+  int ng = conv->config.format == NT_PCAPCONV_FORMAT_PCAPNG;
+  if (tsType == NT_TIMESTAMP_TYPE_PCAP || tsType == NT_TIMESTAMP_TYPE_PCAP_NANOTIME) {
+    // Seconds in the low and the fraction in the high 32 bits as in a pcap record
+    uint64_t scale = tsType == NT_TIMESTAMP_TYPE_PCAP ? 1000 : 1;
+    for (; i < count; i++) {
+      uint64_t sec = in[i] & 0xFFFFFFFF, ns = (in[i] >> 32) * scale;
+      if (ng) {
+        ns += sec * 1000000000;
+        conv->ts[i] = (ns >> 32) | (ns << 32);
+      } else {
+        conv->ts[i] = sec | (ns << 32);
+      }
+    }
+    return;
+  }
+#if defined(__AVX2__) || defined(__SSE4_2__)
+  i = _nt_pcapconv_ts_simd(in, conv->ts, count, _nt_pcapconv_ts_base(tsType), ng);
+#endif
+  for (; i < count; i++) {
+    conv->ts[i] = _nt_pcapconv_ts_scalar(in[i], _nt_pcapconv_ts_base(tsType), ng);
+  }
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Free a converter
+ *
+ * @param[in] conv  Converter
+ */
+static NT_INLINE void _nt_pcapconv_free(NtPcapConv_t* conv)
+{
+  _nt_segindex_free(&conv->idx);
+  free(conv->ts);
+  memset(conv, 0, sizeof(*conv));
+}
+
+/**
+ * @brief Initialize a converter
+ *
+ * @param[out] conv    Converter
+ * @param[in]  config  Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_pcapconv_init(NtPcapConv_t* conv, const NtPcapConvConfig_t* config)
+{
+  NtPcapConvConfig_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  if (config != NULL) {
+    cfg = *config;
+  }
+  if (cfg.snaplen == 0) {
+    cfg.snaplen = 65535;
+  }
+  if (cfg.batch == 0) {
+    cfg.batch = 256;
+  }
+  memset(conv, 0, sizeof(*conv));
+  if (_nt_segindex_alloc(&conv->idx, cfg.batch) != NT_SUCCESS) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  if ((conv->ts = (uint64_t*)malloc(((size_t)cfg.batch + 7) * sizeof(uint64_t))) == NULL) {
+    _nt_pcapconv_free(conv);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  conv->config = cfg;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Configure FCS stripping as done by a stream for pcap descriptors
+ *
+ * Reads @ref NT_NETRX_READ_CMD_PCAP_FCS and strips the FCS when the stream
+ * does not include it in packets with pcap descriptors, so converted
+ * files match files captured with pcap descriptors.
+ *
+ * @param[in,out] config   Configuration to update
+ * @param[in]     hStream  RX stream
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by @ref NT_NetRxRead
+ */
+static NT_INLINE int _nt_pcapconv_config_stream(NtPcapConvConfig_t* config, NtNetStreamRx_t hStream)
+{
+  NtNetRx_t rx;
+  int status;
+  memset(&rx, 0, sizeof(rx));
+  rx.cmd = NT_NETRX_READ_CMD_PCAP_FCS;
+  if ((status = NT_NetRxRead(hStream, &rx)) != NT_SUCCESS) {
+    return status;
+  }
+  config->stripFcs = rx.u.pcap.fcs == 0;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the maximum size of the records of a segment
+ *
+ * @param[in] conv    Converter
+ * @param[in] length  Segment length
+ *
+ * @retval Output buffer size that always holds the converted segment
+ */
+static NT_INLINE uint64_t _nt_pcapconv_bound(const NtPcapConv_t* conv, uint64_t length)
+{
+  // A descriptor is at least as large as a pcap record header, and a
+  // packet is at least 24 bytes, so a block is at most twice the packet
+  return conv->config.format == NT_PCAPCONV_FORMAT_PCAPNG ? 2 * length : length;
+}
+
+/**
+ * @brief Write the file header
+ *
+ * Writes the pcap file header, or the pcapng section header block and
+ * the interface description blocks.
+ *
+ * @param[in]  conv    Converter
+ * @param[out] out     Output buffer
+ * @param[in]  size    Size of the output buffer
+ * @param[out] length  Bytes written
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  The output buffer is too small
+ */
+static NT_INLINE int _nt_pcapconv_file_header(const NtPcapConv_t* conv, void* out, uint64_t size, uint64_t* length)
+{
+  uint8_t* p = (uint8_t*)out;
+  if (conv->config.format == NT_PCAPCONV_FORMAT_PCAPNG) {
+    struct _NtPcapConvShb_s shb;
+    struct _NtPcapConvIdb_s idb;
+    uint32_t n, numIdb = conv->config.numPorts ? conv->config.numPorts : 1;
+    if (size < sizeof(shb) + (uint64_t)numIdb * sizeof(idb)) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    memset(&shb, 0, sizeof(shb));
+    shb.type = 0x0A0D0D0A;
+    shb.length = shb.length2 = sizeof(shb);
+    shb.byteOrder = 0x1A2B3C4D;
+    shb.versionMajor = 1;
+    shb.sectionLength = -1;
+    memcpy(p, &shb, sizeof(shb));
+    p += sizeof(shb);
+    memset(&idb, 0, sizeof(idb));
+    idb.type = 1;
+    idb.length = idb.length2 = sizeof(idb);
+    idb.linktype = NT_PCAPCONV_LINKTYPE_ETHERNET;
+    idb.snaplen = conv->config.snaplen;
+    idb.tsresolCode = 9;
+    idb.tsresolLength = 1;
+    idb.tsresol = 9;
+    for (n = 0; n < numIdb; n++) {
+      memcpy(p, &idb, sizeof(idb));
+      p += sizeof(idb);
+    }
+  } else {
+    struct _NtPcapConvFileHeader_s hdr;
+    if (size < sizeof(hdr)) {
+      return NT_ERROR_INVALID_PARAMETER;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = NT_PCAPCONV_MAGIC_NANO;
+    hdr.versionMajor = 2;
+    hdr.versionMinor = 4;
+    hdr.snaplen = conv->config.snaplen;
+    hdr.linktype = NT_PCAPCONV_LINKTYPE_ETHERNET;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+  }
+  *length = (uint64_t)(p - (uint8_t*)out);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Convert a segment
+ *
+ * The packets from "*offset" are converted and appended to the output
+ * buffer from "*length". When the buffer is full the offset of the first
+ * packet not converted is returned, and the call can be repeated with the
+ * same offset when the buffer has been written. An output buffer of
+ * @ref _nt_pcapconv_bound bytes always holds the whole segment.
+ *
+ * @param[in]     conv     Converter
+ * @param[in]     hNetBuf  Segment
+ * @param[out]    out      Output buffer
+ * @param[in]     size     Size of the output buffer
+ * @param[in,out] length   Bytes used in the output buffer
+ * @param[in,out] offset   Offset of the next packet in the segment. Must be 0 on the first call for a segment
+ *
+ * @retval NT_SUCCESS                                Success - the whole segment has been converted
+ * @retval NT_STATUS_TRYAGAIN                        The output buffer is full - write it and call again
+ * @retval NT_ERROR_INVALID_PARAMETER                The output buffer cannot hold a single packet
+ * @retval NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR  The descriptor type is not supported
+ */
+static NT_INLINE int _nt_pcapconv_segment(NtPcapConv_t* conv, NtNetBuf_t hNetBuf, void* out, uint64_t size, uint64_t* length,
+                                          uint64_t* offset)
+{
+  const uint8_t* seg = (const uint8_t*)hNetBuf->hHdr;
+  uint8_t* base = (uint8_t*)out;
+  uint64_t pos = *length, start = *length;
+  int ng = conv->config.format == NT_PCAPCONV_FORMAT_PCAPNG;
+  struct NtNetBuf_s pktNetBuf;
+  int status;
+
+  memset(&pktNetBuf, 0, sizeof(pktNetBuf));
+  while (*offset < NT_NET_GET_SEGMENT_LENGTH(hNetBuf)) {
+    uint32_t i;
+    if ((status = _nt_segindex_build(&conv->idx, hNetBuf, *offset)) != NT_SUCCESS) {
+      return status;
+    }
+    _nt_pcapconv_ts(conv, (enum NtTimestampType_e)NT_NET_GET_SEGMENT_TIMESTAMP_TYPE(hNetBuf));
+    for (i = 0; i < conv->idx.count; i++) {
+      const uint8_t* pkt = seg + conv->idx.offset[i];
+      uint32_t descrLength, data, wire, caplen, record;
+      pktNetBuf.hHdr = (NtNetBufHdr_t)pkt;
+      descrLength = (uint32_t)NT_NET_GET_PKT_DESCR_LENGTH(&pktNetBuf);
+      wire = (uint32_t)NT_NET_GET_PKT_WIRE_LENGTH(&pktNetBuf);
+      data = conv->idx.capLength[i] > descrLength ? conv->idx.capLength[i] - descrLength : 0;
+      if (conv->config.stripFcs) {
+        wire = wire > 4 ? wire - 4 : 0;
+      }
+      // The stored length includes padding after the frame
+      caplen = data < wire ? data : wire;
+      if (caplen > conv->config.snaplen) {
+        caplen = conv->config.snaplen;
+      }
+      record = ng ? (uint32_t)sizeof(struct _NtPcapConvEpb_s) + ((caplen + 3) & ~3U) + 4
+                  : (uint32_t)sizeof(struct _NtPcapConvRecord_s) + caplen;
+      if (pos + record > size) {
+        *offset = conv->idx.offset[i];
+        conv->stat.packets += i;
+        conv->stat.bytes += pos - start;
+        *length = pos;
+        return pos == start && i == 0 ? NT_ERROR_INVALID_PARAMETER : NT_STATUS_TRYAGAIN;
+      }
+      if (ng) {
+        struct _NtPcapConvEpb_s epb;
+        uint32_t port = conv->idx.rxPort[i];
+        epb.type = 6;
+        epb.length = record;
+        epb.interfaceId = port < conv->config.numPorts ? port : 0;
+        epb.ts = conv->ts[i];
+        epb.caplen = caplen;
+        epb.len = wire;
+        memcpy(base + pos, &epb, sizeof(epb));
+        memcpy(base + pos + sizeof(epb), pkt + descrLength, caplen);
+        memset(base + pos + sizeof(epb) + caplen, 0, record - 4 - sizeof(epb) - caplen);
+        memcpy(base + pos + record - 4, &record, sizeof(record));
+      } else {
+        struct _NtPcapConvRecord_s rec;
+        rec.ts = conv->ts[i];
+        rec.caplen = caplen;
+        rec.len = wire;
+        memcpy(base + pos, &rec, sizeof(rec));
+        memcpy(base + pos + sizeof(rec), pkt + descrLength, caplen);
+      }
+      pos += record;
+    }
+    conv->stat.packets += conv->idx.count;
+    *offset = conv->idx.next;
+  }
+  conv->stat.segments++;
+  conv->stat.bytes += pos - start;
+  *length = pos;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the counters of a converter
+ *
+ * @param[in]  conv  Converter
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_pcapconv_get_stat(const NtPcapConv_t* conv, NtPcapConvStat_t* stat)
+{
+  *stat = conv->stat;
+}
+
+/**
+ * Segment conversion job of @ref _nt_pcapconv_pool_run
+ */
+typedef struct NtPcapConvJob_s {
+  NtNetBuf_t hNetBuf;       //!< Segment to convert
+  void *out;                //!< Output buffer - @ref _nt_pcapconv_bound bytes always suffice
+  uint64_t size;            //!< Size of the output buffer
+  uint64_t length;          //!< Returns the bytes written
+  int status;               //!< Returns the status of @ref _nt_pcapconv_segment
+} NtPcapConvJob_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+struct _NtPcapConvWorker_s {
+  struct NtPcapConvPool_s *pool;
+  NtPcapConv_t conv;
+  volatile uint32_t finished; // Last generation completed
+#ifndef _MSC_VER
+  pthread_t thread;
+#endif
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * Pool of threads converting independent segments
+ */
+typedef struct NtPcapConvPool_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint32_t numThreads;
+  struct _NtPcapConvWorker_s *workers; // numThreads + 1 - the last is used by the calling thread
+  NtPcapConvJob_t *jobs;
+  uint32_t count;
+  volatile uint32_t next;     // Next job to take
+  volatile uint32_t generation;
+  volatile uint32_t stop;
+#endif
+} NtPcapConvPool_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE void _nt_pcapconv_pool_work(NtPcapConvPool_t* pool, NtPcapConv_t* conv)
+{
+  uint32_t j;
+  while ((j = _nt_atomic_fetch_add_u32(&pool->next, 1)) < pool->count) {
+    NtPcapConvJob_t* job = &pool->jobs[j];
+    uint64_t offset = 0;
+    job->length = 0;
+    job->status = _nt_pcapconv_segment(conv, job->hNetBuf, job->out, job->size, &job->length, &offset);
+  }
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_pcapconv_pool_thread(void* arg)
+{
+  struct _NtPcapConvWorker_s* worker = (struct _NtPcapConvWorker_s*)arg;
+  NtPcapConvPool_t* pool = worker->pool;
+  uint32_t seen = 0;
+  while (!_nt_atomic_load_acquire_u32(&pool->stop)) {
+    uint32_t generation = _nt_atomic_load_acquire_u32(&pool->generation);
+    if (generation != seen) {
+      seen = generation;
+      _nt_pcapconv_pool_work(pool, &worker->conv);
+      _nt_atomic_store_release_u32(&worker->finished, seen);
+    } else {
+      _nt_compat_sleep_ns(20000);
+    }
+  }
+  return NULL;
+}
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a converter pool
+ *
+ * @param[in] pool  Converter pool
+ */
+static NT_INLINE void _nt_pcapconv_pool_close(NtPcapConvPool_t* pool)
+{
+  uint32_t t;
+#ifndef _MSC_VER
+  _nt_atomic_store_release_u32(&pool->stop, 1);
+  for (t = 0; pool->workers != NULL && t < pool->numThreads; t++) {
+    pthread_join(pool->workers[t].thread, NULL);
+  }
+#endif
+  for (t = 0; pool->workers != NULL && t <= pool->numThreads; t++) {
+    _nt_pcapconv_free(&pool->workers[t].conv);
+  }
+  free(pool->workers);
+  memset(pool, 0, sizeof(*pool));
+}
+
+/**
+ * @brief Open a pool of threads converting independent segments
+ *
+ * The calling thread converts segments as well, so zero threads converts
+ * all segments in the calling thread. Threads are not supported on
+ * Windows.
+ *
+ * @param[out] pool        Converter pool
+ * @param[in]  numThreads  Number of threads started
+ * @param[in]  config      Converter configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval NT_ERROR_RESOURCE_UNAVAILABLE     A thread could not be started
+ */
+static NT_INLINE int _nt_pcapconv_pool_open(NtPcapConvPool_t* pool, uint32_t numThreads, const NtPcapConvConfig_t* config)
+{
+  uint32_t t;
+  memset(pool, 0, sizeof(*pool));
+#ifdef _MSC_VER
+  numThreads = 0;
+#endif
+  if ((pool->workers = (struct _NtPcapConvWorker_s*)calloc(numThreads + 1, sizeof(struct _NtPcapConvWorker_s))) == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (t = 0; t <= numThreads; t++) {
+    pool->workers[t].pool = pool;
+    if (_nt_pcapconv_init(&pool->workers[t].conv, config) != NT_SUCCESS) {
+      _nt_pcapconv_pool_close(pool);
+      return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+  }
+#ifndef _MSC_VER
+  for (t = 0; t < numThreads; t++) {
+    if (pthread_create(&pool->workers[t].thread, NULL, _nt_pcapconv_pool_thread, &pool->workers[t]) != 0) {
+      pool->numThreads = t;
+      _nt_pcapconv_pool_close(pool);
+      return NT_ERROR_RESOURCE_UNAVAILABLE;
+    }
+    pool->numThreads = t + 1;
+  }
+#endif
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Convert segments on the threads of a pool
+ *
+ * Every job is converted into its own output buffer, so the buffers can
+ * be written in job order afterwards. Returns when all jobs are done.
+ * Waking the threads takes some microseconds, so convert many segments
+ * per call.
+ *
+ * @param[in]     pool   Converter pool
+ * @param[in,out] jobs   Jobs - the length and status are returned
+ * @param[in]     count  Number of jobs
+ *
+ * @retval NT_SUCCESS  All segments were converted
+ * @retval otherwise   The status of the first job that failed
+ */
+static NT_INLINE int _nt_pcapconv_pool_run(NtPcapConvPool_t* pool, NtPcapConvJob_t* jobs, uint32_t count)
+{
+  uint32_t j, t, generation = pool->generation + 1;
+  pool->jobs = jobs;
+  pool->count = count;
+  _nt_atomic_store_release_u32(&pool->next, 0);
+  _nt_atomic_store_release_u32(&pool->generation, generation);
+  _nt_pcapconv_pool_work(pool, &pool->workers[pool->numThreads].conv);
+  // Wait until every thread has left the jobs, so they can be reused
+  for (t = 0; t < pool->numThreads; t++) {
+    while (_nt_atomic_load_acquire_u32(&pool->workers[t].finished) != generation) {
+      _nt_cpu_relax();
+    }
+  }
+  for (j = 0; j < count; j++) {
+    if (jobs[j].status != NT_SUCCESS) {
+      return jobs[j].status;
+    }
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the counters of all threads of a converter pool
+ *
+ * @param[in]  pool  Converter pool
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_pcapconv_pool_get_stat(const NtPcapConvPool_t* pool, NtPcapConvStat_t* stat)
+{
+  uint32_t t;
+  memset(stat, 0, sizeof(*stat));
+  for (t = 0; t <= pool->numThreads; t++) {
+    stat->segments += pool->workers[t].conv.stat.segments;
+    stat->packets += pool->workers[t].conv.stat.packets;
+    stat->bytes += pool->workers[t].conv.stat.bytes;
+  }
+}
+
+#endif // __PCAPCONV_H__
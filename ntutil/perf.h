@@ -0,0 +1,218 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains hardware performance counters for
+ * benchmarks. On Linux the counters are read with perf_event_open and
+ * count user space only. Counters the kernel or the CPU does not
+ * provide - in most virtual machines, or when perf_event_paranoid
+ * forbids it - are marked as not valid and the remaining counters still
+ * work. Counters that have been multiplexed are scaled to the time the
+ * measurement was enabled.
+ *
+ */
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include "nt.h"
+#include "compat.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Performance counters
+ */
+enum NtPerfCounter_e {
+  NT_PERF_CYCLES = 0,       //!< CPU cycles
+  NT_PERF_INSTRUCTIONS,     //!< Retired instructions
+  NT_PERF_LLC_MISSES,       //!< Last level cache misses
+  NT_PERF_L1D_MISSES,       //!< Level 1 data cache read misses
+  NT_PERF_COUNTERS          //!< Number of counters
+};
+
+/**
+ * Performance counter set
+ */
+typedef struct NtPerf_s {
+  uint64_t value[NT_PERF_COUNTERS]; //!< Counter values of the last measurement
+  int valid[NT_PERF_COUNTERS];      //!< The counter is available
+#ifndef DOXYGEN_INTERNAL_ONLY
+  int fd[NT_PERF_COUNTERS];
+#endif
+} NtPerf_t;
+
+/**
+ * @brief Open the performance counters of the calling thread
+ *
+ * @param[out] perf  Performance counter set
+ *
+ * @retval NT_SUCCESS                     At least one counter is available
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED No counter is available
+ */
+static NT_INLINE int _nt_perf_open(NtPerf_t* perf)
+{
+  int i, numValid = 0;
+  memset(perf, 0, sizeof(*perf));
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    perf->fd[i] = -1;
+  }
+#if defined(__linux__)
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (i) {
+    case NT_PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case NT_PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case NT_PERF_LLC_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    default:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    }
+    perf->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf->fd[i] >= 0) {
+      perf->valid[i] = 1;
+      numValid++;
+    }
+  }
+#endif
+  return numValid > 0 ? NT_SUCCESS : NT_ERROR_FEATURE_NOT_SUPPORTED;
+}
+
+/**
+ * @brief Close the performance counters
+ *
+ * @param[in] perf  Performance counter set
+ */
+static NT_INLINE void _nt_perf_close(NtPerf_t* perf)
+{
+#if defined(__linux__)
+  int i;
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    if (perf->fd[i] >= 0) {
+      close(perf->fd[i]);
+      perf->fd[i] = -1;
+    }
+    perf->valid[i] = 0;
+  }
+#else
+  (void)perf;
+#endif
+}
+
+/**
+ * @brief Reset and start the performance counters
+ *
+ * @param[in] perf  Performance counter set
+ */
+static NT_INLINE void _nt_perf_start(NtPerf_t* perf)
+{
+#if defined(__linux__)
+  int i;
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    if (perf->fd[i] >= 0) {
+      ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#else
+  (void)perf;
+#endif
+}
+
+/**
+ * @brief Stop the performance counters and read their values
+ *
+ * The values are stored in perf->value. The value of a counter that is
+ * not valid is 0.
+ *
+ * @param[in] perf  Performance counter set
+ */
+static NT_INLINE void _nt_perf_stop(NtPerf_t* perf)
+{
+  int i;
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    perf->value[i] = 0;
+  }
+#if defined(__linux__)
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    if (perf->fd[i] >= 0) {
+      ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (i = 0; i < NT_PERF_COUNTERS; i++) {
+    uint64_t v[3]; // Value, time enabled and time running
+    if (perf->fd[i] < 0 || read(perf->fd[i], v, sizeof(v)) != (ssize_t)sizeof(v)) {
+      continue;
+    }
+    if (v[2] == 0) {
+      // Never scheduled on the CPU
+      continue;
+    }
+    perf->value[i] = v[2] < v[1] ? (uint64_t)((double)v[0] * (double)v[1] / (double)v[2]) : v[0];
+  }
+#endif
+}
+
+#endif // __PERF_H__
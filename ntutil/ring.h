@@ -0,0 +1,186 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a lock-free single producer single consumer
+ * ring of fixed size elements. The producer and consumer indexes live on
+ * separate cache lines, and each side caches the index of the other side
+ * so the shared cache line is only read when the ring looks full or empty.
+ *
+ */
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "nt.h"
+#include "atomic.h"
+
+/**
+ * Single producer single consumer ring
+ */
+typedef struct NtRing_s {
+  volatile uint64_t head;   //!< Number of elements enqueued - written by the producer
+  uint64_t cachedTail;      //!< Last tail seen by the producer
+  uint8_t pad0[NT_CACHE_LINE_SIZE - 2 * sizeof(uint64_t)];
+  volatile uint64_t tail;   //!< Number of elements dequeued - written by the consumer
+  uint64_t cachedHead;      //!< Last head seen by the consumer
+  uint8_t pad1[NT_CACHE_LINE_SIZE - 2 * sizeof(uint64_t)];
+  uint32_t mask;            //!< Number of elements - 1
+  uint32_t elemSize;        //!< Size of an element in bytes
+  uint8_t *mem;             //!< Element memory
+  uint8_t pad2[NT_CACHE_LINE_SIZE - 2 * sizeof(uint32_t) - sizeof(uint8_t*)];
+} NtRing_t;
+
+/**
+ * @brief Allocate a ring
+ *
+ * @param[out] ring      Ring to initialize
+ * @param[in]  count     Number of elements - must be a power of 2
+ * @param[in]  elemSize  Size of an element in bytes
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Count is not a power of 2
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_ring_init(NtRing_t* ring, uint32_t count, uint32_t elemSize)
+{
+  memset(ring, 0, sizeof(*ring));
+  if (count == 0 || (count & (count - 1)) != 0 || elemSize == 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  ring->mem = (uint8_t*)malloc((size_t)count * elemSize);
+  if (ring->mem == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  ring->mask = count - 1;
+  ring->elemSize = elemSize;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Free a ring allocated with @ref _nt_ring_init
+ */
+static NT_INLINE void _nt_ring_free(NtRing_t* ring)
+{
+  free(ring->mem);
+  ring->mem = NULL;
+}
+
+/**
+ * @brief Copy an element into the ring - producer only
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  The ring is full
+ */
+static NT_INLINE int _nt_ring_enqueue(NtRing_t* ring, const void* elem)
+{
+  uint64_t head = ring->head;
+  if (head - ring->cachedTail > ring->mask) {
+    ring->cachedTail = _nt_atomic_load_acquire_u64(&ring->tail);
+    if (head - ring->cachedTail > ring->mask) {
+      return NT_STATUS_TRYAGAIN;
+    }
+  }
+  memcpy(ring->mem + (size_t)(head & ring->mask) * ring->elemSize, elem, ring->elemSize);
+  _nt_atomic_store_release_u64(&ring->head, head + 1);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the oldest element without removing it - consumer only
+ *
+ * The element stays valid until it is removed with @ref _nt_ring_advance.
+ *
+ * @retval Pointer to the element or NULL if the ring is empty
+ */
+static NT_INLINE void* _nt_ring_peek(NtRing_t* ring)
+{
+  uint64_t tail = ring->tail;
+  if (tail == ring->cachedHead) {
+    ring->cachedHead = _nt_atomic_load_acquire_u64(&ring->head);
+    if (tail == ring->cachedHead) {
+      return NULL;
+    }
+  }
+  return ring->mem + (size_t)(tail & ring->mask) * ring->elemSize;
+}
+
+/**
+ * @brief Remove the oldest elements - consumer only
+ *
+ * @param[in] ring   Ring
+ * @param[in] count  Number of elements to remove. Must not exceed the number of elements in the ring
+ */
+static NT_INLINE void _nt_ring_advance(NtRing_t* ring, uint32_t count)
+{
+  _nt_atomic_store_release_u64(&ring->tail, ring->tail + count);
+}
+
+/**
+ * @brief Copy the oldest element out of the ring - consumer only
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  The ring is empty
+ */
+static NT_INLINE int _nt_ring_dequeue(NtRing_t* ring, void* elem)
+{
+  void* p = _nt_ring_peek(ring);
+  if (p == NULL) {
+    return NT_STATUS_TRYAGAIN;
+  }
+  memcpy(elem, p, ring->elemSize);
+  _nt_ring_advance(ring, 1);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the number of elements in the ring
+ */
+static NT_INLINE uint32_t _nt_ring_count(NtRing_t* ring)
+{
+  uint64_t tail = _nt_atomic_load_acquire_u64(&ring->tail);
+  return (uint32_t)(_nt_atomic_load_acquire_u64(&ring->head) - tail);
+}
+
+#endif // __RING_H__
@@ -0,0 +1,520 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains pollable RX streams. Each RX stream added to
+ * a monitor gets a file descriptor that becomes readable when a segment is
+ * ready, so a single epoll, poll or select loop can serve many lightly
+ * loaded streams without sleeping in @ref NT_NetRxGet per stream or
+ * spinning a core per stream.
+ *
+ * NTAPI offers no file descriptor for a stream, so the monitor threads do
+ * the waiting: a thread serving one stream blocks in @ref NT_NetRxGet, a
+ * thread serving several streams polls them with a zero timeout and
+ * sleeps when all are idle. The sleep starts short and doubles while the
+ * streams stay idle, so an idle thread wakes at most 1000 times per second
+ * by default, at the price of up to that sleep of extra latency for the
+ * first segment after an idle period. A received segment is queued for the
+ * application, and the descriptor is signalled only if the application
+ * found the queue empty, so a busy stream costs no system calls. The
+ * descriptor is an eventfd on Linux and a pipe on other POSIX systems.
+ *
+ * Segments returned by @ref _nt_rxfd_get are released with
+ * @ref _nt_rxfd_release, in the order they were received. The monitor
+ * thread that received a segment calls @ref NT_NetRxRelease for it, as
+ * NTAPI requires.
+ *
+ */
+#ifndef __RXFD_H__
+#define __RXFD_H__
+
+#include "nt.h"
+#include "ring.h"
+#include "aio.h"
+#include "compat.h"
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+/**
+ * Pollable stream statistics
+ */
+typedef struct NtRxFdStat_s {
+  uint64_t segments;        //!< Segments received
+  uint64_t signals;         //!< Times the descriptor was signalled
+  uint64_t queueFull;       //!< Times the monitor found the queue full
+  uint32_t queued;          //!< Segments queued for the application
+} NtRxFdStat_t;
+
+/**
+ * Pollable RX stream
+ */
+typedef struct NtRxFd_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtNetStreamRx_t hStream;
+  int fd;                    // Polled by the application
+  int wfd;                   // Written by the monitor - same as fd for an eventfd
+  NtRing_t ready;            // Received segments - the monitor produces
+  NtRing_t done;             // Released segments - the application produces
+  volatile uint32_t armed;   // Set when the application found the ready queue empty
+  volatile uint32_t error;   // Error returned by NT_NetRxGet
+  uint64_t released;         // Segments released - the monitor only
+  volatile uint64_t segments;
+  volatile uint64_t signals;
+  volatile uint64_t queueFull;
+#endif
+} NtRxFd_t;
+
+/**
+ * Monitor configuration. Zero selects the default value.
+ */
+typedef struct NtRxFdConfig_s {
+  uint32_t numThreads;      //!< Number of monitor threads. Default is 1
+  uint32_t depth;           //!< Segments queued per stream - must be a power of 2. Default is 16
+  int timeout;              //!< NT_NetRxGet timeout in milliseconds of a thread serving one stream. Default is 1
+  uint32_t idleUs;          //!< First sleep in microseconds of a thread serving several streams when all are idle. Default is 20
+  uint32_t maxIdleUs;       //!< Maximum sleep in microseconds - the sleep doubles up to it while the streams are idle. Default is 1000
+} NtRxFdConfig_t;
+
+#if !defined(DOXYGEN_INTERNAL_ONLY) && !defined(_MSC_VER)
+struct _NtRxFdThread_s {
+  struct NtRxFdMonitor_s *mon;
+  uint32_t index;
+  pthread_t thread;
+};
+#endif
+
+/**
+ * Monitor
+ */
+typedef struct NtRxFdMonitor_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtRxFdConfig_t config;
+  NtRxFd_t **streams;
+  uint32_t maxStreams;
+  uint32_t numStreams;
+  volatile uint32_t stop;
+  int started;
+#ifndef _MSC_VER
+  struct _NtRxFdThread_s *threads;
+#endif
+#endif
+} NtRxFdMonitor_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Wake the application if it waits for the stream
+ */
+static NT_INLINE void _nt_rxfd_signal(NtRxFd_t* rx)
+{
+#ifndef _MSC_VER
+  // Pairs with the fence in _nt_rxfd_get - either the application sees the segment or the monitor sees armed
+  _nt_atomic_fence();
+  if (_nt_atomic_load_acquire_u32(&rx->armed) && _nt_atomic_exchange_u32(&rx->armed, 0)) {
+    uint64_t one = 1;
+    ssize_t n = write(rx->wfd, &one, rx->wfd == rx->fd ? sizeof(one) : 1);
+    (void)n;
+    _nt_atomic_store_release_u64(&rx->signals, rx->signals + 1);
+  }
+#else
+  (void)rx;
+#endif
+}
+
+/*
+ * Release the segments returned by the application and receive new ones
+ *
+ * Returns 1 if a segment was received or released.
+ */
+static NT_INLINE int _nt_rxfd_serve(NtRxFd_t* rx, int timeout)
+{
+  NtNetBuf_t hNetBuf;
+  int busy = 0, status;
+  while (_nt_ring_dequeue(&rx->done, &hNetBuf) == NT_SUCCESS) {
+    (void)NT_NetRxRelease(rx->hStream, hNetBuf);
+    rx->released++;
+    busy = 1;
+  }
+  if (rx->error) {
+    return busy;
+  }
+  // Queued, held by the application and released but not yet returned - never more than the queues hold
+  if (rx->segments - rx->released > rx->ready.mask) {
+    _nt_atomic_store_release_u64(&rx->queueFull, rx->queueFull + 1);
+    return busy;
+  }
+  status = NT_NetRxGet(rx->hStream, &hNetBuf, timeout);
+  if (status == NT_SUCCESS) {
+    (void)_nt_ring_enqueue(&rx->ready, &hNetBuf);
+    _nt_atomic_store_release_u64(&rx->segments, rx->segments + 1);
+    _nt_rxfd_signal(rx);
+    return 1;
+  }
+  if (status != NT_STATUS_TIMEOUT && status != NT_STATUS_TRYAGAIN) {
+    _nt_atomic_store_release_u32(&rx->error, (uint32_t)status);
+    // Wake the application to report the error
+    _nt_atomic_store_release_u32(&rx->armed, 1);
+    _nt_rxfd_signal(rx);
+  }
+  return busy;
+}
+
+#ifndef _MSC_VER
+static NT_INLINE void* _nt_rxfd_thread(void* arg)
+{
+  struct _NtRxFdThread_s* thread = (struct _NtRxFdThread_s*)arg;
+  NtRxFdMonitor_t* mon = thread->mon;
+  // A thread serving one stream can block in NT_NetRxGet
+  int single = thread->index + mon->config.numThreads >= mon->numStreams;
+  uint32_t idleUs = mon->config.idleUs;
+  uint32_t s;
+  while (!_nt_atomic_load_acquire_u32(&mon->stop)) {
+    int busy = 0;
+    for (s = thread->index; s < mon->numStreams; s += mon->config.numThreads) {
+      busy |= _nt_rxfd_serve(mon->streams[s], single ? mon->config.timeout : 0);
+    }
+    if (busy) {
+      idleUs = mon->config.idleUs;
+    } else if (!single || mon->streams[thread->index]->error ||
+               mon->streams[thread->index]->segments - mon->streams[thread->index]->released > mon->config.depth - 1) {
+      _nt_compat_sleep_ns((uint64_t)idleUs * 1000);
+      idleUs = idleUs * 2 < mon->config.maxIdleUs ? idleUs * 2 : mon->config.maxIdleUs;
+    }
+  }
+  // Release what is left from the thread that received it - released ones first, then the ones still queued
+  for (s = thread->index; s < mon->numStreams; s += mon->config.numThreads) {
+    NtRxFd_t* rx = mon->streams[s];
+    NtNetBuf_t hNetBuf;
+    while (_nt_ring_dequeue(&rx->done, &hNetBuf) == NT_SUCCESS || _nt_ring_dequeue(&rx->ready, &hNetBuf) == NT_SUCCESS) {
+      (void)NT_NetRxRelease(rx->hStream, hNetBuf);
+    }
+  }
+  return NULL;
+}
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Initialize a monitor
+ *
+ * @param[out] mon         Monitor
+ * @param[in]  maxStreams  Maximum number of streams
+ * @param[in]  config      Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_rxfd_monitor_init(NtRxFdMonitor_t* mon, uint32_t maxStreams, const NtRxFdConfig_t* config)
+{
+  memset(mon, 0, sizeof(*mon));
+  if (config != NULL) {
+    mon->config = *config;
+  }
+  if (mon->config.numThreads == 0) {
+    mon->config.numThreads = 1;
+  }
+  if (mon->config.depth == 0) {
+    mon->config.depth = 16;
+  }
+  if (mon->config.timeout <= 0) {
+    mon->config.timeout = 1;
+  }
+  if (mon->config.idleUs == 0) {
+    mon->config.idleUs = 20;
+  }
+  if (mon->config.idleUs >= 1000000) {
+    mon->config.idleUs = 999999;
+  }
+  if (mon->config.maxIdleUs < mon->config.idleUs) {
+    mon->config.maxIdleUs = mon->config.idleUs > 1000 ? mon->config.idleUs : 1000;
+  }
+  if (mon->config.maxIdleUs >= 1000000) {
+    mon->config.maxIdleUs = 999999;
+  }
+  if (maxStreams == 0 || (mon->config.depth & (mon->config.depth - 1)) != 0) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  mon->streams = (NtRxFd_t**)calloc(maxStreams, sizeof(NtRxFd_t*));
+  if (mon->streams == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  mon->maxStreams = maxStreams;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Add an RX stream to a monitor
+ *
+ * Must be called before @ref _nt_rxfd_monitor_start. The stream must be
+ * opened with NT_NET_INTERFACE_SEGMENT and is not closed by the monitor.
+ * Only the monitor may call @ref NT_NetRxGet and @ref NT_NetRxRelease for
+ * the stream from now on.
+ *
+ * @param[in]  mon      Monitor
+ * @param[out] rx       Pollable stream - must stay in place until the monitor is stopped
+ * @param[in]  hStream  RX stream
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Too many streams or the monitor has started
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED    File descriptors are not supported on this system
+ * @retval otherwise                         The descriptor could not be created - see @ref NT_AIO_ERRNO
+ */
+static NT_INLINE int _nt_rxfd_add(NtRxFdMonitor_t* mon, NtRxFd_t* rx, NtNetStreamRx_t hStream)
+{
+  int status;
+  memset(rx, 0, sizeof(*rx));
+  rx->fd = rx->wfd = -1;
+  if (mon->started || mon->numStreams == mon->maxStreams) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+#if defined(__linux__)
+  rx->fd = rx->wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (rx->fd < 0) {
+    return NT_AIO_ERRNO(errno);
+  }
+#elif !defined(_MSC_VER)
+  {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      return NT_AIO_ERRNO(errno);
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    rx->fd = fds[0];
+    rx->wfd = fds[1];
+  }
+#else
+  return NT_ERROR_FEATURE_NOT_SUPPORTED;
+#endif
+  if ((status = _nt_ring_init(&rx->ready, mon->config.depth, sizeof(NtNetBuf_t))) != NT_SUCCESS ||
+      (status = _nt_ring_init(&rx->done, mon->config.depth, sizeof(NtNetBuf_t))) != NT_SUCCESS) {
+    _nt_ring_free(&rx->ready);
+#ifndef _MSC_VER
+    close(rx->fd);
+    if (rx->wfd != rx->fd) {
+      close(rx->wfd);
+    }
+#endif
+    rx->fd = rx->wfd = -1;
+    return status;
+  }
+  rx->hStream = hStream;
+  mon->streams[mon->numStreams++] = rx;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the file descriptor of a pollable stream
+ *
+ * The descriptor becomes readable when a segment is ready or the stream
+ * has failed. Poll it for reading only after @ref _nt_rxfd_get has
+ * returned NT_STATUS_TRYAGAIN. The application must not read from or
+ * close the descriptor.
+ *
+ * @param[in] rx  Pollable stream
+ *
+ * @return The file descriptor
+ */
+static NT_INLINE int _nt_rxfd_fd(const NtRxFd_t* rx)
+{
+  return rx->fd;
+}
+
+/**
+ * @brief Start the monitor threads
+ *
+ * @param[in] mon  Monitor
+ *
+ * @retval NT_SUCCESS                     Success
+ * @retval NT_ERROR_RESOURCE_UNAVAILABLE  A thread could not be created
+ * @retval NT_ERROR_FEATURE_NOT_SUPPORTED Threads are not supported on this system
+ */
+static NT_INLINE int _nt_rxfd_monitor_start(NtRxFdMonitor_t* mon)
+{
+#ifndef _MSC_VER
+  uint32_t t, numThreads = mon->config.numThreads < mon->numStreams ? mon->config.numThreads : mon->numStreams;
+  if (mon->started) {
+    return NT_SUCCESS;
+  }
+  mon->config.numThreads = numThreads;
+  mon->threads = (struct _NtRxFdThread_s*)calloc(numThreads ? numThreads : 1, sizeof(struct _NtRxFdThread_s));
+  if (mon->threads == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (t = 0; t < numThreads; t++) {
+    mon->threads[t].mon = mon;
+    mon->threads[t].index = t;
+    if (pthread_create(&mon->threads[t].thread, NULL, _nt_rxfd_thread, &mon->threads[t]) != 0) {
+      _nt_atomic_store_release_u32(&mon->stop, 1);
+      while (t-- > 0) {
+        pthread_join(mon->threads[t].thread, NULL);
+      }
+      free(mon->threads);
+      mon->threads = NULL;
+      mon->stop = 0;
+      return NT_ERROR_RESOURCE_UNAVAILABLE;
+    }
+  }
+  mon->started = 1;
+  return NT_SUCCESS;
+#else
+  (void)mon;
+  return NT_ERROR_FEATURE_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Get the next segment of a pollable stream - application thread only
+ *
+ * Returns NT_STATUS_TRYAGAIN when no segment is ready. The descriptor then
+ * becomes readable when one is, so the application can wait for it with
+ * epoll, poll or select and call this function again.
+ *
+ * @param[in]  rx       Pollable stream
+ * @param[out] hNetBuf  Segment
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  No segment is ready
+ * @retval otherwise           Error returned by @ref NT_NetRxGet - the stream is no longer received
+ */
+static NT_INLINE int _nt_rxfd_get(NtRxFd_t* rx, NtNetBuf_t* hNetBuf)
+{
+  uint32_t error;
+  if (_nt_ring_dequeue(&rx->ready, hNetBuf) == NT_SUCCESS) {
+    return NT_SUCCESS;
+  }
+#ifndef _MSC_VER
+  {
+    // Consume the pending signal, then arm and look again
+    uint64_t count;
+    ssize_t n = read(rx->fd, &count, rx->wfd == rx->fd ? sizeof(count) : 1);
+    (void)n;
+  }
+#endif
+  _nt_atomic_store_release_u32(&rx->armed, 1);
+  _nt_atomic_fence();
+  if (_nt_ring_dequeue(&rx->ready, hNetBuf) == NT_SUCCESS) {
+    return NT_SUCCESS;
+  }
+  error = _nt_atomic_load_acquire_u32(&rx->error);
+  return error != 0 ? (int)error : NT_STATUS_TRYAGAIN;
+}
+
+/**
+ * @brief Release a segment returned by @ref _nt_rxfd_get - application thread only
+ *
+ * Segments must be released in the order they were returned.
+ *
+ * @param[in] rx       Pollable stream
+ * @param[in] hNetBuf  Segment
+ */
+static NT_INLINE void _nt_rxfd_release(NtRxFd_t* rx, NtNetBuf_t hNetBuf)
+{
+  // The monitor never has more segments out than the queue holds
+  (void)_nt_ring_enqueue(&rx->done, &hNetBuf);
+}
+
+/**
+ * @brief Get the statistics of a pollable stream
+ *
+ * @param[in]  rx    Pollable stream
+ * @param[out] stat  Statistics
+ */
+static NT_INLINE void _nt_rxfd_get_stat(NtRxFd_t* rx, NtRxFdStat_t* stat)
+{
+  stat->segments = _nt_atomic_load_acquire_u64(&rx->segments);
+  stat->signals = _nt_atomic_load_acquire_u64(&rx->signals);
+  stat->queueFull = _nt_atomic_load_acquire_u64(&rx->queueFull);
+  stat->queued = _nt_ring_count(&rx->ready);
+}
+
+/**
+ * @brief Stop a monitor and free its streams
+ *
+ * The monitor threads release the segments still queued or returned by
+ * the application and stop. The application must not use segments of
+ * the streams any longer. Segments the application has not returned with
+ * @ref _nt_rxfd_release are not released. The RX streams are not closed.
+ *
+ * @param[in] mon  Monitor
+ */
+static NT_INLINE void _nt_rxfd_monitor_close(NtRxFdMonitor_t* mon)
+{
+  uint32_t s;
+#ifndef _MSC_VER
+  if (mon->threads != NULL) {
+    uint32_t t;
+    _nt_atomic_store_release_u32(&mon->stop, 1);
+    for (t = 0; t < mon->config.numThreads; t++) {
+      pthread_join(mon->threads[t].thread, NULL);
+    }
+    free(mon->threads);
+  }
+#endif
+  for (s = 0; s < mon->numStreams; s++) {
+    NtRxFd_t* rx = mon->streams[s];
+    _nt_ring_free(&rx->ready);
+    _nt_ring_free(&rx->done);
+#ifndef _MSC_VER
+    close(rx->fd);
+    if (rx->wfd != rx->fd) {
+      close(rx->wfd);
+    }
+#endif
+    rx->fd = rx->wfd = -1;
+  }
+  free(mon->streams);
+  memset(mon, 0, sizeof(*mon));
+}
+
+#endif // __RXFD_H__
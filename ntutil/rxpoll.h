@@ -0,0 +1,364 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the hybrid busy-poll receive mode for
+ * latency critical streams. Instead of letting @ref NT_NetRxGet split its
+ * timeout into sleep intervals, @ref _nt_rxpoll_get polls the stream with
+ * a zero timeout in three phases:
+ *
+ * - spin: poll back to back for a time budget measured with the CPU time
+ *   stamp counter
+ * - yield: poll and yield the CPU between polls for a second budget
+ * - sleep: poll and sleep between polls, doubling the sleep up to a
+ *   maximum
+ *
+ * In adaptive mode the spin budget shrinks each time it runs out without
+ * data and grows back when data is found while spinning or yielding, so
+ * an idle stream stops burning a core.
+ *
+ * The time spent in every phase is counted, together with a log2
+ * histogram of the detection latency. The detection latency is the time
+ * from the last poll that found no data to the return of the data, which
+ * is an upper bound of the time from data available to return.
+ *
+ */
+#ifndef __RXPOLL_H__
+#define __RXPOLL_H__
+
+#include "nt.h"
+#include "atomic.h"
+#include "compat.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+/**
+ * Number of detection latency histogram buckets. Bucket i counts
+ * latencies from 2^i up to 2^(i+1) nanoseconds - bucket 0 also counts 0.
+ */
+#define NT_RXPOLL_HISTOGRAM_BUCKETS 32
+
+/**
+ * Poll phases
+ */
+enum NtRxPollPhase_e {
+  NT_RXPOLL_PHASE_SPIN = 0,  //!< Polling back to back
+  NT_RXPOLL_PHASE_YIELD,     //!< Polling and yielding the CPU
+  NT_RXPOLL_PHASE_SLEEP,     //!< Polling and sleeping
+  NT_RXPOLL_PHASES           //!< Number of phases
+};
+
+/**
+ * Hybrid poll configuration. Zero selects the default value.
+ */
+typedef struct NtRxPollConfig_s {
+  uint64_t spinNs;          //!< Spin budget in nanoseconds. Default is 50000
+  uint64_t yieldNs;         //!< Yield budget in nanoseconds. Default is 200000
+  uint64_t sleepNs;         //!< First sleep in nanoseconds. Default is 10000
+  uint64_t maxSleepNs;      //!< Maximum sleep in nanoseconds. Default is 1000000
+  int adaptive;             //!< Adapt the spin budget to the traffic
+} NtRxPollConfig_t;
+
+/**
+ * Hybrid poll statistics
+ */
+typedef struct NtRxPollStat_s {
+  uint64_t polls[NT_RXPOLL_PHASES];  //!< NT_NetRxGet calls per phase
+  uint64_t hits[NT_RXPOLL_PHASES];   //!< Segments or packets found per phase
+  uint64_t ns[NT_RXPOLL_PHASES];     //!< Nanoseconds spent per phase
+  uint64_t timeouts;        //!< Calls returning NT_STATUS_TIMEOUT
+  uint64_t spinBudgetNs;    //!< Current spin budget in nanoseconds
+  uint64_t latency[NT_RXPOLL_HISTOGRAM_BUCKETS]; //!< Detection latency histogram
+} NtRxPollStat_t;
+
+/**
+ * Hybrid poll read commands
+ */
+enum NtRxPollCmd_e {
+  NT_RXPOLL_READ_CMD_UNKNOWN = 0, //!< Unknown read command
+  NT_RXPOLL_READ_CMD_GET_STAT,    //!< Get the statistics
+  NT_RXPOLL_READ_CMD_RESET_STAT,  //!< Get the statistics and reset them
+};
+
+/**
+ * Hybrid poll read command
+ */
+typedef struct NtRxPollRead_s {
+  enum NtRxPollCmd_e cmd;   //!< The read command
+  union NtRxPollRead_u {
+    NtRxPollStat_t stat;    //!< The structure to use for NT_RXPOLL_READ_CMD_GET_STAT and NT_RXPOLL_READ_CMD_RESET_STAT
+  } u;
+} NtRxPollRead_t;
+
+/**
+ * Hybrid poll stream
+ */
+typedef struct NtRxPoll_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtNetStreamRx_t hStream;
+  NtRxPollConfig_t config;
+  double nsPerTick;
+  uint64_t spinTicks;        // Configured spin budget
+  uint64_t budgetTicks;      // Current spin budget
+  uint64_t yieldTicks;
+  NtRxPollStat_t stat;
+#endif
+} NtRxPoll_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Time stamp counter - nanoseconds where the CPU has none
+ */
+static NT_INLINE uint64_t _nt_rxpoll_ticks(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return _nt_compat_now_ns();
+#endif
+}
+
+static NT_INLINE void _nt_rxpoll_yield(void)
+{
+#ifdef _MSC_VER
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+static NT_INLINE void _nt_rxpoll_sleep(uint64_t ns)
+{
+#ifdef _MSC_VER
+  Sleep((DWORD)((ns + 999999) / 1000000));
+#else
+  _nt_compat_sleep_ns(ns);
+#endif
+}
+
+/*
+ * Count a hit and its detection latency
+ */
+static NT_INLINE void _nt_rxpoll_hit(NtRxPoll_t* poll, int phase, uint64_t lastMiss, uint64_t now)
+{
+  uint64_t ns = lastMiss != 0 ? (uint64_t)((double)(now - lastMiss) * poll->nsPerTick) : 0;
+  uint32_t bucket = 0;
+  while (ns > 1 && bucket < NT_RXPOLL_HISTOGRAM_BUCKETS - 1) {
+    ns >>= 1;
+    bucket++;
+  }
+  poll->stat.hits[phase]++;
+  poll->stat.latency[bucket]++;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Set up hybrid polling of an RX stream
+ *
+ * Works on streams opened with @ref NT_NetRxOpen or
+ * @ref NT_NetRxOpenMulti, in packet or segment mode. The stream is not
+ * closed by @ref _nt_rxpoll_close. The time stamp counter is calibrated
+ * against the monotonic clock, which takes about a millisecond.
+ *
+ * @param[out] poll     Hybrid poll stream
+ * @param[in]  hStream  RX stream
+ * @param[in]  config   Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS  Success
+ */
+static NT_INLINE int _nt_rxpoll_open(NtRxPoll_t* poll, NtNetStreamRx_t hStream, const NtRxPollConfig_t* config)
+{
+  uint64_t t0, n0, t1, n1;
+  memset(poll, 0, sizeof(*poll));
+  if (config != NULL) {
+    poll->config = *config;
+  }
+  if (poll->config.spinNs == 0) {
+    poll->config.spinNs = 50000;
+  }
+  if (poll->config.yieldNs == 0) {
+    poll->config.yieldNs = 200000;
+  }
+  if (poll->config.sleepNs == 0) {
+    poll->config.sleepNs = 10000;
+  }
+  if (poll->config.maxSleepNs < poll->config.sleepNs) {
+    poll->config.maxSleepNs = poll->config.sleepNs > 1000000 ? poll->config.sleepNs : 1000000;
+  }
+  poll->hStream = hStream;
+  // Calibrate the time stamp counter
+  n0 = _nt_compat_now_ns();
+  t0 = _nt_rxpoll_ticks();
+  do {
+    n1 = _nt_compat_now_ns();
+  } while (n1 - n0 < 1000000);
+  t1 = _nt_rxpoll_ticks();
+  poll->nsPerTick = t1 > t0 ? (double)(n1 - n0) / (double)(t1 - t0) : 1.0;
+  poll->spinTicks = (uint64_t)((double)poll->config.spinNs / poll->nsPerTick);
+  poll->yieldTicks = (uint64_t)((double)poll->config.yieldNs / poll->nsPerTick);
+  poll->budgetTicks = poll->spinTicks;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get data from the stream with hybrid polling
+ *
+ * Has the semantics of @ref NT_NetRxGet.
+ *
+ * @param[in]  poll     Hybrid poll stream
+ * @param[out] hNetBuf  Segment or packet
+ * @param[in]  timeout  Time to wait for data in milliseconds - negative waits forever
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_TIMEOUT  No data within the timeout
+ * @retval otherwise          Error returned by @ref NT_NetRxGet
+ */
+static NT_INLINE int _nt_rxpoll_get(NtRxPoll_t* poll, NtNetBuf_t* hNetBuf, int timeout)
+{
+  uint64_t start = _nt_rxpoll_ticks(), now = start, phaseStart = start, lastMiss = 0;
+  uint64_t timeoutTicks = timeout >= 0 ? (uint64_t)((double)timeout * 1e6 / poll->nsPerTick) : 0;
+  uint64_t sleepNs = poll->config.sleepNs;
+  int phase = poll->budgetTicks > 0 ? NT_RXPOLL_PHASE_SPIN : NT_RXPOLL_PHASE_YIELD;
+  int status;
+  for (;;) {
+    status = NT_NetRxGet(poll->hStream, hNetBuf, 0);
+    now = _nt_rxpoll_ticks();
+    poll->stat.polls[phase]++;
+    if (status == NT_SUCCESS) {
+      _nt_rxpoll_hit(poll, phase, lastMiss, now);
+      break;
+    }
+    if (status != NT_STATUS_TIMEOUT && status != NT_STATUS_TRYAGAIN) {
+      break;
+    }
+    lastMiss = now;
+    if (timeout >= 0 && now - start >= timeoutTicks) {
+      poll->stat.timeouts++;
+      status = NT_STATUS_TIMEOUT;
+      break;
+    }
+    // Move to the next phase when the budget is used
+    if (phase == NT_RXPOLL_PHASE_SPIN && now - start >= poll->budgetTicks) {
+      poll->stat.ns[phase] += (uint64_t)((double)(now - phaseStart) * poll->nsPerTick);
+      phase = NT_RXPOLL_PHASE_YIELD;
+      phaseStart = now;
+      if (poll->config.adaptive) {
+        poll->budgetTicks >>= 1;
+      }
+    } else if (phase == NT_RXPOLL_PHASE_YIELD && now - phaseStart >= poll->yieldTicks) {
+      poll->stat.ns[phase] += (uint64_t)((double)(now - phaseStart) * poll->nsPerTick);
+      phase = NT_RXPOLL_PHASE_SLEEP;
+      phaseStart = now;
+    }
+    if (phase == NT_RXPOLL_PHASE_SPIN) {
+      _nt_cpu_relax();
+    } else if (phase == NT_RXPOLL_PHASE_YIELD) {
+      _nt_rxpoll_yield();
+    } else {
+      _nt_rxpoll_sleep(sleepNs);
+      sleepNs = sleepNs * 2 < poll->config.maxSleepNs ? sleepNs * 2 : poll->config.maxSleepNs;
+    }
+  }
+  poll->stat.ns[phase] += (uint64_t)((double)(now - phaseStart) * poll->nsPerTick);
+  if (poll->config.adaptive && status == NT_SUCCESS && phase != NT_RXPOLL_PHASE_SLEEP) {
+    // Data came while spinning or soon after - spin longer again
+    poll->budgetTicks = poll->budgetTicks * 2 + 1 < poll->spinTicks ? poll->budgetTicks * 2 + 1 : poll->spinTicks;
+  }
+  return status;
+}
+
+/**
+ * @brief Release data returned by @ref _nt_rxpoll_get
+ *
+ * @param[in] poll     Hybrid poll stream
+ * @param[in] hNetBuf  Segment or packet
+ *
+ * @retval See @ref NT_NetRxRelease
+ */
+static NT_INLINE int _nt_rxpoll_release(NtRxPoll_t* poll, NtNetBuf_t hNetBuf)
+{
+  return NT_NetRxRelease(poll->hStream, hNetBuf);
+}
+
+/**
+ * @brief Read the hybrid poll instrumentation
+ *
+ * @param[in]     poll  Hybrid poll stream
+ * @param[in,out] cmd   Read command
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_ERROR_INVALID_PARAMETER  Unknown command
+ */
+static NT_INLINE int _nt_rxpoll_read(NtRxPoll_t* poll, NtRxPollRead_t* cmd)
+{
+  switch (cmd->cmd) {
+  case NT_RXPOLL_READ_CMD_GET_STAT:
+  case NT_RXPOLL_READ_CMD_RESET_STAT:
+    cmd->u.stat = poll->stat;
+    cmd->u.stat.spinBudgetNs = (uint64_t)((double)poll->budgetTicks * poll->nsPerTick);
+    if (cmd->cmd == NT_RXPOLL_READ_CMD_RESET_STAT) {
+      memset(&poll->stat, 0, sizeof(poll->stat));
+    }
+    return NT_SUCCESS;
+  default:
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+}
+
+/**
+ * @brief Stop hybrid polling - the RX stream is not closed
+ *
+ * @param[in] poll  Hybrid poll stream
+ */
+static NT_INLINE void _nt_rxpoll_close(NtRxPoll_t* poll)
+{
+  memset(poll, 0, sizeof(*poll));
+}
+
+#endif // __RXPOLL_H__
@@ -0,0 +1,663 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains a synthetic segment generator. It writes
+ * valid packets with any of the descriptor layouts in ntapi/ - standard
+ * descriptor 0, extended descriptors 7, 8 and 9 and dynamic descriptors
+ * 1, 2 and 3 - so code and benchmarks can be run on reproducible traffic
+ * without an adapter.
+ *
+ * The traffic is configured with a packet size mix, the number of VLAN
+ * tags and MPLS labels, IPv4 or IPv6, UDP or TCP, an optional GRE,
+ * GTPv1-U or IP-in-IP tunnel, the number of flows, a time stamp sequence
+ * and a hash function. The descriptor fields - lengths, offsets, frame
+ * types, hash and color - are set as the adapter sets them for such
+ * packets, and the IPv4 header checksums are valid. The same seed gives
+ * the same packets.
+ *
+ * @ref _nt_seggen_fill has the signature of @ref NtEmuFill_t, so the
+ * generator can feed an emulated stream (see emu.h).
+ *
+ */
+#ifndef __SEGGEN_H__
+#define __SEGGEN_H__
+
+#include "nt.h"
+
+/**
+ * Descriptor layouts
+ */
+enum NtSegGenDescr_e {
+  NT_SEGGEN_DESCR_STD0 = 0,  //!< Standard descriptor 0 - 16 bytes
+  NT_SEGGEN_DESCR_EXT7,      //!< Extended descriptor 7 - 32 bytes
+  NT_SEGGEN_DESCR_EXT8,      //!< Extended descriptor 8 - 32 bytes
+  NT_SEGGEN_DESCR_EXT9,      //!< Extended descriptor 9 - 40 bytes
+  NT_SEGGEN_DESCR_DYN1,      //!< Dynamic descriptor 1 - 18 bytes
+  NT_SEGGEN_DESCR_DYN2,      //!< Dynamic descriptor 2 - 22 bytes
+  NT_SEGGEN_DESCR_DYN3,      //!< Dynamic descriptor 3 - 22 bytes
+};
+
+/**
+ * Tunnels
+ */
+enum NtSegGenTunnel_e {
+  NT_SEGGEN_TUNNEL_NONE = 0, //!< No tunnel
+  NT_SEGGEN_TUNNEL_GRE,      //!< GRE without options
+  NT_SEGGEN_TUNNEL_GTPV1_U,  //!< GTPv1-U G-PDU on UDP port 2152
+  NT_SEGGEN_TUNNEL_IPINIP,   //!< IP in IP
+};
+
+/**
+ * Packet size and its weight in the packet size mix
+ */
+typedef struct NtSegGenSize_s {
+  uint16_t length;          //!< Wire length including the 4-byte FCS
+  uint16_t weight;          //!< Relative frequency
+} NtSegGenSize_t;
+
+/**
+ * Hash function - returns the 24-bit hash value stored in the descriptor
+ */
+typedef uint32_t (*NtSegGenHash_t)(void *ctx, const uint8_t *l2, uint32_t length);
+
+/**
+ * Segment generator configuration. Zero selects the default value.
+ */
+typedef struct NtSegGenConfig_s {
+  enum NtSegGenDescr_e descr;   //!< Descriptor layout. Default is standard descriptor 0
+  const NtSegGenSize_t *sizes;  //!< Packet size mix. Default is IMIX - 7 x 64, 4 x 570 and 1 x 1518 bytes
+  uint32_t numSizes;        //!< Number of entries in the packet size mix
+  uint32_t vlans;           //!< Number of VLAN tags - 0 to 3
+  uint32_t mpls;            //!< Number of MPLS labels - 0 to 7
+  int ipv6;                 //!< IPv6 instead of IPv4
+  int tcp;                  //!< TCP instead of UDP
+  enum NtSegGenTunnel_e tunnel; //!< Tunnel around the IP packet
+  uint32_t flows;           //!< Number of flows - 5-tuples of the innermost packet. Default is 1024
+  uint64_t timestamp;       //!< Time stamp of the first packet
+  uint64_t tsStep;          //!< Time stamp increment per packet. Default is 100
+  uint64_t tsJitter;        //!< Random time stamp increment added per packet - 0 to tsJitter
+  NtSegGenHash_t hash;      //!< Hash function. Default is a hash of the flow number
+  void *hashCtx;            //!< Context passed to the hash function
+  uint32_t hashType;        //!< Hash type stored in the extended descriptors
+  uint32_t numPorts;        //!< Number of RX ports - flows are spread over them. Default is 1
+  uint64_t count;           //!< Number of packets to generate. Default is no limit
+  uint64_t seed;            //!< Random seed. Default is 1
+} NtSegGenConfig_t;
+
+/**
+ * Segment generator
+ */
+typedef struct NtSegGen_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtSegGenConfig_t config;
+  uint32_t *cumWeights;
+  uint16_t *lengths;
+  uint32_t totalWeight;
+  uint32_t descrLength;
+  uint8_t tmpl[192];         // Headers of the packets
+  uint32_t hdrLength;
+  uint32_t l3;               // Outer IP header
+  uint32_t l4;               // Outer L4 header - or the inner IP header for IP in IP
+  uint32_t l5;               // After the outer L4 header
+  uint32_t tun;              // Tunnel header
+  uint32_t il3;              // Innermost IP header
+  uint32_t il4;              // Innermost L4 header
+  uint32_t il5;              // Payload
+  uint64_t rng;
+  uint64_t ts;
+  uint64_t pkts;
+  uint32_t nextLength;       // Wire length of the next packet - 0 if not drawn yet
+  uint8_t colorMap[64];      // Identity filter color map
+#endif
+} NtSegGen_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Stream ID table of the unmatched IP fragment feeds - all feeds map to
+ * stream 0
+ */
+static NT_INLINE int* _nt_seggen_stream_info(void)
+{
+  static int streamInfo[256 << _FEED2STREAM_SHL_];
+  return streamInfo;
+}
+
+static NT_INLINE uint64_t _nt_seggen_rand(NtSegGen_t* gen)
+{
+  // xorshift64*
+  gen->rng ^= gen->rng >> 12;
+  gen->rng ^= gen->rng << 25;
+  gen->rng ^= gen->rng >> 27;
+  return gen->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static NT_INLINE uint32_t _nt_seggen_mix(uint32_t v)
+{
+  v ^= v >> 16;
+  v *= 0x7FEB352D;
+  v ^= v >> 15;
+  v *= 0x846CA68B;
+  v ^= v >> 16;
+  return v;
+}
+
+static NT_INLINE void _nt_seggen_put16(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static NT_INLINE void _nt_seggen_put32(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static NT_INLINE void _nt_seggen_ipv4_csum(uint8_t* ip)
+{
+  uint32_t sum = 0;
+  int i;
+  ip[10] = ip[11] = 0;
+  for (i = 0; i < 20; i += 2) {
+    sum += (uint32_t)(ip[i] << 8 | ip[i + 1]);
+  }
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum += sum >> 16;
+  _nt_seggen_put16(ip + 10, ~sum & 0xFFFF);
+}
+
+/*
+ * Append an IP header without addresses and lengths to the template
+ */
+static NT_INLINE uint32_t _nt_seggen_tmpl_ip(NtSegGen_t* gen, uint32_t off, uint8_t proto)
+{
+  uint8_t* ip = gen->tmpl + off;
+  if (gen->config.ipv6) {
+    ip[0] = 0x60;
+    ip[6] = proto;
+    ip[7] = 64;
+    return off + 40;
+  }
+  ip[0] = 0x45;
+  ip[8] = 64;
+  ip[9] = proto;
+  return off + 20;
+}
+
+/*
+ * Append the innermost L4 header to the template
+ */
+static NT_INLINE uint32_t _nt_seggen_tmpl_l4(NtSegGen_t* gen, uint32_t off)
+{
+  if (gen->config.tcp) {
+    gen->tmpl[off + 12] = 5 << 4;
+    gen->tmpl[off + 13] = 0x10;  // ACK
+    _nt_seggen_put16(gen->tmpl + off + 14, 65535);
+    return off + 20;
+  }
+  return off + 8;
+}
+
+/*
+ * Build the headers shared by all packets
+ */
+static NT_INLINE void _nt_seggen_build_template(NtSegGen_t* gen)
+{
+  uint8_t ipProto = gen->config.tcp ? 6 : 17;
+  uint8_t ipInIpProto = gen->config.ipv6 ? 41 : 4;
+  uint32_t off = 12, i;
+  memset(gen->tmpl, 0, sizeof(gen->tmpl));
+  // Locally administered MAC addresses - the flow is patched in later
+  gen->tmpl[0] = 0x02;
+  gen->tmpl[6] = 0x02;
+  gen->tmpl[11] = 0x01;
+  for (i = 0; i < gen->config.vlans; i++) {
+    _nt_seggen_put16(gen->tmpl + off, i + 1 < gen->config.vlans ? 0x88A8 : 0x8100);
+    _nt_seggen_put16(gen->tmpl + off + 2, 100 + i);
+    off += 4;
+  }
+  if (gen->config.mpls > 0) {
+    _nt_seggen_put16(gen->tmpl + off, 0x8847);
+    off += 2;
+    for (i = 0; i < gen->config.mpls; i++) {
+      _nt_seggen_put32(gen->tmpl + off, (16 + i) << 12 | (i + 1 == gen->config.mpls ? 0x100 : 0) | 64);
+      off += 4;
+    }
+  } else {
+    _nt_seggen_put16(gen->tmpl + off, gen->config.ipv6 ? 0x86DD : 0x0800);
+    off += 2;
+  }
+  gen->l3 = off;
+  switch (gen->config.tunnel) {
+  case NT_SEGGEN_TUNNEL_GRE:
+    gen->l4 = _nt_seggen_tmpl_ip(gen, off, 47);
+    _nt_seggen_put16(gen->tmpl + gen->l4 + 2, gen->config.ipv6 ? 0x86DD : 0x0800);
+    gen->tun = gen->l4;
+    gen->l5 = gen->il3 = gen->l4 + 4;
+    break;
+  case NT_SEGGEN_TUNNEL_GTPV1_U:
+    gen->l4 = _nt_seggen_tmpl_ip(gen, off, 17);
+    _nt_seggen_put16(gen->tmpl + gen->l4, 2152);
+    _nt_seggen_put16(gen->tmpl + gen->l4 + 2, 2152);
+    gen->tun = gen->l5 = gen->l4 + 8;
+    gen->tmpl[gen->tun] = 0x30;      // Version 1, protocol type GTP
+    gen->tmpl[gen->tun + 1] = 0xFF;  // G-PDU
+    gen->il3 = gen->tun + 8;
+    break;
+  case NT_SEGGEN_TUNNEL_IPINIP:
+    gen->l4 = gen->tun = gen->l5 = gen->il3 = _nt_seggen_tmpl_ip(gen, off, ipInIpProto);
+    break;
+  default:
+    gen->il3 = off;
+    break;
+  }
+  gen->il4 = _nt_seggen_tmpl_ip(gen, gen->il3, ipProto);
+  gen->il5 = _nt_seggen_tmpl_l4(gen, gen->il4);
+  if (gen->config.tunnel == NT_SEGGEN_TUNNEL_NONE) {
+    gen->l4 = gen->il4;
+    gen->l5 = gen->il5;
+    gen->tun = 0;
+  }
+  gen->hdrLength = gen->il5;
+}
+
+/*
+ * Write the IP addresses of a flow
+ */
+static NT_INLINE void _nt_seggen_ip_addr(NtSegGen_t* gen, uint8_t* ip, uint32_t src, uint32_t dst)
+{
+  if (gen->config.ipv6) {
+    // 2001:db8::/32 documentation prefix
+    _nt_seggen_put32(ip + 8, 0x20010DB8);
+    _nt_seggen_put32(ip + 20, src);
+    _nt_seggen_put32(ip + 24, 0x20010DB8);
+    _nt_seggen_put32(ip + 36, dst);
+  } else {
+    _nt_seggen_put32(ip + 12, src);
+    _nt_seggen_put32(ip + 16, dst);
+  }
+}
+
+static NT_INLINE void _nt_seggen_ip_length(NtSegGen_t* gen, uint8_t* ip, uint32_t length)
+{
+  if (gen->config.ipv6) {
+    _nt_seggen_put16(ip + 4, length - 40);
+  } else {
+    _nt_seggen_put16(ip + 2, length);
+    _nt_seggen_ipv4_csum(ip);
+  }
+}
+
+/*
+ * Write the frame of a packet and return its hash value
+ */
+static NT_INLINE uint32_t _nt_seggen_frame(NtSegGen_t* gen, uint8_t* l2, uint32_t frameLength, uint32_t flow)
+{
+  uint32_t ipLength = frameLength - 4 - gen->il3;
+  memcpy(l2, gen->tmpl, gen->hdrLength);
+  memset(l2 + gen->hdrLength, 0, frameLength - gen->hdrLength);
+  _nt_seggen_put32(l2 + 2, flow);
+  // Innermost packet
+  _nt_seggen_ip_addr(gen, l2 + gen->il3, 0x0A000000 | (flow & 0xFFFFFF), 0xC0A80000 | (flow % 251 + 1));
+  _nt_seggen_ip_length(gen, l2 + gen->il3, ipLength);
+  _nt_seggen_put16(l2 + gen->il4, 1024 + flow % 64512);
+  _nt_seggen_put16(l2 + gen->il4 + 2, gen->config.tcp ? 443 : 53);
+  if (gen->config.tcp) {
+    _nt_seggen_put32(l2 + gen->il4 + 4, (uint32_t)gen->pkts);
+  } else {
+    _nt_seggen_put16(l2 + gen->il4 + 4, ipLength - (gen->il4 - gen->il3));
+  }
+  if (frameLength - 4 >= gen->il5 + 8) {
+    // Packet number at the start of the payload
+    memcpy(l2 + gen->il5, &gen->pkts, 8);
+  }
+  // Tunnel
+  if (gen->config.tunnel != NT_SEGGEN_TUNNEL_NONE) {
+    _nt_seggen_ip_addr(gen, l2 + gen->l3, 0xAC100000 | (flow & 15), 0xAC110001);
+    _nt_seggen_ip_length(gen, l2 + gen->l3, frameLength - 4 - gen->l3);
+    if (gen->config.tunnel == NT_SEGGEN_TUNNEL_GTPV1_U) {
+      _nt_seggen_put16(l2 + gen->l4 + 4, frameLength - 4 - gen->l4);
+      _nt_seggen_put16(l2 + gen->tun + 2, ipLength);
+      _nt_seggen_put32(l2 + gen->tun + 4, flow);
+    }
+  }
+  if (gen->config.hash != NULL) {
+    return gen->config.hash(gen->config.hashCtx, l2, frameLength) & 0xFFFFFF;
+  }
+  return _nt_seggen_mix(flow) & 0xFFFFFF;
+}
+
+/*
+ * Write the extended descriptor fields shared by formats 7, 8 and 9
+ */
+static NT_INLINE void _nt_seggen_ext(NtSegGen_t* gen, NtExt7DescrRx_t* d, uint32_t hash, uint32_t flow, uint32_t wireLength)
+{
+  int v6 = gen->config.ipv6;
+  d->hash = hash;
+  d->hashType = gen->config.hashType;
+  d->hashValid = 1;
+  d->jumbo = wireLength > 1518;
+  d->l4PortType = gen->config.tunnel == NT_SEGGEN_TUNNEL_GTPV1_U ? NT_L4_PORT_GTPV1_U : NT_L4_PORT_OTHER;
+  switch (gen->config.tunnel) {
+  case NT_SEGGEN_TUNNEL_GRE:
+    d->l4FrameType = NT_L4_FRAME_TYPE_GRE;
+    d->l4ProtocolNumber = 47;
+    d->l4Size = 1;
+    break;
+  case NT_SEGGEN_TUNNEL_GTPV1_U:
+    d->l4FrameType = NT_L4_FRAME_TYPE_UDP;
+    d->l4ProtocolNumber = 17;
+    d->l4Size = 2;
+    break;
+  case NT_SEGGEN_TUNNEL_IPINIP:
+    d->l4FrameType = v6 ? NT_L4_FRAME_TYPE_IPV6 : NT_L4_FRAME_TYPE_IPV4;
+    d->l4ProtocolNumber = v6 ? 41 : 4;
+    d->l4Size = v6 ? 10 : 5;
+    break;
+  default:
+    d->l4FrameType = gen->config.tcp ? NT_L4_FRAME_TYPE_TCP : NT_L4_FRAME_TYPE_UDP;
+    d->l4ProtocolNumber = gen->config.tcp ? 6 : 17;
+    d->l4Size = gen->config.tcp ? 5 : 2;
+    break;
+  }
+  d->l3FrameType = v6 ? NT_L3_FRAME_TYPE_IPv6 : NT_L3_FRAME_TYPE_IPv4;
+  d->l2FrameType = NT_L2_FRAME_TYPE_ETHER_II;
+  d->l3Size = v6 ? 10 : 5;
+  d->mplsCount = gen->config.mpls;
+  d->vlanCount = gen->config.vlans;
+  d->frameLarge = wireLength > 1518;
+  d->frameSmall = wireLength < 64;
+  d->color = flow & 0x3F;
+  d->l5Offset = gen->l5;
+  d->l4Offset = gen->l4;
+  d->l3Offset = gen->l3;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Initialize a segment generator
+ *
+ * @param[out] gen     Segment generator
+ * @param[in]  config  Configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         Invalid configuration
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_seggen_init(NtSegGen_t* gen, const NtSegGenConfig_t* config)
+{
+  static const NtSegGenSize_t imix[] = { { 64, 7 }, { 570, 4 }, { 1518, 1 } };
+  static const uint8_t descrLength[] = { 16, 32, 32, 40, 18, 22, 22 };
+  uint32_t i, sum = 0;
+  memset(gen, 0, sizeof(*gen));
+  if (config != NULL) {
+    gen->config = *config;
+  }
+  if (gen->config.sizes == NULL || gen->config.numSizes == 0) {
+    gen->config.sizes = imix;
+    gen->config.numSizes = 3;
+  }
+  if (gen->config.flows == 0) {
+    gen->config.flows = 1024;
+  }
+  if (gen->config.tsStep == 0) {
+    gen->config.tsStep = 100;
+  }
+  if (gen->config.numPorts == 0) {
+    gen->config.numPorts = 1;
+  }
+  if (gen->config.seed == 0) {
+    gen->config.seed = 1;
+  }
+  if ((uint32_t)gen->config.descr > NT_SEGGEN_DESCR_DYN3 || gen->config.vlans > 3 || gen->config.mpls > 7 ||
+      (uint32_t)gen->config.tunnel > NT_SEGGEN_TUNNEL_IPINIP || gen->config.numPorts > 32) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  gen->descrLength = descrLength[gen->config.descr];
+  _nt_seggen_build_template(gen);
+  gen->cumWeights = (uint32_t*)malloc(gen->config.numSizes * sizeof(uint32_t));
+  gen->lengths = (uint16_t*)malloc(gen->config.numSizes * sizeof(uint16_t));
+  if (gen->cumWeights == NULL || gen->lengths == NULL) {
+    free(gen->cumWeights);
+    free(gen->lengths);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (i = 0; i < gen->config.numSizes; i++) {
+    uint32_t length = gen->config.sizes[i].length;
+    // Room for the headers and the FCS, and within the 14-bit capture length
+    if (length < gen->hdrLength + 4) {
+      length = gen->hdrLength + 4;
+    }
+    if (length > 16383 - 7 - gen->descrLength) {
+      length = 16383 - 7 - gen->descrLength;
+    }
+    sum += gen->config.sizes[i].weight;
+    gen->cumWeights[i] = sum;
+    gen->lengths[i] = (uint16_t)length;
+  }
+  if (sum == 0) {
+    free(gen->cumWeights);
+    free(gen->lengths);
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  gen->totalWeight = sum;
+  gen->rng = gen->config.seed;
+  gen->ts = gen->config.timestamp;
+  for (i = 0; i < 64; i++) {
+    gen->colorMap[i] = (uint8_t)i;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Free a segment generator
+ *
+ * @param[in] gen  Segment generator
+ */
+static NT_INLINE void _nt_seggen_free(NtSegGen_t* gen)
+{
+  free(gen->cumWeights);
+  free(gen->lengths);
+  memset(gen, 0, sizeof(*gen));
+}
+
+/**
+ * @brief Write packets to a buffer
+ *
+ * Writes whole packets until the next one does not fit. Packets are 8-byte
+ * aligned. Has the signature of @ref NtEmuFill_t with the generator as
+ * context. The packet that does not fit is the first one written by the
+ * next call.
+ *
+ * @param[in]  ctx   Segment generator
+ * @param[in]  buf   Where to write the packets - must be 8-byte aligned
+ * @param[in]  size  Room at buf
+ * @param[out] used  Bytes written
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_END_OF_FILE       The configured number of packets has been generated
+ * @retval NT_ERROR_INVALID_PARAMETER  Not even the first packet fits - used is 0
+ */
+static NT_INLINE int _nt_seggen_fill(void* ctx, uint8_t* buf, uint32_t size, uint32_t* used)
+{
+  NtSegGen_t* gen = (NtSegGen_t*)ctx;
+  uint32_t off = 0;
+  while (gen->config.count == 0 || gen->pkts < gen->config.count) {
+    uint32_t wireLength, capLength, flow, hash, port;
+    uint8_t* p = buf + off;
+    if (gen->nextLength == 0) {
+      uint32_t w = (uint32_t)(_nt_seggen_rand(gen) % gen->totalWeight), i = 0;
+      while (gen->cumWeights[i] <= w) {
+        i++;
+      }
+      gen->nextLength = gen->lengths[i];
+    }
+    wireLength = gen->nextLength;
+    capLength = (gen->descrLength + wireLength + 7) & ~7U;
+    if (gen->config.descr >= NT_SEGGEN_DESCR_DYN1) {
+      // Dynamic descriptors have no wire length field - it is the capture length minus the descriptor
+      wireLength = capLength - gen->descrLength;
+    }
+    if (off + capLength > size) {
+      break;
+    }
+    gen->nextLength = 0;
+    flow = (uint32_t)(_nt_seggen_rand(gen) % gen->config.flows);
+    port = flow % gen->config.numPorts;
+    memset(p, 0, gen->descrLength);
+    hash = _nt_seggen_frame(gen, p + gen->descrLength, wireLength, flow);
+    switch (gen->config.descr) {
+    case NT_SEGGEN_DESCR_DYN1:
+    case NT_SEGGEN_DESCR_DYN2: {
+      NtDyn2Descr_t* d = (NtDyn2Descr_t*)p;
+      d->capLength = capLength;
+      d->offset0 = gen->l3;
+      d->offset1 = gen->l4;
+      d->ipProtocol = gen->tmpl[gen->config.ipv6 ? gen->l3 + 6 : gen->l3 + 9];
+      d->rxPort = port;
+      d->ntDynDescr = 1;
+      d->timestamp = gen->ts;
+      d->offset2 = gen->l5;
+      if (gen->config.descr == NT_SEGGEN_DESCR_DYN1) {
+        d->descrFormat = 1;
+        d->descrLength = 18;
+        ((NtDyn1Descr_t*)p)->color = flow & 0x3F;
+      } else {
+        d->descrFormat = 2;
+        d->descrLength = 22;
+        // The hash above the traditional 14-bit color
+        d->color = (uint64_t)hash << 14 | (flow & 0x3FFF);
+      }
+      break;
+    }
+    case NT_SEGGEN_DESCR_DYN3: {
+      NtDyn3Descr_t* d = (NtDyn3Descr_t*)p;
+      d->capLength = capLength;
+      d->wireLength = wireLength;
+      d->color_lo = hash & 0x3FFF;
+      d->rxPort = port;
+      d->descrFormat = 3;
+      d->descrLength = 22;
+      d->ntDynDescr = 1;
+      d->timestamp = gen->ts;
+      d->color_hi = hash >> 14;
+      d->offset0 = gen->l3;
+      d->offset1 = gen->l4;
+      break;
+    }
+    default: {
+      NtStd0Descr_t* d = (NtStd0Descr_t*)p;
+      d->timestamp = gen->ts;
+      d->storedLength = capLength;
+      d->IPCsumOk = 1;
+      d->TCPCsumOk = gen->config.tcp && gen->config.tunnel == NT_SEGGEN_TUNNEL_NONE;
+      d->UDPCsumOk = !d->TCPCsumOk;
+      d->rxPort = port;
+      d->wireLength = wireLength;
+      d->TCPFrame = d->TCPCsumOk;
+      d->UDPFrame = gen->config.tunnel == NT_SEGGEN_TUNNEL_GTPV1_U || (!gen->config.tcp && gen->config.tunnel == NT_SEGGEN_TUNNEL_NONE);
+      d->IPFrame = 1;
+      d->descriptorType = 1;
+      if (gen->config.descr != NT_SEGGEN_DESCR_STD0) {
+        d->extensionLength = (gen->descrLength - 16) / 8;
+        d->extensionFormat = gen->config.descr == NT_SEGGEN_DESCR_EXT7 ? 7 : gen->config.descr == NT_SEGGEN_DESCR_EXT8 ? 8 : 9;
+        _nt_seggen_ext(gen, (NtExt7DescrRx_t*)p, hash, flow, wireLength);
+      }
+      if (gen->config.descr == NT_SEGGEN_DESCR_EXT9) {
+        NtExt9DescrRx_t* d9 = (NtExt9DescrRx_t*)p;
+        d9->tunnelType = gen->config.tunnel == NT_SEGGEN_TUNNEL_GTPV1_U ? NT_TUNNELTYPE_GTPV1_U_GPDU :
+                         gen->config.tunnel == NT_SEGGEN_TUNNEL_IPINIP ? NT_TUNNELTYPE_IPINIP : NT_TUNNELTYPE_OTHER;
+        d9->tunnelHdrSize = gen->config.tunnel == NT_SEGGEN_TUNNEL_GTPV1_U ? 2 : gen->config.tunnel == NT_SEGGEN_TUNNEL_GRE ? 1 : 0;
+        d9->dedupCrc = _nt_seggen_mix(hash ^ (uint32_t)gen->pkts) & 0xFFFFFF;
+        if (gen->config.tunnel != NT_SEGGEN_TUNNEL_NONE) {
+          d9->innerL3Offset = gen->il3;
+          d9->innerL4Offset = gen->il4;
+          d9->innerL5Offset = gen->il5;
+          d9->innerL4FrameType = gen->config.tcp ? NT_L4_FRAME_TYPE_TCP : NT_L4_FRAME_TYPE_UDP;
+          d9->innerL3FrameType = gen->config.ipv6 ? NT_L3_FRAME_TYPE_IPv6 : NT_L3_FRAME_TYPE_IPv4;
+        }
+      }
+      break;
+    }
+    }
+    gen->ts += gen->config.tsStep + (gen->config.tsJitter ? _nt_seggen_rand(gen) % (gen->config.tsJitter + 1) : 0);
+    gen->pkts++;
+    off += capLength;
+  }
+  *used = off;
+  if (off == 0) {
+    return gen->config.count != 0 && gen->pkts >= gen->config.count ? NT_STATUS_END_OF_FILE : NT_ERROR_INVALID_PARAMETER;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Fill a buffer with packets and initialize a segment for it
+ *
+ * @param[in]  gen        Segment generator
+ * @param[in]  buf        Buffer - must be 8-byte aligned
+ * @param[in]  size       Size of the buffer
+ * @param[out] segNetBuf  Segment NtNetBuf_t structure to initialize
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_END_OF_FILE       The configured number of packets has been generated
+ * @retval NT_ERROR_INVALID_PARAMETER  Not even the first packet fits - the segment is empty
+ */
+static NT_INLINE int _nt_seggen_segment(NtSegGen_t* gen, void* buf, uint32_t size, struct NtNetBuf_s* segNetBuf)
+{
+  uint32_t used;
+  int status = _nt_seggen_fill(gen, (uint8_t*)buf, size, &used);
+  _nt_net_initialize_segment_netbuf(used, buf, 0, segNetBuf);
+  segNetBuf->tsType = NT_TIMESTAMP_TYPE_NATIVE_UNIX;
+  segNetBuf->netIf = NT_NET_INTERFACE_SEGMENT;
+  segNetBuf->colorMap = gen->colorMap;
+  segNetBuf->streamInfo = _nt_seggen_stream_info();
+  return status;
+}
+
+#endif // __SEGGEN_H__
@@ -0,0 +1,319 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains the segment index. The segment index walks
+ * all packets of a segment once and decodes the most used descriptor
+ * fields into a struct-of-arrays, so that later processing stages can
+ * work column by column without touching the descriptor bit fields again.
+ *
+ * The field extraction uses AVX2 gathers when compiled with AVX2 support
+ * and plain C otherwise. The fields lie at a different offset in every
+ * descriptor, and without gathers a vector path would load them one at a
+ * time like the plain C loop does.
+ *
+ */
+#ifndef __SEGINDEX_H__
+#define __SEGINDEX_H__
+
+#include "nt.h"
+#include "compat.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Segment index. The columns are indexed by the packet number within
+ * the indexed part of the segment.
+ */
+typedef struct NtSegIndex_s {
+  uint32_t capacity;        //!< Number of entries in each column
+  uint32_t count;           //!< Number of packets indexed by the last call to @ref _nt_segindex_build
+  uint64_t next;            //!< Offset of the first packet not indexed. Equals the segment length when the whole segment has been indexed
+  enum NtPacketDescriptorType_e descrType; //!< Descriptor type of the indexed packets
+  uint8_t descrFormat;      //!< Descriptor format of the indexed packets. See @ref NT_NET_GET_PKT_DESCRIPTOR_FORMAT
+  uint32_t *offset;         //!< Offset of the packet descriptor within the segment
+  uint16_t *capLength;      //!< Stored length including the descriptor. See @ref NT_NET_GET_PKT_CAP_LENGTH
+  uint64_t *timestamp;      //!< Packet time stamp. See @ref NT_NET_GET_PKT_TIMESTAMP
+  uint8_t *rxPort;          //!< Receiving port including the port offset. See @ref NT_NET_GET_PKT_RXPORT
+  uint32_t *hash;           //!< Hash word: value in bits 23:0, type in bits 28:24 and valid in bit 31. Only set for extended descriptor 7, 8 and 9 - otherwise 0
+  void *mem;                //!< Column memory allocated by @ref _nt_segindex_alloc
+} NtSegIndex_t;
+
+/** @def NT_SEGINDEX_HASH
+ *  @brief Get the hash value from a hash index word
+ *  @hideinitializer
+ */
+#define NT_SEGINDEX_HASH(_word_)        ((_word_) & 0xFFFFFF)
+/** @def NT_SEGINDEX_HASH_TYPE
+ *  @brief Get the hash key type from a hash index word
+ *  @hideinitializer
+ */
+#define NT_SEGINDEX_HASH_TYPE(_word_)   (((_word_) >> 24) & 0x1F)
+/** @def NT_SEGINDEX_HASH_VALID
+ *  @brief Get the hash valid bit from a hash index word
+ *  @hideinitializer
+ */
+#define NT_SEGINDEX_HASH_VALID(_word_)  ((_word_) >> 31)
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Location of the indexed fields within a descriptor. A stream always
+ * delivers one descriptor type, so the layout is resolved once per segment.
+ */
+struct _NtSegIndexLayout_s {
+  int dyn;             // 1 for dynamic descriptors
+  uint32_t tsOffset;   // Byte offset of the 64-bit time stamp
+  uint32_t portOffset; // Byte offset of the 32-bit word holding rxPort
+  uint32_t portShift;  // Bit position of rxPort within that word
+  uint32_t portMask;   // Width mask of rxPort
+  uint32_t hashOffset; // Byte offset of the hash word - 0 if no hash is present
+};
+
+static NT_INLINE int _nt_segindex_layout(struct NtNetBuf_s * pktNetBuf, struct _NtSegIndexLayout_s * layout)
+{
+  memset(layout, 0, sizeof(*layout));
+  switch (NT_NET_GET_PKT_DESCRIPTOR_TYPE(pktNetBuf)) {
+  case NT_PACKET_DESCRIPTOR_TYPE_DYNAMIC:
+    // Dynamic descriptor 1, 2 and 3 share the first 16 bytes layout
+    if (_NT_NET_GET_PKT_DESCR_FORMAT_DYN(pktNetBuf) < 1 || _NT_NET_GET_PKT_DESCR_FORMAT_DYN(pktNetBuf) > 3) {
+      return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+    }
+    layout->dyn = 1;
+    layout->tsOffset = 8;
+    layout->portOffset = 4;
+    layout->portShift = 10;
+    layout->portMask = 0x3F;
+    return NT_SUCCESS;
+  case NT_PACKET_DESCRIPTOR_TYPE_NT_EXTENDED:
+    if (_NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) < 7 || _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) > 9) {
+      return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+    }
+    layout->hashOffset = sizeof(NtStd0Descr_t);
+    /* fall through */
+  case NT_PACKET_DESCRIPTOR_TYPE_NT:
+    layout->tsOffset = 0;
+    layout->portOffset = 8;
+    layout->portShift = 24;
+    layout->portMask = 0x1F;
+    return NT_SUCCESS;
+  default:
+    return NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR;
+  }
+}
+
+static NT_INLINE void _nt_segindex_extract_scalar(NtSegIndex_t * idx, const uint8_t * seg, const struct _NtSegIndexLayout_s * layout, uint8_t portOffset, uint32_t first)
+{
+  uint32_t i;
+  for (i = first; i < idx->count; i++) {
+    const uint8_t* pkt = seg + idx->offset[i];
+    uint32_t word;
+    memcpy(&idx->timestamp[i], pkt + layout->tsOffset, sizeof(uint64_t));
+    memcpy(&word, pkt + layout->portOffset, sizeof(uint32_t));
+    idx->rxPort[i] = (uint8_t)(((word >> layout->portShift) & layout->portMask) + portOffset);
+    if (layout->hashOffset) {
+      memcpy(&idx->hash[i], pkt + layout->hashOffset, sizeof(uint32_t));
+    } else {
+      idx->hash[i] = 0;
+    }
+  }
+}
+
+#if defined(__AVX2__)
+static NT_INLINE uint32_t _nt_segindex_extract_simd(NtSegIndex_t * idx, const uint8_t * seg, const struct _NtSegIndexLayout_s * layout, uint8_t portOffset)
+{
+  const __m256i mask = _mm256_set1_epi32((int)layout->portMask);
+  const __m256i portAdd = _mm256_set1_epi32(portOffset);
+  uint32_t i;
+  for (i = 0; i + 8 <= idx->count; i += 8) {
+    __m256i offs = _mm256_loadu_si256((const __m256i*)&idx->offset[i]);
+    __m128i offsLo = _mm256_castsi256_si128(offs);
+    __m128i offsHi = _mm256_extracti128_si256(offs, 1);
+    __m256i word, ports;
+    __m128i p16, p8;
+    _mm256_storeu_si256((__m256i*)&idx->timestamp[i],
+                        _mm256_i32gather_epi64((const long long*)(seg + layout->tsOffset), offsLo, 1));
+    _mm256_storeu_si256((__m256i*)&idx->timestamp[i + 4],
+                        _mm256_i32gather_epi64((const long long*)(seg + layout->tsOffset), offsHi, 1));
+    word = _mm256_i32gather_epi32((const int*)(seg + layout->portOffset), offs, 1);
+    ports = _mm256_add_epi32(_mm256_and_si256(_mm256_srlv_epi32(word, _mm256_set1_epi32((int)layout->portShift)), mask), portAdd);
+    p16 = _mm_packus_epi32(_mm256_castsi256_si128(ports), _mm256_extracti128_si256(ports, 1));
+    p8 = _mm_packus_epi16(p16, p16);
+    _mm_storel_epi64((__m128i*)&idx->rxPort[i], p8);
+    if (layout->hashOffset) {
+      _mm256_storeu_si256((__m256i*)&idx->hash[i],
+                          _mm256_i32gather_epi32((const int*)(seg + layout->hashOffset), offs, 1));
+    } else {
+      _mm256_storeu_si256((__m256i*)&idx->hash[i], _mm256_setzero_si256());
+    }
+  }
+  return i;
+}
+#endif
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Allocate the columns of a segment index
+ *
+ * @param[out] idx       Segment index to initialize
+ * @param[in]  capacity  Maximum number of packets indexed per call to @ref _nt_segindex_build
+ *
+ * @retval  NT_SUCCESS                         Success
+ * @retval  NT_ERROR_MEMORY_ALLOCATION_FAILED  The columns could not be allocated
+ */
+static NT_INLINE int _nt_segindex_alloc(NtSegIndex_t * idx, uint32_t capacity)
+{
+  // Round up to a multiple of 8 entries, so every column starts 32-byte aligned
+  size_t entries = ((size_t)capacity + 7) & ~(size_t)7;
+  size_t size = entries * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+  uint8_t* mem;
+  memset(idx, 0, sizeof(*idx));
+#ifdef _MSC_VER
+  mem = (uint8_t*)_aligned_malloc(size, 64);
+#else
+  if (posix_memalign((void**)&mem, 64, size) != 0) {
+    mem = NULL;
+  }
+#endif
+  if (mem == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  idx->mem = mem;
+  idx->capacity = capacity;
+  idx->timestamp = (uint64_t*)mem;
+  idx->offset = (uint32_t*)(mem + entries * sizeof(uint64_t));
+  idx->hash = (uint32_t*)(mem + entries * (sizeof(uint64_t) + sizeof(uint32_t)));
+  idx->capLength = (uint16_t*)(mem + entries * (sizeof(uint64_t) + 2 * sizeof(uint32_t)));
+  idx->rxPort = (uint8_t*)(mem + entries * (sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t)));
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Free the columns of a segment index
+ *
+ * @param[in] idx  Segment index allocated with @ref _nt_segindex_alloc
+ */
+static NT_INLINE void _nt_segindex_free(NtSegIndex_t * idx)
+{
+#ifdef _MSC_VER
+  _aligned_free(idx->mem);
+#else
+  free(idx->mem);
+#endif
+  memset(idx, 0, sizeof(*idx));
+}
+
+/**
+ * @brief Index the packets of a segment
+ *
+ * This function walks the segment from "startOffset" and indexes up to
+ * "capacity" packets. The packet offsets and lengths are found in one
+ * sequential pass, after which the time stamp, port and hash columns are
+ * extracted for all packets in a vectorized pass. If the segment holds more
+ * packets than the index capacity, idx->next is the offset to continue from.
+ *
+ * All packets in the segment must use the same descriptor. Supported
+ * descriptors are NT standard, extended 7, 8, 9 and dynamic 1, 2, 3.
+ *
+ * @param[in,out] idx          Segment index
+ * @param[in]     segNetBuf    Segment NtNetBuf_s * structure
+ * @param[in]     startOffset  Offset of the first packet to index. Use 0 for a new segment
+ *
+ * @retval  NT_SUCCESS                                Success - idx->count packets have been indexed
+ * @retval  NT_ERROR_UNSUPPORTED_EXTENDED_DESCRIPTOR  The segment descriptor type is not supported
+ */
+static NT_INLINE int _nt_segindex_build(NtSegIndex_t * idx, struct NtNetBuf_s * segNetBuf, uint64_t startOffset)
+{
+  const uint8_t* seg = (const uint8_t*)segNetBuf->hHdr;
+  uint64_t offset = startOffset;
+  uint64_t length = segNetBuf->length;
+  struct _NtSegIndexLayout_s layout;
+  struct NtNetBuf_s pktNetBuf;
+  uint32_t count = 0;
+  uint32_t first = 0;
+  int status;
+
+  idx->count = 0;
+  idx->next = startOffset;
+  if (startOffset >= length) {
+    return NT_SUCCESS;
+  }
+  pktNetBuf.hHdr = (NtNetBufHdr_t)(seg + startOffset);
+  status = _nt_segindex_layout(&pktNetBuf, &layout);
+  if (status != NT_SUCCESS) {
+    return status;
+  }
+  idx->descrType = (enum NtPacketDescriptorType_e)NT_NET_GET_PKT_DESCRIPTOR_TYPE(&pktNetBuf);
+  idx->descrFormat = (uint8_t)NT_NET_GET_PKT_DESCRIPTOR_FORMAT(&pktNetBuf);
+
+  // Sequential pass - the next packet offset depends on the current length
+  if (layout.dyn) {
+    while (offset < length && count < idx->capacity) {
+      uint16_t capLength = (uint16_t)(((const NtDynDescr_t*)(seg + offset))->capLength);
+      idx->offset[count] = (uint32_t)offset;
+      idx->capLength[count++] = capLength;
+      offset += capLength;
+    }
+  } else {
+    while (offset < length && count < idx->capacity) {
+      uint16_t capLength = (uint16_t)(((const NtStd0Descr_t*)(seg + offset))->storedLength);
+      idx->offset[count] = (uint32_t)offset;
+      idx->capLength[count++] = capLength;
+      offset += capLength;
+    }
+  }
+  idx->count = count;
+  idx->next = offset;
+
+  // Column pass
+#if defined(__AVX2__)
+  first = _nt_segindex_extract_simd(idx, seg, &layout, segNetBuf->portOffset);
+#endif
+  _nt_segindex_extract_scalar(idx, seg, &layout, segNetBuf->portOffset, first);
+  return NT_SUCCESS;
+}
+
+#endif // __SEGINDEX_H__
@@ -0,0 +1,384 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+
+/**
+ * @file
+ *
+ * This header file contains reference counted segments. A segment
+ * received by one thread can be shared by several worker threads without
+ * copying the packets: the receiving thread adds the segment to a pool and
+ * takes a reference per worker it hands packets to, and every worker drops
+ * its reference when done.
+ *
+ * @ref NT_NetRxRelease must be called by the thread that received the
+ * segment and in the order the segments were received. The pool therefore
+ * never releases a segment from a worker thread. When the last reference of
+ * a segment is dropped the segment is marked as done, and the receiving
+ * thread releases all done segments from the oldest one and up the next
+ * time it calls @ref _nt_segref_add, @ref _nt_segref_rx_get or
+ * @ref _nt_segref_reclaim. Workers may finish in any order.
+ *
+ */
+#ifndef __SEGREF_H__
+#define __SEGREF_H__
+
+#include "nt.h"
+#include "atomic.h"
+
+/**
+ * Release a segment - called by the receiving thread only
+ */
+typedef int (*NtSegRefRelease_t)(void *ctx, NtNetBuf_t hNetBuf);
+
+/**
+ * Reference counted segment. Aligned to a cache line, so workers
+ * dropping references to different segments do not share cache lines.
+ */
+typedef struct NtSegRef_s {
+  NtNetBuf_t hNetBuf;       //!< The segment - valid while a reference is held
+#ifndef DOXYGEN_INTERNAL_ONLY
+  volatile uint32_t refs;
+  uint32_t unused;
+  uint64_t seq;             // Segment number within the pool
+  struct NtSegRefPool_s *pool;
+  uint8_t pad[NT_CACHE_LINE_SIZE - sizeof(NtNetBuf_t) - 2 * sizeof(uint32_t) - sizeof(uint64_t) - sizeof(void*)];
+#endif
+} NtSegRef_t;
+
+/**
+ * Packet reference - a packet within a reference counted segment
+ */
+typedef struct NtSegRefPkt_s {
+  NtSegRef_t *ref;          //!< Segment holding the packet
+  NtNetBufHdr_t hHdr;       //!< Packet descriptor within the segment
+} NtSegRefPkt_t;
+
+/**
+ * Segment pool statistics
+ */
+typedef struct NtSegRefStat_s {
+  uint64_t segments;        //!< Segments added to the pool
+  uint64_t released;        //!< Segments released
+  uint32_t held;            //!< Segments held now
+  uint32_t maxHeld;         //!< Maximum number of segments held at the same time
+  uint64_t outOfOrder;      //!< Segments whose last reference was dropped before an older segment was done
+  uint64_t poolFull;        //!< Number of times a segment could not be added because all slots were in use
+} NtSegRefStat_t;
+
+/**
+ * Segment pool
+ */
+typedef struct NtSegRefPool_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtSegRefRelease_t release;
+  void *ctx;
+  NtSegRef_t *slots;
+  uint32_t numSlots;
+  uint64_t head;             // Segments added
+  volatile uint64_t tail;    // Segments released
+  volatile uint64_t outOfOrder;
+  NtSegRefStat_t stat;
+#endif
+} NtSegRefPool_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE int _nt_segref_rx_release_cb(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return NT_NetRxRelease((NtNetStreamRx_t)ctx, hNetBuf);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Open a segment pool
+ *
+ * @param[out] pool         Segment pool
+ * @param[in]  numSegments  Maximum number of segments held at the same time
+ * @param[in]  release      Function releasing a segment
+ * @param[in]  ctx          Context passed to the release function
+ *
+ * @retval NT_SUCCESS                        Success
+ * @retval NT_ERROR_INVALID_PARAMETER        Invalid parameter
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED Out of memory
+ */
+static NT_INLINE int _nt_segref_open(NtSegRefPool_t* pool, uint32_t numSegments, NtSegRefRelease_t release, void* ctx)
+{
+  memset(pool, 0, sizeof(*pool));
+  if (numSegments == 0 || release == NULL) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+#ifdef _MSC_VER
+  pool->slots = (NtSegRef_t*)_aligned_malloc(numSegments * sizeof(NtSegRef_t), NT_CACHE_LINE_SIZE);
+#else
+  if (posix_memalign((void**)&pool->slots, NT_CACHE_LINE_SIZE, numSegments * sizeof(NtSegRef_t)) != 0) {
+    pool->slots = NULL;
+  }
+#endif
+  if (pool->slots == NULL) {
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  memset(pool->slots, 0, numSegments * sizeof(NtSegRef_t));
+  pool->numSlots = numSegments;
+  pool->release = release;
+  pool->ctx = ctx;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Open a segment pool for the segments of an RX stream
+ *
+ * The segments are released with @ref NT_NetRxRelease. The stream is not
+ * closed by @ref _nt_segref_close.
+ *
+ * @param[out] pool         Segment pool
+ * @param[in]  numSegments  Maximum number of segments held at the same time
+ * @param[in]  hStream      RX stream opened with NT_NET_INTERFACE_SEGMENT
+ *
+ * @retval See @ref _nt_segref_open
+ */
+static NT_INLINE int _nt_segref_rx_open(NtSegRefPool_t* pool, uint32_t numSegments, NtNetStreamRx_t hStream)
+{
+  return _nt_segref_open(pool, numSegments, _nt_segref_rx_release_cb, (void*)hStream);
+}
+
+/**
+ * @brief Release the done segments in order - receiving thread only
+ *
+ * Releases segments from the oldest one until a segment that is still
+ * referenced is found.
+ *
+ * @param[in] pool  Segment pool
+ *
+ * @retval NT_SUCCESS  Success
+ * @retval otherwise   Error returned by the release function. The segment is still held
+ */
+static NT_INLINE int _nt_segref_reclaim(NtSegRefPool_t* pool)
+{
+  while (pool->tail != pool->head) {
+    NtSegRef_t* ref = &pool->slots[pool->tail % pool->numSlots];
+    int status;
+    if (_nt_atomic_load_acquire_u32(&ref->refs) != 0) {
+      break;
+    }
+    if ((status = pool->release(pool->ctx, ref->hNetBuf)) != NT_SUCCESS) {
+      return status;
+    }
+    ref->hNetBuf = NULL;
+    pool->stat.released++;
+    _nt_atomic_store_release_u64(&pool->tail, pool->tail + 1);
+  }
+  return NT_SUCCESS;
+}
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+/*
+ * Put a segment in the next slot - the pool must not be full
+ */
+static NT_INLINE NtSegRef_t* _nt_segref_insert(NtSegRefPool_t* pool, NtNetBuf_t hNetBuf)
+{
+  NtSegRef_t* slot = &pool->slots[pool->head % pool->numSlots];
+  uint32_t held;
+  slot->hNetBuf = hNetBuf;
+  slot->seq = pool->head;
+  slot->pool = pool;
+  _nt_atomic_store_release_u32(&slot->refs, 1);
+  pool->head++;
+  pool->stat.segments++;
+  held = (uint32_t)(pool->head - pool->tail);
+  if (held > pool->stat.maxHeld) {
+    pool->stat.maxHeld = held;
+  }
+  return slot;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Add a segment to the pool - receiving thread only
+ *
+ * The segment gets one reference owned by the caller. Take a reference
+ * for every worker the segment or its packets are handed to with
+ * @ref _nt_segref_hold, and drop the reference of the caller with
+ * @ref _nt_segref_drop when done handing out.
+ *
+ * @param[in]  pool     Segment pool
+ * @param[in]  hNetBuf  Segment
+ * @param[out] ref      Reference counted segment
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  All slots hold segments still referenced - the segment is not added
+ * @retval otherwise           Error returned by the release function
+ */
+static NT_INLINE int _nt_segref_add(NtSegRefPool_t* pool, NtNetBuf_t hNetBuf, NtSegRef_t** ref)
+{
+  int status;
+  if ((status = _nt_segref_reclaim(pool)) != NT_SUCCESS) {
+    return status;
+  }
+  if (pool->head - pool->tail == pool->numSlots) {
+    pool->stat.poolFull++;
+    return NT_STATUS_TRYAGAIN;
+  }
+  *ref = _nt_segref_insert(pool, hNetBuf);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Receive a segment from an RX stream into the pool - receiving thread only
+ *
+ * Done segments are released first. No segment is received if all slots
+ * are in use, so the stream is never read into a segment the pool cannot
+ * hold.
+ *
+ * @param[in]  pool     Segment pool opened with @ref _nt_segref_rx_open
+ * @param[out] ref      Reference counted segment with one reference owned by the caller
+ * @param[in]  timeout  Time to wait for data in milliseconds
+ *
+ * @retval NT_SUCCESS          Success
+ * @retval NT_STATUS_TRYAGAIN  All slots hold segments still referenced
+ * @retval otherwise           Status returned by @ref NT_NetRxGet or @ref NT_NetRxRelease
+ */
+static NT_INLINE int _nt_segref_rx_get(NtSegRefPool_t* pool, NtSegRef_t** ref, int timeout)
+{
+  NtNetBuf_t hNetBuf;
+  int status;
+  if ((status = _nt_segref_reclaim(pool)) != NT_SUCCESS) {
+    return status;
+  }
+  if (pool->head - pool->tail == pool->numSlots) {
+    pool->stat.poolFull++;
+    return NT_STATUS_TRYAGAIN;
+  }
+  if ((status = NT_NetRxGet((NtNetStreamRx_t)pool->ctx, &hNetBuf, timeout)) != NT_SUCCESS) {
+    return status;
+  }
+  // The slot checked above is still free - reclaiming again could fail and lose the segment
+  *ref = _nt_segref_insert(pool, hNetBuf);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Take references to a segment
+ *
+ * Must be called by a thread already holding a reference to the segment.
+ *
+ * @param[in] ref    Reference counted segment
+ * @param[in] count  Number of references to take
+ */
+static NT_INLINE void _nt_segref_hold(NtSegRef_t* ref, uint32_t count)
+{
+  (void)_nt_atomic_fetch_add_u32(&ref->refs, count);
+}
+
+/**
+ * @brief Drop a reference to a segment - any thread
+ *
+ * The segment and its packets must not be used after the last reference
+ * held by the thread has been dropped. The segment is released by the
+ * receiving thread when no references are left and all older segments
+ * have been released.
+ *
+ * @param[in] ref  Reference counted segment
+ */
+static NT_INLINE void _nt_segref_drop(NtSegRef_t* ref)
+{
+  // The slot may be reused as soon as the last reference is dropped
+  NtSegRefPool_t* pool = ref->pool;
+  uint64_t seq = ref->seq;
+  if (_nt_atomic_fetch_sub_u32(&ref->refs, 1) == 1) {
+    if (seq != _nt_atomic_load_acquire_u64(&pool->tail)) {
+      (void)_nt_atomic_fetch_add_u64(&pool->outOfOrder, 1);
+    }
+  }
+}
+
+/**
+ * @brief Build a packet NtNetBuf_s structure from a packet reference
+ *
+ * The packet macros can be used on the result while a reference to the
+ * segment is held.
+ *
+ * @param[in]  pkt        Packet reference
+ * @param[out] pktNetBuf  Packet NtNetBuf_s * structure
+ */
+static NT_INLINE void _nt_segref_build_pkt_netbuf(const NtSegRefPkt_t* pkt, struct NtNetBuf_s* pktNetBuf)
+{
+  memcpy((void*)pktNetBuf, (void*)pkt->ref->hNetBuf, sizeof(struct NtNetBuf_s));
+  pktNetBuf->hHdr = pkt->hHdr;
+  pktNetBuf->hPkt = (NtNetBufPkt_t)((uint8_t*)pkt->hHdr + NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+}
+
+/**
+ * @brief Get the pool statistics - receiving thread only
+ *
+ * @param[in]  pool  Segment pool
+ * @param[out] stat  Statistics
+ */
+static NT_INLINE void _nt_segref_get_stat(NtSegRefPool_t* pool, NtSegRefStat_t* stat)
+{
+  *stat = pool->stat;
+  stat->held = (uint32_t)(pool->head - pool->tail);
+  stat->outOfOrder = _nt_atomic_load_acquire_u64(&pool->outOfOrder);
+}
+
+/**
+ * @brief Close a segment pool - receiving thread only
+ *
+ * All segments still held are released, whether referenced or not. The
+ * workers must have stopped using them.
+ *
+ * @param[in] pool  Segment pool
+ */
+static NT_INLINE void _nt_segref_close(NtSegRefPool_t* pool)
+{
+  while (pool->tail != pool->head) {
+    (void)pool->release(pool->ctx, pool->slots[pool->tail % pool->numSlots].hNetBuf);
+    pool->tail++;
+  }
+#ifdef _MSC_VER
+  _aligned_free(pool->slots);
+#else
+  free(pool->slots);
+#endif
+  memset(pool, 0, sizeof(*pool));
+}
+
+#endif // __SEGREF_H__
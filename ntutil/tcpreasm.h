@@ -0,0 +1,1241 @@
+/*
+ *
+ * Copyright 2017 Napatech A/S. All Rights Reserved.
+ *
+ * 1. Copying, modification, and distribution of this file, or executable
+ * versions of this file, is governed by the terms of the Napatech Software
+ * license agreement under which this file was made available. If you do not
+ * agree to the terms of the license do not install, copy, access or
+ * otherwise use this file.
+ *
+ * 2. Under the Napatech Software license agreement you are granted a
+ * limited, non-exclusive, non-assignable, copyright license to copy, modify
+ * and distribute this file in conjunction with Napatech SmartNIC's and
+ * similar hardware manufactured or supplied by Napatech A/S.
+ *
+ * 3. The full Napatech Software license agreement is included in this
+ * distribution, please see "NP-0405 Napatech Software license
+ * agreement.pdf"
+ *
+ * 4. Redistributions of source code must retain this copyright notice,
+ * list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES, EXPRESS OR
+ * IMPLIED, AND NAPATECH DISCLAIMS ALL IMPLIED WARRANTIES INCLUDING ANY
+ * IMPLIED WARRANTY OF TITLE, MERCHANTABILITY, NONINFRINGEMENT, OR OF
+ * FITNESS FOR A PARTICULAR PURPOSE. TO THE EXTENT NOT PROHIBITED BY
+ * APPLICABLE LAW, IN NO EVENT SHALL NAPATECH BE LIABLE FOR PERSONAL INJURY,
+ * OR ANY INCIDENTAL, SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES WHATSOEVER,
+ * INCLUDING, WITHOUT LIMITATION, DAMAGES FOR LOSS OF PROFITS, CORRUPTION OR
+ * LOSS OF DATA, FAILURE TO TRANSMIT OR RECEIVE ANY DATA OR INFORMATION,
+ * BUSINESS INTERRUPTION OR ANY OTHER COMMERCIAL DAMAGES OR LOSSES, ARISING
+ * OUT OF OR RELATED TO YOUR USE OR INABILITY TO USE NAPATECH SOFTWARE OR
+ * SERVICES OR ANY THIRD PARTY SOFTWARE OR APPLICATIONS IN CONJUNCTION WITH
+ * THE NAPATECH SOFTWARE OR SERVICES, HOWEVER CAUSED, REGARDLESS OF THE THEORY
+ * OF LIABILITY (CONTRACT, TORT OR OTHERWISE) AND EVEN IF NAPATECH HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGES. SOME JURISDICTIONS DO NOT ALLOW
+ * THE EXCLUSION OR LIMITATION OF LIABILITY FOR PERSONAL INJURY, OR OF
+ * INCIDENTAL OR CONSEQUENTIAL DAMAGES, SO THIS LIMITATION MAY NOT APPLY TO YOU.
+ *
+ *
+
+ */
+/**
+ * @file
+ *
+ * This header file contains a TCP stream reassembler that delivers the
+ * payload of each direction of a connection in sequence order without
+ * copying it. In-order payload is referenced where it lies in its
+ * segment: every piece of payload holds a reference to the
+ * @ref NtSegRef_t of its segment, and the reference is dropped when the
+ * application has consumed the piece.
+ *
+ * Payload is copied to a pool of fixed-size chunks only when it arrives
+ * out of order, when the packet is passed without a segment reference,
+ * and when a piece has held its segment while the configured number of
+ * newer segments were added - the segment pool releases the segments in
+ * order, so a single idle connection would otherwise hold back every
+ * segment after it.
+ *
+ * The connections are kept in a @ref NtFlowTab_t keyed by the sorted
+ * addresses and ports, so both directions share the state, and idle
+ * connections are found with the timer wheel of @ref NtFlowAge_t. The
+ * connection state, the pieces and the chunks are allocated when the
+ * reassembler is opened, so no memory is allocated per packet.
+ *
+ * The application reads the in-order payload a piece at a time with
+ * @ref _nt_tcpreasm_view, or as a number of contiguous bytes with
+ * @ref _nt_tcpreasm_peek - joined in a scratch buffer only when they span
+ * pieces - and frees it with @ref _nt_tcpreasm_consume.
+ *
+ * Retransmitted bytes already delivered in order are ignored, and bytes
+ * already held out of order are kept. In-order data overlapping
+ * out-of-order data replaces it. A direction with data more than the
+ * configured number of bytes beyond the next expected byte skips the gap
+ * before its first out-of-order data, and the bytes lost are reported
+ * with the piece following the gap.
+ *
+ * @ref _nt_tcpreasm_bench measures the throughput and the memory per
+ * connection of the reassembler on a capture file.
+ *
+ */
+#ifndef __TCPREASM_H__
+#define __TCPREASM_H__
+
+#include "nt.h"
+#include "segref.h"
+#include "flowtab.h"
+#include "flowage.h"
+#include "capfile.h"
+#include "compat.h"
+#include "perf.h"
+
+/**
+ * TCP reassembly configuration. Zero selects the default value.
+ */
+typedef struct NtTcpReasmConfig_s {
+  uint32_t maxConnections;  //!< Connections tracked at the same time. Default is 16384
+  uint32_t pieces;          //!< Pieces of payload in the pool. Default is 8 per connection
+  uint32_t chunks;          //!< Chunks of copied payload in the pool. Default is 4 per connection
+  uint32_t chunkSize;       //!< Bytes per chunk - the most bytes of a piece. Default is 2048
+  uint32_t maxOutOfOrder;   //!< Bytes beyond the next expected byte of a direction before a gap is skipped. Default is 256 KB
+  uint32_t maxAge;          //!< Segments added after the segment of a piece before the piece is copied to a chunk. Must be below the number of segments of the pool. 0xFFFFFFFF never copies. Default is 4
+  uint32_t maxPeek;         //!< Most bytes joined by @ref _nt_tcpreasm_peek. Default is 64 KB
+  uint64_t timeout;         //!< Idle timeout in nanoseconds of stream time. Default is 60 s
+} NtTcpReasmConfig_t;
+
+/**
+ * TCP reassembly counters
+ */
+typedef struct NtTcpReasmStat_s {
+  uint64_t packets;         //!< TCP packets received
+  uint64_t connections;     //!< Connections created
+  uint64_t active;          //!< Connections tracked
+  uint64_t maxActive;       //!< Most connections tracked at the same time
+  uint64_t zeroCopyBytes;   //!< Payload bytes referenced in their segment
+  uint64_t copiedBytes;     //!< Payload bytes copied on arrival - out of order or without a segment reference
+  uint64_t agedBytes;       //!< Payload bytes copied for holding their segment longer than the maximum age
+  uint64_t peekBytes;       //!< Bytes joined by @ref _nt_tcpreasm_peek
+  uint64_t duplicateBytes;  //!< Payload bytes received before
+  uint64_t gaps;            //!< Gaps skipped
+  uint64_t gapBytes;        //!< Bytes lost in the skipped gaps
+  uint64_t truncated;       //!< Packets with payload beyond the captured bytes - the rest is lost
+  uint64_t invalid;         //!< Packets with inconsistent headers
+  uint64_t noResource;      //!< Packets not stored because the table or a pool was full
+  uint64_t piecesUsed;      //!< Pieces holding payload
+  uint64_t maxPiecesUsed;   //!< Most pieces holding payload at the same time
+  uint64_t chunksUsed;      //!< Chunks holding payload
+  uint64_t maxChunksUsed;   //!< Most chunks holding payload at the same time
+  uint64_t memory;          //!< Bytes allocated by the reassembler
+} NtTcpReasmStat_t;
+
+/**
+ * In-order payload of a direction
+ */
+typedef struct NtTcpReasmView_s {
+  const uint8_t *data;      //!< Payload - valid until it is consumed
+  uint32_t length;          //!< Bytes of data
+  uint32_t gap;             //!< Bytes lost right before data - 0 if data follows the data before it
+} NtTcpReasmView_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+#define _NT_TCPREASM_NONE 0xFFFFFFFFU
+
+#define _NT_TCPREASM_FIN 0x01
+#define _NT_TCPREASM_SYN 0x02
+#define _NT_TCPREASM_RST 0x04
+
+// Connection table key - the lower address and port first
+struct _NtTcpReasmKey_s {
+  uint8_t addr[2][16];
+  uint16_t port[2];
+  uint32_t ipv6;
+};
+
+struct _NtTcpReasmPiece_s {
+  const uint8_t *data;
+  NtSegRef_t *ref;           // Segment holding data, NULL if data is in a chunk
+  uint32_t chunk;            // Chunk holding data, _NT_TCPREASM_NONE if data is in a segment
+  uint32_t next;
+  uint32_t seq;              // Sequence number of the first byte
+  uint32_t length;
+  uint32_t gap;              // Bytes lost before the piece
+  uint32_t pinPrev;          // Pieces referencing a segment, oldest first
+  uint32_t pinNext;
+  uint32_t unused;
+};
+
+struct _NtTcpReasmDir_s {
+  uint32_t next;             // Sequence number of the next in-order byte
+  uint32_t head;             // In-order pieces
+  uint32_t tail;
+  uint32_t ooo;              // Out-of-order pieces by sequence number
+  uint32_t oooBytes;
+  uint32_t gap;              // Bytes lost before the next in-order piece
+  uint32_t finSeq;           // Sequence number of the FIN
+  uint8_t known;             // next is valid
+  uint8_t finSeen;
+};
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * TCP connection. Direction 0 is the sender of the first packet seen -
+ * the client when the connection is seen from its SYN.
+ */
+typedef struct NtTcpReasmConn_s {
+  void *user;               //!< Free for the application - NULL for a new connection
+  uint32_t pending[2];      //!< In-order payload bytes not consumed, per direction
+  uint8_t fin[2];           //!< Set when all payload up to the FIN of the direction is in order
+  uint8_t rst;              //!< Set when a RST has been seen
+#ifndef DOXYGEN_INTERNAL_ONLY
+  uint8_t origin;            // Key order of direction 0
+  struct _NtTcpReasmDir_s dir[2];
+#endif
+} NtTcpReasmConn_t;
+
+/**
+ * TCP reassembler. Must only be used by the thread adding the segments to
+ * the segment pool.
+ */
+typedef struct NtTcpReasm_s {
+#ifndef DOXYGEN_INTERNAL_ONLY
+  NtTcpReasmConfig_t config;
+  NtFlowTab_t tab;
+  NtFlowAge_t age;
+  struct _NtTcpReasmPiece_s *pieces;
+  uint32_t *freePieces;      // Stack of free pieces
+  uint32_t numFreePieces;
+  uint8_t *chunks;
+  uint32_t *freeChunks;      // Stack of free chunks
+  uint32_t numFreeChunks;
+  uint32_t pinHead;
+  uint32_t pinTail;
+  uint64_t newest;           // Number of the newest segment seen
+  uint8_t *scratch;          // Pieces joined by peek
+  void **expired;
+  NtTcpReasmStat_t stat;
+#endif
+} NtTcpReasm_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE uint8_t* _nt_tcpreasm_chunk(const NtTcpReasm_t* tcp, uint32_t index)
+{
+  return tcp->chunks + (uint64_t)index * tcp->config.chunkSize;
+}
+
+static NT_INLINE uint32_t _nt_tcpreasm_rd32(const uint8_t* p)
+{
+  return ((uint32_t)_nt_hashref_rd16(p) << 16) | _nt_hashref_rd16(p + 2);
+}
+
+static NT_INLINE void _nt_tcpreasm_pin(NtTcpReasm_t* tcp, uint32_t index)
+{
+  struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+  p->pinNext = _NT_TCPREASM_NONE;
+  p->pinPrev = tcp->pinTail;
+  if (tcp->pinTail != _NT_TCPREASM_NONE) {
+    tcp->pieces[tcp->pinTail].pinNext = index;
+  } else {
+    tcp->pinHead = index;
+  }
+  tcp->pinTail = index;
+}
+
+static NT_INLINE void _nt_tcpreasm_unpin(NtTcpReasm_t* tcp, uint32_t index)
+{
+  struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+  if (p->pinPrev != _NT_TCPREASM_NONE) {
+    tcp->pieces[p->pinPrev].pinNext = p->pinNext;
+  } else {
+    tcp->pinHead = p->pinNext;
+  }
+  if (p->pinNext != _NT_TCPREASM_NONE) {
+    tcp->pieces[p->pinNext].pinPrev = p->pinPrev;
+  } else {
+    tcp->pinTail = p->pinPrev;
+  }
+}
+
+static NT_INLINE uint32_t _nt_tcpreasm_alloc_chunk(NtTcpReasm_t* tcp)
+{
+  uint32_t used = tcp->config.chunks - tcp->numFreeChunks + 1;
+  if (used > tcp->stat.maxChunksUsed) {
+    tcp->stat.maxChunksUsed = used;
+  }
+  return tcp->freeChunks[--tcp->numFreeChunks];
+}
+
+/*
+ * Get a piece of payload - referenced in the segment of ref or, without
+ * ref, copied to a chunk. Returns _NT_TCPREASM_NONE if a pool is empty.
+ */
+static NT_INLINE uint32_t _nt_tcpreasm_alloc(NtTcpReasm_t* tcp, uint32_t seq, const uint8_t* data, uint32_t length, NtSegRef_t* ref)
+{
+  struct _NtTcpReasmPiece_s* p;
+  uint32_t index, used;
+  if (tcp->numFreePieces == 0 || (ref == NULL && tcp->numFreeChunks == 0)) {
+    return _NT_TCPREASM_NONE;
+  }
+  index = tcp->freePieces[--tcp->numFreePieces];
+  used = tcp->config.pieces - tcp->numFreePieces;
+  if (used > tcp->stat.maxPiecesUsed) {
+    tcp->stat.maxPiecesUsed = used;
+  }
+  p = &tcp->pieces[index];
+  p->next = _NT_TCPREASM_NONE;
+  p->seq = seq;
+  p->length = length;
+  p->gap = 0;
+  if (ref != NULL) {
+    _nt_segref_hold(ref, 1);
+    p->data = data;
+    p->ref = ref;
+    p->chunk = _NT_TCPREASM_NONE;
+    _nt_tcpreasm_pin(tcp, index);
+    tcp->stat.zeroCopyBytes += length;
+  } else {
+    p->chunk = _nt_tcpreasm_alloc_chunk(tcp);
+    p->ref = NULL;
+    p->data = _nt_tcpreasm_chunk(tcp, p->chunk);
+    memcpy(_nt_tcpreasm_chunk(tcp, p->chunk), data, length);
+    tcp->stat.copiedBytes += length;
+  }
+  return index;
+}
+
+static NT_INLINE void _nt_tcpreasm_free(NtTcpReasm_t* tcp, uint32_t index)
+{
+  struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+  if (p->ref != NULL) {
+    _nt_tcpreasm_unpin(tcp, index);
+    _nt_segref_drop(p->ref);
+  } else {
+    tcp->freeChunks[tcp->numFreeChunks++] = p->chunk;
+  }
+  tcp->freePieces[tcp->numFreePieces++] = index;
+}
+
+static NT_INLINE void _nt_tcpreasm_free_list(NtTcpReasm_t* tcp, uint32_t index)
+{
+  while (index != _NT_TCPREASM_NONE) {
+    uint32_t next = tcp->pieces[index].next;
+    _nt_tcpreasm_free(tcp, index);
+    index = next;
+  }
+}
+
+/*
+ * Copy the pieces that have held their segment for the maximum age to
+ * chunks, so the segment pool can release the segment
+ */
+static NT_INLINE void _nt_tcpreasm_age(NtTcpReasm_t* tcp)
+{
+  while (tcp->pinHead != _NT_TCPREASM_NONE && tcp->numFreeChunks != 0) {
+    uint32_t index = tcp->pinHead;
+    struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+    NtSegRef_t* ref = p->ref;
+    if (tcp->newest - ref->seq < tcp->config.maxAge) {
+      break;
+    }
+    p->chunk = _nt_tcpreasm_alloc_chunk(tcp);
+    memcpy(_nt_tcpreasm_chunk(tcp, p->chunk), p->data, p->length);
+    p->data = _nt_tcpreasm_chunk(tcp, p->chunk);
+    p->ref = NULL;
+    _nt_tcpreasm_unpin(tcp, index);
+    _nt_segref_drop(ref);
+    tcp->stat.agedBytes += p->length;
+  }
+}
+
+static NT_INLINE void _nt_tcpreasm_append(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir, uint32_t index)
+{
+  struct _NtTcpReasmDir_s* d = &conn->dir[dir];
+  struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+  p->next = _NT_TCPREASM_NONE;
+  p->gap = d->gap;
+  d->gap = 0;
+  if (d->tail != _NT_TCPREASM_NONE) {
+    tcp->pieces[d->tail].next = index;
+  } else {
+    d->head = index;
+  }
+  d->tail = index;
+  d->next = p->seq + p->length;
+  conn->pending[dir] += p->length;
+}
+
+/*
+ * Move the out-of-order pieces that have become in order to the in-order pieces
+ */
+static NT_INLINE void _nt_tcpreasm_drain(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir)
+{
+  struct _NtTcpReasmDir_s* d = &conn->dir[dir];
+  while (d->ooo != _NT_TCPREASM_NONE) {
+    uint32_t index = d->ooo, behind;
+    struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+    behind = d->next - p->seq;
+    if ((int32_t)behind < 0) {
+      break;
+    }
+    d->ooo = p->next;
+    d->oooBytes -= p->length;
+    if (behind >= p->length) {
+      tcp->stat.duplicateBytes += p->length;
+      _nt_tcpreasm_free(tcp, index);
+      continue;
+    }
+    // The bytes received in order since are kept
+    tcp->stat.duplicateBytes += behind;
+    p->data += behind;
+    p->length -= behind;
+    p->seq += behind;
+    _nt_tcpreasm_append(tcp, conn, dir, index);
+  }
+  if (d->finSeen && d->next == d->finSeq) {
+    conn->fin[dir] = 1;
+  }
+}
+
+/*
+ * Skip the gap before the first out-of-order piece, or before seq if it
+ * comes first
+ */
+static NT_INLINE void _nt_tcpreasm_skip(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir, uint32_t seq)
+{
+  struct _NtTcpReasmDir_s* d = &conn->dir[dir];
+  uint32_t lost;
+  if (d->ooo != _NT_TCPREASM_NONE && (int32_t)(tcp->pieces[d->ooo].seq - seq) < 0) {
+    seq = tcp->pieces[d->ooo].seq;
+  }
+  lost = seq - d->next;
+  tcp->stat.gaps++;
+  tcp->stat.gapBytes += lost;
+  d->gap = d->gap + lost < d->gap ? 0xFFFFFFFFU : d->gap + lost;
+  d->next = seq;
+  _nt_tcpreasm_drain(tcp, conn, dir);
+}
+
+/*
+ * Copy out-of-order payload to the sorted out-of-order pieces, leaving out
+ * the bytes already there
+ */
+static NT_INLINE int _nt_tcpreasm_store_ooo(NtTcpReasm_t* tcp, struct _NtTcpReasmDir_s* d, uint32_t seq, const uint8_t* data, uint32_t length)
+{
+  uint32_t* link = &d->ooo;
+  uint32_t end = seq + length;
+  while (seq != end) {
+    uint32_t stop = end;
+    while (*link != _NT_TCPREASM_NONE) {
+      struct _NtTcpReasmPiece_s* p = &tcp->pieces[*link];
+      uint32_t pEnd = p->seq + p->length;
+      if ((int32_t)(pEnd - seq) <= 0) {
+        link = &p->next;
+        continue;
+      }
+      if ((int32_t)(p->seq - seq) <= 0) {
+        // The piece holds the first bytes already
+        uint32_t dup = (int32_t)(pEnd - end) >= 0 ? end - seq : pEnd - seq;
+        tcp->stat.duplicateBytes += dup;
+        seq += dup;
+        data += dup;
+        link = &p->next;
+        if (seq == end) {
+          return NT_SUCCESS;
+        }
+        continue;
+      }
+      if ((int32_t)(p->seq - end) < 0) {
+        stop = p->seq;
+      }
+      break;
+    }
+    while (seq != stop) {
+      uint32_t size = stop - seq < tcp->config.chunkSize ? stop - seq : tcp->config.chunkSize;
+      uint32_t index = _nt_tcpreasm_alloc(tcp, seq, data, size, NULL);
+      if (index == _NT_TCPREASM_NONE) {
+        return NT_ERROR_RESOURCE_UNAVAILABLE;
+      }
+      tcp->pieces[index].next = *link;
+      *link = index;
+      link = &tcp->pieces[index].next;
+      d->oooBytes += size;
+      seq += size;
+      data += size;
+    }
+  }
+  return NT_SUCCESS;
+}
+
+/*
+ * Add the payload of a packet to a direction
+ */
+static NT_INLINE int _nt_tcpreasm_payload(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir, uint32_t seq,
+                                          const uint8_t* data, uint32_t length, NtSegRef_t* ref)
+{
+  struct _NtTcpReasmDir_s* d = &conn->dir[dir];
+  for (;;) {
+    uint32_t behind = d->next - seq, ahead;
+    if ((int32_t)behind > 0) {
+      if (behind >= length) {
+        tcp->stat.duplicateBytes += length;
+        return NT_SUCCESS;
+      }
+      tcp->stat.duplicateBytes += behind;
+      seq += behind;
+      data += behind;
+      length -= behind;
+    }
+    ahead = seq - d->next;
+    if (ahead == 0 || (uint64_t)ahead + length <= tcp->config.maxOutOfOrder) {
+      break;
+    }
+    _nt_tcpreasm_skip(tcp, conn, dir, seq);
+  }
+  if (seq != d->next) {
+    return _nt_tcpreasm_store_ooo(tcp, d, seq, data, length);
+  }
+  while (length != 0) {
+    uint32_t size = length < tcp->config.chunkSize ? length : tcp->config.chunkSize;
+    uint32_t index = _nt_tcpreasm_alloc(tcp, seq, data, size, ref);
+    if (index == _NT_TCPREASM_NONE) {
+      _nt_tcpreasm_drain(tcp, conn, dir);
+      return NT_ERROR_RESOURCE_UNAVAILABLE;
+    }
+    _nt_tcpreasm_append(tcp, conn, dir, index);
+    seq += size;
+    data += size;
+    length -= size;
+  }
+  _nt_tcpreasm_drain(tcp, conn, dir);
+  return NT_SUCCESS;
+}
+
+/*
+ * Find the IP and TCP headers of a packet. Returns NT_STATUS_NO_DATA if
+ * the packet is not an unfragmented TCP packet.
+ */
+static NT_INLINE int _nt_tcpreasm_parse(struct NtNetBuf_s* pktNetBuf, const uint8_t* pkt, uint32_t length,
+                                        uint32_t* l3Offset, uint32_t* l4Offset, int* ipv6)
+{
+  if (_NT_NET_GET_PKT_DESCR_PTR_DYN(pktNetBuf)->ntDynDescr == 0 &&
+      _NT_NET_GET_PKT_NT_DESCR_TYPE(pktNetBuf) == NT_PACKET_DESCRIPTOR_TYPE_NT_EXTENDED &&
+      _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) >= 7 && _NT_NET_GET_PKT_NT_DESCR_FORMAT(pktNetBuf) <= 9) {
+    // The adapter has decoded the packet
+    uint32_t l3Type = (uint32_t)_NT_NET_GET_PKT_L3_FRAME_TYPE_EXT7(pktNetBuf);
+    if ((l3Type != NT_L3_FRAME_TYPE_IPv4 && l3Type != NT_L3_FRAME_TYPE_IPv6) ||
+        _NT_NET_GET_PKT_L4_FRAME_TYPE_EXT7(pktNetBuf) != NT_L4_FRAME_TYPE_TCP ||
+        _NT_NET_GET_PKT_L3_FRAGMENTED_EXT7(pktNetBuf) || _NT_NET_GET_PKT_IPV6_FR_HEADER_EXT7(pktNetBuf) ||
+        _NT_NET_GET_PKT_L3_OFFSET_EXT7(pktNetBuf) == 0 || _NT_NET_GET_PKT_L4_OFFSET_EXT7(pktNetBuf) == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    *l3Offset = (uint32_t)_NT_NET_GET_PKT_L3_OFFSET_EXT7(pktNetBuf);
+    *l4Offset = (uint32_t)_NT_NET_GET_PKT_L4_OFFSET_EXT7(pktNetBuf);
+    *ipv6 = l3Type == NT_L3_FRAME_TYPE_IPv6;
+  } else {
+    struct _NtHashRefPktInfo_s info;
+    _nt_hashref_parse_pkt(pkt, length, &info);
+    if (info.l3Offset == 0 || info.protocol != _NT_HASHREF_PROTO_TCP || info.fragmented || info.l4Offset == 0) {
+      return NT_STATUS_NO_DATA;
+    }
+    *l3Offset = info.l3Offset;
+    *l4Offset = info.l4Offset;
+    *ipv6 = info.ipv6;
+  }
+  return NT_SUCCESS;
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Close a TCP reassembler
+ *
+ * The segment references held by the pieces are dropped, so close the
+ * reassembler before the segment pool.
+ *
+ * @param[in] tcp  TCP reassembler
+ */
+static NT_INLINE void _nt_tcpreasm_close(NtTcpReasm_t* tcp)
+{
+  while (tcp->pieces != NULL && tcp->pinHead != _NT_TCPREASM_NONE) {
+    NtSegRef_t* ref = tcp->pieces[tcp->pinHead].ref;
+    _nt_tcpreasm_unpin(tcp, tcp->pinHead);
+    _nt_segref_drop(ref);
+  }
+  _nt_flowage_close(&tcp->age);
+  _nt_flowtab_close(&tcp->tab);
+  free(tcp->pieces);
+  free(tcp->freePieces);
+  free(tcp->chunks);
+  free(tcp->freeChunks);
+  free(tcp->scratch);
+  free(tcp->expired);
+  tcp->pieces = NULL;
+  tcp->freePieces = NULL;
+  tcp->chunks = NULL;
+  tcp->freeChunks = NULL;
+  tcp->scratch = NULL;
+  tcp->expired = NULL;
+}
+
+/**
+ * @brief Open a TCP reassembler
+ *
+ * @param[out] tcp     TCP reassembler
+ * @param[in]  config  Optional configuration - NULL selects the defaults
+ *
+ * @retval NT_SUCCESS                         Success
+ * @retval NT_ERROR_INVALID_PARAMETER         Invalid configuration
+ * @retval NT_ERROR_MEMORY_ALLOCATION_FAILED  Out of memory
+ */
+static NT_INLINE int _nt_tcpreasm_open(NtTcpReasm_t* tcp, const NtTcpReasmConfig_t* config)
+{
+  NtFlowTabConfig_t tabConfig;
+  NtFlowAgeConfig_t ageConfig;
+  uint32_t i;
+  int status;
+
+  memset(tcp, 0, sizeof(*tcp));
+  tcp->pinHead = _NT_TCPREASM_NONE;
+  tcp->pinTail = _NT_TCPREASM_NONE;
+  if (config != NULL) {
+    tcp->config = *config;
+  }
+  if (tcp->config.maxConnections == 0) {
+    tcp->config.maxConnections = 16384;
+  }
+  if (tcp->config.pieces == 0) {
+    tcp->config.pieces = tcp->config.maxConnections * 8;
+  }
+  if (tcp->config.chunks == 0) {
+    tcp->config.chunks = tcp->config.maxConnections * 4;
+  }
+  if (tcp->config.chunkSize == 0) {
+    tcp->config.chunkSize = 2048;
+  }
+  if (tcp->config.maxOutOfOrder == 0) {
+    tcp->config.maxOutOfOrder = 256 * 1024;
+  }
+  if (tcp->config.maxAge == 0) {
+    tcp->config.maxAge = 4;
+  }
+  if (tcp->config.maxPeek == 0) {
+    tcp->config.maxPeek = 64 * 1024;
+  }
+  // Sequence numbers are compared within half the sequence space
+  if (tcp->config.maxOutOfOrder >= 1U << 30 || tcp->config.pieces == _NT_TCPREASM_NONE ||
+      tcp->config.chunks == _NT_TCPREASM_NONE) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+
+  memset(&tabConfig, 0, sizeof(tabConfig));
+  tabConfig.maxFlows = tcp->config.maxConnections;
+  tabConfig.keySize = sizeof(struct _NtTcpReasmKey_s);
+  tabConfig.valueSize = sizeof(NtTcpReasmConn_t);
+  if ((status = _nt_flowtab_open(&tcp->tab, &tabConfig)) != NT_SUCCESS) {
+    return status;
+  }
+  memset(&ageConfig, 0, sizeof(ageConfig));
+  ageConfig.timeout = tcp->config.timeout;
+  if ((status = _nt_flowage_open(&tcp->age, &tcp->tab, &ageConfig)) != NT_SUCCESS) {
+    _nt_tcpreasm_close(tcp);
+    return status;
+  }
+  tcp->config.timeout = tcp->age.config.timeout;
+  tcp->pieces = (struct _NtTcpReasmPiece_s*)malloc(tcp->config.pieces * sizeof(struct _NtTcpReasmPiece_s));
+  tcp->freePieces = (uint32_t*)malloc(tcp->config.pieces * sizeof(uint32_t));
+  tcp->chunks = (uint8_t*)malloc((size_t)tcp->config.chunks * tcp->config.chunkSize);
+  tcp->freeChunks = (uint32_t*)malloc(tcp->config.chunks * sizeof(uint32_t));
+  tcp->scratch = (uint8_t*)malloc(tcp->config.maxPeek);
+  tcp->expired = (void**)malloc(tcp->age.config.budget * sizeof(void*));
+  if (tcp->pieces == NULL || tcp->freePieces == NULL || tcp->chunks == NULL || tcp->freeChunks == NULL ||
+      tcp->scratch == NULL || tcp->expired == NULL) {
+    _nt_tcpreasm_close(tcp);
+    return NT_ERROR_MEMORY_ALLOCATION_FAILED;
+  }
+  for (i = 0; i < tcp->config.pieces; i++) {
+    tcp->freePieces[i] = tcp->config.pieces - 1 - i;
+  }
+  tcp->numFreePieces = tcp->config.pieces;
+  for (i = 0; i < tcp->config.chunks; i++) {
+    tcp->freeChunks[i] = tcp->config.chunks - 1 - i;
+  }
+  tcp->numFreeChunks = tcp->config.chunks;
+  tcp->stat.memory = tcp->tab.bucketBytes + tcp->tab.entryBytes +
+                     tcp->tab.config.maxFlows * (sizeof(struct _NtFlowAgeNode_s) + sizeof(uint32_t)) +
+                     (uint64_t)tcp->config.pieces * (sizeof(struct _NtTcpReasmPiece_s) + sizeof(uint32_t)) +
+                     (uint64_t)tcp->config.chunks * (tcp->config.chunkSize + sizeof(uint32_t)) + tcp->config.maxPeek +
+                     tcp->age.config.budget * sizeof(void*);
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Advance the stream time and the segment age from a segment
+ *
+ * Lets the idle timeouts run and the pieces holding old segments be
+ * copied when no TCP packets arrive. Packets passed to @ref _nt_tcpreasm_pkt
+ * do the same.
+ *
+ * @param[in] tcp      TCP reassembler
+ * @param[in] hNetBuf  Segment
+ * @param[in] ref      Optional - the segment in the segment pool
+ */
+static NT_INLINE void _nt_tcpreasm_segment(NtTcpReasm_t* tcp, NtNetBuf_t hNetBuf, NtSegRef_t* ref)
+{
+  _nt_flowage_segment(&tcp->age, hNetBuf);
+  if (ref != NULL && ref->seq > tcp->newest) {
+    tcp->newest = ref->seq;
+    _nt_tcpreasm_age(tcp);
+  }
+}
+
+/**
+ * @brief Pass a packet to the TCP reassembler
+ *
+ * The payload is added to the direction of the connection of the packet.
+ * With a segment reference the in-order payload is referenced in the
+ * segment, which must stay held by the caller until the call returns.
+ * All segment references must come from the same segment pool.
+ *
+ * A connection is created for any TCP packet of an unknown connection.
+ * Connections are only removed with @ref _nt_tcpreasm_remove, e.g. when
+ * both directions have seen their FIN, after a RST or when returned by
+ * @ref _nt_tcpreasm_expire.
+ *
+ * @param[in]  tcp        TCP reassembler
+ * @param[in]  pktNetBuf  Packet
+ * @param[in]  ref        Optional - the segment holding the packet. NULL copies the payload
+ * @param[out] conn       Connection of the packet
+ * @param[out] dir        Direction of the packet
+ *
+ * @retval NT_SUCCESS                       Success - pieces may have been lost if a pool was full
+ * @retval NT_STATUS_NO_DATA                The packet is not an unfragmented TCP packet, or its headers are invalid
+ * @retval NT_ERROR_RESOURCE_UNAVAILABLE    The connection table is full
+ */
+static NT_INLINE int _nt_tcpreasm_pkt(NtTcpReasm_t* tcp, struct NtNetBuf_s* pktNetBuf, NtSegRef_t* ref,
+                                      NtTcpReasmConn_t** conn, uint32_t* dir)
+{
+  const uint8_t* pkt = (const uint8_t*)NT_NET_GET_PKT_L2_PTR(pktNetBuf);
+  uint32_t length = (uint32_t)(NT_NET_GET_PKT_CAP_LENGTH(pktNetBuf) - NT_NET_GET_PKT_DESCR_LENGTH(pktNetBuf));
+  uint32_t l3Offset, l4Offset, end, dataOffset, seq, n;
+  const uint8_t *ip, *th, *src, *dst;
+  struct _NtTcpReasmKey_s key;
+  struct _NtTcpReasmDir_s* d;
+  NtTcpReasmConn_t* c;
+  uint16_t sport, dport;
+  int ipv6, swapped, inserted, cmp;
+  uint8_t flags;
+
+  if (_nt_tcpreasm_parse(pktNetBuf, pkt, length, &l3Offset, &l4Offset, &ipv6) != NT_SUCCESS) {
+    return NT_STATUS_NO_DATA;
+  }
+  tcp->stat.packets++;
+  ip = pkt + l3Offset;
+  th = pkt + l4Offset;
+  end = ipv6 ? l3Offset + 40 + _nt_hashref_rd16(ip + 4) : l3Offset + _nt_hashref_rd16(ip + 2);
+  if (end > length) {
+    tcp->stat.truncated++;
+    end = length;
+  }
+  if (end < l4Offset + 20 || (dataOffset = (uint32_t)(th[12] >> 4) << 2) < 20 || l4Offset + dataOffset > end) {
+    tcp->stat.invalid++;
+    return NT_STATUS_NO_DATA;
+  }
+
+  memset(&key, 0, sizeof(key));
+  src = ipv6 ? ip + 8 : ip + 12;
+  dst = ipv6 ? ip + 24 : ip + 16;
+  n = ipv6 ? 16 : 4;
+  sport = _nt_hashref_rd16(th);
+  dport = _nt_hashref_rd16(th + 2);
+  cmp = memcmp(src, dst, n);
+  swapped = cmp > 0 || (cmp == 0 && sport > dport);
+  memcpy(key.addr[swapped], src, n);
+  memcpy(key.addr[!swapped], dst, n);
+  key.port[swapped] = sport;
+  key.port[!swapped] = dport;
+  key.ipv6 = (uint32_t)ipv6;
+  // The table spreads the connections on the key alone
+  if ((c = (NtTcpReasmConn_t*)_nt_flowtab_insert(&tcp->tab, 0, &key, &inserted)) == NULL) {
+    tcp->stat.noResource++;
+    return NT_ERROR_RESOURCE_UNAVAILABLE;
+  }
+  if (inserted) {
+    c->origin = (uint8_t)swapped;
+    c->dir[0].head = c->dir[0].tail = c->dir[0].ooo = _NT_TCPREASM_NONE;
+    c->dir[1].head = c->dir[1].tail = c->dir[1].ooo = _NT_TCPREASM_NONE;
+    tcp->stat.connections++;
+    if (++tcp->stat.active > tcp->stat.maxActive) {
+      tcp->stat.maxActive = tcp->stat.active;
+    }
+  }
+  _nt_flowage_touch_pkt(&tcp->age, c, pktNetBuf);
+  if (ref != NULL && ref->seq > tcp->newest) {
+    tcp->newest = ref->seq;
+    _nt_tcpreasm_age(tcp);
+  }
+
+  *conn = c;
+  *dir = (uint32_t)(swapped ^ c->origin);
+  d = &c->dir[*dir];
+  flags = th[13];
+  seq = _nt_tcpreasm_rd32(th + 4);
+  if (flags & _NT_TCPREASM_RST) {
+    c->rst = 1;
+  }
+  if (flags & _NT_TCPREASM_SYN) {
+    seq++;
+  }
+  if (!d->known) {
+    // Without the SYN the stream is picked up at the first packet
+    d->next = seq;
+    d->known = 1;
+  }
+  end -= l4Offset + dataOffset;
+  if ((flags & _NT_TCPREASM_FIN) && !d->finSeen) {
+    d->finSeq = seq + end;
+    d->finSeen = 1;
+  }
+  if (end != 0 && _nt_tcpreasm_payload(tcp, c, *dir, seq, th + dataOffset, end, ref) != NT_SUCCESS) {
+    tcp->stat.noResource++;
+  }
+  if (d->finSeen && d->next == d->finSeq) {
+    c->fin[*dir] = 1;
+  }
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get the first piece of the in-order payload of a direction
+ *
+ * @param[in]  tcp   TCP reassembler
+ * @param[in]  conn  Connection
+ * @param[in]  dir   Direction
+ * @param[out] view  Payload - valid until consumed
+ *
+ * @retval NT_SUCCESS         Success
+ * @retval NT_STATUS_NO_DATA  No in-order payload
+ */
+static NT_INLINE int _nt_tcpreasm_view(const NtTcpReasm_t* tcp, const NtTcpReasmConn_t* conn, uint32_t dir, NtTcpReasmView_t* view)
+{
+  const struct _NtTcpReasmPiece_s* p;
+  if (conn->dir[dir].head == _NT_TCPREASM_NONE) {
+    view->data = NULL;
+    view->length = 0;
+    view->gap = 0;
+    return NT_STATUS_NO_DATA;
+  }
+  p = &tcp->pieces[conn->dir[dir].head];
+  view->data = p->data;
+  view->length = p->length;
+  view->gap = p->gap;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Get a number of contiguous bytes of the in-order payload of a direction
+ *
+ * The bytes are returned where they lie if the first piece holds them,
+ * otherwise the pieces are joined in a scratch buffer that is valid until
+ * the next call. The bytes never span a gap.
+ *
+ * @param[in]  tcp     TCP reassembler
+ * @param[in]  conn    Connection
+ * @param[in]  dir     Direction
+ * @param[in]  length  Bytes wanted - at most the configured maximum
+ * @param[out] view    Payload. With NT_STATUS_TRYAGAIN the data is NULL and
+ *                     the length is the number of bytes available - if it is
+ *                     below conn->pending[dir] a gap follows, and the bytes
+ *                     will never be completed
+ *
+ * @retval NT_SUCCESS                  Success
+ * @retval NT_STATUS_TRYAGAIN          Fewer bytes are available
+ * @retval NT_ERROR_INVALID_PARAMETER  Length above the configured maximum
+ */
+static NT_INLINE int _nt_tcpreasm_peek(NtTcpReasm_t* tcp, const NtTcpReasmConn_t* conn, uint32_t dir, uint32_t length, NtTcpReasmView_t* view)
+{
+  const struct _NtTcpReasmPiece_s* p;
+  uint32_t index = conn->dir[dir].head, got;
+  if (_nt_tcpreasm_view(tcp, conn, dir, view) != NT_SUCCESS) {
+    return length == 0 ? NT_SUCCESS : NT_STATUS_TRYAGAIN;
+  }
+  if (view->length >= length) {
+    view->length = length;
+    return NT_SUCCESS;
+  }
+  if (length > tcp->config.maxPeek) {
+    return NT_ERROR_INVALID_PARAMETER;
+  }
+  // Count the bytes first, so nothing is copied for a message not yet complete
+  for (got = view->length, index = tcp->pieces[index].next;
+       got < length && index != _NT_TCPREASM_NONE && tcp->pieces[index].gap == 0; index = tcp->pieces[index].next) {
+    got += tcp->pieces[index].length;
+  }
+  if (got < length) {
+    view->data = NULL;
+    view->length = got;
+    return NT_STATUS_TRYAGAIN;
+  }
+  for (got = 0, index = conn->dir[dir].head; got != length; index = p->next) {
+    uint32_t size;
+    p = &tcp->pieces[index];
+    size = length - got < p->length ? length - got : p->length;
+    memcpy(tcp->scratch + got, p->data, size);
+    got += size;
+  }
+  tcp->stat.peekBytes += length;
+  view->data = tcp->scratch;
+  view->length = length;
+  return NT_SUCCESS;
+}
+
+/**
+ * @brief Free in-order payload of a direction
+ *
+ * Drops the segment references of the pieces consumed.
+ *
+ * @param[in] tcp     TCP reassembler
+ * @param[in] conn    Connection
+ * @param[in] dir     Direction
+ * @param[in] length  Bytes consumed - at most conn->pending[dir]
+ */
+static NT_INLINE void _nt_tcpreasm_consume(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir, uint32_t length)
+{
+  struct _NtTcpReasmDir_s* d = &conn->dir[dir];
+  if (length > conn->pending[dir]) {
+    length = conn->pending[dir];
+  }
+  conn->pending[dir] -= length;
+  while (length != 0) {
+    uint32_t index = d->head;
+    struct _NtTcpReasmPiece_s* p = &tcp->pieces[index];
+    if (p->length > length) {
+      p->data += length;
+      p->length -= length;
+      p->seq += length;
+      p->gap = 0;
+      break;
+    }
+    length -= p->length;
+    d->head = p->next;
+    if (d->head == _NT_TCPREASM_NONE) {
+      d->tail = _NT_TCPREASM_NONE;
+    }
+    _nt_tcpreasm_free(tcp, index);
+  }
+}
+
+/**
+ * @brief Skip the gaps of a direction
+ *
+ * Makes all out-of-order payload in-order, e.g. for a connection that has
+ * been reset or has timed out. The bytes lost are reported with the piece
+ * after each gap.
+ *
+ * @param[in] tcp   TCP reassembler
+ * @param[in] conn  Connection
+ * @param[in] dir   Direction
+ */
+static NT_INLINE void _nt_tcpreasm_flush(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir)
+{
+  while (conn->dir[dir].ooo != _NT_TCPREASM_NONE) {
+    _nt_tcpreasm_skip(tcp, conn, dir, tcp->pieces[conn->dir[dir].ooo].seq);
+  }
+}
+
+/**
+ * @brief Remove a connection
+ *
+ * The payload not consumed is freed. The connection is not valid after
+ * the call.
+ *
+ * @param[in] tcp   TCP reassembler
+ * @param[in] conn  Connection
+ */
+static NT_INLINE void _nt_tcpreasm_remove(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn)
+{
+  uint32_t dir;
+  for (dir = 0; dir < 2; dir++) {
+    _nt_tcpreasm_free_list(tcp, conn->dir[dir].head);
+    _nt_tcpreasm_free_list(tcp, conn->dir[dir].ooo);
+  }
+  _nt_flowage_remove(&tcp->age, conn);
+  tcp->stat.active--;
+}
+
+/**
+ * @brief Get the connections that have been idle for the timeout
+ *
+ * The connections stay in the table until removed with
+ * @ref _nt_tcpreasm_remove, so their payload can be flushed and consumed
+ * first; a connection receiving a packet instead is tracked again. Call
+ * after each packet batch - at most the flow aging budget of timers is
+ * handled per call.
+ *
+ * @param[in]  tcp    TCP reassembler
+ * @param[out] conns  Expired connections
+ * @param[in]  max    Maximum number of connections to return
+ *
+ * @retval The number of connections returned
+ */
+static NT_INLINE uint32_t _nt_tcpreasm_expire(NtTcpReasm_t* tcp, NtTcpReasmConn_t** conns, uint32_t max)
+{
+  uint32_t n, i;
+  n = _nt_flowage_expire(&tcp->age, tcp->expired, max < tcp->age.config.budget ? max : tcp->age.config.budget);
+  for (i = 0; i < n; i++) {
+    conns[i] = (NtTcpReasmConn_t*)tcp->expired[i];
+  }
+  return n;
+}
+
+/**
+ * @brief Get the counters of a TCP reassembler
+ *
+ * @param[in]  tcp   TCP reassembler
+ * @param[out] stat  Counters
+ */
+static NT_INLINE void _nt_tcpreasm_get_stat(const NtTcpReasm_t* tcp, NtTcpReasmStat_t* stat)
+{
+  *stat = tcp->stat;
+  stat->piecesUsed = tcp->config.pieces - tcp->numFreePieces;
+  stat->chunksUsed = tcp->config.chunks - tcp->numFreeChunks;
+}
+
+/**
+ * TCP reassembly benchmark configuration. Zero selects the default value.
+ */
+typedef struct NtTcpReasmBenchConfig_s {
+  uint32_t message;         //!< Bytes the application waits for before consuming, as a parser waiting for complete messages. Default is 4096
+  const NtCapFileConfig_t *file; //!< Capture file reader configuration - NULL selects the defaults
+} NtTcpReasmBenchConfig_t;
+
+/**
+ * TCP reassembly benchmark result
+ */
+typedef struct NtTcpReasmBenchResult_s {
+  uint64_t pkts;            //!< Packets read
+  uint64_t bytes;           //!< Segment bytes read
+  uint64_t payload;         //!< Payload bytes consumed
+  uint64_t checksum;        //!< Sum of the first byte of each message read - keeps the reads from being optimized away
+  double seconds;           //!< Elapsed time
+  double gbps;              //!< Throughput in Gbit/s of segment bytes
+  double nsPerPkt;          //!< Nanoseconds per packet
+  double cyclesPerPkt;      //!< CPU cycles per packet - 0 without performance counters
+  double stateBytes;        //!< Bytes of table and timer state per configured connection
+  double bufferBytes;       //!< Most bytes of pieces and chunks in use divided by the most connections tracked
+  double zeroCopy;          //!< Fraction of the payload bytes stored without copying
+  NtTcpReasmStat_t stat;    //!< Reassembly counters
+} NtTcpReasmBenchResult_t;
+
+#ifndef DOXYGEN_INTERNAL_ONLY
+static NT_INLINE int _nt_tcpreasm_bench_release(void* ctx, NtNetBuf_t hNetBuf)
+{
+  return _nt_capfile_release((NtCapFile_t*)ctx, hNetBuf);
+}
+
+/*
+ * Read the in-order payload of a direction as an application would:
+ * whole messages while the connection is open, everything once it has
+ * been closed. Removes closed connections.
+ */
+static NT_INLINE void _nt_tcpreasm_bench_read(NtTcpReasm_t* tcp, NtTcpReasmConn_t* conn, uint32_t dir, uint32_t message,
+                                              int closed, NtTcpReasmBenchResult_t* result)
+{
+  NtTcpReasmView_t view;
+  if (!closed) {
+    // A message cut by a gap is dropped
+    while (_nt_tcpreasm_peek(tcp, conn, dir, message, &view) == NT_SUCCESS ||
+           (view.length != 0 && view.length < conn->pending[dir])) {
+      if (view.data != NULL) {
+        result->checksum += view.data[0];
+      }
+      result->payload += view.length;
+      _nt_tcpreasm_consume(tcp, conn, dir, view.length);
+    }
+    return;
+  }
+  for (dir = 0; dir < 2; dir++) {
+    _nt_tcpreasm_flush(tcp, conn, dir);
+    while (_nt_tcpreasm_view(tcp, conn, dir, &view) == NT_SUCCESS) {
+      result->checksum += view.data[0];
+      result->payload += view.length;
+      _nt_tcpreasm_consume(tcp, conn, dir, view.length);
+    }
+  }
+  _nt_tcpreasm_remove(tcp, conn);
+}
+#endif // DOXYGEN_INTERNAL_ONLY
+
+/**
+ * @brief Measure the TCP reassembler on a capture file
+ *
+ * Reads the segments of the file into a segment pool of as many segments
+ * as the reader reads ahead, and passes the packets to the reassembler
+ * with their segment references. The application is emulated by a parser
+ * consuming the payload in messages of a fixed size, so the data of a
+ * message not yet complete stays held. Connections are removed when both
+ * FINs have been seen, after a RST, at the timeout and at the end of the
+ * file.
+ *
+ * @param[in]  name    Capture file name
+ * @param[in]  config  Reassembler configuration - NULL selects the defaults
+ * @param[in]  bench   Benchmark configuration - NULL selects the defaults
+ * @param[in]  perf    Opened performance counters - NULL to measure time only
+ * @param[out] result  Result
+ *
+ * @retval NT_SUCCESS                     Success
+ * @retval NT_ERROR_INVALID_PARAMETER     Invalid configuration, e.g. a maximum age not below the read-ahead depth
+ * @retval NT_ERROR_RESOURCE_UNAVAILABLE  The segments are held by pieces that could not be copied - too few chunks
+ * @retval otherwise                      Error returned by the capture file reader
+ */
+static NT_INLINE int _nt_tcpreasm_bench(const char* name, const NtTcpReasmConfig_t* config, const NtTcpReasmBenchConfig_t* bench,
+                                        NtPerf_t* perf, NtTcpReasmBenchResult_t* result)
+{
+  NtTcpReasmBenchConfig_t cfg;
+  NtCapFile_t file;
+  NtSegRefPool_t pool;
+  NtTcpReasm_t tcp;
+  NtTcpReasmConn_t* conns[64];
+  struct NtNetBuf_s burst[64];
+  uint64_t start, maxBuffer = 0;
+  int status;
+
+  memset(result, 0, sizeof(*result));
+  if (bench != NULL) {
+    cfg = *bench;
+  } else {
+    memset(&cfg, 0, sizeof(cfg));
+  }
+  if (cfg.message == 0) {
+    cfg.message = 4096;
+  }
+  if ((status = _nt_capfile_open(&file, name, cfg.file)) != NT_SUCCESS) {
+    return status;
+  }
+  if ((status = _nt_segref_open(&pool, file.numSlots, _nt_tcpreasm_bench_release, &file)) != NT_SUCCESS) {
+    _nt_capfile_close(&file);
+    return status;
+  }
+  if ((status = _nt_tcpreasm_open(&tcp, config)) != NT_SUCCESS) {
+    _nt_segref_close(&pool);
+    _nt_capfile_close(&file);
+    return status;
+  }
+  if (tcp.config.maxAge >= file.numSlots || cfg.message > tcp.config.maxPeek) {
+    status = NT_ERROR_INVALID_PARAMETER;
+    goto out;
+  }
+
+  if (perf != NULL) {
+    _nt_perf_start(perf);
+  }
+  start = _nt_compat_now_ns();
+  for (;;) {
+    NtNetBuf_t hNetBuf;
+    NtSegRef_t* ref;
+    uint64_t offset = 0, buffer;
+    unsigned count, i;
+    if ((status = _nt_segref_reclaim(&pool)) != NT_SUCCESS) {
+      break;
+    }
+    if ((status = _nt_capfile_get(&file, &hNetBuf)) != NT_SUCCESS) {
+      if (status == NT_STATUS_END_OF_FILE) {
+        status = NT_SUCCESS;
+      } else if (status == NT_STATUS_TRYAGAIN) {
+        status = NT_ERROR_RESOURCE_UNAVAILABLE;
+      }
+      break;
+    }
+    if ((status = _nt_segref_add(&pool, hNetBuf, &ref)) != NT_SUCCESS) {
+      (void)_nt_capfile_release(&file, hNetBuf);
+      status = NT_ERROR_RESOURCE_UNAVAILABLE;
+      break;
+    }
+    result->bytes += NT_NET_GET_SEGMENT_LENGTH(hNetBuf);
+    _nt_tcpreasm_segment(&tcp, hNetBuf, ref);
+    while ((count = _nt_net_get_packet_burst(hNetBuf, &offset, burst, 64)) > 0) {
+      for (i = 0; i < count; i++) {
+        NtTcpReasmConn_t* conn;
+        uint32_t dir;
+        if (_nt_tcpreasm_pkt(&tcp, &burst[i], ref, &conn, &dir) == NT_SUCCESS) {
+          _nt_tcpreasm_bench_read(&tcp, conn, dir, cfg.message, conn->rst || (conn->fin[0] && conn->fin[1]), result);
+        }
+      }
+      result->pkts += count;
+      while ((count = _nt_tcpreasm_expire(&tcp, conns, 64)) > 0) {
+        for (i = 0; i < count; i++) {
+          _nt_tcpreasm_bench_read(&tcp, conns[i], 0, cfg.message, 1, result);
+        }
+      }
+    }
+    _nt_segref_drop(ref);
+    buffer = (uint64_t)(tcp.config.pieces - tcp.numFreePieces) * sizeof(struct _NtTcpReasmPiece_s) +
+             (uint64_t)(tcp.config.chunks - tcp.numFreeChunks) * tcp.config.chunkSize;
+    if (buffer > maxBuffer) {
+      maxBuffer = buffer;
+    }
+  }
+  if (status == NT_SUCCESS) {
+    // The connections still open at the end of the file
+    uint64_t position = 0;
+    NtTcpReasmConn_t* conn;
+    while ((conn = (NtTcpReasmConn_t*)_nt_flowtab_next(&tcp.tab, &position)) != NULL) {
+      _nt_tcpreasm_bench_read(&tcp, conn, 0, cfg.message, 1, result);
+    }
+  }
+  result->seconds = (double)(_nt_compat_now_ns() - start) / 1e9;
+  if (perf != NULL) {
+    _nt_perf_stop(perf);
+  }
+
+  _nt_tcpreasm_get_stat(&tcp, &result->stat);
+  if (result->seconds > 0) {
+    result->gbps = (double)result->bytes * 8 / result->seconds / 1e9;
+  }
+  if (result->pkts > 0) {
+    result->nsPerPkt = result->seconds * 1e9 / (double)result->pkts;
+    if (perf != NULL) {
+      result->cyclesPerPkt = (double)perf->value[NT_PERF_CYCLES] / (double)result->pkts;
+    }
+  }
+  result->stateBytes = (double)(tcp.tab.bucketBytes + tcp.tab.entryBytes) / (double)tcp.config.maxConnections +
+                       sizeof(struct _NtFlowAgeNode_s) + sizeof(uint32_t);
+  if (result->stat.maxActive > 0) {
+    result->bufferBytes = (double)maxBuffer / (double)result->stat.maxActive;
+  }
+  if (result->stat.zeroCopyBytes + result->stat.copiedBytes > 0) {
+    result->zeroCopy = (double)(result->stat.zeroCopyBytes - result->stat.agedBytes) /
+                       (double)(result->stat.zeroCopyBytes + result->stat.copiedBytes);
+  }
+out:
+  _nt_tcpreasm_close(&tcp);
+  _nt_segref_close(&pool);
+  _nt_capfile_close(&file);
+  return status;
+}
+
+/**
+ * @brief Print a benchmark result
+ *
+ * @param[in] stream  Output stream
+ * @param[in] result  Result from @ref _nt_tcpreasm_bench
+ */
+static NT_INLINE void _nt_tcpreasm_bench_print(FILE* stream, const NtTcpReasmBenchResult_t* result)
+{
+  const NtTcpReasmStat_t* stat = &result->stat;
+  fprintf(stream, "%-20s %14llu\n", "packets", (unsigned long long)result->pkts);
+  fprintf(stream, "%-20s %14.3f\n", "Gbit/s", result->gbps);
+  fprintf(stream, "%-20s %14.3f\n", "ns/pkt", result->nsPerPkt);
+  fprintf(stream, "%-20s %14.3f\n", "cycles/pkt", result->cyclesPerPkt);
+  fprintf(stream, "%-20s %14llu\n", "payload bytes", (unsigned long long)result->payload);
+  fprintf(stream, "%-20s %14.4f\n", "zero-copy fraction", result->zeroCopy);
+  fprintf(stream, "%-20s %14llu\n", "copied on arrival", (unsigned long long)stat->copiedBytes);
+  fprintf(stream, "%-20s %14llu\n", "copied on age", (unsigned long long)stat->agedBytes);
+  fprintf(stream, "%-20s %14llu\n", "joined by peek", (unsigned long long)stat->peekBytes);
+  fprintf(stream, "%-20s %14llu\n", "gap bytes", (unsigned long long)stat->gapBytes);
+  fprintf(stream, "%-20s %14llu\n", "connections", (unsigned long long)stat->connections);
+  fprintf(stream, "%-20s %14llu\n", "max connections", (unsigned long long)stat->maxActive);
+  fprintf(stream, "%-20s %14.1f\n", "state bytes/conn", result->stateBytes);
+  fprintf(stream, "%-20s %14.1f\n", "buffer bytes/conn", result->bufferBytes);
+  fprintf(stream, "%-20s %14llu\n", "no resource", (unsigned long long)stat->noResource);
+}
+
+#endif // __TCPREASM_H__